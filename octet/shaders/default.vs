@@ -4,8 +4,17 @@
 //
 
 // matrices
-uniform mat4 modelToProjection;
-uniform mat4 modelToCamera;
+#ifdef INSTANCED
+  // one model matrix per instance from the instance buffer (see render_queue)
+  attribute mat4 modelToWorld;
+  uniform mat4 worldToProjection;
+  uniform mat4 worldToCamera;
+  #define modelToProjection (worldToProjection * modelToWorld)
+  #define modelToCamera (worldToCamera * modelToWorld)
+#else
+  uniform mat4 modelToProjection;
+  uniform mat4 modelToCamera;
+#endif
 
 // attributes from vertex buffer
 attribute vec4 pos;
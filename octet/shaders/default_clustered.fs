@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// default frament shader for solid colours lit by light clusters (see light_clusters.h)
+//
+
+// constant parameters
+#ifdef GL_ARB_uniform_buffer_object
+  #extension GL_ARB_uniform_buffer_object : enable
+
+  // lights shared by all materials (see frame_uniforms.h)
+  layout(std140) uniform frame_uniforms {
+    vec4 lighting[17];
+    int num_lights;
+  };
+#else
+  uniform vec4 lighting[17];
+  uniform int num_lights;
+#endif
+uniform vec4 diffuse;
+
+// cluster_params[0] = tiles across, down and in depth
+// cluster_params[1] = depth slice scale and bias, 1/viewport size
+// cluster_params[2] = 1/grid size, light and index texture widths
+// cluster_params[3] = 1/light texture size, 1/index texture size
+uniform vec4 cluster_params[4];
+uniform sampler2D cluster_grid;
+uniform sampler2D cluster_indices;
+uniform sampler2D cluster_lights;
+
+// inputs
+varying vec2 uv_;
+varying vec3 normal_;
+varying vec3 camera_pos_;
+varying vec4 color_;
+
+// element "index" of a texture used as an array
+vec4 fetch(sampler2D tex, float index, float width, vec2 inv_size) {
+  float y = floor((index + 0.5) / width);
+  float x = index - y * width;
+  return texture2D(tex, (vec2(x, y) + 0.5) * inv_size);
+}
+
+void main() {
+  vec3 nnormal = normalize(normal_);
+  vec3 diffuse_light = lighting[0].xyz;
+  for (int i = 0; i != num_lights; ++i) {
+    vec3 light_direction = lighting[i * 4 + 2].xyz;
+    vec3 light_color = lighting[i * 4 + 3].xyz;
+    float diffuse_factor = max(dot(light_direction, nnormal), 0.0);
+    diffuse_light += diffuse_factor * light_color;
+  }
+
+  // no clusters this frame: the global lights only.
+  if (cluster_params[0].z > 0.0) {
+    vec2 tile = floor(gl_FragCoord.xy * cluster_params[1].zw * cluster_params[0].xy);
+    tile = clamp(tile, vec2(0, 0), cluster_params[0].xy - 1.0);
+    float slice = floor(log(max(-camera_pos_.z, 1e-6)) * cluster_params[1].x + cluster_params[1].y);
+    slice = clamp(slice, 0.0, cluster_params[0].z - 1.0);
+    vec2 grid_uv = (vec2(tile.y * cluster_params[0].x + tile.x, slice) + 0.5) * cluster_params[2].xy;
+    vec4 cluster = texture2D(cluster_grid, grid_uv);
+    int count = int(cluster.y);
+
+    for (int i = 0; i != count; ++i) {
+      float light_index = fetch(cluster_indices, cluster.x + float(i), cluster_params[2].w, cluster_params[3].zw).x;
+      float base = light_index * 4.0;
+      vec4 light_pos = fetch(cluster_lights, base, cluster_params[2].z, cluster_params[3].xy);
+      vec4 light_dir = fetch(cluster_lights, base + 1.0, cluster_params[2].z, cluster_params[3].xy);
+      vec3 light_color = fetch(cluster_lights, base + 2.0, cluster_params[2].z, cluster_params[3].xy).xyz;
+      vec4 light_atten = fetch(cluster_lights, base + 3.0, cluster_params[2].z, cluster_params[3].xy);
+
+      vec3 to_light = light_pos.xyz - camera_pos_;
+      float dist = length(to_light);
+      vec3 light_direction = to_light / dist;
+      float atten = 1.0 / (light_atten.x + (light_atten.y + light_atten.z * dist) * dist);
+
+      // w is the cosine of the spot light's half angle, or -1 for point lights.
+      if (light_dir.w > -1.0) {
+        float spot_cos = dot(light_direction, light_dir.xyz);
+        atten *= spot_cos >= light_dir.w ? pow(max(spot_cos, 0.0), light_atten.w) : 0.0;
+      }
+
+      diffuse_light += max(dot(light_direction, nnormal), 0.0) * atten * light_color;
+    }
+  }
+
+  gl_FragColor = vec4(diffuse.xyz * diffuse_light, 1.0);
+}
+
@@ -4,8 +4,18 @@
 //
 
 // constant parameters
-uniform vec4 lighting[17];
-uniform int num_lights;
+#ifdef GL_ARB_uniform_buffer_object
+  #extension GL_ARB_uniform_buffer_object : enable
+
+  // lights shared by all materials (see frame_uniforms.h)
+  layout(std140) uniform frame_uniforms {
+    vec4 lighting[17];
+    int num_lights;
+  };
+#else
+  uniform vec4 lighting[17];
+  uniform int num_lights;
+#endif
 uniform sampler2D diffuse_sampler;
 
 // inputs
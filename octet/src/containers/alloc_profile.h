@@ -0,0 +1,338 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// allocation profiler
+//
+// build with -D OCTET_ALLOC_PROFILE=1 to record allocations per tag and per call site.
+// otherwise OCTET_ALLOC_TAG() does nothing and the allocator is unchanged.
+//
+// Example
+//
+//   void load_terrain() {
+//     OCTET_ALLOC_TAG("terrain");
+//     ... allocations in here are counted against "terrain" and the code that called the allocator.
+//   }
+//
+//   alloc_profile::dump(stdout);
+//
+
+namespace octet { namespace containers {
+  /// Counts allocations made by the allocator, grouped by tag and by call site.
+  ///
+  /// A call site is the return address of allocator::malloc() (which is not inlined when profiling)
+  /// together with the innermost OCTET_ALLOC_TAG() on this thread. The address is in the function that
+  /// called the allocator, often a container method inlined into its user; find it with addr2line
+  /// (after taking off the module base) or the debugger's disassembly.
+  /// Each profiled block has a 16 byte header holding its site, so frees are counted
+  /// against the site that made the allocation.
+  class alloc_profile {
+  public:
+    enum {
+      max_tags = 64,
+      max_sites = 4096,
+
+      /// bytes added to the front of each block (keeps 16 byte alignment)
+      header_size = 16,
+    };
+
+    /// counters for a tag or a site
+    struct stats_t {
+      size_t num_allocs;
+      size_t num_frees;
+      size_t total_bytes;
+      size_t live_bytes;
+      size_t peak_bytes;
+    };
+
+    /// a named group of allocations
+    struct tag_t {
+      const char *name;
+      stats_t stats;
+    };
+
+    /// a caller of the allocator inside a tag
+    struct site_t {
+      const void *caller;
+      unsigned tag;
+      stats_t stats;
+    };
+
+    /// ways to sort the report
+    enum sort_t {
+      sort_live_bytes,
+      sort_peak_bytes,
+      sort_total_bytes,
+      sort_num_allocs,
+    };
+
+  private:
+    enum { magic = 0x0c7e7a11, site_table_size = max_sites * 2 };
+
+    struct header_t {
+      uint32_t site;
+      uint32_t magic;
+      uint64_t size;
+    };
+
+    // singleton state, zero initialised.
+    // tag 0 is "untagged" and site 0 takes the allocations when the sites are full.
+    struct state_t {
+      std::atomic<int> lock;
+      unsigned num_tags;
+      unsigned num_sites;
+      size_t num_bad_frees;
+      tag_t tags[max_tags];
+      site_t sites[max_sites];
+
+      // open addressed: site indices by caller and tag, 0 if empty.
+      unsigned site_table[site_table_size];
+    };
+
+    static state_t &state() {
+      static state_t instance;
+      return instance;
+    }
+
+    // innermost tag on this thread
+    static unsigned &current_tag() {
+      static OCTET_THREAD_LOCAL unsigned instance;
+      return instance;
+    }
+
+    class lock_t {
+      std::atomic<int> &flag;
+    public:
+      lock_t(std::atomic<int> &flag) : flag(flag) {
+        while (flag.exchange(1, std::memory_order_acquire)) {}
+      }
+
+      ~lock_t() {
+        flag.store(0, std::memory_order_release);
+      }
+    };
+
+    static void add(stats_t &s, size_t size) {
+      s.num_allocs++;
+      s.total_bytes += size;
+      s.live_bytes += size;
+      if (s.live_bytes > s.peak_bytes) s.peak_bytes = s.live_bytes;
+    }
+
+    static void remove(stats_t &s, size_t size) {
+      s.num_frees++;
+      s.live_bytes -= size;
+    }
+
+    static size_t get_key(const stats_t &s, sort_t sort) {
+      switch (sort) {
+        case sort_peak_bytes: return s.peak_bytes;
+        case sort_total_bytes: return s.total_bytes;
+        case sort_num_allocs: return s.num_allocs;
+        default: return s.live_bytes;
+      }
+    }
+
+    // call with the lock held.
+    static void init(state_t &s) {
+      if (s.num_sites == 0) {
+        s.num_sites = 1;
+        s.num_tags = 1;
+      }
+    }
+
+    // find or add the site of a caller and tag, with the lock held.
+    static unsigned find_site(state_t &s, const void *caller, unsigned tag) {
+      init(s);
+      size_t hash = ((size_t)caller >> 2) * 0x9e3779b1u + tag;
+      for (unsigned i = 0; i != site_table_size; ++i) {
+        unsigned &slot = s.site_table[(hash + i) & (site_table_size - 1)];
+        if (slot == 0) {
+          if (s.num_sites == max_sites) return 0;
+          site_t &site = s.sites[s.num_sites];
+          site.caller = caller;
+          site.tag = tag;
+          return slot = s.num_sites++;
+        }
+        const site_t &site = s.sites[slot];
+        if (site.caller == caller && site.tag == tag) return slot;
+      }
+      return 0;
+    }
+
+    // count a new block against a site, with the lock held.
+    static void *record(state_t &s, void *block, size_t size, unsigned site) {
+      header_t *h = (header_t*)block;
+      h->site = site;
+      h->magic = magic;
+      h->size = size;
+
+      site_t &st = s.sites[site];
+      add(st.stats, size);
+      add(s.tags[st.tag].stats, size);
+      return (uint8_t*)block + header_size;
+    }
+
+    // sort indices by decreasing key
+    template <class item_t> static void sort_indices(unsigned *indices, unsigned num, const item_t *items, sort_t sort) {
+      for (unsigned i = 0; i != num; ++i) indices[i] = i;
+      std::sort(indices, indices + num, [=](unsigned a, unsigned b) {
+        return get_key(items[a].stats, sort) > get_key(items[b].stats, sort);
+      });
+    }
+
+  public:
+    /// find or add a tag by name. Returns 0 ("untagged") if there are too many.
+    static unsigned add_tag(const char *name) {
+      state_t &s = state();
+      lock_t lock(s.lock);
+      init(s);
+
+      for (unsigned i = 1; i != s.num_tags; ++i) {
+        if (!strcmp(s.tags[i].name, name)) {
+          return i;
+        }
+      }
+
+      if (s.num_tags == max_tags) return 0;
+      s.tags[s.num_tags].name = name;
+      return s.num_tags++;
+    }
+
+    /// counts allocations on this thread against a tag until the end of the scope.
+    /// use OCTET_ALLOC_TAG(name) rather than this directly; it caches the tag in a static.
+    class scope {
+      unsigned prev;
+    public:
+      scope(unsigned tag) {
+        prev = current_tag();
+        current_tag() = tag;
+      }
+
+      ~scope() {
+        current_tag() = prev;
+      }
+    };
+
+    /// record a new block made by the code at caller, in the current tag.
+    /// block has header_size extra bytes at the start.
+    static void *on_malloc(void *block, size_t size, const void *caller) {
+      unsigned tag = current_tag();
+      state_t &s = state();
+      lock_t lock(s.lock);
+      return record(s, block, size, find_site(s, caller, tag));
+    }
+
+    /// record a resized block, which stays with the site that first allocated it.
+    static void *on_realloc(void *block, size_t size, unsigned site) {
+      state_t &s = state();
+      lock_t lock(s.lock);
+      return record(s, block, size, site);
+    }
+
+    /// forget a block and return the start of the header.
+    /// size is corrected to the allocated size if the caller got it wrong.
+    static void *on_free(void *ptr, size_t &size, unsigned *site_out = 0) {
+      header_t *h = (header_t*)((uint8_t*)ptr - header_size);
+      state_t &s = state();
+      lock_t lock(s.lock);
+      if (h->magic != magic || h->size != size) {
+        // freed with the wrong size, or freed twice.
+        s.num_bad_frees++;
+        if (h->magic == magic) size = (size_t)h->size;
+      }
+      unsigned site = h->site < s.num_sites ? h->site : 0;
+      site_t &st = s.sites[site];
+      remove(st.stats, size);
+      remove(s.tags[st.tag].stats, size);
+      h->magic = 0;
+      if (site_out) *site_out = site;
+      return (void*)h;
+    }
+
+    /// number of tags so far (including "untagged")
+    static unsigned get_num_tags() {
+      unsigned n = state().num_tags;
+      return n ? n : 1;
+    }
+
+    /// number of sites so far (including "untagged")
+    static unsigned get_num_sites() {
+      unsigned n = state().num_sites;
+      return n ? n : 1;
+    }
+
+    /// copy of a tag's counters
+    static tag_t get_tag(unsigned index) {
+      state_t &s = state();
+      lock_t lock(s.lock);
+      tag_t result = s.tags[index];
+      if (!result.name) result.name = "untagged";
+      return result;
+    }
+
+    /// copy of a site's counters
+    static site_t get_site(unsigned index) {
+      state_t &s = state();
+      lock_t lock(s.lock);
+      return s.sites[index];
+    }
+
+    /// number of frees whose size did not match the malloc.
+    static size_t get_num_bad_frees() {
+      return state().num_bad_frees;
+    }
+
+    /// get the tags and sites in report order, and how many of each were sorted.
+    /// more may be added while the report is written, so only read this many.
+    static void get_sorted(unsigned *tag_order, unsigned &num_tags, unsigned *site_order, unsigned &num_sites, sort_t sort) {
+      state_t &s = state();
+      lock_t lock(s.lock);
+      num_tags = s.num_tags ? s.num_tags : 1;
+      num_sites = s.num_sites ? s.num_sites : 1;
+      sort_indices(tag_order, num_tags, s.tags, sort);
+      sort_indices(site_order, num_sites, s.sites, sort);
+    }
+
+    /// write a report, biggest first.
+    static void dump(FILE *file, sort_t sort = sort_live_bytes) {
+      static unsigned tag_order[max_tags];
+      static unsigned site_order[max_sites];
+      unsigned num_tags = 0, num_sites = 0;
+      get_sorted(tag_order, num_tags, site_order, num_sites, sort);
+
+      fprintf(file, "%-32s %10s %10s %12s %12s %12s\n", "tag", "allocs", "frees", "total", "live", "peak");
+      for (unsigned i = 0; i != num_tags; ++i) {
+        tag_t t = get_tag(tag_order[i]);
+        const stats_t &st = t.stats;
+        fprintf(file, "%-32s %10u %10u %12u %12u %12u\n", t.name, (unsigned)st.num_allocs, (unsigned)st.num_frees, (unsigned)st.total_bytes, (unsigned)st.live_bytes, (unsigned)st.peak_bytes);
+      }
+
+      fprintf(file, "\n%-18s %-32s %10s %12s %12s %12s\n", "caller", "tag", "allocs", "total", "live", "peak");
+      for (unsigned i = 0; i != num_sites; ++i) {
+        site_t site = get_site(site_order[i]);
+        const stats_t &st = site.stats;
+        if (st.num_allocs == 0) continue;
+        fprintf(file, "%-18p %-32s %10u %12u %12u %12u\n", site.caller, get_tag(site.tag).name, (unsigned)st.num_allocs, (unsigned)st.total_bytes, (unsigned)st.live_bytes, (unsigned)st.peak_bytes);
+      }
+
+      if (get_num_bad_frees()) {
+        fprintf(file, "\nwarning: %u frees with the wrong size\n", (unsigned)get_num_bad_frees());
+      }
+    }
+  };
+} }
+
+#define OCTET_ALLOC_CONCAT2(a, b) a##b
+#define OCTET_ALLOC_CONCAT(a, b) OCTET_ALLOC_CONCAT2(a, b)
+
+#if OCTET_ALLOC_PROFILE
+  /// count allocations until the end of this scope against a tag.
+  #define OCTET_ALLOC_TAG(name) \
+    static unsigned OCTET_ALLOC_CONCAT(octet_alloc_tag_index_, __LINE__) = octet::containers::alloc_profile::add_tag(name); \
+    octet::containers::alloc_profile::scope OCTET_ALLOC_CONCAT(octet_alloc_tag_, __LINE__)(OCTET_ALLOC_CONCAT(octet_alloc_tag_index_, __LINE__))
+#else
+  #define OCTET_ALLOC_TAG(name)
+#endif
@@ -6,14 +6,16 @@
 //
 // game-style memory allocator
 //
-// this is a placeholder for a game-style memory allocator
-// using malloc and free is frowned upon in grown-up circles.
+// small blocks (up to 1024 bytes) come from size-class pools carved out of 64k chunks.
+// each thread keeps a small magazine of free blocks per size class so that
+// most mallocs and frees touch no shared state at all.
+// larger blocks go to the system heap, always 16-byte aligned.
 //
-// these functions are poor for the following reasons:
+// free() and realloc() are passed the size of the block, so we do not need a
+// header on each allocation to find its size class.
 //
-// 1) free() has to compute the size of the block to free
-// 2) these functions use heavy weight locks to guard the heap.
-// 3) implementations are quite variable
+// define OCTET_SYSTEM_ALLOCATOR 1 to send everything to the system heap (for comparison).
+// define OCTET_ALLOC_PROFILE 1 to count allocations by tag and call site (see alloc_profile.h).
 
 // this is a dummy class used to customise the placement new and delete
 struct dynarray_dummy_t {};
@@ -49,10 +51,63 @@ void operator delete(void *ptr, void *place, dynarray_dummy_t x) {}
 
 
 namespace octet { namespace containers {
+  /// Pooled, thread cached memory allocator used by all the containers and resources.
+  ///
+  /// Blocks of up to max_small_size bytes are allocated from one of num_classes size classes.
+  /// Each thread has a magazine of free blocks per class; when this is empty, half a magazine
+  /// is fetched from the global pool and when it is full, half is returned.
+  ///
+  /// Threads other than the main thread should call flush_thread_cache() before they exit.
   class allocator {
+  public:
+    enum {
+      /// every block is aligned to at least this
+      alignment = 16,
+
+      /// number of small block size classes
+      num_classes = 20,
+
+      /// largest block handled by the pools
+      max_small_size = 1024,
+
+      /// pools grow in chunks of this size
+      chunk_size = 65536,
+
+      /// maximum number of free blocks held by each thread per class
+      magazine_size = 32,
+    };
+
+  private:
+    // free blocks are kept in singly linked lists
+    struct free_block {
+      free_block *next;
+    };
+
+    // global pool for one size class
+    struct pool_t {
+      std::atomic<int> lock;
+      free_block *free_list;
+      char *chunk_pos;
+      char *chunk_end;
+    };
+
     // singleton state, a bit like an old-world global variable
+    // note: zero initialised, so no constructor is needed
     struct state_t {
-      size_t num_bytes;
+      std::atomic<size_t> num_bytes;
+      std::atomic<size_t> num_allocs;
+      std::atomic<size_t> num_reserved;
+      pool_t pools[num_classes];
+    };
+
+    // per-thread magazines
+    struct thread_cache_t {
+      free_block *head[num_classes];
+      unsigned count[num_classes];
+
+      // allocated bytes and calls not yet added to state()
+      ptrdiff_t pending_bytes;
+      size_t pending_allocs;
     };
 
     static state_t &state() {
@@ -60,47 +115,288 @@ namespace octet { namespace containers {
       return instance;
     }
 
+    static thread_cache_t &thread_cache() {
+      static OCTET_THREAD_LOCAL thread_cache_t instance;
+      return instance;
+    }
+
+    // keep the byte count per thread so that threads do not fight over one cache line.
+    static void add_bytes(ptrdiff_t bytes) {
+      thread_cache_t &cache = thread_cache();
+      cache.pending_bytes += bytes;
+      if (cache.pending_bytes >= chunk_size || cache.pending_bytes <= -chunk_size) {
+        flush_counts(cache);
+      }
+    }
+
+    static void flush_counts(thread_cache_t &cache) {
+      state().num_bytes.fetch_add((size_t)cache.pending_bytes, std::memory_order_relaxed);
+      state().num_allocs.fetch_add(cache.pending_allocs, std::memory_order_relaxed);
+      cache.pending_bytes = 0;
+      cache.pending_allocs = 0;
+    }
+
+    // simple spin lock, pool operations are very short.
+    class spin_lock {
+      std::atomic<int> &flag;
+    public:
+      spin_lock(std::atomic<int> &flag) : flag(flag) {
+        while (flag.exchange(1, std::memory_order_acquire)) {
+          while (flag.load(std::memory_order_relaxed)) {}
+        }
+      }
+
+      ~spin_lock() {
+        flag.store(0, std::memory_order_release);
+      }
+    };
+
+    // 16..128 step 16, 160..256 step 32, 320..512 step 64, 640..1024 step 128
+    static unsigned get_class(size_t size) {
+      if (size <= 128) return size <= 16 ? 0 : (unsigned)((size - 1) >> 4);
+      if (size <= 256) return 4 + (unsigned)((size - 1) >> 5);
+      if (size <= 512) return 8 + (unsigned)((size - 1) >> 6);
+      return 12 + (unsigned)((size - 1) >> 7);
+    }
+
+    static size_t get_class_size(unsigned cls) {
+      static const unsigned short sizes[num_classes] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256,
+        320, 384, 448, 512,
+        640, 768, 896, 1024,
+      };
+      return sizes[cls];
+    }
+
+    // fetch half a magazine of blocks from the global pool (the magazine is empty)
+    static free_block *refill(thread_cache_t &cache, unsigned cls) {
+      pool_t &pool = state().pools[cls];
+      size_t block_size = get_class_size(cls);
+      free_block *head = 0;
+      unsigned count = 0;
+      {
+        spin_lock lock(pool.lock);
+        while (count != magazine_size/2 && pool.free_list) {
+          free_block *b = pool.free_list;
+          pool.free_list = b->next;
+          b->next = head;
+          head = b;
+          count++;
+        }
+        while (count != magazine_size/2) {
+          if (pool.chunk_pos == pool.chunk_end) {
+            pool.chunk_pos = (char*)system_malloc(chunk_size);
+            if (!pool.chunk_pos) break;
+            pool.chunk_end = pool.chunk_pos + (chunk_size / block_size) * block_size;
+            state().num_reserved.fetch_add(chunk_size, std::memory_order_relaxed);
+          }
+          free_block *b = (free_block*)pool.chunk_pos;
+          pool.chunk_pos += block_size;
+          b->next = head;
+          head = b;
+          count++;
+        }
+      }
+      cache.head[cls] = head;
+      cache.count[cls] = count;
+      return head;
+    }
+
+    // return the first count blocks in the magazine to the global pool
+    static void flush(thread_cache_t &cache, unsigned cls, unsigned count) {
+      if (count == 0) return;
+      free_block *first = cache.head[cls];
+      free_block *last = first;
+      for (unsigned i = 1; i != count; ++i) {
+        last = last->next;
+      }
+      cache.head[cls] = last->next;
+      cache.count[cls] -= count;
+
+      pool_t &pool = state().pools[cls];
+      spin_lock lock(pool.lock);
+      last->next = pool.free_list;
+      pool.free_list = first;
+    }
+
+    static void *pool_malloc(size_t size) {
+      #if !OCTET_SYSTEM_ALLOCATOR
+        if (size <= max_small_size) {
+          unsigned cls = get_class(size);
+          thread_cache_t &cache = thread_cache();
+          free_block *b = cache.head[cls];
+          if (!b) {
+            b = refill(cache, cls);
+            if (!b) return 0;
+          }
+          cache.head[cls] = b->next;
+          cache.count[cls]--;
+          return (void*)b;
+        }
+      #endif
+      return system_malloc(size);
+    }
+
+    static void pool_free(void *ptr, size_t size) {
+      #if !OCTET_SYSTEM_ALLOCATOR
+        if (size <= max_small_size) {
+          unsigned cls = get_class(size);
+          thread_cache_t &cache = thread_cache();
+          if (cache.count[cls] == magazine_size) {
+            flush(cache, cls, magazine_size/2);
+          }
+          free_block *b = (free_block*)ptr;
+          b->next = cache.head[cls];
+          cache.head[cls] = b;
+          cache.count[cls]++;
+          return;
+        }
+      #endif
+      system_free(ptr);
+    }
+
+    static void *pool_realloc(void *ptr, size_t old_size, size_t size) {
+      #if !OCTET_SYSTEM_ALLOCATOR
+        if (old_size <= max_small_size || size <= max_small_size) {
+          // same size class: nothing to do.
+          if (old_size <= max_small_size && size <= max_small_size && get_class(old_size) == get_class(size)) {
+            return ptr;
+          }
+          void *res = pool_malloc(size);
+          if (res) {
+            memcpy(res, ptr, old_size < size ? old_size : size);
+            pool_free(ptr, old_size);
+          }
+          return res;
+        }
+      #endif
+      return system_realloc(ptr, old_size, size);
+    }
+
   public:
-    // todo: implement this from scratch using a pool allocator
-    static void *malloc(size_t size) {
-      state().num_bytes += size;
-      #if OCTET_MAC
-        void *res = 0;
-        posix_memalign(&res, 16, size);
-      #elif OCTET_SSE
-        void *res = ::_aligned_malloc(size, 16);
+    /// allocate directly from the system heap, 16 byte aligned.
+    static void *system_malloc(size_t size) {
+      #if defined(WIN32)
+        return ::_aligned_malloc(size, alignment);
       #elif OCTET_VITA
-        void *res = ::memalign(size, 16);
+        return ::memalign(alignment, size);
+      #else
+        void *res = 0;
+        if (posix_memalign(&res, alignment, size ? size : (size_t)alignment)) return 0;
+        return res;
+      #endif
+    }
+
+    /// free a block allocated with system_malloc
+    static void system_free(void *ptr) {
+      #if defined(WIN32)
+        ::_aligned_free(ptr);
       #else
-        void *res = ::malloc(size);
+        ::free(ptr);
+      #endif
+    }
+
+    /// resize a block allocated with system_malloc, keeping the alignment.
+    static void *system_realloc(void *ptr, size_t old_size, size_t size) {
+      #if defined(WIN32)
+        return ::_aligned_realloc(ptr, size, alignment);
+      #else
+        // realloc() does not promise to keep our alignment
+        void *res = ::realloc(ptr, size);
+        if (((size_t)res & (alignment-1)) != 0) {
+          void *aligned = system_malloc(size);
+          memcpy(aligned, res, old_size < size ? old_size : size);
+          ::free(res);
+          res = aligned;
+        }
+        return res;
       #endif
-      //printf("malloc %p[%d] -> %d\n", res, size, state().num_bytes);
-      return res;
     }
 
+    #if OCTET_ALLOC_PROFILE
+      // count a block against the code at caller.
+      static void *profiled_malloc(size_t size, const void *caller) {
+        add_bytes((ptrdiff_t)size);
+        thread_cache().pending_allocs++;
+        void *block = pool_malloc(size + alloc_profile::header_size);
+        return block ? alloc_profile::on_malloc(block, size, caller) : 0;
+      }
+    #endif
+
+    /// allocate a block of at least size bytes, aligned to 16 bytes.
+    /// not inlined when profiling, so that the profiler sees who called it.
+    #if OCTET_ALLOC_PROFILE
+      OCTET_NOINLINE
+    #endif
+    static void *malloc(size_t size) {
+      #if OCTET_ALLOC_PROFILE
+        return profiled_malloc(size, OCTET_RETURN_ADDRESS());
+      #else
+        add_bytes((ptrdiff_t)size);
+        thread_cache().pending_allocs++;
+        return pool_malloc(size);
+      #endif
+    }
+
+    /// free a block, size must be the same as the size passed to malloc (or realloc).
     static void free(void *ptr, size_t size) {
-      state().num_bytes -= size;
-      //printf("free %p[%d] -> %d\n", ptr, size, state().num_bytes);
-      #if OCTET_MAC
-        return ::free(ptr);
-      #elif OCTET_SSE
-        return ::_aligned_free(ptr);
+      if (!ptr) return;
+      #if OCTET_ALLOC_PROFILE
+        void *block = alloc_profile::on_free(ptr, size);
+        add_bytes(-(ptrdiff_t)size);
+        pool_free(block, size + alloc_profile::header_size);
       #else
-        return ::free(ptr);
+        add_bytes(-(ptrdiff_t)size);
+        pool_free(ptr, size);
       #endif
     }
 
+    /// resize a block. old_size must be the size passed to malloc (or realloc).
+    #if OCTET_ALLOC_PROFILE
+      OCTET_NOINLINE
+    #endif
     static void *realloc(void *ptr, size_t old_size, size_t size) {
-      state().num_bytes += size - old_size;
-      #if OCTET_MAC
-        void *res = ::realloc(ptr, size);
-      #elif OCTET_SSE
-        void *res = ::_aligned_realloc(ptr, size, 16);
+      #if OCTET_ALLOC_PROFILE
+        if (!ptr) return profiled_malloc(size, OCTET_RETURN_ADDRESS());
+
+        // the block keeps the site it was allocated at.
+        unsigned site = 0;
+        void *block = alloc_profile::on_free(ptr, old_size, &site);
+        add_bytes((ptrdiff_t)size - (ptrdiff_t)old_size);
+        block = pool_realloc(block, old_size + alloc_profile::header_size, size + alloc_profile::header_size);
+        return block ? alloc_profile::on_realloc(block, size, site) : 0;
       #else
-        void *res = ::realloc(ptr, size);
+        if (!ptr) return malloc(size);
+        add_bytes((ptrdiff_t)size - (ptrdiff_t)old_size);
+        return pool_realloc(ptr, old_size, size);
       #endif
-      //printf("realloc %p[%d] -> %p[%d] %d\n", ptr, old_size, res, size, state().num_bytes);
-      return res;
+    }
+
+    /// return this thread's cached blocks to the global pools.
+    /// worker threads should call this before they exit.
+    static void flush_thread_cache() {
+      thread_cache_t &cache = thread_cache();
+      for (unsigned cls = 0; cls != num_classes; ++cls) {
+        flush(cache, cls, cache.count[cls]);
+      }
+      flush_counts(cache);
+    }
+
+    /// number of bytes currently allocated by callers.
+    /// other threads batch their counts, so this may be out by up to chunk_size per thread.
+    static size_t get_num_bytes() {
+      return state().num_bytes.load(std::memory_order_relaxed) + thread_cache().pending_bytes;
+    }
+
+    /// total number of calls to malloc() so far (other threads are batched as above).
+    static size_t get_num_allocs() {
+      return state().num_allocs.load(std::memory_order_relaxed) + thread_cache().pending_allocs;
+    }
+
+    /// number of bytes reserved from the system for the small block pools.
+    static size_t get_num_reserved() {
+      return state().num_reserved.load(std::memory_order_relaxed);
     }
 
     // crude check of stack integrity
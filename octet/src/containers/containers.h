@@ -25,13 +25,17 @@
 #ifndef OCTET_CONTAINERS_INCLUDED
 #define OCTET_CONTAINERS_INCLUDED
 
+#include "../containers/alloc_profile.h"
 #include "../containers/allocator.h"
-#include "../containers/dictionary.h"
+#include "../containers/frame_allocator.h"
 #include "../containers/hash_map.h"
 #include "../containers/double_list.h"
 #include "../containers/dynarray.h"
+#include "../containers/dictionary.h"
 #include "../containers/string.h"
 #include "../containers/ref.h"
+#include "../containers/small_dynarray.h"
+#include "../containers/slot_map.h"
 #include "../containers/bitset.h"
 
 namespace octet {
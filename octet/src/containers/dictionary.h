@@ -15,67 +15,190 @@ namespace octet { namespace containers {
   /// Example:
   ///
   ///     dictionary<int> my_dict;
-  ///     my_dict["fred"] = 27; 
-  ///     my_dict["anne"] = 28; 
+  ///     my_dict["fred"] = 27;
+  ///     my_dict["anne"] = 28;
   ///
   ///     int annes_age = my_dict["anne"];
   ///
+  /// Keys are copied into large chunks of memory owned by the dictionary, so adding a key
+  /// does not usually allocate. Each entry keeps the length and hash of its key.
+  ///
+  /// If you look up the same key more than once, or already know its length, get the hash
+  /// once with calc_hash() and use the (key, length, hash) versions of the methods.
+  /// These do not need a zero terminated key.
+  ///
+  ///     unsigned len;
+  ///     unsigned hash = dictionary<int>::calc_hash(name, len);
+  ///     int index = my_dict.get_index(name, len, hash);
+  ///     if (index < 0) my_dict.get(name, len, hash) = 29;
+  ///
+  /// To fill a dictionary at load time, use begin_bulk(), add_bulk() and end_bulk(),
+  /// which build the table once at the end.
   template <class value_t, class allocator_t=allocator> class dictionary {
-    struct entry_t { const char *key; unsigned hash; value_t value; };
+    struct entry_t { const char *key; unsigned length; unsigned hash; value_t value; };
+
+    // key storage. Keys never move unless the dictionary is compacted by erase().
+    struct chunk_t { chunk_t *next; size_t size; };
+
+    enum {
+      chunk_size = 4096,
+      chunk_header = (sizeof(chunk_t) + 15) & ~15,
+    };
+
     entry_t *entries;
     unsigned num_entries;
     unsigned max_entries;
-  
-    // hash is a compromise between fewer collisions and
-    // faster hash calculation.
-    unsigned calc_hash( const char *key ) {
-      unsigned hash = 0;
-      for (int i = 0; key[i]; ++i) {
-        hash = ( hash << 5 ) ^ ( hash << 3 ) ^ (key[i] & 0xff);
-      }
-      return hash;
-    }
-  
-    // internal method to find an entry for a key
-    entry_t *find( const char *key, unsigned hash ) {
+
+    chunk_t *chunks;
+    char *chunk_pos;
+    char *chunk_end;
+
+    // bytes of key storage in use by current keys and by erased keys.
+    size_t live_key_bytes;
+    size_t dead_key_bytes;
+
+    // entries added between begin_bulk() and end_bulk()
+    entry_t *bulk_entries;
+    unsigned num_bulk_entries;
+    unsigned max_bulk_entries;
+
+    // copy a key into the key storage and add a terminator
+    const char *add_key(const char *key, unsigned length) {
+      size_t bytes = length + 1;
+      if (chunk_pos + bytes > chunk_end) {
+        size_t size = bytes > chunk_size - chunk_header ? bytes + chunk_header : (size_t)chunk_size;
+        OCTET_ALLOC_TAG("dictionary keys");
+        chunk_t *chunk = (chunk_t*)allocator_t::malloc(size);
+        chunk->next = chunks;
+        chunk->size = size;
+        chunks = chunk;
+        chunk_pos = (char*)chunk + chunk_header;
+        chunk_end = (char*)chunk + size;
+      }
+      char *result = chunk_pos;
+      chunk_pos += bytes;
+      memcpy(result, key, length);
+      result[length] = 0;
+      live_key_bytes += bytes;
+      return result;
+    }
+
+    void free_chunks(chunk_t *chunk) {
+      while (chunk) {
+        chunk_t *next = chunk->next;
+        allocator_t::free(chunk, chunk->size);
+        chunk = next;
+      }
+    }
+
+    // can entries be moved with memcpy? (see is_trivially_relocatable)
+    enum { relocatable = is_trivially_relocatable<value_t>::value };
+
+    // mark a table of entries as empty. values are only constructed when a key is added.
+    static void clear_entries(entry_t *dest, unsigned num) {
+      for (unsigned i = 0; i != num; ++i) {
+        dest[i].key = 0;
+      }
+    }
+
+    // move an entry to an empty slot, leaving the source to be reused or freed.
+    static void move_entry(entry_t *dest, entry_t *src) {
+      if (relocatable) {
+        memcpy((void*)dest, (const void*)src, sizeof(entry_t));
+      } else {
+        dest->key = src->key;
+        dest->length = src->length;
+        dest->hash = src->hash;
+        dynarray_dummy_t x;
+        new (&dest->value, x) value_t(src->value);
+        src->value.~value_t();
+      }
+    }
+
+    // destroy the values of the entries that have keys.
+    static void destroy_entries(entry_t *src, unsigned num) {
+      for (unsigned i = 0; i != num; ++i) {
+        if (src[i].key) src[i].value.~value_t();
+      }
+    }
+
+    // internal method to find an entry for a key: either the key or an empty slot.
+    entry_t *find(const char *key, unsigned length, unsigned hash) {
       unsigned mask = max_entries - 1;
       for (unsigned i = 0; i != max_entries; ++i) {
         entry_t *entry = &entries[ ( i + hash ) & mask ];
         if (!entry->key) {
           return entry;
         }
-        if (entry->hash == hash && !strcmp(entry->key, key)) {
+        if (entry->hash == hash && entry->length == length && !memcmp(entry->key, key, length)) {
           return entry;
         }
       }
       return 0;
     }
-  
-    // grow the dictionary when needed
-    void expand() {
+
+    // move the entries into a table of a new size. keys are not copied.
+    void rehash(unsigned new_max_entries) {
       entry_t *old_entries = entries;
       unsigned old_max_entries = max_entries;
-      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries*2);
-      memset(entries, 0, sizeof(entry_t) * max_entries*2);
-      max_entries *= 2;
+      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * new_max_entries);
+      clear_entries(entries, new_max_entries);
+      max_entries = new_max_entries;
       for (unsigned i = 0; i != old_max_entries; ++i) {
         entry_t *old_entry = &old_entries[i];
         if (old_entry->key) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
-          *new_entry = *old_entry;
+          entry_t *new_entry = find(old_entry->key, old_entry->length, old_entry->hash);
+          move_entry(new_entry, old_entry);
         }
       }
       allocator_t::free(old_entries, sizeof(entry_t) * old_max_entries);
     }
 
-    void release() {
+    // grow the dictionary when needed
+    void expand() {
+      rehash(max_entries * 2);
+    }
+
+    // add a key to an empty slot returned by find()
+    value_t &add_entry(entry_t *entry, const char *key, unsigned length, unsigned hash) {
+      // reducing this ratio decreases hot search time at the
+      // expense of size (cold search time).
+      if (num_entries >= max_entries * 3 / 4) {
+        expand();
+        entry = find(key, length, hash);
+      }
+      num_entries++;
+      entry->key = add_key(key, length);
+      entry->length = length;
+      entry->hash = hash;
+      dynarray_dummy_t x;
+      new (&entry->value, x) value_t();
+      return entry->value;
+    }
+
+    // copy the live keys to new storage when most of it is erased keys.
+    void compact() {
+      chunk_t *old_chunks = chunks;
+      chunks = 0;
+      chunk_pos = chunk_end = 0;
+      live_key_bytes = dead_key_bytes = 0;
       for (unsigned i = 0; i != max_entries; ++i) {
         entry_t *entry = &entries[i];
-        if (entry->key ) {
-          allocator_t::free((void*)entry->key, strlen(entry->key)+1);
+        if (entry->key) {
+          entry->key = add_key(entry->key, entry->length);
         }
       }
+      free_chunks(old_chunks);
+    }
+
+    void release() {
+      destroy_entries(entries, max_entries);
+      free_chunks(chunks);
       allocator_t::free(entries, sizeof(entry_t) * max_entries);
+      if (bulk_entries) {
+        destroy_entries(bulk_entries, num_bulk_entries);
+        allocator_t::free(bulk_entries, sizeof(entry_t) * max_bulk_entries);
+      }
       entries = 0;
       num_entries = 0;
       max_entries = 0;
@@ -85,7 +208,12 @@ namespace octet { namespace containers {
       num_entries = 0;
       max_entries = 4;
       entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_entries);
-      memset(entries, 0, sizeof(entry_t) * max_entries);
+      clear_entries(entries, max_entries);
+      chunks = 0;
+      chunk_pos = chunk_end = 0;
+      live_key_bytes = dead_key_bytes = 0;
+      bulk_entries = 0;
+      num_bulk_entries = max_bulk_entries = 0;
     }
   public:
     /// make a new dictionary
@@ -93,33 +221,189 @@ namespace octet { namespace containers {
       init();
     }
 
+    /// Hash function used by the dictionary. Returns the length of the zero terminated key in length.
+    static unsigned calc_hash(const char *key, unsigned &length) {
+      unsigned hash = 2166136261u;
+      const char *p = key;
+      for (; *p; ++p) {
+        hash = ( hash ^ (*p & 0xff) ) * 16777619u;
+      }
+      length = (unsigned)(p - key);
+      return hash_map_cmp::fuzz_hash(hash);
+    }
+
+    /// Hash function used by the dictionary, for a key of known length (need not be zero terminated).
+    static unsigned calc_hash_bytes(const char *key, size_t length) {
+      unsigned hash = 2166136261u;
+      for (size_t i = 0; i != length; ++i) {
+        hash = ( hash ^ (key[i] & 0xff) ) * 16777619u;
+      }
+      return hash_map_cmp::fuzz_hash(hash);
+    }
+
     /// Access an element by name.
     /// This will create a new element if one does not exist.
     /// For more detail, use get_index(), get_key() and get_value()
     value_t &operator[]( const char *key ) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
-      if (!entry || !entry->key) {
-        // reducing this ratio decreases hot search time at the
-        // expense of size (cold search time).
-        if (num_entries > max_entries * 3 / 4) {
-          expand();
-          entry = find(key, hash);
-        }
-        num_entries++;
-        size_t bytes = strlen(key) + 1;
-        entry->key = (char *)allocator_t::malloc(bytes);
-        entry->hash = hash;
-        memcpy((void*)entry->key, key, bytes);
+      unsigned length;
+      unsigned hash = calc_hash(key, length);
+      return get(key, length, hash);
+    }
+
+    /// Access an element by key, length and hash from calc_hash(), adding it if it does not exist.
+    value_t &get(const char *key, unsigned length, unsigned hash) {
+      assert(!bulk_entries && "dictionary: call end_bulk() first");
+      entry_t *entry = find(key, length, hash);
+      if (entry->key) {
+        return entry->value;
       }
-      return entry->value;
+      return add_entry(entry, key, length, hash);
     }
 
     /// Return true if the dictionary contains key.
     bool contains(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
-      return entry && entry->key;
+      return get_index(key) >= 0;
+    }
+
+    /// Return true if the dictionary contains key. hash is from calc_hash().
+    bool contains(const char *key, unsigned length, unsigned hash) {
+      return get_index(key, length, hash) >= 0;
+    }
+
+    /// Remove a key and its value. Returns false if the key was not found.
+    ///
+    /// Note: this may move the other keys and changes the index of other values.
+    bool erase(const char *key) {
+      unsigned length;
+      unsigned hash = calc_hash(key, length);
+      return erase(key, length, hash);
+    }
+
+    /// Remove a key and its value. hash is from calc_hash().
+    bool erase(const char *key, unsigned length, unsigned hash) {
+      int index = get_index(key, length, hash);
+      if (index < 0) return false;
+
+      live_key_bytes -= length + 1;
+      dead_key_bytes += length + 1;
+      entries[index].value.~value_t();
+
+      // move later entries in the same run back into the gap, if their home slot allows.
+      unsigned mask = max_entries - 1;
+      unsigned hole = (unsigned)index;
+      for (unsigned slot = (hole + 1) & mask; entries[slot].key; slot = (slot + 1) & mask) {
+        unsigned home = entries[slot].hash & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+          move_entry(&entries[hole], &entries[slot]);
+          hole = slot;
+        }
+      }
+      entries[hole].key = 0;
+      num_entries--;
+
+      if (dead_key_bytes > chunk_size && dead_key_bytes > live_key_bytes) {
+        compact();
+      }
+      return true;
+    }
+
+    /// Make space for num_keys keys using key_bytes bytes of text
+    /// so that adding them does not allocate.
+    void reserve(unsigned num_keys, size_t key_bytes = 0) {
+      unsigned new_max_entries = max_entries;
+      while (num_keys >= new_max_entries * 3 / 4) {
+        new_max_entries *= 2;
+      }
+      if (new_max_entries != max_entries) {
+        rehash(new_max_entries);
+      }
+
+      size_t bytes = key_bytes + num_keys;
+      if (key_bytes && chunk_pos + bytes > chunk_end) {
+        OCTET_ALLOC_TAG("dictionary keys");
+        size_t size = bytes + chunk_header;
+        chunk_t *chunk = (chunk_t*)allocator_t::malloc(size);
+        chunk->next = chunks;
+        chunk->size = size;
+        chunks = chunk;
+        chunk_pos = (char*)chunk + chunk_header;
+        chunk_end = (char*)chunk + size;
+      }
+    }
+
+    /// Start adding a lot of keys. No lookups are allowed until end_bulk().
+    /// expected_keys is a hint.
+    void begin_bulk(unsigned expected_keys = 0) {
+      assert(!bulk_entries);
+      max_bulk_entries = expected_keys > 16 ? expected_keys : 16;
+      bulk_entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_bulk_entries);
+      num_bulk_entries = 0;
+    }
+
+    /// Add a key and value between begin_bulk() and end_bulk().
+    /// If a key is added more than once, the last value is kept.
+    void add_bulk(const char *key, const value_t &value) {
+      unsigned length;
+      unsigned hash = calc_hash(key, length);
+      add_bulk(key, length, hash, value);
+    }
+
+    /// Add a key and value between begin_bulk() and end_bulk(). hash is from calc_hash().
+    void add_bulk(const char *key, unsigned length, unsigned hash, const value_t &value) {
+      assert(bulk_entries && "dictionary: call begin_bulk() first");
+      if (num_bulk_entries == max_bulk_entries) {
+        size_t old_bytes = sizeof(entry_t) * max_bulk_entries;
+        if (relocatable) {
+          bulk_entries = (entry_t*)allocator_t::realloc(bulk_entries, old_bytes, old_bytes * 2);
+        } else {
+          entry_t *old_entries = bulk_entries;
+          bulk_entries = (entry_t*)allocator_t::malloc(old_bytes * 2);
+          for (unsigned i = 0; i != num_bulk_entries; ++i) {
+            move_entry(&bulk_entries[i], &old_entries[i]);
+          }
+          allocator_t::free(old_entries, old_bytes);
+        }
+        max_bulk_entries *= 2;
+      }
+      entry_t *entry = &bulk_entries[num_bulk_entries++];
+      entry->key = add_key(key, length);
+      entry->length = length;
+      entry->hash = hash;
+      dynarray_dummy_t x;
+      new (&entry->value, x) value_t(value);
+    }
+
+    /// Finish adding keys: the table is sized once for all the new keys.
+    void end_bulk() {
+      assert(bulk_entries && "dictionary: call begin_bulk() first");
+      entry_t *src = bulk_entries;
+      unsigned num = num_bulk_entries;
+      bulk_entries = 0;
+
+      // the keys are already in the key storage.
+      unsigned new_max_entries = max_entries;
+      while (num_entries + num >= new_max_entries * 3 / 4) {
+        new_max_entries *= 2;
+      }
+      if (new_max_entries != max_entries) {
+        rehash(new_max_entries);
+      }
+
+      for (unsigned i = 0; i != num; ++i) {
+        entry_t *entry = find(src[i].key, src[i].length, src[i].hash);
+        if (entry->key) {
+          // duplicate key, the last one wins.
+          entry->value = src[i].value;
+          src[i].value.~value_t();
+          live_key_bytes -= src[i].length + 1;
+          dead_key_bytes += src[i].length + 1;
+        } else {
+          move_entry(entry, &src[i]);
+          num_entries++;
+        }
+      }
+      allocator_t::free(src, sizeof(entry_t) * max_bulk_entries);
+      num_bulk_entries = max_bulk_entries = 0;
     }
 
     /// Return the number of entries stored in the dictionary.
@@ -138,6 +422,12 @@ namespace octet { namespace containers {
       return entries[index].key;
     }
 
+    /// When iterating, get the length of the key for a certain index.
+    unsigned get_key_length(unsigned index) const {
+      assert(index < max_entries);
+      return entries[index].length;
+    }
+
     /// When iterating, access a specified value.
     value_t &get_value(unsigned index) {
       assert(index < max_entries);
@@ -146,8 +436,15 @@ namespace octet { namespace containers {
 
     /// Get the index for a certain key, or -1 if the key is not found.
     int get_index(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
+      unsigned length;
+      unsigned hash = calc_hash(key, length);
+      return get_index(key, length, hash);
+    }
+
+    /// Get the index for a key, length and hash from calc_hash(), or -1 if the key is not found.
+    int get_index(const char *key, unsigned length, unsigned hash) {
+      assert(!bulk_entries && "dictionary: call end_bulk() first");
+      entry_t *entry = find(key, length, hash);
       return entry && entry->key ? (int)(entry - entries) : -1;
     }
 
@@ -156,10 +453,10 @@ namespace octet { namespace containers {
       release();
       init();
     }
-  
+
     /// Bye bye dictionary. Use the allocator to free up memory.
     ~dictionary() {
-      reset();
+      release();
     }
   };
 } }
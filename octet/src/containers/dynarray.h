@@ -7,6 +7,14 @@
 
 
 namespace octet { namespace containers {
+  /// Can an item_t be moved to a new address with memcpy (and not destroyed at the old one)?
+  ///
+  /// dynarray uses this to grow arrays with realloc. Specialise it for classes
+  /// that do not point into themselves, like ref<> and dynarray<>.
+  template <class item_t> struct is_trivially_relocatable {
+    enum { value = std::is_trivially_copyable<item_t>::value };
+  };
+
   /// Dynamic array class similar to std::vector.
   ///
   /// Example
@@ -24,6 +32,9 @@ namespace octet { namespace containers {
   ///     dynarray<int> ints;          // ok. int is well-behaved.
   ///     dynarray<mesh> meshes;       // bad! mesh contains other arrays.
   ///     dynarray<ref<mesh> > meshes; // ok. managed pointers to meshes.
+  ///
+  /// Arrays of trivially relocatable items (see is_trivially_relocatable) grow with
+  /// allocator_t::realloc and do not call copy constructors or destructors when they move.
   template <class item_t, class allocator_t=allocator, bool use_new_delete=true> class dynarray {
     item_t *data_;
     typedef unsigned int_size_t;
@@ -33,6 +44,36 @@ namespace octet { namespace containers {
     int_size_t capacity_;
     enum { min_capacity = 8 };
 
+    // can we move items with memcpy/realloc?
+    enum { relocatable = !use_new_delete || is_trivially_relocatable<item_t>::value };
+
+    // can we copy items with memcpy?
+    enum { copyable = !use_new_delete || std::is_trivially_copyable<item_t>::value };
+
+    // move the items to a new block of memory of size new_capacity.
+    void reallocate(int_size_t new_capacity) {
+      if (relocatable) {
+        data_ = (item_t *)allocator_t::realloc(data_, capacity_ * sizeof(item_t), new_capacity * sizeof(item_t));
+      } else {
+        dynarray_dummy_t x;
+        item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
+        for (int_size_t i = 0; i != size_; ++i) {
+          new (new_data + i, x) item_t(std::move(data_[i]));
+          data_[i].~item_t();
+        }
+        if (data_) {
+          allocator_t::free(data_, capacity_ * sizeof(item_t));
+        }
+        data_ = new_data;
+      }
+      capacity_ = new_capacity;
+    }
+
+    // make room for one more item, doubling the capacity.
+    void grow() {
+      reallocate(capacity_ == 0 ? (int_size_t)min_capacity : capacity_ * 2);
+    }
+
   public:
     /// Create a new, empty, dynamic array
     dynarray() {
@@ -43,7 +84,7 @@ namespace octet { namespace containers {
 
     /// Create a new dynamic array of a certain size.
     dynarray(int_size_t size) {
-      data_ = (item_t*)allocator::malloc(size * sizeof(item_t));
+      data_ = (item_t*)allocator_t::malloc(size * sizeof(item_t));
       size_ = capacity_ = size;
       if (use_new_delete) {
         dynarray_dummy_t x;
@@ -57,9 +98,9 @@ namespace octet { namespace containers {
     ///
     /// Note: this is very slow and will happen frequently in naive code.
     dynarray(const dynarray &rhs) {
-      data_ = (item_t*)allocator::malloc(rhs.size_ * sizeof(item_t));
+      data_ = (item_t*)allocator_t::malloc(rhs.size_ * sizeof(item_t));
       size_ = capacity_ = rhs.size_;
-      if (use_new_delete) {
+      if (!copyable) {
         dynarray_dummy_t x;
         for (int_size_t i = 0; i != size_; ++i) {
           new (data_ + i, x)item_t(rhs.data_[i]);
@@ -69,6 +110,41 @@ namespace octet { namespace containers {
       }
     }
 
+    /// Take the contents of another array, leaving it empty. No items are copied.
+    dynarray(dynarray &&rhs) {
+      data_ = rhs.data_;
+      size_ = rhs.size_;
+      capacity_ = rhs.capacity_;
+      rhs.data_ = 0;
+      rhs.size_ = 0;
+      rhs.capacity_ = 0;
+    }
+
+    /// Replace the contents with a copy of another array.
+    dynarray &operator=(const dynarray &rhs) {
+      if (this != &rhs) {
+        dynarray tmp(rhs);
+        swap(tmp);
+      }
+      return *this;
+    }
+
+    /// Replace the contents with those of another array, leaving it empty.
+    dynarray &operator=(dynarray &&rhs) {
+      if (this != &rhs) {
+        reset();
+        swap(rhs);
+      }
+      return *this;
+    }
+
+    /// Exchange the contents of two arrays.
+    void swap(dynarray &rhs) {
+      std::swap(data_, rhs.data_);
+      std::swap(size_, rhs.size_);
+      std::swap(capacity_, rhs.capacity_);
+    }
+
     /// Destroy the array and its contents.
     ~dynarray() {
       reset();
@@ -105,40 +181,72 @@ namespace octet { namespace containers {
     iterator end() {
       return iterator(this, size_);
     }
-  
+
     /// iterator insert for STL compatibility
     iterator insert(iterator it, const item_t &new_item) {
-      int_size_t old_length = size_;
-      resize(size_+1);
-      for (int_size_t i = old_length; i != it.elem; --i) {
-        data_[i] = data_[i-1];
+      if (relocatable) {
+        item_t tmp(new_item);
+        if (size_ == capacity_) grow();
+        memmove((void*)(data_ + it.elem + 1), (void*)(data_ + it.elem), (size_ - it.elem) * sizeof(item_t));
+        dynarray_dummy_t x;
+        new (data_ + it.elem, x) item_t(std::move(tmp));
+        size_++;
+      } else {
+        int_size_t old_length = size_;
+        resize(size_+1);
+        for (int_size_t i = old_length; i != it.elem; --i) {
+          data_[i] = std::move(data_[i-1]);
+        }
+        data_[it.elem] = new_item;
       }
-      data_[it.elem] = new_item;
       return it;
     }
 
     /// iterator erase for STL compatibility
     iterator erase(iterator it) {
-      for (int_size_t i = it.elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
-      }
-      resize(size_-1);
+      erase(it.elem);
       return it;
     }
-  
+
     /// Erase an item; move subsequent items down to fill the gap.
     void erase(unsigned elem) {
-      for (int_size_t i = elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
+      if (relocatable) {
+        if (use_new_delete) data_[elem].~item_t();
+        memmove((void*)(data_ + elem), (void*)(data_ + elem + 1), (size_ - elem - 1) * sizeof(item_t));
+        size_--;
+      } else {
+        for (int_size_t i = elem; i < size_-1; ++i) {
+          data_[i] = std::move(data_[i+1]);
+        }
+        resize(size_-1);
       }
-      resize(size_-1);
     }
 
     /// Add an item at the back of the array.
     void push_back(const item_t &new_item) {
-      int_size_t old_length = size_;
-      resize(size_+1);
-      data_[old_length] = new_item;
+      emplace_back(new_item);
+    }
+
+    /// Move an item to the back of the array.
+    void push_back(item_t &&new_item) {
+      emplace_back(std::move(new_item));
+    }
+
+    /// Construct an item at the back of the array from the arguments.
+    ///
+    ///     dynarray<vec3> points;
+    ///     points.emplace_back(1.0f, 2.0f, 3.0f);
+    template <class... args_t> item_t &emplace_back(args_t&&... args) {
+      dynarray_dummy_t x;
+      if (size_ == capacity_) {
+        // the arguments may refer to items in this array, so construct first.
+        item_t tmp(std::forward<args_t>(args)...);
+        grow();
+        new (data_ + size_, x) item_t(std::move(tmp));
+      } else {
+        new (data_ + size_, x) item_t(std::forward<args_t>(args)...);
+      }
+      return data_[size_++];
     }
 
     /// Get the last element in the array.
@@ -151,13 +259,13 @@ namespace octet { namespace containers {
     bool empty() const {
       return size_ == 0;
     }
-  
+
     /// Access an element in the array.
     item_t &operator[](size_t elem) { return data_[elem]; }
 
     /// Read an element in the array.
     const item_t &operator[](size_t elem) const { return data_[elem]; }
-  
+
     /// Return number of elements in the array
     int_size_t size() const { return size_; }
 
@@ -169,7 +277,7 @@ namespace octet { namespace containers {
 
     /// Get a pointer to the first element of the array.
     item_t *data() { return data_; }
-  
+
     /// Resize the array to make it bigger or smaller.
     void resize(size_t new_length) {
       bool trace = false; // hack this for detailed traces
@@ -186,11 +294,11 @@ namespace octet { namespace containers {
         size_ = (int_size_t)new_length;
       } else if (new_length > capacity_) {
         if (trace) printf("case 2: growing dynarray beyond capacity_\n");
-        int_size_t new_capacity = ((int_size_t)new_length < size_ ? size_ : (int_size_t)new_length);
+        int_size_t new_capacity = (int_size_t)new_length;
 
         if (new_length == size_ + 1) {
           // growing array by 1: round up to power of two.
-          new_capacity = capacity_ == 0 ? min_capacity : capacity_ * 2;
+          new_capacity = capacity_ == 0 ? (int_size_t)min_capacity : capacity_ * 2;
           while (new_capacity < new_length) new_capacity *= 2;
         }
 
@@ -221,26 +329,10 @@ namespace octet { namespace containers {
 
     /// Reserve an amount of memory to use with this array.
     /// Use this before you start a loop with push_back calls, for example.
+    /// Does nothing if the capacity is already big enough.
     void reserve(int_size_t new_capacity) {
-      if (new_capacity >= size_) {
-        dynarray_dummy_t x;
-        item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
-      
-        if (use_new_delete) {
-          // initialize new data_ elements from old ones
-          for (int_size_t i = 0; i != size_; ++i) {
-            new (new_data + i, x) item_t(data_[i]);
-            data_[i].~item_t();
-          }
-        }
-
-        // free up data_
-        if (data_) {
-          allocator_t::free(data_, capacity_ * sizeof(item_t));
-        }
-
-        data_ = new_data;
-        capacity_ = new_capacity;
+      if (new_capacity > capacity_) {
+        reallocate(new_capacity);
       }
     }
 
@@ -248,6 +340,9 @@ namespace octet { namespace containers {
     void pop_back() {
       assert(size_ != 0);
       size_--;
+      if (use_new_delete) {
+        data_[size_].~item_t();
+      }
     }
 
     /// Reset the array to zero size, freeing up the data.
@@ -267,6 +362,11 @@ namespace octet { namespace containers {
     }
   };
 
+  /// dynarray only points to its heap memory, so it can be moved with memcpy.
+  template <class item_t, class allocator_t, bool use_new_delete> struct is_trivially_relocatable<dynarray<item_t, allocator_t, use_new_delete> > {
+    enum { value = 1 };
+  };
+
   inline void vformat(dynarray <char> &ary, const char *fmt, va_list v) {
     unsigned old_size = ary.size();
     #ifdef WIN32
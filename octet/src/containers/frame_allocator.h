@@ -0,0 +1,222 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// per-frame linear allocator for temporaries
+//
+
+namespace octet { namespace containers {
+  /// Linear (bump pointer) allocator for data that only lives for a frame or two.
+  ///
+  /// There are two arenas. end_frame() swaps them and resets the one used in the previous
+  /// frame, so data allocated in frame N is still valid until the end of frame N+1.
+  ///
+  /// Example
+  ///
+  ///     dynarray<mat4t, frame_allocator> temp;
+  ///     temp.reserve(num_nodes);
+  ///
+  /// free() only reclaims memory if it was the last block allocated, so reserve() arrays
+  /// before filling them. If an arena fills up, overflow blocks come from the allocator and
+  /// the arena is grown when it is next reset; once warm, no heap allocations are made.
+  ///
+  /// end_frame() is called by the app at the end of every frame.
+  /// This allocator is for the main thread only, and for per-frame update and render temporaries.
+  /// Load time work, such as building meshes, should use the default allocator: big overflows
+  /// are only freed at end_frame() and grow the arenas for good.
+  class frame_allocator {
+  public:
+    enum {
+      /// every block is aligned to at least this
+      alignment = 16,
+
+      /// size of each arena on first use
+      initial_size = 256 * 1024,
+
+      /// arenas do not grow beyond this; bigger frames use overflow blocks.
+      max_size = 16 * 1024 * 1024,
+    };
+
+  private:
+    // heap block used when an arena is full
+    struct overflow_t {
+      overflow_t *next;
+      size_t size;
+    };
+
+    enum { overflow_header = (sizeof(overflow_t) + alignment - 1) & ~(alignment - 1) };
+
+    struct arena_t {
+      uint8_t *base;
+      size_t capacity;
+      size_t used;
+      overflow_t *overflow;
+      size_t overflow_bytes;
+    };
+
+    // singleton state, zero initialised.
+    struct state_t {
+      arena_t arenas[2];
+      unsigned current;
+      unsigned frame_number;
+      size_t high_water;
+      size_t num_overflows;
+    };
+
+    static state_t &state() {
+      static state_t instance;
+      return instance;
+    }
+
+    static size_t round_up(size_t size) {
+      return (size + alignment - 1) & ~(size_t)(alignment - 1);
+    }
+
+    // free the overflow blocks and grow the arena to hold everything used last time.
+    static void reset_arena(arena_t &a) {
+      size_t wanted = a.used + a.overflow_bytes;
+      while (a.overflow) {
+        overflow_t *next = a.overflow->next;
+        allocator::free(a.overflow, a.overflow->size + overflow_header);
+        a.overflow = next;
+      }
+
+      if (a.overflow_bytes && a.capacity < max_size) {
+        size_t new_capacity = a.capacity ? a.capacity : (size_t)initial_size;
+        while (new_capacity < wanted && new_capacity < max_size) {
+          new_capacity *= 2;
+        }
+        if (new_capacity > max_size) new_capacity = max_size;
+        OCTET_ALLOC_TAG("frame_allocator");
+        allocator::free(a.base, a.capacity);
+        a.base = (uint8_t*)allocator::malloc(new_capacity);
+        a.capacity = new_capacity;
+      }
+
+      a.used = 0;
+      a.overflow_bytes = 0;
+    }
+
+  public:
+    /// allocate size bytes from the current frame.
+    static void *malloc(size_t size) {
+      state_t &s = state();
+      arena_t &a = s.arenas[s.current];
+      size = round_up(size);
+      if (a.used + size <= a.capacity) {
+        void *res = a.base + a.used;
+        a.used += size;
+        return res;
+      }
+
+      OCTET_ALLOC_TAG("frame_allocator");
+      if (!a.base) {
+        a.capacity = initial_size;
+        a.base = (uint8_t*)allocator::malloc(a.capacity);
+        if (size <= a.capacity) {
+          a.used = size;
+          return a.base;
+        }
+      }
+
+      overflow_t *o = (overflow_t*)allocator::malloc(size + overflow_header);
+      o->next = a.overflow;
+      o->size = size;
+      a.overflow = o;
+      a.overflow_bytes += size;
+      s.num_overflows++;
+      return (uint8_t*)o + overflow_header;
+    }
+
+    /// only the most recent block is reclaimed, everything else goes at end_frame().
+    static void free(void *ptr, size_t size) {
+      state_t &s = state();
+      arena_t &a = s.arenas[s.current];
+      size = round_up(size);
+      if ((uint8_t*)ptr + size == a.base + a.used) {
+        a.used -= size;
+      }
+    }
+
+    /// grow in place if this is the most recent block.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      state_t &s = state();
+      arena_t &a = s.arenas[s.current];
+      old_size = round_up(old_size);
+      if (ptr && (uint8_t*)ptr + old_size == a.base + a.used && a.used - old_size + round_up(size) <= a.capacity) {
+        a.used = a.used - old_size + round_up(size);
+        return ptr;
+      }
+      void *res = malloc(size);
+      if (ptr) {
+        memcpy(res, ptr, old_size < size ? old_size : size);
+        free(ptr, old_size);
+      }
+      return res;
+    }
+
+    /// current position in the frame, use with rewind() for scoped temporaries.
+    static size_t get_mark() {
+      state_t &s = state();
+      return s.arenas[s.current].used;
+    }
+
+    /// release everything allocated in the arena since get_mark().
+    static void rewind(size_t mark) {
+      state_t &s = state();
+      arena_t &a = s.arenas[s.current];
+      if (mark <= a.used) a.used = mark;
+    }
+
+    /// releases temporaries at the end of a block of code
+    ///
+    ///     {
+    ///       frame_allocator::scope temps;
+    ///       dynarray<int, frame_allocator> tmp;
+    ///       ...
+    ///     }
+    class scope {
+      size_t mark;
+      unsigned frame_number;
+    public:
+      scope() {
+        mark = get_mark();
+        frame_number = state().frame_number;
+      }
+
+      ~scope() {
+        // if the frame ended inside the scope, the arena has already been swapped.
+        if (frame_number == state().frame_number) rewind(mark);
+      }
+    };
+
+    /// call at the end of each frame to recycle the memory from the previous frame.
+    static void end_frame() {
+      state_t &s = state();
+      arena_t &a = s.arenas[s.current];
+      size_t total = a.used + a.overflow_bytes;
+      if (total > s.high_water) s.high_water = total;
+      s.current ^= 1;
+      s.frame_number++;
+      reset_arena(s.arenas[s.current]);
+    }
+
+    /// largest number of bytes used in one frame.
+    static size_t get_high_water() {
+      return state().high_water;
+    }
+
+    /// bytes used so far this frame.
+    static size_t get_frame_bytes() {
+      state_t &s = state();
+      return s.arenas[s.current].used + s.arenas[s.current].overflow_bytes;
+    }
+
+    /// total number of times an arena has overflowed to the heap.
+    static size_t get_num_overflows() {
+      return state().num_overflows;
+    }
+  };
+} }
@@ -13,13 +13,30 @@ namespace octet { namespace containers {
   /// A support class for hash_map that is used to implement different kinds of key.
   class hash_map_cmp {
   public:
-    // mix in some bits from higher positions to lower positions
-    static unsigned fuzz_hash(unsigned hash) { return hash ^ (hash >> 3) ^ (hash >> 5); }
+    // mix all the bits of the key into all the bits of the hash (murmur3 finaliser)
+    static unsigned fuzz_hash(unsigned hash) {
+      hash ^= hash >> 16;
+      hash *= 0x85ebca6b;
+      hash ^= hash >> 13;
+      hash *= 0xc2b2ae35;
+      hash ^= hash >> 16;
+      return hash;
+    }
+
+    // 64 bit version of the above, folded to 32 bits.
+    static unsigned fuzz_hash64(uint64_t hash) {
+      hash ^= hash >> 33;
+      hash *= 0xff51afd7ed558ccdull;
+      hash ^= hash >> 33;
+      hash *= 0xc4ceb9fe1a85ec53ull;
+      hash ^= hash >> 33;
+      return (unsigned)hash;
+    }
 
-    static unsigned get_hash(void *key) { return fuzz_hash((unsigned)(intptr_t)key); }
+    static unsigned get_hash(void *key) { return fuzz_hash64((uint64_t)(uintptr_t)key); }
     static unsigned get_hash(int key) { return fuzz_hash((unsigned)key); }
     static unsigned get_hash(unsigned key) { return fuzz_hash((unsigned)key); }
-    static unsigned get_hash(uint64_t key) { return fuzz_hash((unsigned)(key ^ (key >> 32))); }
+    static unsigned get_hash(uint64_t key) { return fuzz_hash64(key); }
 
     static bool is_empty(void *key) { return !key; }
     static bool is_empty(int key) { return !key; }
@@ -43,61 +60,155 @@ namespace octet { namespace containers {
   ///     printf("[5]=%d [9]=%d\n", int_to_int[5], int_to_int[9]);
   ///
   ///     for (unsigned i = 0; i != int_to_int.size(); ++i) {
-  ///       printf("key=d value=%d\n", int_to_int.get_key(i), int_to_int.get_value(i));
+  ///       if (int_to_int.is_used(i)) {
+  ///         printf("key=d value=%d\n", int_to_int.get_key(i), int_to_int.get_value(i));
+  ///       }
   ///     }
+  ///
+  /// Each slot has a control byte, kept in a separate array: 0x80 if the slot is empty,
+  /// otherwise the low seven bits of the hash. Lookups compare sixteen control bytes at a time
+  /// (with SSE2 if available) and only compare keys whose bits match.
+  ///
+  /// Collisions use linear probing and erase() shifts later entries back, so there are no tombstones.
+  /// Values are zero filled (not constructed) when a key is added, and unused slots have zero keys.
   template <typename key_t, typename value_t, class cmp_t=hash_map_cmp, class allocator_t=allocator> class hash_map {
     // internal gubbins to implement the hash map
     struct entry_t { key_t key; unsigned hash; value_t value; };
 
+    enum {
+      group_size = 16,
+      ctrl_empty = 0x80,
+      min_entries = 16,
+    };
+
     entry_t *entries;
+    uint8_t *ctrl;
     unsigned num_entries;
     unsigned max_entries;
 
-    // internal method to find an existing key in the map
-    entry_t *find( const key_t &key, unsigned hash ) {
+    // bytes used by entries and control bytes. The first group_size-1 control bytes
+    // are repeated at the end so that we can always read a whole group.
+    static size_t get_bytes(unsigned max_entries) {
+      return sizeof(entry_t) * max_entries + max_entries + group_size - 1;
+    }
+
+    static unsigned get_h1(unsigned hash) { return hash >> 7; }
+    static uint8_t get_h2(unsigned hash) { return (uint8_t)(hash & 0x7f); }
+
+    // bit n is set if group[n] == value
+    static unsigned match_byte(const uint8_t *group, uint8_t value) {
+      #if OCTET_SSE2
+        __m128i g = _mm_loadu_si128((const __m128i*)group);
+        return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)value)));
+      #else
+        unsigned result = 0;
+        for (unsigned i = 0; i != group_size; ++i) {
+          result |= (group[i] == value) << i;
+        }
+        return result;
+      #endif
+    }
+
+    static unsigned lowest_bit(unsigned bits) {
+      #if defined(_MSC_VER)
+        unsigned long result;
+        _BitScanForward(&result, bits);
+        return (unsigned)result;
+      #else
+        return (unsigned)__builtin_ctz(bits);
+      #endif
+    }
+
+    void set_ctrl(unsigned slot, uint8_t value) {
+      ctrl[slot] = value;
+      if (slot < group_size - 1) {
+        ctrl[max_entries + slot] = value;
+      }
+    }
+
+    // internal method to find an existing key in the map. returns -1 if not found.
+    int find(const key_t &key, unsigned hash) const {
       unsigned mask = max_entries - 1;
-      for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[ ( i + hash ) & mask ];
-        if (cmp_t::is_empty(entry->key)) {
-          return entry;
+      uint8_t h2 = get_h2(hash);
+      unsigned pos = get_h1(hash) & mask;
+      for (unsigned probed = 0; probed < max_entries; probed += group_size) {
+        const uint8_t *group = ctrl + pos;
+        for (unsigned bits = match_byte(group, h2); bits; bits &= bits - 1) {
+          unsigned slot = (pos + lowest_bit(bits)) & mask;
+          const entry_t &entry = entries[slot];
+          if (entry.hash == hash && entry.key == key) {
+            return (int)slot;
+          }
         }
-        if (entry->hash == hash && entry->key == key) {
-          return entry;
+        if (match_byte(group, ctrl_empty)) {
+          return -1;
         }
+        pos = (pos + group_size) & mask;
       }
-      assert(0 && "hash_map: all entries are used. expand() did not get called");
-      return 0;
+      return -1;
     }
-  
-    // increase the size of the map if we have run out of space
-    void expand() {
+
+    // first empty slot in the probe sequence for this hash.
+    unsigned find_empty(unsigned hash) const {
+      unsigned mask = max_entries - 1;
+      unsigned pos = get_h1(hash) & mask;
+      for (;;) {
+        unsigned bits = match_byte(ctrl + pos, ctrl_empty);
+        if (bits) {
+          return (pos + lowest_bit(bits)) & mask;
+        }
+        pos = (pos + group_size) & mask;
+      }
+    }
+
+    // zero a run of entries. keys and values are plain data, so this is all the construction they get.
+    static void clear_entries(entry_t *dest, unsigned num) {
+      dynarray_dummy_t x;
+      for (unsigned i = 0; i != num; ++i) {
+        new (dest + i, x) entry_t();
+      }
+    }
+
+    void allocate(unsigned new_max_entries) {
+      max_entries = new_max_entries;
+      entries = (entry_t*)allocator_t::malloc(get_bytes(max_entries));
+      ctrl = (uint8_t*)(entries + max_entries);
+      clear_entries(entries, max_entries);
+      memset(ctrl, ctrl_empty, max_entries + group_size - 1);
+    }
+
+    // move all the entries to a new table
+    void rehash(unsigned new_max_entries) {
       entry_t *old_entries = entries;
+      uint8_t *old_ctrl = ctrl;
       unsigned old_max_entries = max_entries;
-      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries*2);
-      memset(entries, 0, sizeof(entry_t) * max_entries*2);
-      max_entries *= 2;
+      allocate(new_max_entries);
       for (unsigned i = 0; i != old_max_entries; ++i) {
-        entry_t *old_entry = &old_entries[i];
-        if (!cmp_t::is_empty(old_entry->key)) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
-          *new_entry = *old_entry;
+        if (old_ctrl[i] != ctrl_empty) {
+          unsigned slot = find_empty(old_entries[i].hash);
+          set_ctrl(slot, old_ctrl[i]);
+          memcpy(&entries[slot], &old_entries[i], sizeof(entry_t));
         }
       }
-      allocator_t::free(old_entries, sizeof(entry_t) * old_max_entries);
+      allocator_t::free(old_entries, get_bytes(old_max_entries));
+    }
+
+    // increase the size of the map if we have run out of space
+    void expand() {
+      rehash(max_entries * 2);
     }
 
     void release() {
-      allocator_t::free(entries, sizeof(entry_t) * max_entries);
+      allocator_t::free(entries, get_bytes(max_entries));
       entries = 0;
+      ctrl = 0;
       num_entries = 0;
       max_entries = 0;
     }
 
     void init() {
       num_entries = 0;
-      max_entries = 4;
-      entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_entries);
-      memset(entries, 0, sizeof(entry_t) * max_entries);
+      allocate(min_entries);
     }
   public:
     // Create an empty map.
@@ -105,44 +216,87 @@ namespace octet { namespace containers {
       init();
     }
 
-    /// Remove all keys and values from the hash map.
+    /// Remove all keys and values from the hash map. Keeps the memory for reuse.
     void clear() {
-      release();
-      init();
+      num_entries = 0;
+      clear_entries(entries, max_entries);
+      memset(ctrl, ctrl_empty, max_entries + group_size - 1);
     }
-  
-    /// Access the map by key
+
+    /// Make space for num keys so that adding them does not resize the map.
+    void reserve(unsigned num) {
+      unsigned new_max_entries = max_entries;
+      while (num > new_max_entries - new_max_entries / 8) {
+        new_max_entries *= 2;
+      }
+      if (new_max_entries != max_entries) {
+        rehash(new_max_entries);
+      }
+    }
+
+    /// Access the map by key. Adds a zero value if the key is not there.
     value_t &operator[]( const key_t &key ) {
       unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      if (cmp_t::is_empty(entry->key)) {
-        // reducing this ratio decreases hot search time at the
-        // expense of size (cold search time).
-        if (num_entries >= max_entries * 3 / 4) {
-          expand();
-          entry = find(key, hash);
-        }
-        num_entries++;
-        entry->key = key;
-        entry->hash = hash;
+      int index = find( key, hash );
+      if (index >= 0) {
+        return entries[index].value;
       }
-      return entry->value;
+
+      // keep the load below 7/8, above this probe lengths grow quickly.
+      if (num_entries + 1 > max_entries - max_entries / 8) {
+        expand();
+      }
+
+      unsigned slot = find_empty(hash);
+      num_entries++;
+      set_ctrl(slot, get_h2(hash));
+      entry_t &entry = entries[slot];
+      entry.key = key;
+      entry.hash = hash;
+      dynarray_dummy_t x;
+      new (&entry.value, x) value_t();
+      return entry.value;
     }
 
     /// Does the map have this key?
-    bool contains(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return !cmp_t::is_empty(entry->key);
+    bool contains(const key_t &key) const {
+      return find(key, cmp_t::get_hash(key)) >= 0;
+    }
+
+    /// Remove a key and its value. Returns false if the key was not there.
+    bool erase(const key_t &key) {
+      int index = find(key, cmp_t::get_hash(key));
+      if (index < 0) return false;
+
+      // move later entries in the same run back into the gap, if their home slot allows.
+      unsigned mask = max_entries - 1;
+      unsigned hole = (unsigned)index;
+      for (unsigned slot = (hole + 1) & mask; ctrl[slot] != ctrl_empty; slot = (slot + 1) & mask) {
+        unsigned home = get_h1(entries[slot].hash) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+          memcpy(&entries[hole], &entries[slot], sizeof(entry_t));
+          set_ctrl(hole, ctrl[slot]);
+          hole = slot;
+        }
+      }
+
+      set_ctrl(hole, ctrl_empty);
+      clear_entries(&entries[hole], 1);
+      num_entries--;
+      return true;
     }
 
-    /// Get an integer that represents the position in the map of this key.
+    /// Get an integer that represents the position in the map of this key or -1 if it is not there.
     ///
-    /// Note: only valid if the map does not change size.
-    int get_index(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return entry ? (int)(entry - entries) : -1;
+    /// Note: only valid if the map does not change size or have keys erased.
+    int get_index(const key_t &key) const {
+      return find(key, cmp_t::get_hash(key));
+    }
+
+    /// Is there a key at this index?
+    bool is_used(int index) const {
+      assert((unsigned)index < max_entries);
+      return ctrl[index] != ctrl_empty;
     }
 
     /// For a specfic index, get the key.
@@ -159,19 +313,25 @@ namespace octet { namespace containers {
       return entries[index].value;
     }
 
+    /// For a specific index, get the value to modify
+    value_t &access_value(int index) {
+      assert((unsigned)index < max_entries);
+      return entries[index].value;
+    }
+
     /// bye bye hash map
     ~hash_map() {
-      allocator_t::free(entries, sizeof(entry_t) * max_entries);
-      entries = 0;
-      num_entries = 0;
-      max_entries = 0;
+      release();
     }
 
     /// Get the maximum number of keys and values in the map.
     ///
     /// Used for iteration.
-    unsigned size() { return max_entries; }
-    
+    unsigned size() const { return max_entries; }
+
+    /// Get the number of keys in the map.
+    unsigned get_num_entries() const { return num_entries; }
+
     //key_t key(unsigned i) { return entries[i].key; }
     //value_t value(unsigned i) { return entries[i].value; }
   };
@@ -10,6 +10,82 @@
 //
 
 namespace octet { namespace containers {
+  /// Reference count for objects used on one thread at a time.
+  class ref_count_plain {
+    int count;
+
+  public:
+    ref_count_plain() : count(0) {
+    }
+
+    /// add a reference.
+    void increment() {
+      count++;
+    }
+
+    /// add a reference only if there is one already. Returns false if the count was zero.
+    bool increment_if_live() {
+      if (count == 0) return false;
+      count++;
+      return true;
+    }
+
+    /// remove a reference. Returns true if this was the last one.
+    bool decrement() {
+      return --count == 0;
+    }
+
+    /// current number of references.
+    int get() const {
+      return count;
+    }
+  };
+
+  /// Reference count for objects shared between threads.
+  ///
+  /// Adding a reference needs no ordering as the caller already has one.
+  /// Removing one is acquire-release so that all the writes made through other references
+  /// are visible to the thread that deletes the object.
+  class ref_count_atomic {
+    std::atomic<int> count;
+
+  public:
+    ref_count_atomic() : count(0) {
+    }
+
+    /// add a reference.
+    void increment() {
+      count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// add a reference only if there is one already. Returns false if the count was zero.
+    bool increment_if_live() {
+      int old = count.load(std::memory_order_relaxed);
+      do {
+        if (old == 0) return false;
+      } while (!count.compare_exchange_weak(old, old + 1, std::memory_order_acquire, std::memory_order_relaxed));
+      return true;
+    }
+
+    /// remove a reference. Returns true if this was the last one.
+    bool decrement() {
+      return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    /// current number of references.
+    int get() const {
+      return count.load(std::memory_order_relaxed);
+    }
+  };
+
+  /// The count used by resources.
+  /// Build with -D OCTET_THREAD_SAFE_REFS=1 to share resources between threads.
+  #if OCTET_THREAD_SAFE_REFS
+    typedef ref_count_atomic ref_count_t;
+  #else
+    typedef ref_count_plain ref_count_t;
+  #endif
+
   /// The ref class is used to keep reference counter pointers to object.
   ///
   /// It should only be used as a data member in a class. Do not use ref as
@@ -46,6 +122,12 @@ namespace octet { namespace containers {
       if (item) item->add_ref();
     }
 
+    /// move constructor - takes the reference from rhs, no reference counting.
+    ref(ref &&rhs) {
+      item = rhs.item;
+      rhs.item = 0;
+    }
+
     /// initialize with new item - pointer then "owns" object
     ref(item_t *new_item) {
       if (new_item) new_item->add_ref();
@@ -61,6 +143,16 @@ namespace octet { namespace containers {
       return rhs;
     }
 
+    /// take the reference from rhs - frees any old object
+    ref &operator=(ref &&rhs) {
+      if (this != &rhs) {
+        if (item) item->release();
+        item = rhs.item;
+        rhs.item = 0;
+      }
+      return *this;
+    }
+
     /// replace item with new one - frees any old object
     item_t *operator=(item_t *new_item) {
       if (new_item) new_item->add_ref();
@@ -90,4 +182,9 @@ namespace octet { namespace containers {
       item = 0;
     }
   };
+
+  /// ref is only a pointer, so arrays of refs can be moved with memcpy.
+  template <class item_t, class allocator_t> struct is_trivially_relocatable<ref<item_t, allocator_t> > {
+    enum { value = 1 };
+  };
 } }
@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// slot map: dense array of items addressed by generational handles
+//
+
+namespace octet { namespace containers {
+  /// A handle to an item in a slot_map.
+  ///
+  /// The generation changes every time a slot is reused, so a handle
+  /// to an erased item never finds the item that replaced it.
+  /// The default handle is never valid.
+  struct slot_map_handle {
+    uint32_t index;
+    uint32_t generation;
+
+    slot_map_handle() : index(0), generation(0) {
+    }
+
+    slot_map_handle(uint32_t index, uint32_t generation) : index(index), generation(generation) {
+    }
+
+    /// true for a default handle. A handle that is not null may still be stale.
+    bool is_null() const { return generation == 0; }
+
+    bool operator==(const slot_map_handle &rhs) const { return index == rhs.index && generation == rhs.generation; }
+    bool operator!=(const slot_map_handle &rhs) const { return !(*this == rhs); }
+  };
+
+  /// Unordered collection with O(1) insert, erase and lookup by handle.
+  ///
+  /// Items are kept packed in one array, so iterating is as fast as for a dynarray.
+  /// Erasing an item moves the last item into its place; handles stay valid but
+  /// dense indices change.
+  ///
+  /// Example
+  ///
+  ///     slot_map<ref<mesh_instance> > instances;
+  ///     slot_map_handle h = instances.insert(mi);
+  ///     for (unsigned i = 0; i != instances.size(); ++i) {
+  ///       instances[i]->update(dt);
+  ///     }
+  ///     instances.erase(h);
+  ///     assert(instances.get(h) == 0); // stale handle
+  template <class item_t, class allocator_t=allocator> class slot_map {
+    struct slot_t {
+      // dense index if in use, next free slot otherwise.
+      uint32_t index;
+
+      // odd if in use. incremented on insert and erase.
+      uint32_t generation;
+    };
+
+    enum { no_slot = 0xffffffff };
+
+    // packed items and the slot that owns each of them.
+    dynarray<item_t, allocator_t> items;
+    dynarray<uint32_t, allocator_t> item_slots;
+
+    // indirection from handles to items.
+    dynarray<slot_t, allocator_t> slots;
+    uint32_t free_slot;
+
+    slot_t *find_slot(slot_map_handle handle) {
+      if (handle.index >= slots.size()) return 0;
+      slot_t &slot = slots[handle.index];
+      return slot.generation == handle.generation ? &slot : 0;
+    }
+
+    const slot_t *find_slot(slot_map_handle handle) const {
+      if (handle.index >= slots.size()) return 0;
+      const slot_t &slot = slots[handle.index];
+      return slot.generation == handle.generation ? &slot : 0;
+    }
+
+    // get a free slot and make it point at dense index.
+    slot_map_handle alloc_slot(uint32_t index) {
+      uint32_t slot_index = free_slot;
+      if (slot_index == no_slot) {
+        slot_t new_slot = { 0, 0 };
+        slot_index = slots.size();
+        slots.push_back(new_slot);
+      } else {
+        free_slot = slots[slot_index].index;
+      }
+      slot_t &slot = slots[slot_index];
+      slot.index = index;
+      slot.generation++;
+      return slot_map_handle(slot_index, slot.generation);
+    }
+
+  public:
+    /// make an empty slot map
+    slot_map() {
+      free_slot = no_slot;
+    }
+
+    /// Add an item and return its handle.
+    slot_map_handle insert(const item_t &item) {
+      slot_map_handle handle = alloc_slot(items.size());
+      items.push_back(item);
+      item_slots.push_back(handle.index);
+      return handle;
+    }
+
+    /// Construct an item in place and return its handle.
+    template <class... args_t> slot_map_handle emplace(args_t&&... args) {
+      slot_map_handle handle = alloc_slot(items.size());
+      items.emplace_back(std::forward<args_t>(args)...);
+      item_slots.push_back(handle.index);
+      return handle;
+    }
+
+    /// Remove an item. Returns false if the handle is stale.
+    /// The last item is moved into the gap.
+    bool erase(slot_map_handle handle) {
+      slot_t *slot = find_slot(handle);
+      if (!slot) return false;
+
+      uint32_t index = slot->index;
+      uint32_t last = items.size() - 1;
+      if (index != last) {
+        items[index] = std::move(items[last]);
+        item_slots[index] = item_slots[last];
+        slots[item_slots[index]].index = index;
+      }
+      items.pop_back();
+      item_slots.pop_back();
+
+      slot->generation++;
+      slot->index = free_slot;
+      free_slot = handle.index;
+      return true;
+    }
+
+    /// Get an item by handle, or null if the handle is stale.
+    item_t *get(slot_map_handle handle) {
+      slot_t *slot = find_slot(handle);
+      return slot ? &items[slot->index] : 0;
+    }
+
+    /// Get an item by handle, or null if the handle is stale.
+    const item_t *get(slot_map_handle handle) const {
+      const slot_t *slot = find_slot(handle);
+      return slot ? &items[slot->index] : 0;
+    }
+
+    /// Is this handle for an item that is still in the map?
+    bool contains(slot_map_handle handle) const {
+      return find_slot(handle) != 0;
+    }
+
+    /// Get the dense index of an item, or -1 if the handle is stale.
+    int get_index(slot_map_handle handle) const {
+      const slot_t *slot = find_slot(handle);
+      return slot ? (int)slot->index : -1;
+    }
+
+    /// Get the handle of the item at a dense index.
+    slot_map_handle get_handle(unsigned index) const {
+      uint32_t slot_index = item_slots[index];
+      return slot_map_handle(slot_index, slots[slot_index].generation);
+    }
+
+    /// Number of items.
+    unsigned size() const { return items.size(); }
+
+    /// Access an item by dense index (0..size()-1) for iteration.
+    item_t &operator[](unsigned index) { return items[index]; }
+
+    /// Read an item by dense index (0..size()-1) for iteration.
+    const item_t &operator[](unsigned index) const { return items[index]; }
+
+    /// Pointer to the packed items.
+    item_t *data() { return items.data(); }
+
+    /// Make space for num items.
+    void reserve(unsigned num) {
+      items.reserve(num);
+      item_slots.reserve(num);
+      slots.reserve(num);
+    }
+
+    /// Remove all the items. Old handles stay stale.
+    void clear() {
+      for (unsigned i = items.size(); i != 0; --i) {
+        erase(get_handle(i - 1));
+      }
+    }
+
+    /// Remove all the items and free the memory.
+    /// Note: old handles may be valid again after this.
+    void reset() {
+      items.reset();
+      item_slots.reset();
+      slots.reset();
+      free_slot = no_slot;
+    }
+  };
+} }
@@ -0,0 +1,249 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// dynamic array with space for a few items inside the object
+//
+
+namespace octet { namespace containers {
+  /// Dynamic array that holds up to inline_capacity items without allocating.
+  ///
+  /// Use this for arrays that are usually tiny, such as the children of a scene node.
+  /// When the array grows beyond inline_capacity, the items move to the heap like a dynarray.
+  ///
+  /// Example
+  ///
+  ///     small_dynarray<ref<scene_node>, 4> children;
+  ///     children.push_back(node);  // no allocation
+  ///
+  /// Note: unlike dynarray, moving a small_dynarray moves the inline items one at a time.
+  template <class item_t, unsigned inline_capacity, class allocator_t=allocator> class small_dynarray {
+    typedef unsigned int_size_t;
+
+    item_t *data_;
+    int_size_t size_;
+    int_size_t capacity_;
+    typename std::aligned_storage<sizeof(item_t) * inline_capacity, std::alignment_of<item_t>::value>::type storage_;
+
+    enum { relocatable = is_trivially_relocatable<item_t>::value };
+
+    item_t *inline_data() { return (item_t*)&storage_; }
+
+    bool is_inline() const { return data_ == (const item_t*)&storage_; }
+
+    // move count items from src to uninitialised dest
+    static void relocate(item_t *dest, item_t *src, int_size_t count) {
+      if (relocatable) {
+        memcpy((void*)dest, (void*)src, count * sizeof(item_t));
+      } else {
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != count; ++i) {
+          new (dest + i, x) item_t(std::move(src[i]));
+          src[i].~item_t();
+        }
+      }
+    }
+
+    // move the items to a new heap block of size new_capacity.
+    void reallocate(int_size_t new_capacity) {
+      if (relocatable && !is_inline()) {
+        data_ = (item_t *)allocator_t::realloc(data_, capacity_ * sizeof(item_t), new_capacity * sizeof(item_t));
+      } else {
+        item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
+        relocate(new_data, data_, size_);
+        free_data();
+        data_ = new_data;
+      }
+      capacity_ = new_capacity;
+    }
+
+    void free_data() {
+      if (!is_inline()) {
+        allocator_t::free(data_, capacity_ * sizeof(item_t));
+      }
+    }
+
+    void init() {
+      data_ = inline_data();
+      size_ = 0;
+      capacity_ = inline_capacity;
+    }
+
+    // take the items from rhs, leaving it empty
+    void take(small_dynarray &rhs) {
+      if (rhs.is_inline()) {
+        init();
+        relocate(data_, rhs.data_, rhs.size_);
+        size_ = rhs.size_;
+      } else {
+        data_ = rhs.data_;
+        size_ = rhs.size_;
+        capacity_ = rhs.capacity_;
+      }
+      rhs.init();
+    }
+
+  public:
+    /// Create a new, empty array.
+    small_dynarray() {
+      init();
+    }
+
+    /// Create a copy of an array.
+    small_dynarray(const small_dynarray &rhs) {
+      init();
+      reserve(rhs.size_);
+      dynarray_dummy_t x;
+      for (int_size_t i = 0; i != rhs.size_; ++i) {
+        new (data_ + i, x) item_t(rhs.data_[i]);
+      }
+      size_ = rhs.size_;
+    }
+
+    /// Take the contents of another array, leaving it empty.
+    small_dynarray(small_dynarray &&rhs) {
+      take(rhs);
+    }
+
+    /// Replace the contents with a copy of another array.
+    small_dynarray &operator=(const small_dynarray &rhs) {
+      if (this != &rhs) {
+        small_dynarray tmp(rhs);
+        reset();
+        take(tmp);
+      }
+      return *this;
+    }
+
+    /// Replace the contents with those of another array, leaving it empty.
+    small_dynarray &operator=(small_dynarray &&rhs) {
+      if (this != &rhs) {
+        reset();
+        take(rhs);
+      }
+      return *this;
+    }
+
+    /// Destroy the array and its contents.
+    ~small_dynarray() {
+      reset();
+    }
+
+    /// start of the items, for range based for loops.
+    item_t *begin() { return data_; }
+
+    /// end of the items, for range based for loops.
+    item_t *end() { return data_ + size_; }
+
+    /// Add an item at the back of the array.
+    void push_back(const item_t &new_item) {
+      emplace_back(new_item);
+    }
+
+    /// Move an item to the back of the array.
+    void push_back(item_t &&new_item) {
+      emplace_back(std::move(new_item));
+    }
+
+    /// Construct an item at the back of the array from the arguments.
+    template <class... args_t> item_t &emplace_back(args_t&&... args) {
+      dynarray_dummy_t x;
+      if (size_ == capacity_) {
+        // the arguments may refer to items in this array, so construct first.
+        item_t tmp(std::forward<args_t>(args)...);
+        reallocate(capacity_ * 2);
+        new (data_ + size_, x) item_t(std::move(tmp));
+      } else {
+        new (data_ + size_, x) item_t(std::forward<args_t>(args)...);
+      }
+      return data_[size_++];
+    }
+
+    /// Erase an item; move subsequent items down to fill the gap.
+    void erase(unsigned elem) {
+      assert(elem < size_);
+      if (relocatable) {
+        data_[elem].~item_t();
+        memmove((void*)(data_ + elem), (void*)(data_ + elem + 1), (size_ - elem - 1) * sizeof(item_t));
+      } else {
+        for (int_size_t i = elem; i < size_-1; ++i) {
+          data_[i] = std::move(data_[i+1]);
+        }
+        data_[size_-1].~item_t();
+      }
+      size_--;
+    }
+
+    /// Shrink the size of the array by one.
+    void pop_back() {
+      assert(size_ != 0);
+      size_--;
+      data_[size_].~item_t();
+    }
+
+    /// Get the last element in the array.
+    item_t &back() const {
+      assert(size_);
+      return data_[size_-1];
+    }
+
+    /// Return true if the array is empty.
+    bool empty() const {
+      return size_ == 0;
+    }
+
+    /// Access an element in the array.
+    item_t &operator[](size_t elem) { return data_[elem]; }
+
+    /// Read an element in the array.
+    const item_t &operator[](size_t elem) const { return data_[elem]; }
+
+    /// Return number of elements in the array
+    int_size_t size() const { return size_; }
+
+    /// Return the number of elements in the array before we have to reallocate the memory
+    int_size_t capacity() const { return capacity_; }
+
+    /// Get a constant pointer to the first element of the array.
+    const item_t *data() const { return data_; }
+
+    /// Get a pointer to the first element of the array.
+    item_t *data() { return data_; }
+
+    /// Resize the array, default constructing new items.
+    void resize(size_t new_length) {
+      dynarray_dummy_t x;
+      if (new_length > capacity_) {
+        int_size_t new_capacity = capacity_ * 2;
+        while (new_capacity < new_length) new_capacity *= 2;
+        reallocate(new_capacity);
+      }
+      while (size_ < new_length) {
+        new (data_ + size_, x) item_t;
+        size_++;
+      }
+      while (size_ > new_length) {
+        size_--;
+        data_[size_].~item_t();
+      }
+    }
+
+    /// Make sure there is space for new_capacity items.
+    void reserve(int_size_t new_capacity) {
+      if (new_capacity > capacity_) {
+        reallocate(new_capacity);
+      }
+    }
+
+    /// Reset the array to zero size, freeing any heap memory.
+    void reset() {
+      for (int_size_t i = 0; i != size_; ++i) {
+        data_[i].~item_t();
+      }
+      free_data();
+      init();
+    }
+  };
+} }
@@ -0,0 +1,1349 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+namespace octet {
+  /// Timings for the containers and scene systems.
+  /// Results go to stdout and log.txt.
+  ///
+  /// build with -D OCTET_SYSTEM_ALLOCATOR=1 to get the baseline numbers for the allocator tests.
+  class example_benchmark : public app {
+    // scene for drawing box
+    ref<visual_scene> app_scene;
+
+    // run fn and return the time taken in milliseconds
+    template <class fn_t> static double time_ms(fn_t fn) {
+      std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+      fn();
+      std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+      return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    static void report(const char *name, double ms) {
+      printf("%-40s %10.3f ms\n", name, ms);
+      log("%-40s %10.3f ms\n", name, ms);
+    }
+
+    // small random numbers, the same on every platform.
+    static unsigned next_random(unsigned &seed) {
+      seed = seed * 1664525 + 1013904223;
+      return seed >> 8;
+    }
+
+    // a mix of mostly small allocations with a random working set, like a scene load.
+    template <class malloc_t, class free_t> static void alloc_mix(malloc_t do_malloc, free_t do_free, unsigned num_ops) {
+      enum { num_slots = 4096 };
+      void *ptrs[num_slots];
+      unsigned sizes[num_slots];
+      memset(ptrs, 0, sizeof(ptrs));
+      unsigned seed = 0x1234;
+      for (unsigned i = 0; i != num_ops; ++i) {
+        unsigned r = next_random(seed);
+        unsigned slot = r % num_slots;
+        if (ptrs[slot]) {
+          do_free(ptrs[slot], sizes[slot]);
+          ptrs[slot] = 0;
+        } else {
+          // 1 in 16 is large
+          unsigned size = (r >> 12) & 15 ? 8 + (r >> 16) % 248 : 1024 + (r >> 16) % 4096;
+          ptrs[slot] = do_malloc(size);
+          sizes[slot] = size;
+          memset(ptrs[slot], 0, 8);
+        }
+      }
+      for (unsigned slot = 0; slot != num_slots; ++slot) {
+        if (ptrs[slot]) do_free(ptrs[slot], sizes[slot]);
+      }
+    }
+
+    static void *pool_malloc(size_t size) { return allocator::malloc(size); }
+    static void pool_free(void *ptr, size_t size) { allocator::free(ptr, size); }
+    static void *crt_malloc(size_t size) { return ::malloc(size); }
+    static void crt_free(void *ptr, size_t) { ::free(ptr); }
+
+    static void alloc_threads(bool use_pool, unsigned num_threads, unsigned num_ops) {
+      std::vector<std::thread> threads;
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads.push_back(std::thread([=]() {
+          if (use_pool) {
+            alloc_mix(pool_malloc, pool_free, num_ops);
+            allocator::flush_thread_cache();
+          } else {
+            alloc_mix(crt_malloc, crt_free, num_ops);
+          }
+        }));
+      }
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i].join();
+      }
+    }
+
+    void allocator_benchmarks() {
+      const unsigned num_ops = 2000000;
+      report("alloc mix: allocator", time_ms([=]() { alloc_mix(pool_malloc, pool_free, num_ops); }));
+      report("alloc mix: ::malloc", time_ms([=]() { alloc_mix(crt_malloc, crt_free, num_ops); }));
+      report("alloc mix x4 threads: allocator", time_ms([=]() { alloc_threads(true, 4, num_ops); }));
+      report("alloc mix x4 threads: ::malloc", time_ms([=]() { alloc_threads(false, 4, num_ops); }));
+
+      // these use the allocator through the containers, so compare with an OCTET_SYSTEM_ALLOCATOR build.
+      report("collada load x10 (duck)", time_ms([]() {
+        for (int i = 0; i != 10; ++i) {
+          collada_builder loader;
+          if (!loader.load_xml("assets/duck_triangulate.dae")) return;
+          resource_dict dict;
+          loader.get_resources(dict);
+        }
+      }));
+
+      ref<mesh> msh = new mesh_box(vec3(1));
+      ref<material> mat = new material(vec4(1, 0, 0, 1));
+      report("mesh_instance churn 10k x20", time_ms([&]() {
+        for (int i = 0; i != 20; ++i) {
+          dynarray<ref<mesh_instance> > instances;
+          for (int j = 0; j != 10000; ++j) {
+            instances.push_back(new mesh_instance(new scene_node(), msh, mat));
+          }
+        }
+      }));
+
+      printf("allocator bytes in use %d, reserved %d\n", (int)allocator::get_num_bytes(), (int)allocator::get_num_reserved());
+    }
+
+    // build small temporary arrays, as a culling or sorting pass would.
+    template <class allocator_t> static void temp_arrays(unsigned num_frames) {
+      unsigned seed = 0x5678;
+      for (unsigned frame = 0; frame != num_frames; ++frame) {
+        for (unsigned pass = 0; pass != 256; ++pass) {
+          dynarray<unsigned, allocator_t> keys;
+          keys.reserve(100);
+          for (unsigned i = 0; i != 100; ++i) {
+            keys.push_back(next_random(seed));
+          }
+        }
+        frame_allocator::end_frame();
+      }
+    }
+
+    void frame_allocator_benchmarks() {
+      report("temp arrays 1000 frames: allocator", time_ms([]() { temp_arrays<allocator>(1000); }));
+      report("temp arrays 1000 frames: frame_allocator", time_ms([]() { temp_arrays<frame_allocator>(1000); }));
+      printf("frame_allocator high water %d, overflows %d\n", (int)frame_allocator::get_high_water(), (int)frame_allocator::get_num_overflows());
+    }
+
+    // the hash_map before the control byte version, for comparison.
+    template <typename key_t, typename value_t, class cmp_t> class legacy_hash_map {
+      struct entry_t { key_t key; unsigned hash; value_t value; };
+      entry_t *entries;
+      unsigned num_entries;
+      unsigned max_entries;
+
+      entry_t *find(const key_t &key, unsigned hash) {
+        unsigned mask = max_entries - 1;
+        for (unsigned i = 0; i != max_entries; ++i) {
+          entry_t *entry = &entries[(i + hash) & mask];
+          if (cmp_t::is_empty(entry->key) || (entry->hash == hash && entry->key == key)) {
+            return entry;
+          }
+        }
+        return 0;
+      }
+
+      void expand() {
+        entry_t *old_entries = entries;
+        unsigned old_max_entries = max_entries;
+        max_entries *= 2;
+        entries = (entry_t *)allocator::malloc(sizeof(entry_t) * max_entries);
+        memset(entries, 0, sizeof(entry_t) * max_entries);
+        for (unsigned i = 0; i != old_max_entries; ++i) {
+          if (!cmp_t::is_empty(old_entries[i].key)) {
+            *find(old_entries[i].key, old_entries[i].hash) = old_entries[i];
+          }
+        }
+        allocator::free(old_entries, sizeof(entry_t) * old_max_entries);
+      }
+    public:
+      legacy_hash_map() {
+        num_entries = 0;
+        max_entries = 4;
+        entries = (entry_t*)allocator::malloc(sizeof(entry_t) * max_entries);
+        memset(entries, 0, sizeof(entry_t) * max_entries);
+      }
+
+      ~legacy_hash_map() {
+        allocator::free(entries, sizeof(entry_t) * max_entries);
+      }
+
+      value_t &operator[](const key_t &key) {
+        unsigned hash = cmp_t::get_hash(key);
+        entry_t *entry = find(key, hash);
+        if (cmp_t::is_empty(entry->key)) {
+          if (num_entries >= max_entries * 3 / 4) {
+            expand();
+            entry = find(key, hash);
+          }
+          num_entries++;
+          entry->key = key;
+          entry->hash = hash;
+        }
+        return entry->value;
+      }
+    };
+
+    // position, normal, uv as in a typical unindexed mesh.
+    struct bench_vertex {
+      const float *values;
+
+      bool operator==(const bench_vertex &rhs) const { return memcmp(values, rhs.values, sizeof(float) * 8) == 0; }
+    };
+
+    // same hash function as mesh::general_vertex
+    struct bench_vertex_cmp : hash_map_cmp {
+      static unsigned get_hash(const bench_vertex &key) {
+        const uint8_t *bytes = (const uint8_t *)key.values;
+        unsigned hash = 0;
+        for (unsigned i = 0; i != sizeof(float) * 8; ++i) {
+          hash = (hash * 7) + (hash >> 13) + bytes[i];
+        }
+        return fuzz_hash(hash);
+      }
+      static bool is_empty(const bench_vertex &key) { return key.values == 0; }
+    };
+
+    // old fuzz_hash for the legacy map
+    struct legacy_vertex_cmp : bench_vertex_cmp {
+      static unsigned get_hash(const bench_vertex &key) {
+        unsigned hash = bench_vertex_cmp::get_hash(key);
+        return hash ^ (hash >> 3) ^ (hash >> 5);
+      }
+    };
+
+    // build an index buffer for an unindexed vertex buffer, as mesh::reindex does.
+    template <class map_t> static unsigned reindex(const dynarray<float> &vertices, dynarray<unsigned> &indices) {
+      map_t vertex_to_index;
+      unsigned num_vertices = vertices.size() / 8;
+      unsigned num_unique = 0;
+      indices.resize(num_vertices);
+      for (unsigned i = 0; i != num_vertices; ++i) {
+        bench_vertex v = { &vertices[i * 8] };
+        unsigned &index = vertex_to_index[v];
+        if (index == 0) index = ++num_unique;
+        indices[i] = index - 1;
+      }
+      return num_unique;
+    }
+
+    void hash_map_benchmarks() {
+      // a 1M vertex triangle soup: a grid of quads, two triangles each, before indexing.
+      const unsigned grid = 408;
+      const unsigned num_vertices = grid * grid * 6;
+      dynarray<float> vertices(num_vertices * 8);
+      static const unsigned corners[6][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1} };
+      for (unsigned i = 0; i != num_vertices; ++i) {
+        unsigned quad = i / 6;
+        float x = (float)(quad % grid + corners[i % 6][0]);
+        float z = (float)(quad / grid + corners[i % 6][1]);
+        float v[8] = { x, x * z * 0.001f, z, 0, 1, 0, x / grid, z / grid };
+        memcpy(&vertices[i * 8], v, sizeof(v));
+      }
+
+      dynarray<unsigned> indices;
+      unsigned num_unique = 0;
+      report("reindex 1M vertices: legacy hash_map", time_ms([&]() {
+        num_unique = reindex<legacy_hash_map<bench_vertex, unsigned, legacy_vertex_cmp> >(vertices, indices);
+      }));
+      report("reindex 1M vertices: hash_map", time_ms([&]() {
+        num_unique = reindex<hash_map<bench_vertex, unsigned, bench_vertex_cmp> >(vertices, indices);
+      }));
+      printf("%d unique vertices\n", num_unique);
+
+      // insert and erase with a steady working set, as a cache of resources would.
+      report("hash_map insert/erase 4M", time_ms([]() {
+        hash_map<unsigned, unsigned> map;
+        unsigned seed = 0x1357;
+        for (unsigned i = 0; i != 4000000; ++i) {
+          unsigned key = next_random(seed) % 65536 + 1;
+          if (!map.erase(key)) map[key] = i;
+        }
+      }));
+    }
+
+    void dictionary_benchmarks() {
+      // names like the ones in a COLLADA file
+      const unsigned num_keys = 100000;
+      dynarray<char> names(num_keys * 32);
+      for (unsigned i = 0; i != num_keys; ++i) {
+        sprintf(&names[i * 32], "node_%d_mesh", i * 7919);
+      }
+
+      report("dictionary 100k keys, 1M lookups", time_ms([&]() {
+        dictionary<int> dict;
+        for (unsigned i = 0; i != num_keys; ++i) {
+          dict[&names[i * 32]] = i;
+        }
+        unsigned found = 0;
+        for (unsigned j = 0; j != 10; ++j) {
+          for (unsigned i = 0; i != num_keys; ++i) {
+            found += dict.get_index(&names[i * 32]) >= 0;
+          }
+        }
+        if (found != num_keys * 10) printf("dictionary: lookup failed\n");
+      }));
+
+      report("dictionary 100k keys bulk build", time_ms([&]() {
+        dictionary<int> dict;
+        dict.begin_bulk(num_keys);
+        for (unsigned i = 0; i != num_keys; ++i) {
+          dict.add_bulk(&names[i * 32], i);
+        }
+        dict.end_bulk();
+      }));
+
+      report("get_atom 1M", time_ms([&]() {
+        for (unsigned i = 0; i != 1000000; ++i) {
+          app_utils::get_atom(&names[(i % 1000) * 32]);
+        }
+      }));
+    }
+
+    void dynarray_benchmarks() {
+      ref<mesh> msh = new mesh();
+      report("dynarray<ref<mesh>> push_back 10M", time_ms([&]() {
+        for (int i = 0; i != 10; ++i) {
+          dynarray<ref<mesh> > refs;
+          for (int j = 0; j != 1000000; ++j) {
+            refs.push_back(msh);
+          }
+        }
+      }));
+
+      report("dynarray<dynarray<int>> push_back 100k", time_ms([]() {
+        dynarray<dynarray<int> > rows;
+        dynarray<int> row;
+        for (int i = 0; i != 100; ++i) {
+          row.push_back(i);
+        }
+        for (int i = 0; i != 100000; ++i) {
+          rows.push_back(row);
+        }
+      }));
+
+      report("scene_node add_child 100k x4", time_ms([]() {
+        ref<scene_node> root = new scene_node();
+        for (int i = 0; i != 100000; ++i) {
+          scene_node *node = new scene_node();
+          root->add_child(node);
+          for (int j = 0; j != 4; ++j) {
+            node->add_child(new scene_node());
+          }
+        }
+      }));
+    }
+
+    // object with a choice of reference count, to compare the policies.
+    template <class count_t> struct counted {
+      count_t count;
+      void add_ref() { count.increment(); }
+      void release() { if (count.decrement()) delete this; }
+    };
+
+    // fill an array with refs to obj and empty it again, num_ops add_ref/release pairs.
+    template <class count_t> static void ref_copies(counted<count_t> *obj, unsigned num_ops) {
+      ref<counted<count_t> > keep = obj;
+      dynarray<ref<counted<count_t> > > refs;
+      refs.reserve(1000);
+      for (unsigned i = 0; i != num_ops; i += 1000) {
+        for (unsigned j = 0; j != 1000; ++j) {
+          refs.push_back(keep);
+        }
+        refs.resize(0);
+      }
+    }
+
+    // num_threads threads, each with its own object or all sharing one.
+    template <class count_t> static void ref_threads(bool shared, unsigned num_threads, unsigned num_ops) {
+      ref<counted<count_t> > shared_obj = new counted<count_t>();
+      std::vector<std::thread> threads;
+      for (unsigned i = 0; i != num_threads; ++i) {
+        counted<count_t> *obj = shared ? (counted<count_t>*)shared_obj : new counted<count_t>();
+        threads.push_back(std::thread([=]() {
+          ref_copies(obj, num_ops);
+        }));
+      }
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i].join();
+      }
+    }
+
+    void ref_count_benchmarks() {
+      const unsigned num_ops = 10000000;
+      report("ref add/release 10M: plain", time_ms([=]() { ref_copies(new counted<ref_count_plain>(), num_ops); }));
+      report("ref add/release 10M: atomic", time_ms([=]() { ref_copies(new counted<ref_count_atomic>(), num_ops); }));
+      report("ref add/release 10M x4 own: plain", time_ms([=]() { ref_threads<ref_count_plain>(false, 4, num_ops); }));
+      report("ref add/release 10M x4 own: atomic", time_ms([=]() { ref_threads<ref_count_atomic>(false, 4, num_ops); }));
+      report("ref add/release 10M x4 shared: atomic", time_ms([=]() { ref_threads<ref_count_atomic>(true, 4, num_ops); }));
+
+      ref<mesh> msh = new mesh();
+      weak_ref<mesh> weak = msh;
+      report("weak_ref lock 1M", time_ms([&]() {
+        for (unsigned i = 0; i != 1000000; ++i) {
+          ref<mesh> strong = weak.lock();
+        }
+      }));
+    }
+
+    // the scene_node world matrix before it was cached: walk the parents every time.
+    static mat4t legacy_model_to_world(scene_node *node) {
+      mat4t result = node->get_nodeToParent();
+      for (scene_node *p = node->get_parent(); p != NULL; p = p->get_parent()) {
+        result = result * p->get_nodeToParent();
+      }
+      return result;
+    }
+
+    // move the top of each chain and read every world matrix, as render and culling do.
+    template <bool cached> static float world_matrix_frames(scene_node *root, dynarray<scene_node*> &nodes, unsigned num_frames) {
+      float sum = 0;
+      for (unsigned frame = 0; frame != num_frames; ++frame) {
+        for (int i = 0; i != root->get_num_children(); ++i) {
+          root->get_child(i)->rotate(1, vec3(0, 1, 0));
+        }
+        if (cached) root->update_world();
+        for (unsigned i = 0; i != nodes.size(); ++i) {
+          mat4t m = cached ? nodes[i]->calcModelToWorld() : legacy_model_to_world(nodes[i]);
+          sum += m[3][0];
+        }
+      }
+      return sum;
+    }
+
+    void scene_benchmarks() {
+      // 10k nodes in chains 16 deep, like skeletons or vehicles with many parts.
+      ref<scene_node> root = new scene_node();
+      dynarray<scene_node*> nodes;
+      for (unsigned i = 0; i != 625; ++i) {
+        scene_node *parent = root;
+        for (unsigned j = 0; j != 16; ++j) {
+          scene_node *node = new scene_node(parent);
+          node->translate(vec3(1, 0, 0));
+          nodes.push_back(node);
+          parent = node;
+        }
+      }
+      float walk_sum = 0, cache_sum = 0;
+      report("world matrices 10k depth 16 x100: walk", time_ms([&]() { walk_sum = world_matrix_frames<false>(root, nodes, 100); }));
+      report("world matrices 10k depth 16 x100: cache", time_ms([&]() { cache_sum = world_matrix_frames<true>(root, nodes, 100); }));
+      log("world matrix checksums %f %f\n", walk_sum, cache_sum);
+
+      // a crowd: 1000 characters with 100 animated bones each, 5 children per bone.
+      ref<scene_node> crowd = new scene_node();
+      dynarray<scene_node*> bones;
+      for (unsigned i = 0; i != 1000; ++i) {
+        unsigned first = bones.size();
+        bones.push_back(new scene_node(crowd));
+        for (unsigned j = 1; j != 100; ++j) {
+          bones.push_back(new scene_node(bones[first + (j - 1) / 5]));
+        }
+      }
+
+      report("crowd 100k bones x10: walk", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          for (unsigned i = 0; i != bones.size(); ++i) {
+            bones[i]->access_nodeToParent().w() = vec4(1, frame * 0.01f, 0, 1);
+          }
+          crowd->update_world();
+        }
+      }));
+
+      transform_system transforms;
+      transforms.build(crowd);
+      report("crowd 100k bones x10: transform_system", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          for (unsigned i = 0; i != bones.size(); ++i) {
+            bones[i]->access_nodeToParent().w() = vec4(1, frame * 0.01f, 0, 1);
+          }
+          transforms.update();
+        }
+      }));
+
+      report("crowd 100k bones x10: locals only", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          for (unsigned i = 1; i != transforms.size(); ++i) {
+            transforms.access_local(i).w() = vec4(1, frame * 0.01f, 0, 1);
+          }
+          transforms.update(false, false);
+        }
+      }));
+      printf("(transform_system: %u threads, %u levels)\n", platform::thread_pool::get_default().get_num_threads(), transforms.get_num_levels());
+
+      // a large outdoor level: 50k boxes all around the camera, most of them off screen.
+      {
+        ref<visual_scene> scene = new visual_scene();
+        scene->create_default_camera_and_lights();
+        camera_instance *cam = scene->get_camera_instance(0);
+        cam->get_node()->loadIdentity();
+        cam->set_perspective(0, 45, 1, 0.5f, 1000);
+        ref<mesh> box = new mesh_box(vec3(1));
+        ref<material> red = new material(vec4(1, 0, 0, 1));
+        unsigned seed = 0x1357;
+        for (unsigned i = 0; i != 50000; ++i) {
+          scene_node *node = new scene_node(scene);
+          float x = (next_random(seed) % 2000) * 0.5f - 500.0f;
+          float y = (next_random(seed) % 200) * 0.5f - 50.0f;
+          float z = (next_random(seed) % 2000) * 0.5f - 500.0f;
+          node->translate(vec3(x, y, z));
+          scene->add_mesh_instance(new mesh_instance(node, box, red));
+        }
+        scene->begin_render(256, 256);
+        scene->update(0);
+        for (unsigned culling = 0; culling != 2; ++culling) {
+          scene->set_frustum_culling(culling != 0);
+          double ms = time_ms([&]() {
+            for (unsigned frame = 0; frame != 4; ++frame) {
+              scene->render(1.0f);
+            }
+            glFinish();
+          });
+          report(culling ? "render 50k instances x4: culled" : "render 50k instances x4: all", ms);
+        }
+        const visual_scene::cull_stats &stats = scene->get_cull_stats();
+        printf("(culling: %u tested, %u visible, %u culled)\n", stats.num_tested, stats.num_visible, stats.num_culled);
+      }
+
+      // spawn and despawn with 10k live instances, as a particle or bullet heavy level would.
+      ref<mesh> msh = new mesh_box(vec3(1));
+      ref<material> mat = new material(vec4(1, 0, 0, 1));
+      report("visual_scene spawn/delete 100k", time_ms([&]() {
+        ref<visual_scene> scene = new visual_scene();
+        dynarray<mesh_instance*> live;
+        unsigned seed = 0x2468;
+        for (unsigned i = 0; i != 100000; ++i) {
+          if (live.size() == 10000) {
+            unsigned index = next_random(seed) % live.size();
+            scene->delete_mesh_instance(live[index]);
+            live[index] = live.back();
+            live.pop_back();
+          }
+          live.push_back(scene->add_mesh_instance(new mesh_instance(new scene_node(), msh, mat)));
+        }
+      }));
+    }
+
+    // the nearest hit the way cast_ray used to find it: test every instance.
+    static mesh_instance *linear_cast_ray(visual_scene *scene, const ray &the_ray, float &depth) {
+      mesh_instance *result = 0;
+      depth = 2.0f;
+      for (int i = 0; i != scene->get_num_mesh_instances(); ++i) {
+        mesh_instance *mi = scene->get_mesh_instance(i);
+        const mat4t &nodeToWorld = mi->get_node()->calcModelToWorld();
+        if (!the_ray.intersects(mi->get_mesh()->get_aabb().get_transform(nodeToWorld))) continue;
+        ray model_ray = the_ray.get_transform(nodeToWorld.inverse3x4());
+        int indices[3] = {0};
+        vec4 bary_numer(0, 0, 0, 0);
+        float bary_denom;
+        if (mi->get_mesh()->ray_cast(model_ray, indices, bary_numer, bary_denom)) {
+          float t = bary_numer.w() / bary_denom;
+          if (t <= 1.0f && t < depth) {
+            depth = t;
+            result = mi;
+          }
+        }
+      }
+      return result;
+    }
+
+    void scene_query_benchmarks() {
+      ref<mesh> box = new mesh_box(vec3(1));
+      ref<material> red = new material(vec4(1, 0, 0, 1));
+      for (unsigned num_instances = 1000; num_instances <= 100000; num_instances *= 10) {
+        // same density at every size: about one box per 1000 cubic units.
+        ref<visual_scene> scene = new visual_scene();
+        float size = powf(num_instances * 1000.0f, 1.0f / 3);
+        unsigned seed = 0x9753;
+        dynarray<scene_node*> nodes;
+        for (unsigned i = 0; i != num_instances; ++i) {
+          scene_node *node = new scene_node(scene);
+          vec3 pos(next_random(seed) * (1.0f / 16777216), next_random(seed) * (1.0f / 16777216), next_random(seed) * (1.0f / 16777216));
+          node->translate((pos - 0.5f) * size);
+          nodes.push_back(node);
+          scene->add_mesh_instance(new mesh_instance(node, box, red));
+        }
+        scene->update(0);
+
+        // 200 line of sight checks 50 units long.
+        enum { num_queries = 200 };
+        dynarray<ray> rays;
+        for (unsigned i = 0; i != num_queries; ++i) {
+          vec3 start = vec3(next_random(seed) % 1000, next_random(seed) % 1000, next_random(seed) % 1000) * (size / 1000) - size * 0.5f;
+          vec3 dir = vec3(next_random(seed) % 1000, next_random(seed) % 1000, next_random(seed) % 1000) * 0.002f - 1.0f;
+          rays.push_back(ray(start, start + normalize(dir) * 50.0f));
+        }
+
+        char name[64];
+        unsigned linear_hits = 0, tree_hits = 0;
+        snprintf(name, sizeof(name), "ray x200, %uk instances: linear", num_instances / 1000);
+        report(name, time_ms([&]() {
+          for (unsigned i = 0; i != num_queries; ++i) {
+            float depth;
+            linear_hits += linear_cast_ray(scene, rays[i], depth) != 0;
+          }
+        }));
+        snprintf(name, sizeof(name), "ray x200, %uk instances: aabb_tree", num_instances / 1000);
+        report(name, time_ms([&]() {
+          for (unsigned i = 0; i != num_queries; ++i) {
+            visual_scene::cast_result result;
+            scene->cast_ray(result, rays[i]);
+            tree_hits += result.mi != 0;
+          }
+        }));
+
+        // radius 10 queries, as for explosions.
+        unsigned linear_found = 0, tree_found = 0;
+        snprintf(name, sizeof(name), "sphere x200, %uk instances: linear", num_instances / 1000);
+        report(name, time_ms([&]() {
+          for (unsigned i = 0; i != num_queries; ++i) {
+            sphere volume(rays[i].get_start(), 10.0f);
+            for (int j = 0; j != scene->get_num_mesh_instances(); ++j) {
+              mesh_instance *mi = scene->get_mesh_instance(j);
+              linear_found += volume.intersects(mi->get_mesh()->get_aabb().get_transform(mi->get_node()->calcModelToWorld()));
+            }
+          }
+        }));
+        snprintf(name, sizeof(name), "sphere x200, %uk instances: aabb_tree", num_instances / 1000);
+        report(name, time_ms([&]() {
+          dynarray<mesh_instance*> found;
+          for (unsigned i = 0; i != num_queries; ++i) {
+            found.resize(0);
+            scene->query_sphere(found, sphere(rays[i].get_start(), 10.0f));
+            tree_found += found.size();
+          }
+        }));
+
+        // a tenth of the instances drift each frame.
+        snprintf(name, sizeof(name), "refit 10%% moving x10, %uk instances", num_instances / 1000);
+        report(name, time_ms([&]() {
+          for (unsigned frame = 0; frame != 10; ++frame) {
+            for (unsigned i = frame; i < nodes.size(); i += 10) {
+              nodes[i]->translate(vec3(0.1f, 0, 0));
+            }
+            scene->update(0);
+          }
+        }));
+        printf("(hits %u/%u, found %u/%u)\n", linear_hits, tree_hits, linear_found, tree_found);
+      }
+    }
+
+    // every triangle, as mesh::ray_cast used to do it.
+    static float linear_mesh_ray_cast(const dynarray<mesh::vertex> &vertices, const dynarray<uint32_t> &indices, const ray &the_ray) {
+      vec3 org = the_ray.get_start();
+      vec3 dir = the_ray.get_distance();
+      float best = 1e37f;
+      for (unsigned i = 0; i != indices.size(); i += 3) {
+        vec3 a = vertices[indices[i]].pos;
+        vec3 e1 = vec3(vertices[indices[i + 1]].pos) - a;
+        vec3 e2 = vec3(vertices[indices[i + 2]].pos) - a;
+        vec3 pvec = cross(dir, e2);
+        float det = dot(e1, pvec);
+        if (det == 0) continue;
+        vec3 tvec = org - a;
+        vec3 qvec = cross(tvec, e1);
+        float u = dot(tvec, pvec) / det, v = dot(dir, qvec) / det, t = dot(e2, qvec) / det;
+        if (u >= 0 && v >= 0 && u + v <= 1 && t >= 0 && t < best) best = t;
+      }
+      return best;
+    }
+
+    void mesh_ray_cast_benchmarks() {
+      // a 2M triangle height field, like a scanned mesh or a big terrain.
+      enum { grid = 1000 };
+      dynarray<mesh::vertex> vertices;
+      dynarray<uint32_t> indices;
+      vertices.reserve((grid + 1) * (grid + 1));
+      for (unsigned z = 0; z <= grid; ++z) {
+        for (unsigned x = 0; x <= grid; ++x) {
+          float height = sinf(x * 0.05f) * cosf(z * 0.07f) * 5.0f;
+          vertices.push_back(mesh::vertex(vec3(x * 0.1f, height, z * 0.1f), vec3(0, 1, 0), vec3(0, 0, 0)));
+        }
+      }
+      for (unsigned z = 0; z != grid; ++z) {
+        for (unsigned x = 0; x != grid; ++x) {
+          uint32_t i = z * (grid + 1) + x;
+          uint32_t quad[6] = { i, i + 1, i + grid + 1, i + 1, i + grid + 2, i + grid + 1 };
+          for (unsigned j = 0; j != 6; ++j) indices.push_back(quad[j]);
+        }
+      }
+      ref<mesh> msh = new mesh();
+      msh->set_default_attributes();
+      msh->set_vertices(vertices);
+      msh->set_indices(indices);
+
+      // picking rays from above at random points.
+      enum { num_rays = 20 };
+      dynarray<ray> rays;
+      unsigned seed = 0x4321;
+      for (unsigned i = 0; i != num_rays; ++i) {
+        vec3 target((next_random(seed) % 1000) * 0.1f, 0, (next_random(seed) % 1000) * 0.1f);
+        rays.push_back(ray(target + vec3(3, 20, 2), target - vec3(3, 20, 2)));
+      }
+
+      float linear_sum = 0, bvh_sum = 0;
+      report("mesh ray cast 2M tris x20: linear", time_ms([&]() {
+        for (unsigned i = 0; i != num_rays; ++i) {
+          linear_sum += linear_mesh_ray_cast(vertices, indices, rays[i]);
+        }
+      }));
+      report("mesh ray cast 2M tris: build triangle_bvh", time_ms([&]() {
+        msh->update_ray_cast_bvh();
+      }));
+      report("mesh ray cast 2M tris x20: triangle_bvh", time_ms([&]() {
+        for (unsigned i = 0; i != num_rays; ++i) {
+          int tri[3];
+          vec4 bary_numer;
+          float bary_denom;
+          if (msh->ray_cast(rays[i], tri, bary_numer, bary_denom)) {
+            bvh_sum += bary_numer.w() / bary_denom;
+          }
+        }
+      }));
+      log("mesh ray cast checksums %f %f\n", linear_sum, bvh_sum);
+    }
+
+    void render_queue_benchmarks() {
+      // 10k instances in view, with 4 shaders, 64 materials and 8 meshes mixed up.
+      ref<visual_scene> scene = new visual_scene();
+      scene->create_default_camera_and_lights();
+      camera_instance *cam = scene->get_camera_instance(0);
+      cam->get_node()->loadIdentity();
+      cam->set_perspective(0, 60, 1, 0.5f, 1000);
+
+      dynarray<ref<param_shader> > shaders;
+      for (unsigned i = 0; i != 4; ++i) {
+        shaders.push_back(new param_shader("shaders/default.vs", "shaders/default_solid.fs"));
+      }
+      dynarray<ref<material> > materials;
+      unsigned seed = 0x9753;
+      for (unsigned i = 0; i != 64; ++i) {
+        vec4 color((next_random(seed) & 255) / 255.0f, (next_random(seed) & 255) / 255.0f, (next_random(seed) & 255) / 255.0f, 1);
+        materials.push_back(new material(color, shaders[i % shaders.size()]));
+      }
+      dynarray<ref<mesh> > meshes;
+      for (unsigned i = 0; i != 8; ++i) {
+        if (i & 1) {
+          meshes.push_back(new mesh_sphere(vec3(0, 0, 0), 0.5f + i * 0.1f));
+        } else {
+          meshes.push_back(new mesh_box(vec3(0.5f + i * 0.1f)));
+        }
+      }
+
+      for (unsigned i = 0; i != 10000; ++i) {
+        scene_node *node = new scene_node(scene);
+        float z = -20.0f - (next_random(seed) % 1000) * 0.1f;
+        float x = ((next_random(seed) % 1000) * 0.001f - 0.5f) * -z;
+        float y = ((next_random(seed) % 1000) * 0.001f - 0.5f) * -z;
+        node->translate(vec3(x, y, z));
+        mesh *msh = meshes[next_random(seed) % meshes.size()];
+        material *mat = materials[next_random(seed) % materials.size()];
+        scene->add_mesh_instance(new mesh_instance(node, msh, mat));
+      }
+
+      scene->begin_render(256, 256);
+      scene->update(0);
+      static const char *names[] = {
+        "render 10k mixed instances x4: in order, no vertex arrays",
+        "render 10k mixed instances x4: in order",
+        "render 10k mixed instances x4: sorted",
+        "render 10k mixed instances x4: instanced",
+      };
+      for (unsigned mode = 0; mode != 4; ++mode) {
+        mesh::set_vertex_arrays(mode != 0);
+        scene->set_render_sorting(mode >= 2);
+        scene->set_instancing(mode == 3);
+        scene->render(1.0f);
+        glFinish();
+        double ms = time_ms([&]() {
+          for (unsigned frame = 0; frame != 4; ++frame) {
+            scene->render(1.0f);
+          }
+          glFinish();
+        });
+        report(names[mode], ms);
+
+        // one more frame to count the GL calls.
+        gl_state::begin_frame();
+        scene->render(1.0f);
+        const render_queue::stats &stats = scene->get_render_stats();
+        printf(
+          "(%u draws, %u instanced, %u program binds, %u material binds, %u texture binds, %u buffer binds, %u vertex array binds)\n",
+          stats.num_draw_calls, stats.num_instanced_draw_calls, stats.num_program_binds, stats.num_material_binds, stats.num_texture_binds, stats.num_buffer_binds, stats.num_vertex_array_binds
+        );
+        const gl_state::stats &gl_stats = gl_state::get_stats();
+        printf("(%u gl state calls, %u skipped)\n", gl_stats.num_calls, gl_stats.num_skipped);
+      }
+    }
+
+    void occlusion_benchmarks() {
+      // an indoor level: rooms of boxes behind a row of walls, with a few boxes in front.
+      ref<visual_scene> scene = new visual_scene();
+      scene->create_default_camera_and_lights();
+      camera_instance *cam = scene->get_camera_instance(0);
+      cam->get_node()->loadIdentity();
+      cam->set_perspective(0, 60, 1, 0.5f, 1000);
+
+      ref<material> grey = new material(vec4(0.5f, 0.5f, 0.5f, 1));
+      ref<mesh> wall = new mesh_box(vec3(10, 10, 0.5f));
+      for (unsigned i = 0; i != 5; ++i) {
+        scene_node *node = new scene_node(scene);
+        node->translate(vec3(i * 20.0f - 40, 0, -30));
+        mesh_instance *mi = new mesh_instance(node, wall, grey);
+        mi->set_flags(mi->get_flags() | mesh_instance::flag_occluder);
+        scene->add_mesh_instance(mi);
+      }
+
+      ref<mesh> box = new mesh_box(vec3(0.5f));
+      ref<material> red = new material(vec4(1, 0, 0, 1));
+      unsigned seed = 0x3579;
+      for (unsigned i = 0; i != 10000; ++i) {
+        scene_node *node = new scene_node(scene);
+        float z = i < 200 ? -5.0f - (next_random(seed) % 200) * 0.1f : -35.0f - (next_random(seed) % 1000) * 0.2f;
+        float x = ((next_random(seed) % 1000) * 0.001f - 0.5f) * -z;
+        float y = ((next_random(seed) % 1000) * 0.001f - 0.5f) * -z;
+        node->translate(vec3(x, y, z));
+        scene->add_mesh_instance(new mesh_instance(node, box, red));
+      }
+
+      // one draw per box, as if they were all different props.
+      scene->set_instancing(false);
+      scene->begin_render(256, 256);
+      scene->update(0);
+      for (unsigned occlusion = 0; occlusion != 2; ++occlusion) {
+        scene->set_occlusion_culling(occlusion != 0);
+        scene->render(1.0f);
+        glFinish();
+        double ms = time_ms([&]() {
+          for (unsigned frame = 0; frame != 4; ++frame) {
+            scene->render(1.0f);
+          }
+          glFinish();
+        });
+        report(occlusion ? "render 10k behind walls x4: occlusion" : "render 10k behind walls x4: frustum", ms);
+        const visual_scene::cull_stats &stats = scene->get_cull_stats();
+        printf("(culling: %u tested, %u visible, %u culled, %u occluded)\n", stats.num_tested, stats.num_visible, stats.num_culled, stats.num_occluded);
+      }
+      const occlusion_buffer::stats &stats = scene->get_occlusion_buffer().get_stats();
+      printf("(occlusion: %u occluders, %u triangles)\n", stats.num_occluders, stats.num_triangles);
+    }
+
+    void lod_benchmarks() {
+      // a 330k triangle sphere simplified to a quarter, then a chain of levels for a field of spheres.
+      ref<mesh> detailed = new mesh_sphere(vec3(0), 0.5f, 7);
+      ref<simplifier> quarter;
+      report("simplify 330k triangles to 25%", time_ms([&]() { quarter = new simplifier(detailed, 0.25f); }));
+      printf("(%u -> %u triangles, error %f)\n", detailed->get_num_indices() / 3, quarter->get_num_indices() / 3, quarter->get_error());
+
+      ref<lod_group> lods = new lod_group(new mesh_sphere(vec3(0), 0.5f, 4));
+      report("lod_group generate 4 levels", time_ms([&]() { lods->generate(4); }));
+
+      // the old way: four instances per node with distance ranges, against one instance with a lod_group.
+      mesh *spheres[] = {
+        new mesh_sphere(vec3(0), 0.5f, 3), new mesh_sphere(vec3(0), 0.5f, 2),
+        new mesh_sphere(vec3(0), 0.5f, 1), new mesh_sphere(vec3(0), 0.5f, 0)
+      };
+      static const float distances[] = { -1e37f, 5, 15, 45, 1e37f };
+      ref<material> red = new material(vec4(1, 0, 0, 1));
+      for (unsigned pass = 0; pass != 2; ++pass) {
+        ref<visual_scene> scene = new visual_scene();
+        scene->create_default_camera_and_lights();
+        camera_instance *cam = scene->get_camera_instance(0);
+        cam->get_node()->loadIdentity();
+        cam->get_node()->translate(vec3(0, 2, 0));
+        cam->set_far_plane(1000);
+        for (int x = 0; x <= 10; ++x) {
+          for (int y = 0; y <= 5; ++y) {
+            for (int z = 0; z <= 50; ++z) {
+              scene_node *node = new scene_node(scene);
+              node->translate(vec3((x - 5) * 2.0f, (y - 2.5f) * 2.0f, -z * 2.0f));
+              if (pass == 0) {
+                for (unsigned k = 0; k != 4; ++k) {
+                  mesh_instance *mi = new mesh_instance(node, spheres[k], red);
+                  mi->set_min_draw_distance(distances[k]);
+                  mi->set_max_draw_distance(distances[k + 1]);
+                  mi->set_flags(mesh_instance::flag_enabled | mesh_instance::flag_lod);
+                  scene->add_mesh_instance(mi);
+                }
+              } else {
+                mesh_instance *mi = new mesh_instance(node, lods->get_mesh(0), red);
+                mi->set_lod_group(lods);
+                scene->add_mesh_instance(mi);
+              }
+            }
+          }
+        }
+
+        scene->begin_render(1280, 720);
+        scene->update(0);
+        scene->render(16.0f / 9);
+        glFinish();
+        double ms = time_ms([&]() {
+          for (unsigned frame = 0; frame != 4; ++frame) {
+            scene->render(16.0f / 9);
+          }
+          glFinish();
+        });
+        report(pass == 0 ? "render 3366 spheres x4: distance ranges" : "render 3366 spheres x4: lod_group", ms);
+        const render_queue::stats &stats = scene->get_render_stats();
+        printf("(%u draws)\n", stats.num_items);
+      }
+    }
+
+    // a tube along y, one unit per bone, for skinning. Each ring of vertices is weighted between the two nearest bones.
+    static mesh *make_skinned_tube(unsigned num_bones, unsigned num_sides) {
+      struct vertex {
+        vec3p pos;
+        vec3p normal;
+        vec2p uv;
+        float blendweight[3];
+        float blendindices[4];
+      };
+
+      unsigned num_rings = num_bones + 1;
+      dynarray<vertex> vertices;
+      dynarray<uint32_t> indices;
+      for (unsigned r = 0; r != num_rings; ++r) {
+        float y = (float)r;
+        int b0 = std::min(std::max((int)floorf(y - 0.5f), 0), (int)num_bones - 1);
+        int b1 = std::min(b0 + 1, (int)num_bones - 1);
+        float t = b1 == b0 ? 0.0f : std::min(std::max(y - 0.5f - b0, 0.0f), 1.0f);
+        for (unsigned s = 0; s != num_sides; ++s) {
+          float angle = s * (2 * 3.14159265f / num_sides);
+          vertex &v = vertices.emplace_back();
+          v.pos = vec3(cosf(angle) * 0.25f, y, sinf(angle) * 0.25f);
+          v.normal = vec3(cosf(angle), 0, sinf(angle));
+          v.uv = vec2((float)s / num_sides, y / num_bones);
+          // the first bone gets one minus the other weights.
+          v.blendweight[0] = t;
+          v.blendweight[1] = v.blendweight[2] = 0;
+          v.blendindices[0] = (float)b0;
+          v.blendindices[1] = (float)b1;
+          v.blendindices[2] = v.blendindices[3] = 0;
+        }
+      }
+      for (unsigned r = 0; r + 1 < num_rings; ++r) {
+        for (unsigned s = 0; s != num_sides; ++s) {
+          uint32_t a = r * num_sides + s, b = r * num_sides + (s + 1) % num_sides;
+          uint32_t tri[] = { a, a + num_sides, b, b, a + num_sides, b + num_sides };
+          for (unsigned k = 0; k != 6; ++k) indices.push_back(tri[k]);
+        }
+      }
+
+      mat4t identity;
+      identity.loadIdentity();
+      skin *skn = new skin(identity);
+      for (unsigned i = 0; i != num_bones; ++i) {
+        mat4t bindToModel;
+        bindToModel.loadIdentity();
+        bindToModel.translate(vec3(0, -(float)i, 0));
+        skn->add_joint(bindToModel, (atom_t)(i + 1));
+      }
+
+      mesh *msh = new mesh(skn);
+      msh->add_attribute(attribute_pos, 3, GL_FLOAT, 0);
+      msh->add_attribute(attribute_normal, 3, GL_FLOAT, 12);
+      msh->add_attribute(attribute_uv, 2, GL_FLOAT, 24);
+      msh->add_attribute(attribute_blendweight, 3, GL_FLOAT, 32);
+      msh->add_attribute(attribute_blendindices, 4, GL_FLOAT, 44);
+      msh->set_params(sizeof(vertex), indices.size(), vertices.size(), GL_TRIANGLES, GL_UNSIGNED_INT);
+      msh->allocate(vertices.size() * sizeof(vertex), indices.size() * sizeof(uint32_t));
+      msh->assign(vertices.size() * sizeof(vertex), indices.size() * sizeof(uint32_t), (uint8_t*)vertices.data(), (uint8_t*)indices.data());
+      msh->calc_aabb();
+      return msh;
+    }
+
+    // a chain of bones for make_skinned_tube, each bent by angle degrees. The nodes are added to bones.
+    static skeleton *make_bone_chain(unsigned num_bones, float angle, dynarray<ref<scene_node> > &bones) {
+      skeleton *skel = new skeleton();
+      for (unsigned i = 0; i != num_bones; ++i) {
+        mat4t nodeToParent;
+        nodeToParent.loadIdentity();
+        if (i) nodeToParent.translate(vec3(0, 1, 0));
+        nodeToParent.rotateZ(angle);
+        scene_node *node = new scene_node(nodeToParent, (atom_t)(i + 1));
+        skel->add_bone(node, (int)i - 1);
+        bones.push_back(node);
+      }
+      return skel;
+    }
+
+    void skinning_benchmarks() {
+      // 1000 characters with 64 bones each.
+      enum { num_characters = 1000, num_bones = 64 };
+      ref<mesh> tube = make_skinned_tube(num_bones, 6);
+      skin *skn = tube->get_skin();
+      dynarray<ref<skeleton> > skeletons;
+      dynarray<ref<scene_node> > bones;
+      dynarray<int> indices(num_characters * num_bones);
+      for (unsigned c = 0; c != num_characters; ++c) {
+        skeletons.push_back(make_bone_chain(num_bones, (float)(c % 7), bones));
+        skeletons[c]->match_skin(skn, &indices[c * num_bones]);
+      }
+
+      mat4t modelToCamera;
+      modelToCamera.loadIdentity();
+      modelToCamera.translate(vec3(0, 0, -50));
+      report("skin palettes 1000 x 64 bones: one by one", time_ms([&]() {
+        for (unsigned c = 0; c != num_characters; ++c) {
+          skeletons[c]->calc_transforms(modelToCamera, skn);
+        }
+      }));
+
+      platform::thread_pool &pool = platform::thread_pool::get_default();
+      dynarray<mat4t> palettes(num_characters * num_bones);
+      report("skin palettes 1000 x 64 bones: pool", time_ms([&]() {
+        pool.parallel_for(num_characters, 16, [&](unsigned begin, unsigned end) {
+          dynarray<mat4t> scratch(num_bones);
+          for (unsigned c = begin; c != end; ++c) {
+            skeletons[c]->calc_palette(skn, &indices[c * num_bones], modelToCamera, &palettes[c * num_bones], scratch.data());
+          }
+        });
+      }));
+      printf("(%u threads, %u vertices per character)\n", pool.get_num_threads(), tube->get_num_vertices());
+
+      // skinning on the CPU, in model space.
+      mat4t identity;
+      identity.loadIdentity();
+      for (unsigned c = 0; c != num_characters; ++c) {
+        dynarray<mat4t> scratch(num_bones);
+        skeletons[c]->calc_palette(skn, &indices[c * num_bones], identity, &palettes[c * num_bones], scratch.data());
+      }
+      dynarray<ref<skinner> > skinners;
+      for (unsigned c = 0; c != num_characters; ++c) {
+        skinners.push_back(new skinner(tube));
+      }
+      for (unsigned mode = 0; mode != 2; ++mode) {
+        report(mode == 0 ? "cpu skin 1000 x 64 bones: linear" : "cpu skin 1000 x 64 bones: dual quaternion", time_ms([&]() {
+          pool.parallel_for(num_characters, 16, [&](unsigned begin, unsigned end) {
+            for (unsigned c = begin; c != end; ++c) {
+              skinners[c]->skin(&palettes[c * num_bones], num_bones, mode == 0 ? skinner::blend_linear : skinner::blend_dual_quaternion);
+            }
+          });
+        }));
+      }
+      report("cpu skin 1000 x 64 bones: upload", time_ms([&]() {
+        for (unsigned c = 0; c != num_characters; ++c) {
+          skinners[c]->upload();
+        }
+        glFinish();
+      }));
+      skinners.reset();
+
+      // the whole frame: palettes, skinning and drawing.
+      ref<visual_scene> scene = new visual_scene();
+      scene->create_default_camera_and_lights();
+      camera_instance *cam = scene->get_camera_instance(0);
+      cam->get_node()->loadIdentity();
+      cam->get_node()->translate(vec3(0, 30, 0));
+      cam->set_far_plane(1000);
+      ref<material> grey = new material(vec4(0.5f, 0.5f, 0.5f, 1));
+      for (unsigned c = 0; c != num_characters; ++c) {
+        scene_node *node = new scene_node(scene);
+        node->translate(vec3((float)(c % 40) * 4 - 80, 0, -(float)(c / 40) * 4 - 10));
+        scene->add_mesh_instance(new mesh_instance(node, tube, grey, skeletons[c]));
+      }
+      scene->set_cpu_skinning(true);
+      scene->begin_render(1280, 720);
+      scene->update(0);
+      for (unsigned mode = 0; mode != 2; ++mode) {
+        scene->set_skin_blend(mode == 0 ? skinner::blend_linear : skinner::blend_dual_quaternion);
+        scene->render(16.0f / 9);
+        glFinish();
+        double ms = time_ms([&]() {
+          for (unsigned frame = 0; frame != 4; ++frame) {
+            scene->render(16.0f / 9);
+          }
+          glFinish();
+        });
+        report(mode == 0 ? "render 1000 cpu skinned x4: linear" : "render 1000 cpu skinned x4: dual quaternion", ms);
+      }
+      const render_queue::stats &stats = scene->get_render_stats();
+      printf("(%u draws)\n", stats.num_draw_calls);
+    }
+
+    void light_cluster_benchmarks() {
+      // a night scene: 1000 street lamps and spot lights along a 400m stretch in front of the camera.
+      dynarray<ref<light> > lights;
+      dynarray<ref<scene_node> > nodes;
+      unsigned seed = 0x8642;
+      for (unsigned i = 0; i != 1000; ++i) {
+        light *lt = new light();
+        scene_node *node = new scene_node();
+        float x = (next_random(seed) % 1000) * 0.2f - 100.0f;
+        float y = (next_random(seed) % 100) * 0.1f;
+        float z = (next_random(seed) % 1000) * -0.4f;
+        node->translate(vec3(x, y, z));
+        node->rotate((float)(next_random(seed) % 360), vec3(1, 0, 0));
+        lt->set_kind(i % 4 == 0 ? atom_spot : atom_point);
+        lt->set_color(vec4(1, 0.9f, 0.7f, 1));
+        lt->set_attenuation(1, 0.5f, 0.5f + (next_random(seed) % 100) * 0.01f);
+        lt->set_falloff(60, 4);
+        lights.push_back(lt);
+        nodes.push_back(node);
+      }
+
+      mat4t cameraToProjection;
+      cameraToProjection.loadIdentity();
+      cameraToProjection.frustum(-0.5f * 16 / 9, 0.5f * 16 / 9, -0.5f, 0.5f, 0.5f, 500);
+      mat4t worldToCamera;
+      worldToCamera.loadIdentity();
+
+      light_clusters clusters;
+      platform::thread_pool two_threads(1);
+      for (unsigned pass = 0; pass != 2; ++pass) {
+        clusters.set_thread_pool(pass == 0 ? &two_threads : &platform::thread_pool::get_default());
+        double ms = time_ms([&]() {
+          for (unsigned frame = 0; frame != 100; ++frame) {
+            clusters.begin(cameraToProjection, 0.5f, 500, 1280, 720);
+            for (unsigned i = 0; i != lights.size(); ++i) {
+              clusters.add_light(lights[i], nodes[i], worldToCamera);
+            }
+            clusters.build();
+          }
+        });
+        report(pass == 0 ? "light clusters 1000 lights x100: 2 threads" : "light clusters 1000 lights x100: pool", ms);
+      }
+      report("light clusters 1000 lights x100: upload", time_ms([&]() {
+        for (unsigned frame = 0; frame != 100; ++frame) {
+          clusters.upload();
+        }
+        glFinish();
+      }));
+      const light_clusters::stats &stats = clusters.get_stats();
+      printf(
+        "(%u lights, %u culled, %u references, %.1f per cluster, %u most, %u overflows)\n",
+        stats.num_lights, stats.num_culled_lights, stats.num_references,
+        (float)stats.num_references / (light_clusters::default_dim_x * light_clusters::default_dim_y * light_clusters::default_dim_z),
+        stats.max_cluster_lights, stats.num_overflows
+      );
+    }
+
+    // a take of motion capture for a chain of bones: a transform for each bone keyed 30 times a second.
+    static animation *make_bone_animation(const dynarray<ref<scene_node> > &bones, float duration) {
+      animation *anim = new animation();
+      unsigned num_keys = (unsigned)(duration * 30) + 1;
+      dynarray<float> times(num_keys);
+      for (unsigned k = 0; k != num_keys; ++k) {
+        times[k] = k / 30.0f;
+      }
+      for (unsigned i = 0; i != bones.size(); ++i) {
+        dynarray<float> values(num_keys * 16);
+        for (unsigned k = 0; k != num_keys; ++k) {
+          // collada matrices have the translation in the last column.
+          float angle = sinf(times[k] * (1.0f + (i % 5) * 0.3f)) * 0.3f;
+          float c = cosf(angle), s = sinf(angle);
+          float m[16] = { c, -s, 0, 0, s, c, 0, i ? 1.0f : 0.0f, 0, 0, 1, 0, 0, 0, 0, 1 };
+          memcpy(&values[k * 16], m, sizeof(m));
+        }
+        anim->add_channel(bones[i], bones[i]->get_sid(), atom_transform, atom_, times, values);
+      }
+      return anim;
+    }
+
+    void animation_benchmarks() {
+      // 1000 instances of a 90 second, 64 bone take.
+      enum { num_instances = 1000, num_bones = 64 };
+      dynarray<ref<scene_node> > bones;
+      ref<skeleton> skel = make_bone_chain(num_bones, 0, bones);
+      ref<animation> anim = make_bone_animation(bones, 90);
+      ref<animation_clip> clip;
+      report("animation clip compile 64 bones x 90s", time_ms([&]() {
+        clip = new animation_clip(anim, 0.001f);
+      }));
+      unsigned num_keys = 0;
+      for (unsigned i = 0; i != clip->get_num_tracks(); ++i) {
+        num_keys += clip->get_num_keys(i);
+      }
+      printf(
+        "(animation %u bytes, clip %u bytes, %u of %u keys kept)\n",
+        anim->get_num_bytes(), clip->get_num_bytes(), num_keys, anim->get_num_keys(0) * anim->get_num_channels()
+      );
+
+      // every instance starts at a different time.
+      dynarray<ref<animation_instance> > instances;
+      dynarray<ref<animation_instance> > clip_instances;
+      for (unsigned i = 0; i != num_instances; ++i) {
+        instances.push_back(new animation_instance(anim, 0, true));
+        clip_instances.push_back(new animation_instance(clip, 0, true));
+        instances[i]->update(i * 0.077f);
+        clip_instances[i]->update(i * 0.077f);
+      }
+
+      // just the writes, to nodes and to the skeleton of a mesh_instance.
+      ref<mesh_instance> skinned = new mesh_instance(new scene_node(), 0, 0, skel);
+      for (unsigned pass = 0; pass != 2; ++pass) {
+        resource *target = pass == 0 ? 0 : (resource*)skinned;
+        dynarray<animation_binding> bindings(num_bones);
+        for (unsigned i = 0; i != num_bones; ++i) {
+          bindings[i].bind(target ? target : (resource*)bones[i], bones[i]->get_sid(), atom_transform, atom_);
+        }
+        float *values = (float*)anim->get_key_values(0, 0);
+        report(pass == 0 ? "animation writes 1000 x 64 nodes x10: set_value" : "animation writes 1000 x 64 bones x10: set_value", time_ms([&]() {
+          for (unsigned n = 0; n != num_instances * 10; ++n) {
+            for (unsigned i = 0; i != num_bones; ++i) {
+              (target ? target : (resource*)bones[i])->set_value(bones[i]->get_sid(), atom_transform, atom_, values);
+            }
+          }
+        }));
+        report(pass == 0 ? "animation writes 1000 x 64 nodes x10: bound" : "animation writes 1000 x 64 bones x10: bound", time_ms([&]() {
+          for (unsigned n = 0; n != num_instances * 10; ++n) {
+            for (unsigned i = 0; i != num_bones; ++i) {
+              bindings[i].write(values);
+            }
+          }
+        }));
+      }
+
+      report("animation 1000 x 64 bones x10 frames: eval_chan", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          for (unsigned i = 0; i != num_instances; ++i) {
+            instances[i]->update(1.0f / 30);
+          }
+        }
+      }));
+      report("animation 1000 x 64 bones x10 frames: clip", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          for (unsigned i = 0; i != num_instances; ++i) {
+            clip_instances[i]->update(1.0f / 30);
+          }
+        }
+      }));
+
+      dynarray<animation_clip::cursor> cursors(num_instances);
+      dynarray<float> poses(num_instances * clip->get_pose_size());
+      report("animation 1000 x 64 bones x10 frames: clip sample only", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          for (unsigned i = 0; i != num_instances; ++i) {
+            clip->sample(cursors[i], i * 0.077f + frame * (1.0f / 30), &poses[i * clip->get_pose_size()]);
+          }
+        }
+      }));
+    }
+
+    void pose_benchmarks() {
+      // a crowd of 5000 characters with 32 bones, all playing one of two shared clips. Half are crossfading.
+      enum { num_characters = 5000, num_bones = 32 };
+      dynarray<ref<scene_node> > first;
+      ref<skeleton> skel = make_bone_chain(num_bones, 0, first);
+      ref<animation_clip> walk = new animation_clip(make_bone_animation(first, 10));
+      ref<animation_clip> run = new animation_clip(make_bone_animation(first, 7));
+
+      ref<visual_scene> scene = new visual_scene();
+      slot_map<ref<animation_instance> > instances;
+      for (unsigned c = 0; c != num_characters; ++c) {
+        dynarray<ref<scene_node> > bones;
+        skel = make_bone_chain(num_bones, 0, bones);
+        scene->add_child(bones[0]);
+        for (unsigned i = 1; i != num_bones; ++i) {
+          bones[i - 1]->add_child(bones[i]);
+        }
+        animation_instance *inst = new animation_instance(c % 2 ? walk : run, bones[0], true);
+        inst->update(c * 0.01f);
+        instances.insert(inst);
+        if (c % 2) {
+          animation_instance *other = new animation_instance(run, bones[0], true);
+          other->set_weight(0);
+          other->fade_to(1, 100);
+          inst->fade_to(0, 100);
+          instances.insert(other);
+        }
+      }
+
+      pose_system poses;
+      poses.update(instances, 0);
+      printf("(%u instances, %u nodes)\n", poses.get_num_instances(), poses.get_num_nodes());
+
+      report("pose 5000 x 32 bones x10 frames: one by one", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          for (unsigned i = 0; i != instances.size(); ++i) {
+            instances[i]->update(1.0f / 30);
+          }
+        }
+      }));
+
+      platform::thread_pool two_threads(1);
+      for (unsigned pass = 0; pass != 2; ++pass) {
+        poses.set_thread_pool(pass == 0 ? &two_threads : &platform::thread_pool::get_default());
+        double ms = time_ms([&]() {
+          for (unsigned frame = 0; frame != 10; ++frame) {
+            poses.update(instances, 1.0f / 30);
+          }
+        });
+        report(pass == 0 ? "pose 5000 x 32 bones x10 frames: pose_system 2 threads" : "pose 5000 x 32 bones x10 frames: pose_system pool", ms);
+      }
+
+      // the whole update: animation and world matrices.
+      for (unsigned i = 0; i != instances.size(); ++i) {
+        scene->add_animation_instance(instances[i]);
+      }
+      scene->update(0);
+      report("pose 5000 x 32 bones x10 frames: visual_scene update", time_ms([&]() {
+        for (unsigned frame = 0; frame != 10; ++frame) {
+          scene->update(1.0f / 30);
+        }
+      }));
+    }
+
+  public:
+    /// this is called when we construct the class before everything is initialised.
+    example_benchmark(int argc, char **argv) : app(argc, argv) {
+    }
+
+    /// this is called once OpenGL is initialized
+    void app_init() {
+      #if OCTET_SYSTEM_ALLOCATOR
+        report("(system allocator build)", 0);
+      #endif
+      allocator_benchmarks();
+      frame_allocator_benchmarks();
+      hash_map_benchmarks();
+      dictionary_benchmarks();
+      dynarray_benchmarks();
+      ref_count_benchmarks();
+      scene_benchmarks();
+      scene_query_benchmarks();
+      mesh_ray_cast_benchmarks();
+      render_queue_benchmarks();
+      occlusion_benchmarks();
+      lod_benchmarks();
+      light_cluster_benchmarks();
+      skinning_benchmarks();
+      animation_benchmarks();
+      pose_benchmarks();
+
+      app_scene =  new visual_scene();
+      app_scene->create_default_camera_and_lights();
+
+      material *red = new material(vec4(1, 0, 0, 1));
+      mesh_box *box = new mesh_box(vec3(4));
+      scene_node *node = new scene_node();
+      app_scene->add_child(node);
+      app_scene->add_mesh_instance(new mesh_instance(node, box, red));
+    }
+
+    /// this is called to draw the world
+    void draw_world(int x, int y, int w, int h) {
+      int vx = 0, vy = 0;
+      get_viewport_size(vx, vy);
+      app_scene->begin_render(vx, vy);
+
+      // update matrices. assume 30 fps.
+      app_scene->update(1.0f/30);
+
+      // draw the scene
+      app_scene->render((float)vx / vy);
+
+      // tumble the box  (there is only one mesh instance)
+      scene_node *node = app_scene->get_mesh_instance(0)->get_node();
+      node->rotate(1, vec3(1, 0, 0));
+      node->rotate(1, vec3(0, 1, 0));
+    }
+  };
+}
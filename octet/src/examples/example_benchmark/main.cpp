@@ -0,0 +1,30 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Benchmarks for containers and scene systems
+//
+
+#include <chrono>
+#include <thread>
+
+#include "../../octet.h"
+
+#include "example_benchmark.h"
+
+/// Run the benchmarks
+int main(int argc, char **argv) {
+  // set up the platform.
+  octet::app::init_all(argc, argv);
+
+  // our application.
+  octet::example_benchmark app(argc, argv);
+  app.init();
+
+  // open windows
+  octet::app::run_all_apps();
+}
+
+
@@ -31,7 +31,8 @@ namespace octet {
 
       GLuint gl_texture;
       glGenTextures(1, &gl_texture);
-      glBindTexture(GL_TEXTURE_2D, gl_texture);
+      gl_state::active_texture(0);
+      gl_state::bind_texture(0, GL_TEXTURE_2D, gl_texture);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, dim, dim, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
       img = new image(GL_TEXTURE_2D, gl_texture, dim, dim, 1);
@@ -96,7 +97,8 @@ namespace octet {
         }
       }
 
-      glBindTexture(GL_TEXTURE_2D, img->get_gl_texture());
+      gl_state::active_texture(0);
+      gl_state::bind_texture(0, GL_TEXTURE_2D, img->get_gl_texture());
       glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, dim, dim, GL_RGBA, GL_UNSIGNED_BYTE, values.data());
 
       // update matrices. assume 30 fps.
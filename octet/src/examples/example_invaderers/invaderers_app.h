@@ -78,8 +78,8 @@ namespace octet {
       mat4t modelToProjection = mat4t::build_projection_matrix(modelToWorld, cameraToWorld);
 
       // set up opengl to draw textured triangles using sampler 0 (GL_TEXTURE0)
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, texture);
+      gl_state::active_texture(0);
+      gl_state::bind_texture(0, GL_TEXTURE_2D, texture);
 
       // Set render uniform parameters
       GLuint program = shader.get_program();
@@ -1016,8 +1016,8 @@ namespace octet {
       aabb bb(vec3(0, 0, 0), vec3(256, 256, 0));
 
       unsigned num_quads = font.build_mesh(bb, vertices, indices, max_quads, text, 0);
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, font_texture);
+      gl_state::active_texture(0);
+      gl_state::bind_texture(0, GL_TEXTURE_2D, font_texture);
 
       GLuint program = shader.get_program();
       GLint is3DLoc = glGetUniformLocation(program, "is3D");
@@ -1429,11 +1429,11 @@ namespace octet {
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
       // don't allow Z buffer depth testing (closer objects are always drawn in front of far ones)
-      glDisable(GL_DEPTH_TEST);
+      gl_state::set_enabled(GL_DEPTH_TEST, false);
 
       // allow alpha blend (transparency when alpha channel is 0)
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      gl_state::set_enabled(GL_BLEND, true);
+      gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
       // draw all the sprites
       for (int i = 0; i != num_sprites; ++i) {
@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+namespace octet {
+  /// Scene lit by hundreds of point lights with clustered lighting.
+  class example_lights : public app {
+    // scene for drawing the spheres
+    ref<visual_scene> app_scene;
+
+    // the nodes of the lights, which circle the spheres.
+    dynarray<scene_node*> light_nodes;
+  public:
+    /// this is called when we construct the class before everything is initialised.
+    example_lights(int argc, char **argv) : app(argc, argv) {
+    }
+
+    /// this is called once OpenGL is initialized
+    void app_init() {
+      app_scene =  new visual_scene();
+      app_scene->create_default_camera_and_lights();
+      app_scene->get_camera_instance(0)->get_node()->translate(vec3(0, 20, 30));
+      app_scene->get_camera_instance(0)->get_node()->rotate(-30, vec3(1, 0, 0));
+      app_scene->get_camera_instance(0)->set_far_plane(200);
+
+      // point lights are sorted into clusters each frame, and the clustered material
+      // adds up the ones in its cluster. Without this, only the directional light reaches it.
+      app_scene->set_clustered_lighting(true);
+      material *mat = new material(vec4(1, 1, 1, 1), NULL, true);
+
+      mesh *floor = new mesh_box(vec3(40, 0.5f, 40));
+      scene_node *floor_node = new scene_node();
+      floor_node->translate(vec3(0, -1.5f, 0));
+      app_scene->add_child(floor_node);
+      app_scene->add_mesh_instance(new mesh_instance(floor_node, floor, mat));
+
+      mesh *sphere = new mesh_sphere(vec3(0), 1, 2);
+      for (int x = -8; x <= 8; ++x) {
+        for (int z = -8; z <= 8; ++z) {
+          scene_node *node = new scene_node();
+          node->translate(vec3(x * 4.0f, 0, z * 4.0f));
+          app_scene->add_child(node);
+          app_scene->add_mesh_instance(new mesh_instance(node, sphere, mat));
+        }
+      }
+
+      // 256 small coloured lights.
+      random rand;
+      for (int i = 0; i != 256; ++i) {
+        light *lt = new light();
+        lt->set_kind(atom_point);
+        lt->set_color(vec4(rand.get(0.2f, 1.0f), rand.get(0.2f, 1.0f), rand.get(0.2f, 1.0f), 1));
+        lt->set_attenuation(1, 0, 0.25f);
+
+        scene_node *node = new scene_node();
+        node->translate(vec3(rand.get(-34.0f, 34.0f), rand.get(0.5f, 3.0f), rand.get(-34.0f, 34.0f)));
+        app_scene->add_child(node);
+        light_instance *li = new light_instance();
+        li->set_node(node);
+        li->set_light(lt);
+        app_scene->add_light_instance(li);
+        light_nodes.push_back(node);
+      }
+    }
+
+    /// this is called to draw the world
+    void draw_world(int x, int y, int w, int h) {
+      int vx = 0, vy = 0;
+      get_viewport_size(vx, vy);
+      app_scene->begin_render(vx, vy);
+
+      // turn the lights slowly about the centre.
+      float c = cosf(0.01f), s = sinf(0.01f);
+      for (unsigned i = 0; i != light_nodes.size(); ++i) {
+        mat4t &m = light_nodes[i]->access_nodeToParent();
+        vec3 pos = m.w().xyz();
+        m.w() = vec4(pos.x() * c - pos.z() * s, pos.y(), pos.x() * s + pos.z() * c, 1);
+      }
+
+      // update matrices. assume 30 fps.
+      app_scene->update(1.0f/30);
+
+      // draw the scene
+      app_scene->render((float)vx / vy);
+    }
+  };
+}
@@ -26,29 +26,10 @@ namespace octet {
       // material used by all spheres.
       material *mat = new material(vec4(1, 0, 0, 1));
 
-      // second material to show effect
-      material *mat2 = new material(vec4(0, 1, 0, 1));
-
-      // four different LOD models
-      mesh_sphere *spheres[] = {
-        new mesh_sphere(vec3(0), 0.5f, 3),
-        new mesh_sphere(vec3(0), 0.5f, 2),
-        new mesh_sphere(vec3(0), 0.5f, 1),
-        new mesh_sphere(vec3(0), 0.5f, 0)
-      };
-
-      // distances where LOD values change
-      static const float distances[] = {
-        //-1e37f, 3, 6, 18, 1e37f   // high performance, low quality
-        //-1e37f, 3, 6, 18, 1e37f   // high performance, low quality
-        -1e37f, 5, 15, 45, 1e37f  // medium performance and quality
-        //-1e37f, 5, 25, 125, 1e37f // low performance, high quality
-      };
-
-      // materials for LODs (it is common to have simpler shaders for further objects).
-      material *mats[] = {
-        mat, mat, mat, mat  // show smallest lod in different cocalclour
-      };
+      // the full sphere and four simpler versions of it, made by collapsing edges.
+      // each instance draws the simplest level whose error is under a pixel on screen.
+      ref<lod_group> lods = new lod_group(new mesh_sphere(vec3(0), 0.5f, 4));
+      lods->generate(4);
 
       int num_x = 10;
       int num_y = 5;
@@ -62,16 +43,9 @@ namespace octet {
             scene_node *node = new scene_node();
             node->translate(vec3((x-num_x*0.5f) * 2.0f, (y - num_y*0.5f) * 2.0f, -z * 2.0f));
             app_scene->add_child(node);
-            for (int k = 0; k != 4; ++k) {
-              // The mesh instance has a min and max distance.
-              // By choosing these carefully, we will draw only one of the four variants
-              // depending on distance.
-              mesh_instance *mi = new mesh_instance(node, spheres[k], mats[k]);
-              mi->set_min_draw_distance(distances[k]);
-              mi->set_max_draw_distance(distances[k+1]);
-              mi->set_flags(mesh_instance::flag_enabled|mesh_instance::flag_lod);
-              app_scene->add_mesh_instance(mi);
-            }
+            mesh_instance *mi = new mesh_instance(node, lods->get_mesh(0), mat);
+            mi->set_lod_group(lods);
+            app_scene->add_mesh_instance(mi);
           }
         }
       }
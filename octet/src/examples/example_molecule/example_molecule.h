@@ -236,7 +236,7 @@ namespace octet {
 
       glCullFace(GL_BACK);
       glFrontFace(GL_CW);
-      glEnable(GL_CULL_FACE);
+      gl_state::set_enabled(GL_CULL_FACE, true);
 
       /*scene_node *camera_node = app_scene->get_camera_instance(0)->get_node();
       scene_node *box_node = app_scene->get_mesh_instance(0)->get_node();
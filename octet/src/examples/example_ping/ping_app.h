@@ -226,7 +226,7 @@ namespace octet {
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
       // allow Z buffer depth testing (closer objects are always drawn in front of far ones)
-      glEnable(GL_DEPTH_TEST);
+      gl_state::set_enabled(GL_DEPTH_TEST, true);
 
       // draw the ball
       ball.render(color_shader_, cameraToWorld);
@@ -20,7 +20,7 @@ namespace octet {
       shader = new color_shader();
 
       glGenBuffers(1, &vertices);
-      glBindBuffer(GL_ARRAY_BUFFER, vertices);
+      gl_state::bind_buffer(GL_ARRAY_BUFFER, vertices);
 
       // corners (vertices) of the triangle
       static const float vertex_data[] = {
@@ -46,7 +46,7 @@ namespace octet {
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
       /// allow Z buffer depth testing (closer objects are always drawn in front of far ones)
-      glEnable(GL_DEPTH_TEST);
+      gl_state::set_enabled(GL_DEPTH_TEST, true);
 
       // we use a unit matrix will not change the (-1..1, -1..1, -1..1) xyz space of OpenGL
       mat4t modelToProjection;
@@ -59,7 +59,7 @@ namespace octet {
       glEnableVertexAttribArray(0);
 
       // use the buffer we made earlier.
-      glBindBuffer(GL_ARRAY_BUFFER, vertices);
+      gl_state::bind_buffer(GL_ARRAY_BUFFER, vertices);
 
       // tell OpenGL what kind of vertices we have
       glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), NULL);
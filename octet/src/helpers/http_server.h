@@ -31,6 +31,44 @@ namespace octet { namespace helpers {
       ioctlsocket(socket, FIONBIO, &mode);
     }
 
+    // /graph?operation=alloc_profile&callback=x
+    // tags and call sites, largest live bytes first. Empty unless built with OCTET_ALLOC_PROFILE.
+    void write_alloc_profile(dynarray<string> &response, const char *callback) {
+      static unsigned tag_order[alloc_profile::max_tags];
+      static unsigned site_order[alloc_profile::max_sites];
+      unsigned num_tags = 0, num_sites = 0;
+      alloc_profile::get_sorted(tag_order, num_tags, site_order, num_sites, alloc_profile::sort_live_bytes);
+      #if OCTET_ALLOC_PROFILE
+        int enabled = 1;
+      #else
+        int enabled = 0;
+      #endif
+
+      response.resize(response.size()+1);
+      response.back().format("%s({\"enabled\": %d, \"bytes\": %u, \"allocs\": %u, \"tags\": [\n", callback, enabled, (unsigned)allocator::get_num_bytes(), (unsigned)allocator::get_num_allocs());
+      for (unsigned i = 0; i != num_tags; ++i) {
+        alloc_profile::tag_t tag = alloc_profile::get_tag(tag_order[i]);
+        const alloc_profile::stats_t &st = tag.stats;
+        response.resize(response.size()+1);
+        response.back().format("%s{\"name\": \"%s\", \"allocs\": %u, \"frees\": %u, \"total\": %u, \"live\": %u, \"peak\": %u}\n",
+          i ? "," : "", tag.name, (unsigned)st.num_allocs, (unsigned)st.num_frees, (unsigned)st.total_bytes, (unsigned)st.live_bytes, (unsigned)st.peak_bytes
+        );
+      }
+
+      response.resize(response.size()+1);
+      response.back().format("], \"sites\": [\n");
+      for (unsigned i = 0; i != num_sites; ++i) {
+        alloc_profile::site_t site = alloc_profile::get_site(site_order[i]);
+        const alloc_profile::stats_t &st = site.stats;
+        response.resize(response.size()+1);
+        response.back().format("%s{\"caller\": \"%p\", \"tag\": \"%s\", \"allocs\": %u, \"total\": %u, \"live\": %u, \"peak\": %u}\n",
+          i ? "," : "", site.caller, alloc_profile::get_tag(site.tag).name, (unsigned)st.num_allocs, (unsigned)st.total_bytes, (unsigned)st.live_bytes, (unsigned)st.peak_bytes
+        );
+      }
+      response.resize(response.size()+1);
+      response.back().format("]})\n");
+    }
+
     void parse_http_request(session &s, char *p) {
       string header(p);
 
@@ -56,11 +94,13 @@ namespace octet { namespace helpers {
       string id;
       string callback;
       bool get_children = false;
+      bool get_alloc_profile = false;
       for (unsigned i = 0; i != ops.size(); ++i) {
         dynarray<string> lhsrhs;
         ops[i].split(lhsrhs, "=");
         if (lhsrhs[0] == "operation") {
           get_children = lhsrhs[1] == "get_children";
+          get_alloc_profile = lhsrhs[1] == "alloc_profile";
         } else if (lhsrhs[0] == "id") {
           id = lhsrhs[1];
         } else if (lhsrhs[0] == "callback") {
@@ -69,20 +109,24 @@ namespace octet { namespace helpers {
         //log("%s = %s\n", lhsrhs[0].c_str(), lhsrhs[1].c_str());
       }
 
-      if (!get_children) return;
+      if (!get_children && !get_alloc_profile) return;
 
       //dynarray<string> id_parts;
       //id.split(id_parts, ".");
 
       dynarray<string> response;
       response.reserve(64);
-      int max_depth = 5;
-      http_writer writer(0, max_depth, response);
-      response.resize(response.size()+1);
-      response.back().format("%s([\n", callback.c_str());
-      dict->visit(writer);
-      response.resize(response.size()+1);
-      response.back().format("])\n");
+      if (get_children) {
+        int max_depth = 5;
+        http_writer writer(0, max_depth, response);
+        response.resize(response.size()+1);
+        response.back().format("%s([\n", callback.c_str());
+        dict->visit(writer);
+        response.resize(response.size()+1);
+        response.back().format("])\n");
+      } else {
+        write_alloc_profile(response, callback.c_str());
+      }
 
       // With HTTP 1.1 we can keep the connection open and respond to more
       // feeds without the overhead of a new connection.
@@ -32,13 +32,13 @@ namespace octet { namespace loaders {
     dictionary<TiXmlElement *, allocator> ids;
     dynarray<float> temp_floats;
 
-    // find all the ids in an xml file
+    // find all the ids in an xml file (between ids.begin_bulk() and ids.end_bulk())
     void find_ids(TiXmlElement *parent) {
       for (TiXmlElement *elem = parent->FirstChildElement(); elem; elem = elem->NextSiblingElement()) {
         const char *attrib = elem->Attribute("id");
         if (attrib) {
           //printf("%s %s\n", elem->Value(), attrib);
-          ids[attrib] = elem;
+          ids.add_bulk(attrib, elem);
         }
         find_ids(elem);
       }
@@ -47,7 +47,8 @@ namespace octet { namespace loaders {
     TiXmlElement *find_id(const char *source) {
       if (source) {
         if (source[0] == '#') source++;
-        return ids[source];
+        int index = ids.get_index(source);
+        return index < 0 ? 0 : ids.get_value(index);
       }
       return 0;
     }
@@ -1233,7 +1234,9 @@ namespace octet { namespace loaders {
         return false;
       }
 
+      ids.begin_bulk(256);
       find_ids(top);
+      ids.end_bulk();
       return true;
     }
 
@@ -1273,19 +1276,37 @@ namespace octet { namespace loaders {
 
     // extract resources from the collada file into a collection.
     void get_resources(resource_dict &dict) {
-      add_images(dict);
+      {
+        OCTET_ALLOC_TAG("image");
+        add_images(dict);
+      }
 
-      add_materials(dict);
+      {
+        OCTET_ALLOC_TAG("material");
+        add_materials(dict);
+      }
 
-      add_geometry(dict);
+      {
+        OCTET_ALLOC_TAG("mesh");
+        add_geometry(dict);
+      }
 
-      add_controllers(dict);
+      {
+        OCTET_ALLOC_TAG("skin");
+        add_controllers(dict);
+      }
 
       // scenes refer to all the above
-      add_scenes(dict);
+      {
+        OCTET_ALLOC_TAG("scene");
+        add_scenes(dict);
+      }
 
       // animations refer to all other objects
-      add_animations(dict);
+      {
+        OCTET_ALLOC_TAG("animation");
+        add_animations(dict);
+      }
     }
   };
 }}
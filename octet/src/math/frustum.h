@@ -0,0 +1,160 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// view frustum: six half spaces
+//
+
+namespace octet { namespace math {
+  /// The volume that a camera can see, as six half spaces that point inwards.
+  ///
+  /// The planes come from the columns of a world to projection matrix, so any perspective
+  /// or ortho camera works. This is Gribb and Hartmann's method; their rows are our columns
+  /// because mat4t multiplies row vectors on the left.
+  ///
+  /// Example
+  ///
+  ///     frustum view(worldToCamera * cameraToProjection);
+  ///     if (view.intersects(bb)) draw();
+  class frustum {
+  public:
+    enum { num_planes = 6 };
+
+  private:
+    // dot(normal, p) + offset >= 0 for points inside.
+    // kept as separate arrays so that the box test can load one component for four boxes.
+    float nx[num_planes];
+    float ny[num_planes];
+    float nz[num_planes];
+    float offset[num_planes];
+
+    void set_plane(unsigned i, vec4_in value) {
+      float len = length(value.xyz());
+      float scale = len > 0 ? 1.0f / len : 0.0f;
+      nx[i] = value.x() * scale;
+      ny[i] = value.y() * scale;
+      nz[i] = value.z() * scale;
+      offset[i] = value.w() * scale;
+    }
+
+  public:
+    /// A frustum that contains everything.
+    frustum() {
+      for (unsigned i = 0; i != num_planes; ++i) {
+        nx[i] = ny[i] = nz[i] = 0;
+        offset[i] = 1;
+      }
+    }
+
+    /// The frustum of a world to projection matrix.
+    frustum(const mat4t &worldToProjection) {
+      init(worldToProjection);
+    }
+
+    /// Set the planes from a world to projection matrix.
+    /// Points are inside if -w <= x, y, z <= w after projection.
+    void init(const mat4t &worldToProjection) {
+      // we use row vectors, so projected x is dot(p, column 0) and so on.
+      const mat4t &m = worldToProjection;
+      vec4 col0(m[0][0], m[1][0], m[2][0], m[3][0]);
+      vec4 col1(m[0][1], m[1][1], m[2][1], m[3][1]);
+      vec4 col2(m[0][2], m[1][2], m[2][2], m[3][2]);
+      vec4 col3(m[0][3], m[1][3], m[2][3], m[3][3]);
+      set_plane(0, col3 + col0); // left
+      set_plane(1, col3 - col0); // right
+      set_plane(2, col3 + col1); // bottom
+      set_plane(3, col3 - col1); // top
+      set_plane(4, col3 + col2); // near
+      set_plane(5, col3 - col2); // far
+    }
+
+    /// Get one of the planes (left, right, bottom, top, near, far).
+    half_space get_plane(unsigned i) const {
+      return half_space(vec3(nx[i], ny[i], nz[i]), offset[i]);
+    }
+
+    /// Is this point inside?
+    bool intersects(const vec3 &rhs) const {
+      for (unsigned i = 0; i != num_planes; ++i) {
+        if (nx[i] * rhs.x() + ny[i] * rhs.y() + nz[i] * rhs.z() + offset[i] < 0) return false;
+      }
+      return true;
+    }
+
+    /// Is this sphere partly inside? (may give false positives near the corners)
+    bool intersects(const sphere &rhs) const {
+      vec3 c = rhs.get_center();
+      for (unsigned i = 0; i != num_planes; ++i) {
+        if (nx[i] * c.x() + ny[i] * c.y() + nz[i] * c.z() + offset[i] < -rhs.get_radius()) return false;
+      }
+      return true;
+    }
+
+    /// Is this box partly inside? (may give false positives near the corners)
+    bool intersects(const aabb &rhs) const {
+      vec3 c = rhs.get_center();
+      vec3 h = rhs.get_half_extent();
+      for (unsigned i = 0; i != num_planes; ++i) {
+        float distance = nx[i] * c.x() + ny[i] * c.y() + nz[i] * c.z() + offset[i];
+        float fatness = fabsf(nx[i]) * h.x() + fabsf(ny[i]) * h.y() + fabsf(nz[i]) * h.z();
+        if (distance < -fatness) return false;
+      }
+      return true;
+    }
+
+    /// Test many boxes, given as arrays of centres and half extents.
+    /// Sets visible[i] to 1 if box i is partly inside, 0 otherwise, and returns the number inside.
+    /// With SSE2, four boxes are tested at once.
+    unsigned intersects(uint8_t *visible, const float *cx, const float *cy, const float *cz, const float *hx, const float *hy, const float *hz, unsigned count) const {
+      unsigned num_visible = 0;
+      unsigned i = 0;
+      #if OCTET_SSE2
+        __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 pnx[num_planes], pny[num_planes], pnz[num_planes], pabx[num_planes], paby[num_planes], pabz[num_planes], poff[num_planes];
+        for (unsigned p = 0; p != num_planes; ++p) {
+          pnx[p] = _mm_set1_ps(nx[p]);
+          pny[p] = _mm_set1_ps(ny[p]);
+          pnz[p] = _mm_set1_ps(nz[p]);
+          pabx[p] = _mm_and_ps(pnx[p], abs_mask);
+          paby[p] = _mm_and_ps(pny[p], abs_mask);
+          pabz[p] = _mm_and_ps(pnz[p], abs_mask);
+          poff[p] = _mm_set1_ps(offset[p]);
+        }
+
+        for (; i + 4 <= count; i += 4) {
+          __m128 x = _mm_loadu_ps(cx + i), y = _mm_loadu_ps(cy + i), z = _mm_loadu_ps(cz + i);
+          __m128 ex = _mm_loadu_ps(hx + i), ey = _mm_loadu_ps(hy + i), ez = _mm_loadu_ps(hz + i);
+          __m128 outside = _mm_setzero_ps();
+          for (unsigned p = 0; p != num_planes; ++p) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pnx[p], x), _mm_mul_ps(pny[p], y)), _mm_add_ps(_mm_mul_ps(pnz[p], z), poff[p]));
+            __m128 fatness = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pabx[p], ex), _mm_mul_ps(paby[p], ey)), _mm_mul_ps(pabz[p], ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, fatness), _mm_setzero_ps()));
+          }
+          unsigned mask = (unsigned)_mm_movemask_ps(outside);
+          for (unsigned j = 0; j != 4; ++j) {
+            uint8_t v = (uint8_t)(((mask >> j) & 1) ^ 1);
+            visible[i + j] = v;
+            num_visible += v;
+          }
+        }
+      #endif
+
+      for (; i != count; ++i) {
+        uint8_t v = 1;
+        for (unsigned p = 0; p != num_planes; ++p) {
+          float distance = nx[p] * cx[i] + ny[p] * cy[i] + nz[p] * cz[i] + offset[p];
+          float fatness = fabsf(nx[p]) * hx[i] + fabsf(ny[p]) * hy[i] + fabsf(nz[p]) * hz[i];
+          if (distance + fatness < 0) {
+            v = 0;
+            break;
+          }
+        }
+        visible[i] = v;
+        num_visible += v;
+      }
+      return num_visible;
+    }
+  };
+} }
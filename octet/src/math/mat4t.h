@@ -646,6 +646,30 @@ namespace octet { namespace math {
     return (rhs[0] * lhs.xxxx() + rhs[1] * lhs.yyyy() + rhs[2] * lhs.zzzz() + rhs[3]).xyz();
   }
 
+  /// dest = lhs * rhs, using SSE2 if we have it. For batches of matrices, eg. world matrices and bone palettes.
+  /// dest may be lhs or rhs.
+  inline void multiply(mat4t &dest, const mat4t &lhs, const mat4t &rhs) {
+    #if OCTET_SSE2
+      const float *l = (const float*)&lhs;
+      const float *r = (const float*)&rhs;
+      float *d = (float*)&dest;
+      __m128 r0 = _mm_loadu_ps(r + 0);
+      __m128 r1 = _mm_loadu_ps(r + 4);
+      __m128 r2 = _mm_loadu_ps(r + 8);
+      __m128 r3 = _mm_loadu_ps(r + 12);
+      for (unsigned i = 0; i != 4; ++i) {
+        __m128 row = _mm_loadu_ps(l + i * 4);
+        __m128 sum = _mm_mul_ps(r0, _mm_shuffle_ps(row, row, 0x00));
+        sum = _mm_add_ps(sum, _mm_mul_ps(r1, _mm_shuffle_ps(row, row, 0x55)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(r2, _mm_shuffle_ps(row, row, 0xaa)));
+        sum = _mm_add_ps(sum, _mm_mul_ps(r3, _mm_shuffle_ps(row, row, 0xff)));
+        _mm_storeu_ps(d + i * 4, sum);
+      }
+    #else
+      dest = lhs * rhs;
+    #endif
+  }
+
   /// Get 3x4 inverse
   static inline mat4t inverse3x4(const mat4t &v) {
     return v.inverse3x4();
@@ -82,6 +82,7 @@ namespace octet {
 #include "sphere.h"
 #include "plane.h"
 #include "half_space.h"
+#include "frustum.h"
 #include "ray.h"
 #include "polygon.h"
 #include "zcylinder.h"
@@ -436,6 +436,7 @@ namespace octet { namespace math {
   public:
     vec3p() { v[0] = v[1] = v[2] = 0; }
     vec3p(const vec3p &in) { v[0] = in.v[0]; v[1] = in.v[1]; v[2] = in.v[2]; }
+    vec3p &operator=(const vec3p &in) { v[0] = in.v[0]; v[1] = in.v[1]; v[2] = in.v[2]; return *this; }
     vec3p(const vec3 &in) {
       #if OCTET_SSE
         static const u_m128_i4 mask = { -1, -1, -1, 0 };
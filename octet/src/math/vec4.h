@@ -44,6 +44,15 @@ namespace octet { namespace math {
       #endif
     }
 
+    OCTET_HOT vec4 &operator=(const vec4 &rhs) {
+      #if OCTET_SSE
+        m = rhs.m;
+      #else
+        v[0] = rhs.v[0]; v[1] = rhs.v[1]; v[2] = rhs.v[2]; v[3] = rhs.v[3];
+      #endif
+      return *this;
+    }
+
     OCTET_HOT vec4(float f) {
       #if OCTET_SSE
         m = _mm_set_ps1(f);
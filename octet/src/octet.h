@@ -102,6 +102,7 @@
   // target specific support: Windows, Mac, Linux, PS Vita
   #include "platform/machine_specific.h"
   #include "platform/args_parser.h"
+  #include "platform/thread_pool.h"
 
   // math library
   #include "math/math.h"
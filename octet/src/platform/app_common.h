@@ -22,6 +22,7 @@ namespace octet {
     attribute_blendindices = 7,
     attribute_texcoord = 8,
     attribute_uv = 8,
+    attribute_instance_matrix = 9, // four slots, 9 to 12, one for each row
     attribute_tangent = 14,
     attribute_bitangent = 15,
     attribute_binormal = 15,
@@ -106,6 +107,9 @@ namespace octet {
 
     void end_frame() {
       prev_keys = keys;
+
+      // recycle last frame's temporaries
+      frame_allocator::end_frame();
     }
 
     virtual void draw_world(int x, int y, int w, int h) = 0;
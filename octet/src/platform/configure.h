@@ -26,6 +26,11 @@
   #define OCTET_OPENCL 0
 #endif
 
+// 1 for atomic reference counts on resources (see ref.h)
+#ifndef OCTET_THREAD_SAFE_REFS
+  #define OCTET_THREAD_SAFE_REFS 0
+#endif
+
 #if defined(WIN32)
   #define OCTET_SSE 1
   #pragma warning(disable : 4996)
@@ -55,11 +60,44 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <utility>
 
 #if defined(WIN32)
   #include <direct.h>
 #endif
 
+// SSE2 integer compares, used by the containers. (x86 only)
+#if OCTET_SSE || defined(__SSE2__)
+  #define OCTET_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
+// thread local storage for per-thread caches (allocator magazines etc.)
+#if defined(WIN32)
+  #define OCTET_THREAD_LOCAL __declspec(thread)
+#else
+  #define OCTET_THREAD_LOCAL __thread
+#endif
+
+// the address that the current function returns to, and a way to keep a function out of line
+// so that this is its caller (see alloc_profile.h)
+#if defined(_MSC_VER)
+  #define OCTET_RETURN_ADDRESS() _ReturnAddress()
+  #define OCTET_NOINLINE __declspec(noinline)
+#else
+  #define OCTET_RETURN_ADDRESS() __builtin_return_address(0)
+  #define OCTET_NOINLINE __attribute__((noinline))
+#endif
+
 namespace octet {
   /// write some text to log.txt
   inline static FILE * log(const char *fmt, ...) {
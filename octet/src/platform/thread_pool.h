@@ -0,0 +1,158 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// worker threads for data parallel loops
+//
+
+namespace octet { namespace platform {
+  /// A fixed set of worker threads that share the iterations of a loop.
+  ///
+  /// The calling thread works on the loop too, and parallel_for returns when
+  /// every iteration is done. Loops smaller than one grain run on the calling thread.
+  ///
+  /// Example
+  ///
+  ///     thread_pool::get_default().parallel_for(num_items, 1024, [&](unsigned begin, unsigned end) {
+  ///       for (unsigned i = begin; i != end; ++i) items[i].update();
+  ///     });
+  ///
+  /// Note: a parallel_for inside a parallel_for runs on the calling thread.
+  class thread_pool {
+    typedef void (*job_fn_t)(void *context, unsigned begin, unsigned end);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+
+    // the current loop. written under the mutex before generation changes.
+    job_fn_t job_fn;
+    void *job_context;
+    unsigned job_count;
+    unsigned job_grain;
+    std::atomic<unsigned> job_next;
+
+    // incremented for each loop; workers wait for it to change.
+    unsigned generation;
+
+    // workers yet to finish the current loop.
+    unsigned num_pending;
+    bool quit;
+
+    // true on a thread that is running a loop.
+    static bool &in_loop() {
+      static OCTET_THREAD_LOCAL bool instance;
+      return instance;
+    }
+
+    template <class fn_t> static void call(void *context, unsigned begin, unsigned end) {
+      (*(fn_t*)context)(begin, end);
+    }
+
+    // take grains of the current loop until there are none left.
+    void run_grains() {
+      for (;;) {
+        unsigned begin = job_next.fetch_add(job_grain, std::memory_order_relaxed);
+        if (begin >= job_count) break;
+        unsigned end = job_count - begin < job_grain ? job_count : begin + job_grain;
+        job_fn(job_context, begin, end);
+      }
+    }
+
+    void worker_loop() {
+      in_loop() = true;
+      unsigned seen = 0;
+      for (;;) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          while (!quit && generation == seen) work_cv.wait(lock);
+          if (quit) break;
+          seen = generation;
+        }
+        run_grains();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--num_pending == 0) done_cv.notify_one();
+        }
+      }
+
+      // give this thread's cached blocks back before it exits.
+      allocator::flush_thread_cache();
+    }
+
+  public:
+    /// Start num_threads workers. 0 means one less than the number of cores.
+    thread_pool(unsigned num_threads = 0) {
+      job_fn = 0;
+      job_context = 0;
+      job_count = 0;
+      job_grain = 1;
+      job_next = 0;
+      generation = 0;
+      num_pending = 0;
+      quit = false;
+
+      if (num_threads == 0) {
+        unsigned num_cores = std::thread::hardware_concurrency();
+        num_threads = num_cores > 1 ? num_cores - 1 : 0;
+      }
+      for (unsigned i = 0; i != num_threads; ++i) {
+        workers.push_back(std::thread([this]() { worker_loop(); }));
+      }
+    }
+
+    /// Stop the workers.
+    ~thread_pool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+      }
+      work_cv.notify_all();
+      for (unsigned i = 0; i != workers.size(); ++i) {
+        workers[i].join();
+      }
+    }
+
+    /// number of threads that run loops, including the caller.
+    unsigned get_num_threads() const {
+      return (unsigned)workers.size() + 1;
+    }
+
+    /// Call fn(begin, end) on ranges of at most grain items that cover [0, count).
+    template <class fn_t> void parallel_for(unsigned count, unsigned grain, fn_t &&fn) {
+      if (grain == 0) grain = 1;
+      if (count <= grain || workers.empty() || in_loop()) {
+        if (count) fn(0, count);
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        job_fn = &call<typename std::remove_reference<fn_t>::type>;
+        job_context = (void*)&fn;
+        job_count = count;
+        job_grain = grain;
+        job_next = 0;
+        num_pending = (unsigned)workers.size();
+        generation++;
+      }
+      work_cv.notify_all();
+
+      in_loop() = true;
+      run_grains();
+      in_loop() = false;
+
+      std::unique_lock<std::mutex> lock(mutex);
+      while (num_pending != 0) done_cv.wait(lock);
+    }
+
+    /// The pool shared by the engine systems, started on first use.
+    static thread_pool &get_default() {
+      static thread_pool instance;
+      return instance;
+    }
+  };
+} }
@@ -190,8 +190,8 @@ namespace octet { namespace resources {
       // make a new texture handle
       GLuint handle = 0;
       glGenTextures(1, &handle);
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, handle);
+      gl_state::active_texture(0);
+      gl_state::bind_texture(0, GL_TEXTURE_2D, handle);
 
       glTexImage2D(GL_TEXTURE_2D, 0, gl_kind, width, height, 0, in_format, GL_UNSIGNED_BYTE, (void*)image);
 
@@ -201,6 +201,24 @@ namespace octet { namespace resources {
       return handle;
     }
 
+    /// Does the current GL context have at least this version?
+    /// OpenGL ES contexts are compared with the es_ numbers instead. eg. has_gl_version(3, 3, 3, 0)
+    static bool has_gl_version(int major, int minor, int es_major, int es_minor) {
+      static int version = -1;
+      static bool is_es;
+      if (version < 0) {
+        const char *str = (const char*)glGetString(GL_VERSION);
+        const char *es = str ? strstr(str, "OpenGL ES ") : 0;
+        int maj = 0, min = 0;
+        if (str) {
+          sscanf(es ? es + 10 : str, "%d.%d", &maj, &min);
+        }
+        version = maj * 100 + min;
+        is_es = es != 0;
+      }
+      return is_es ? version >= es_major * 100 + es_minor : version >= major * 100 + minor;
+    }
+
     /// Make an OpenAL sound buffer
     static ALuint make_sound_buffer(unsigned kind, unsigned rate, dynarray<unsigned char> &buffer, unsigned offset, unsigned size) {
       ALuint id = 0;
@@ -228,16 +246,22 @@ namespace octet { namespace resources {
 
       static int num_atoms = 0;
       if (num_atoms == 0) {
+        dict->begin_bulk(512);
         for (++num_atoms; predefined_atom(num_atoms); num_atoms++) {
-          (*dict)[predefined_atom(num_atoms)] = (atom_t)num_atoms;
+          dict->add_bulk(predefined_atom(num_atoms), (atom_t)num_atoms);
         }
+        dict->end_bulk();
       }
-      if (dict->contains(name)) {
-        //log("old atom %s %d\n", name, (*dict)[name]);
-        return (*dict)[name];
+      // hash the name once for both the lookup and the insert.
+      unsigned length;
+      unsigned hash = dictionary<atom_t>::calc_hash(name, length);
+      int index = dict->get_index(name, length, hash);
+      if (index >= 0) {
+        //log("old atom %s %d\n", name, dict->get_value(index));
+        return dict->get_value(index);
       } else {
         //log("new atom %s %d\n", name, num_atoms);
-        return (*dict)[name] = (atom_t)num_atoms++;
+        return dict->get(name, length, hash) = (atom_t)num_atoms++;
       }
     }
 
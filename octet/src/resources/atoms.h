@@ -144,3 +144,26 @@ OCTET_ATOM(npos)
 OCTET_ATOM(diffuse_light)
 OCTET_ATOM(specular_light)
 OCTET_ATOM(first_index)
+OCTET_ATOM(target_ratio)
+OCTET_ATOM(max_error)
+OCTET_ATOM(meshes)
+OCTET_ATOM(errors)
+OCTET_ATOM(pixel_error)
+OCTET_ATOM(hysteresis)
+OCTET_ATOM(clip)
+OCTET_ATOM(tracks)
+OCTET_ATOM(times)
+OCTET_ATOM(keys)
+OCTET_ATOM(raw_keys)
+OCTET_ATOM(lane_min)
+OCTET_ATOM(lane_scale)
+OCTET_ATOM(pose_size)
+OCTET_ATOM(quantized_size)
+OCTET_ATOM(weight)
+OCTET_ATOM(target_weight)
+OCTET_ATOM(fade_speed)
+OCTET_ATOM(layer)
+OCTET_ATOM(cluster_params)
+OCTET_ATOM(cluster_grid)
+OCTET_ATOM(cluster_indices)
+OCTET_ATOM(cluster_lights)
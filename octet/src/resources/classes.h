@@ -10,6 +10,7 @@ OCTET_CLASS(scene, indexer)
 OCTET_CLASS(scene, material)
 OCTET_CLASS(scene, image)
 OCTET_CLASS(scene, animation)
+OCTET_CLASS(scene, animation_clip)
 OCTET_CLASS(scene, light)
 OCTET_CLASS(scene, camera_instance)
 OCTET_CLASS(scene, light_instance)
@@ -36,4 +37,7 @@ OCTET_CLASS(scene, mesh_voxel_grid)
 #endif
 OCTET_CLASS(scene, mesh_points)
 OCTET_CLASS(scene, mesh_cylinder)
+OCTET_CLASS(scene, simplifier)
+OCTET_CLASS(scene, lod_group)
+OCTET_CLASS(scene, skinner)
 //OCTET_CLASS(scene, value)
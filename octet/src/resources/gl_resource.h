@@ -23,6 +23,14 @@ namespace octet { namespace resources {
     // GL_ARRAY_BUFFER etc.
     GLuint target;
 
+    // changed whenever the contents may have changed. unique across all buffers.
+    mutable unsigned version;
+
+    static unsigned next_version() {
+      static unsigned counter;
+      return ++counter;
+    }
+
   public:
     /// Helper class to make a write-only lock
     class wolock {
@@ -70,6 +78,7 @@ namespace octet { namespace resources {
     /// Make a new OpenGL Resource
     gl_resource(unsigned target=0, unsigned size=0) {
       buffer = 0;
+      version = next_version();
       this->target = target;
       if (size) {
         allocate(target, size);
@@ -88,7 +97,7 @@ namespace octet { namespace resources {
     void allocate(GLuint target, size_t size, GLuint kind = GL_STATIC_DRAW) {
       reset();
       glGenBuffers(1, &buffer);
-      glBindBuffer(target, buffer);
+      gl_state::bind_buffer(target, buffer);
       glBufferData(target, size, NULL, kind);
       #ifdef OCTET_GLES2
         bytes.resize(size);
@@ -96,18 +105,38 @@ namespace octet { namespace resources {
         this->size = size;
       #endif
       this->target = target;
-      glBindBuffer(target, 0);
+      version = next_version();
+      gl_state::bind_buffer(target, 0);
+    }
+
+    /// Replace the whole contents with new data, for buffers that change every frame.
+    /// The old storage is orphaned so that we do not wait for draws that still use it.
+    void stream(GLuint target, const void *ptr, size_t size) {
+      if (buffer == 0) {
+        glGenBuffers(1, &buffer);
+      }
+      gl_state::bind_buffer(target, buffer);
+      glBufferData(target, size, ptr, GL_STREAM_DRAW);
+      #ifdef OCTET_GLES2
+        bytes.resize(size);
+        if (size) memcpy(&bytes[0], ptr, size);
+      #else
+        this->size = size;
+      #endif
+      this->target = target;
+      version = next_version();
     }
 
     /// Clear the OpenGL object
     void reset() {
       if (buffer != 0) {
-        glDeleteBuffers(1, &buffer);
+        gl_state::delete_buffer(buffer);
       }
       #ifdef OCTET_GLES2
         bytes.reset();
       #endif
       buffer = 0;
+      version = next_version();
     }
 
     /// Destructor
@@ -129,6 +158,12 @@ namespace octet { namespace resources {
       #endif
     }
 
+    /// A number that changes whenever the buffer is written, for caching data made from it.
+    /// No two buffers share a version.
+    unsigned get_version() const {
+      return version;
+    }
+
     /// get the GL buffer object we are wrapping.
     GLuint get_buffer() const {
       return buffer;
@@ -140,7 +175,7 @@ namespace octet { namespace resources {
       #ifdef OCTET_GLES2
         return (const void*)&bytes[0];
       #else
-        glBindBuffer(target, buffer);
+        gl_state::bind_buffer(target, buffer);
         #ifdef __APPLE__
           // OSX does not support glMapBufferRange 
           return glMapBuffer(target, GL_READ_ONLY);
@@ -154,7 +189,7 @@ namespace octet { namespace resources {
     /// deprecated
     void unlock_read_only() const {
       #ifndef OCTET_GLES2
-        glBindBuffer(target, buffer);
+        gl_state::bind_buffer(target, buffer);
         glUnmapBuffer(target);
       #endif
     }
@@ -165,7 +200,7 @@ namespace octet { namespace resources {
       #ifdef OCTET_GLES2
         return (void*)&bytes[0];
       #else
-        glBindBuffer(target, buffer);
+        gl_state::bind_buffer(target, buffer);
         #ifdef __APPLE__
           // OSX does not support glMapBufferRange 
           void *res = glMapBuffer(target, GL_READ_WRITE);
@@ -179,8 +214,9 @@ namespace octet { namespace resources {
     /// release a read-write lock
     /// deprecated
     void unlock() const {
+      version = next_version();
       #ifdef OCTET_GLES2
-        glBindBuffer(target, buffer);
+        gl_state::bind_buffer(target, buffer);
         glBufferSubData(target, 0, bytes.size(), &bytes[0]);
       #else
         glUnmapBuffer(target);
@@ -193,7 +229,7 @@ namespace octet { namespace resources {
       #ifdef OCTET_GLES2
         return (void*)&bytes[0];
       #else
-        glBindBuffer(target, buffer);
+        gl_state::bind_buffer(target, buffer);
         #ifdef __APPLE__
           // OSX does not support glMapBufferRange 
           return glMapBuffer(target, GL_WRITE_ONLY);
@@ -206,8 +242,9 @@ namespace octet { namespace resources {
     /// release a read-write lock
     /// deprecated
     void unlock_write_only() const {
+      version = next_version();
       #ifdef OCTET_GLES2
-        glBindBuffer(target, buffer);
+        gl_state::bind_buffer(target, buffer);
         glBufferSubData(target, 0, bytes.size(), &bytes[0]);
       #else
         glUnmapBuffer(target);
@@ -216,7 +253,7 @@ namespace octet { namespace resources {
 
     /// bind the resource to the target
     void bind() const {
-      glBindBuffer(target, buffer);
+      gl_state::bind_buffer(target, buffer);
     }
 
     /// copy data into the resource
@@ -0,0 +1,253 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Shadow copy of the OpenGL state so that redundant calls can be skipped.
+//
+
+namespace octet { namespace resources {
+  /// Tracks the OpenGL state that octet sets and skips calls that would not change it.
+  /// The driver is never asked for the current state; anything we have not set ourselves is "unknown"
+  /// and the first call always goes through.
+  /// If you call GL directly (eg. glBindTexture), call invalidate() afterwards.
+  class gl_state {
+  public:
+    /// Calls made through gl_state since the last begin_frame()
+    struct stats {
+      /// calls passed on to OpenGL
+      unsigned num_calls;
+
+      /// calls skipped because the state was already set
+      unsigned num_skipped;
+    };
+
+  private:
+    enum {
+      unknown = ~0u,
+      max_texture_units = 16,
+      num_buffer_targets = 2,
+      num_texture_targets = 2,
+    };
+
+    // enable flags we track. unknown flags are passed through.
+    enum cap_type {
+      cap_blend,
+      cap_depth_test,
+      cap_cull_face,
+      cap_sample_alpha_to_coverage,
+      cap_sample_coverage,
+      num_caps,
+    };
+
+    struct state {
+      GLuint program;
+      GLuint vertex_array;
+      GLuint buffers[num_buffer_targets];
+      GLuint active_texture;
+      GLuint textures[max_texture_units][num_texture_targets];
+      unsigned caps[num_caps];
+      GLuint blend_src;
+      GLuint blend_dst;
+      GLint sample_buffers;
+      bool has_sample_buffers;
+      stats frame_stats;
+    };
+
+    static state &get() {
+      static state *value;
+      if (!value) {
+        value = new state();
+        memset(&value->frame_stats, 0, sizeof(value->frame_stats));
+        forget(*value);
+      }
+      return *value;
+    }
+
+    static void forget(state &s) {
+      s.program = unknown;
+      s.vertex_array = unknown;
+      for (unsigned i = 0; i != num_buffer_targets; ++i) s.buffers[i] = unknown;
+      s.active_texture = unknown;
+      for (unsigned i = 0; i != max_texture_units; ++i) {
+        for (unsigned j = 0; j != num_texture_targets; ++j) s.textures[i][j] = unknown;
+      }
+      for (unsigned i = 0; i != num_caps; ++i) s.caps[i] = unknown;
+      s.blend_src = s.blend_dst = unknown;
+      s.has_sample_buffers = false;
+    }
+
+    // returns true if the call is needed and counts it.
+    static bool update(GLuint &cached, GLuint value) {
+      state &s = get();
+      if (cached == value) {
+        s.frame_stats.num_skipped++;
+        return false;
+      }
+      cached = value;
+      s.frame_stats.num_calls++;
+      return true;
+    }
+
+    static int buffer_index(GLenum target) {
+      switch (target) {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_ELEMENT_ARRAY_BUFFER: return 1;
+        default: return -1;
+      }
+    }
+
+    static int texture_index(GLenum target) {
+      switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_CUBE_MAP: return 1;
+        default: return -1;
+      }
+    }
+
+    static int cap_index(GLenum cap) {
+      switch (cap) {
+        case GL_BLEND: return cap_blend;
+        case GL_DEPTH_TEST: return cap_depth_test;
+        case GL_CULL_FACE: return cap_cull_face;
+        case GL_SAMPLE_ALPHA_TO_COVERAGE: return cap_sample_alpha_to_coverage;
+        case GL_SAMPLE_COVERAGE: return cap_sample_coverage;
+        default: return -1;
+      }
+    }
+
+  public:
+    /// Forget everything we know about the GL state, eg. after calling GL directly.
+    static void invalidate() {
+      forget(get());
+    }
+
+    /// Reset the call counts. visual_scene::begin_render() does this.
+    static void begin_frame() {
+      memset(&get().frame_stats, 0, sizeof(stats));
+    }
+
+    /// Get the call counts since the last begin_frame()
+    static const stats &get_stats() {
+      return get().frame_stats;
+    }
+
+    /// glUseProgram
+    static void use_program(GLuint program) {
+      if (update(get().program, program)) {
+        glUseProgram(program);
+      }
+    }
+
+    /// glBindBuffer. The element array binding belongs to the vertex array object, so it is tracked per bind_vertex_array().
+    static void bind_buffer(GLenum target, GLuint buffer) {
+      int idx = buffer_index(target);
+      if (idx < 0) {
+        get().frame_stats.num_calls++;
+        glBindBuffer(target, buffer);
+      } else if (update(get().buffers[idx], buffer)) {
+        glBindBuffer(target, buffer);
+      }
+    }
+
+    /// glDeleteBuffers. GL unbinds deleted buffers, so we must too as the name may be reused.
+    static void delete_buffer(GLuint buffer) {
+      state &s = get();
+      for (unsigned i = 0; i != num_buffer_targets; ++i) {
+        if (s.buffers[i] == buffer) s.buffers[i] = unknown;
+      }
+      glDeleteBuffers(1, &buffer);
+    }
+
+    /// glBindVertexArray
+    static void bind_vertex_array(GLuint vertex_array) {
+      #ifndef OCTET_GLES2
+        state &s = get();
+        if (update(s.vertex_array, vertex_array)) {
+          glBindVertexArray(vertex_array);
+          s.buffers[buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = unknown;
+        }
+      #endif
+    }
+
+    /// glDeleteVertexArrays. Deleting the bound vertex array object binds object zero.
+    static void delete_vertex_array(GLuint vertex_array) {
+      #ifndef OCTET_GLES2
+        state &s = get();
+        if (s.vertex_array == vertex_array) {
+          s.vertex_array = 0;
+          s.buffers[buffer_index(GL_ELEMENT_ARRAY_BUFFER)] = unknown;
+        }
+        glDeleteVertexArrays(1, &vertex_array);
+      #endif
+    }
+
+    /// glActiveTexture. unit is 0, 1, 2... not GL_TEXTURE0 etc.
+    static void active_texture(unsigned unit) {
+      if (update(get().active_texture, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+      }
+    }
+
+    /// glBindTexture on a texture unit. The active texture unit is only changed if the binding changes,
+    /// so call active_texture() as well if you are going to use glTexImage2D etc.
+    static void bind_texture(unsigned unit, GLenum target, GLuint texture) {
+      state &s = get();
+      int idx = texture_index(target);
+      if (idx >= 0 && unit < max_texture_units) {
+        if (s.textures[unit][idx] == texture) {
+          s.frame_stats.num_skipped++;
+          return;
+        }
+        s.textures[unit][idx] = texture;
+      }
+      active_texture(unit);
+      s.frame_stats.num_calls++;
+      glBindTexture(target, texture);
+    }
+
+    /// glDeleteTextures. GL unbinds deleted textures from every unit, so we must too as the name may be reused.
+    static void delete_texture(GLuint texture) {
+      state &s = get();
+      for (unsigned i = 0; i != max_texture_units; ++i) {
+        for (unsigned j = 0; j != num_texture_targets; ++j) {
+          if (s.textures[i][j] == texture) s.textures[i][j] = unknown;
+        }
+      }
+      glDeleteTextures(1, &texture);
+    }
+
+    /// glEnable or glDisable
+    static void set_enabled(GLenum cap, bool value) {
+      int idx = cap_index(cap);
+      if (idx < 0 || update(get().caps[idx], value)) {
+        if (idx < 0) get().frame_stats.num_calls++;
+        if (value) glEnable(cap); else glDisable(cap);
+      }
+    }
+
+    /// glBlendFunc
+    static void blend_func(GLenum src, GLenum dst) {
+      state &s = get();
+      if (s.blend_src == src && s.blend_dst == dst) {
+        s.frame_stats.num_skipped++;
+        return;
+      }
+      s.blend_src = src;
+      s.blend_dst = dst;
+      s.frame_stats.num_calls++;
+      glBlendFunc(src, dst);
+    }
+
+    /// GL_SAMPLE_BUFFERS of the framebuffer, only asked for once.
+    static GLint get_sample_buffers() {
+      state &s = get();
+      if (!s.has_sample_buffers) {
+        glGetIntegerv(GL_SAMPLE_BUFFERS, &s.sample_buffers);
+        s.has_sample_buffers = true;
+      }
+      return s.sample_buffers;
+    }
+  };
+} }
@@ -8,6 +8,9 @@
 //
 // This class is a base class for most of the allocatable objects in the engine.
 // It provides automation for casts, saving and loading.
+//
+// Reference counts are plain ints unless built with -D OCTET_THREAD_SAFE_REFS=1.
+// weak_ref<> points at a resource without keeping it alive.
 
 // this macro implements standard functions for each class
 #define RESOURCE_META(classname) \
@@ -16,16 +19,95 @@
   static atom_t get_type_static() { return atom_##classname; }
 
 namespace octet { namespace resources {
+  class resource;
+
+  /// Shared between a resource and its weak references.
+  ///
+  /// Made when the first weak_ref is taken and freed when the resource and all of
+  /// its weak references have gone. The lock stops a weak_ref reviving a resource
+  /// while it is being destroyed.
+  class weak_link {
+    // weak references plus one for the resource while it is alive.
+    ref_count_t num_refs;
+
+    // guards object
+    std::atomic<int> lock_flag;
+
+    // null once the resource is destroyed
+    resource *object;
+
+    void lock_object() {
+      while (lock_flag.exchange(1, std::memory_order_acquire)) {}
+    }
+
+    void unlock_object() {
+      lock_flag.store(0, std::memory_order_release);
+    }
+
+  public:
+    weak_link(resource *object) : lock_flag(0), object(object) {
+      num_refs.increment();
+    }
+
+    void add_ref() {
+      num_refs.increment();
+    }
+
+    void release() {
+      if (num_refs.decrement()) {
+        delete this;
+      }
+    }
+
+    /// get the resource with an extra life, or null if it is dead or dying.
+    resource *lock();
+
+    /// true if the resource has been destroyed.
+    bool expired() {
+      lock_object();
+      bool result = object == 0;
+      unlock_object();
+      return result;
+    }
+
+    /// called by the resource destructor.
+    void expire() {
+      lock_object();
+      object = 0;
+      unlock_object();
+      release();
+    }
+
+    void *operator new (size_t size) {
+      return allocator::malloc(size);
+    }
+
+    void operator delete (void *ptr, size_t size) {
+      return allocator::free(ptr, size);
+    }
+  };
+
   /// Base class for resources; provides aligned allocation and reference counting.
   class resource {
     // how many lives do we have?
-    int ref_count;
+    ref_count_t ref_count;
+
+    // made on demand by get_weak_link()
+    std::atomic<weak_link*> weak;
 
   public:
     /// Make a new resource with no lives.
     /// Adding it to a ref<> will give it a life.
-    resource() {
-      ref_count = 0;
+    resource() : weak(0) {
+    }
+
+    /// A copy is a new object; it starts with no lives and no weak references.
+    resource(const resource &) : weak(0) {
+    }
+
+    /// Assigning a resource (eg. mesh contents) keeps our own lives and weak references.
+    resource &operator=(const resource &) {
+      return *this;
     }
 
     /// factory for making new resources of various kinds
@@ -51,20 +133,47 @@ namespace octet { namespace resources {
 
     /// destructors must be virtual or they may not get called!
     virtual ~resource() {
+      weak_link *link = weak.load(std::memory_order_acquire);
+      if (link) link->expire();
     }
 
     /// Give this resource an extra life; see the %ref class.
     void add_ref() {
-      ref_count++;
+      ref_count.increment();
     }
 
     /// Remove a life from this resource and delete it if it is dead; see the %ref class.
     void release() {
-      if (--ref_count == 0) {
+      if (ref_count.decrement()) {
         delete this;
       }
     }
 
+    /// Give this resource an extra life unless it has none. Used by weak_ref.
+    bool try_add_ref() {
+      return ref_count.increment_if_live();
+    }
+
+    /// number of lives. Only a hint if other threads hold refs.
+    int get_ref_count() const {
+      return ref_count.get();
+    }
+
+    /// get the link used by weak references, making it if necessary.
+    weak_link *get_weak_link() {
+      weak_link *link = weak.load(std::memory_order_acquire);
+      if (!link) {
+        weak_link *new_link = new weak_link(this);
+        if (weak.compare_exchange_strong(link, new_link, std::memory_order_acq_rel, std::memory_order_acquire)) {
+          link = new_link;
+        } else {
+          // another thread got there first.
+          delete new_link;
+        }
+      }
+      return link;
+    }
+
     /// use the allocator to allocate this resource and its child classes
     void *operator new (size_t size) {
       return allocator::malloc(size);
@@ -83,5 +192,118 @@ namespace octet { namespace resources {
     #include "classes.h"
     #undef OCTET_CLASS
   };
+
+  inline resource *weak_link::lock() {
+    lock_object();
+    resource *result = object && object->try_add_ref() ? object : 0;
+    unlock_object();
+    return result;
+  }
+
+  /// A pointer to a resource that does not keep it alive.
+  ///
+  /// Use this to break cycles (eg. a child pointing at its parent) or for caches.
+  /// lock() returns a ref that keeps the resource alive, or an empty ref if the resource
+  /// has been destroyed. A resource with no refs at all (count zero) also locks to empty.
+  ///
+  /// Example
+  ///
+  ///     weak_ref<mesh> weak = my_mesh;
+  ///     ...
+  ///     ref<mesh> strong = weak.lock();
+  ///     if (strong) strong->get_num_vertices();
+  template <class item_t> class weak_ref {
+    weak_link *link;
+
+    void set(weak_link *new_link) {
+      if (new_link) new_link->add_ref();
+      if (link) link->release();
+      link = new_link;
+    }
+
+  public:
+    /// empty weak reference
+    weak_ref() {
+      link = 0;
+    }
+
+    /// weak reference to an item
+    weak_ref(item_t *item) {
+      link = 0;
+      if (item) set(item->get_weak_link());
+    }
+
+    /// weak reference to the item in a ref
+    weak_ref(const ref<item_t> &item) {
+      link = 0;
+      if (item) set(item->get_weak_link());
+    }
+
+    weak_ref(const weak_ref &rhs) {
+      link = 0;
+      set(rhs.link);
+    }
+
+    weak_ref(weak_ref &&rhs) {
+      link = rhs.link;
+      rhs.link = 0;
+    }
+
+    weak_ref &operator=(const weak_ref &rhs) {
+      set(rhs.link);
+      return *this;
+    }
+
+    weak_ref &operator=(weak_ref &&rhs) {
+      if (this != &rhs) {
+        if (link) link->release();
+        link = rhs.link;
+        rhs.link = 0;
+      }
+      return *this;
+    }
+
+    weak_ref &operator=(item_t *item) {
+      set(item ? item->get_weak_link() : 0);
+      return *this;
+    }
+
+    weak_ref &operator=(const ref<item_t> &item) {
+      set(item ? item->get_weak_link() : 0);
+      return *this;
+    }
+
+    ~weak_ref() {
+      if (link) link->release();
+    }
+
+    /// get a strong reference, empty if the item has gone.
+    ref<item_t> lock() const {
+      ref<item_t> result;
+      resource *object = link ? link->lock() : 0;
+      if (object) {
+        result = static_cast<item_t*>(object);
+        object->release();
+      }
+      return result;
+    }
+
+    /// true if there is no item or it has been destroyed.
+    bool expired() const {
+      return !link || link->expired();
+    }
+
+    /// forget the item.
+    void reset() {
+      set(0);
+    }
+  };
+} }
+
+namespace octet { namespace containers {
+  /// weak_ref is only a pointer, so arrays of them can be moved with memcpy.
+  template <class item_t> struct is_trivially_relocatable<resources::weak_ref<item_t> > {
+    enum { value = 1 };
+  };
 } }
 
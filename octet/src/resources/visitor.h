@@ -217,8 +217,8 @@ namespace octet { namespace resources {
       }
     }
 
-    /// Call this in your "visit" method for dynarrays of references
-    template <class type> void visit(dynarray<ref<type> > &value, atom_t sid) {
+    // dynarray and small_dynarray of references
+    template <class type, class array_t> void visit_ref_array(array_t &value, atom_t sid) {
       if (error) return;
       int size = value.size();
       if (begin_refs(sid, size, false)) {
@@ -263,6 +263,16 @@ namespace octet { namespace resources {
       }
     }
 
+    /// Call this in your "visit" method for dynarrays of references
+    template <class type> void visit(dynarray<ref<type> > &value, atom_t sid) {
+      visit_ref_array<type>(value, sid);
+    }
+
+    /// Call this in your "visit" method for small_dynarrays of references
+    template <class type, unsigned inline_capacity> void visit(small_dynarray<ref<type>, inline_capacity> &value, atom_t sid) {
+      visit_ref_array<type>(value, sid);
+    }
+
     /// Call this in your "visit" method for dictionaries
     template <class type> void visit(dictionary<ref<type> > &value, atom_t sid) {
       if (error) return;
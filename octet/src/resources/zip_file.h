@@ -100,7 +100,7 @@ namespace octet { namespace resources {
 
     /// allow ref<zip_file>
     void release() {
-      if (--ref_cnt) {
+      if (--ref_cnt == 0) {
         delete this;
       }
     }
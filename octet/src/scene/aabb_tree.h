@@ -0,0 +1,409 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// dynamic bounding volume tree for scene queries
+//
+
+namespace octet { namespace scene {
+  /// Binary tree of boxes that can change while the game runs.
+  ///
+  /// Each item is a leaf with a "fat" box a little bigger than the item.
+  /// Moving an item only changes the tree when it leaves its fat box, and
+  /// the tree is kept balanced by rotations as items come and go,
+  /// so queries visit O(log n) nodes rather than every item.
+  ///
+  /// Example
+  ///
+  ///     aabb_tree<mesh_instance*> tree;
+  ///     int proxy = tree.insert(bb, mi);
+  ///     tree.move(proxy, new_bb);
+  ///     tree.query(view_frustum, [&](int proxy) { draw(tree.get_item(proxy)); });
+  ///     tree.remove(proxy);
+  ///
+  /// Proxies are indices that stay the same until remove().
+  template <class item_t> class aabb_tree {
+    enum { null_node = -1 };
+
+    struct node_t {
+      vec3 lo;
+      vec3 hi;
+
+      // parent, or next free node when not in use.
+      int parent;
+
+      // child[0] is null_node for leaves.
+      int child[2];
+
+      // 0 for leaves, -1 for free nodes.
+      int height;
+
+      item_t item;
+    };
+
+    dynarray<node_t> nodes;
+    int root;
+    int free_list;
+    unsigned num_items;
+
+    // fat boxes grow by this much plus fat_scale times the half extent.
+    float fat_margin;
+    float fat_scale;
+
+    bool is_leaf(int index) const {
+      return nodes[index].child[0] == null_node;
+    }
+
+    // half the surface area; the chance that a random ray hits the box.
+    static float cost(const vec3 &lo, const vec3 &hi) {
+      vec3 d = hi - lo;
+      return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+    }
+
+    int alloc_node() {
+      int index = free_list;
+      if (index == null_node) {
+        index = (int)nodes.size();
+        nodes.resize(nodes.size() + 1);
+      } else {
+        free_list = nodes[index].parent;
+      }
+      node_t &n = nodes[index];
+      n.parent = null_node;
+      n.child[0] = n.child[1] = null_node;
+      n.height = 0;
+      return index;
+    }
+
+    void free_node(int index) {
+      nodes[index].parent = free_list;
+      nodes[index].height = -1;
+      free_list = index;
+    }
+
+    // recalculate the box and height of an inner node from its children.
+    void fit(int index) {
+      node_t &n = nodes[index];
+      const node_t &a = nodes[n.child[0]];
+      const node_t &b = nodes[n.child[1]];
+      n.lo = min(a.lo, b.lo);
+      n.hi = max(a.hi, b.hi);
+      n.height = 1 + (a.height > b.height ? a.height : b.height);
+    }
+
+    void replace_child(int parent, int old_child, int new_child) {
+      if (parent == null_node) {
+        root = new_child;
+      } else {
+        node_t &p = nodes[parent];
+        p.child[p.child[0] == old_child ? 0 : 1] = new_child;
+      }
+    }
+
+    // if one child of a is two levels taller than the other, rotate it up to replace a.
+    // returns the index of the new subtree root.
+    int balance(int a) {
+      if (is_leaf(a) || nodes[a].height < 2) return a;
+
+      int b = nodes[a].child[0];
+      int c = nodes[a].child[1];
+      int diff = nodes[c].height - nodes[b].height;
+      if (diff >= -1 && diff <= 1) return a;
+
+      // "up" is the taller child, it takes a's place; "side" (which stays under a) is its shorter child.
+      int up_slot = diff > 1 ? 1 : 0;
+      int up = nodes[a].child[up_slot];
+      int f = nodes[up].child[0];
+      int g = nodes[up].child[1];
+      int keep = nodes[f].height > nodes[g].height ? f : g;
+      int side = keep == f ? g : f;
+
+      nodes[up].parent = nodes[a].parent;
+      replace_child(nodes[a].parent, a, up);
+
+      nodes[up].child[0] = a;
+      nodes[up].child[1] = keep;
+      nodes[a].parent = up;
+
+      nodes[a].child[up_slot] = side;
+      nodes[side].parent = a;
+
+      fit(a);
+      fit(up);
+      return up;
+    }
+
+    // fix boxes and heights from index to the root.
+    void refit_ancestors(int index) {
+      while (index != null_node) {
+        index = balance(index);
+        fit(index);
+        index = nodes[index].parent;
+      }
+    }
+
+    void insert_leaf(int leaf) {
+      if (root == null_node) {
+        root = leaf;
+        nodes[leaf].parent = null_node;
+        return;
+      }
+
+      // walk down to the sibling that adds the least surface area to the tree.
+      vec3 lo = nodes[leaf].lo, hi = nodes[leaf].hi;
+      int index = root;
+      while (!is_leaf(index)) {
+        const node_t &n = nodes[index];
+        vec3 union_lo = min(n.lo, lo), union_hi = max(n.hi, hi);
+        float area = cost(n.lo, n.hi);
+        float union_area = cost(union_lo, union_hi);
+
+        // cost of a new parent here, and the cost pushed down to the children.
+        float cost_here = 2.0f * union_area;
+        float inherited = 2.0f * (union_area - area);
+
+        float child_cost[2];
+        for (int i = 0; i != 2; ++i) {
+          const node_t &c = nodes[n.child[i]];
+          float grown = cost(min(c.lo, lo), max(c.hi, hi));
+          child_cost[i] = (c.child[0] == null_node ? grown : grown - cost(c.lo, c.hi)) + inherited;
+        }
+
+        if (cost_here < child_cost[0] && cost_here < child_cost[1]) break;
+        index = child_cost[0] < child_cost[1] ? n.child[0] : n.child[1];
+      }
+
+      int sibling = index;
+      int old_parent = nodes[sibling].parent;
+      int new_parent = alloc_node();
+      node_t &p = nodes[new_parent];
+      p.parent = old_parent;
+      p.child[0] = sibling;
+      p.child[1] = leaf;
+      replace_child(old_parent, sibling, new_parent);
+      nodes[sibling].parent = new_parent;
+      nodes[leaf].parent = new_parent;
+
+      refit_ancestors(new_parent);
+    }
+
+    void remove_leaf(int leaf) {
+      if (leaf == root) {
+        root = null_node;
+        return;
+      }
+
+      int parent = nodes[leaf].parent;
+      int grand_parent = nodes[parent].parent;
+      int sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+
+      replace_child(grand_parent, parent, sibling);
+      nodes[sibling].parent = grand_parent;
+      free_node(parent);
+
+      refit_ancestors(grand_parent);
+    }
+
+    void set_fat_box(int index, const aabb &box) {
+      vec3 half = box.get_half_extent();
+      vec3 grow = half * fat_scale + vec3(fat_margin);
+      nodes[index].lo = box.get_min() - grow;
+      nodes[index].hi = box.get_max() + grow;
+    }
+
+    // call fn(proxy) for leaves where test(lo, hi) is true, skipping subtrees that fail.
+    template <class test_t, class fn_t> void query_impl(test_t test, fn_t fn) const {
+      if (root == null_node) return;
+      small_dynarray<int, 64> stack;
+      stack.push_back(root);
+      while (!stack.empty()) {
+        int index = stack.back();
+        stack.pop_back();
+        const node_t &n = nodes[index];
+        if (!test(n.lo, n.hi)) continue;
+        if (n.child[0] == null_node) {
+          fn(index);
+        } else {
+          stack.push_back(n.child[0]);
+          stack.push_back(n.child[1]);
+        }
+      }
+    }
+
+  public:
+    /// Make an empty tree. margin and scale set how much bigger than the items the leaf boxes are.
+    aabb_tree(float margin = 0.1f, float scale = 0.125f) {
+      root = null_node;
+      free_list = null_node;
+      num_items = 0;
+      fat_margin = margin;
+      fat_scale = scale;
+    }
+
+    /// Add an item with a world space box. Returns the proxy for the item.
+    int insert(const aabb &box, const item_t &item) {
+      int leaf = alloc_node();
+      nodes[leaf].item = item;
+      set_fat_box(leaf, box);
+      insert_leaf(leaf);
+      num_items++;
+      return leaf;
+    }
+
+    /// Take an item out of the tree. The proxy may be reused by a later insert().
+    void remove(int proxy) {
+      assert(is_proxy(proxy));
+      remove_leaf(proxy);
+      free_node(proxy);
+      num_items--;
+    }
+
+    /// The item has moved to box. Returns true if the tree changed; false if
+    /// the box is still inside the leaf's fat box.
+    bool move(int proxy, const aabb &box) {
+      assert(is_proxy(proxy));
+      node_t &n = nodes[proxy];
+      if (all(n.lo <= box.get_min()) && all(box.get_max() <= n.hi)) {
+        return false;
+      }
+      remove_leaf(proxy);
+      set_fat_box(proxy, box);
+      insert_leaf(proxy);
+      return true;
+    }
+
+    /// Remove all the items.
+    void clear() {
+      nodes.resize(0);
+      root = null_node;
+      free_list = null_node;
+      num_items = 0;
+    }
+
+    /// Is this proxy an item in the tree?
+    bool is_proxy(int proxy) const {
+      return (unsigned)proxy < nodes.size() && nodes[proxy].height == 0;
+    }
+
+    /// Get the item for a proxy.
+    const item_t &get_item(int proxy) const {
+      return nodes[proxy].item;
+    }
+
+    /// Access the item for a proxy.
+    item_t &access_item(int proxy) {
+      return nodes[proxy].item;
+    }
+
+    /// Get the fat box of a proxy.
+    aabb get_fat_aabb(int proxy) const {
+      const node_t &n = nodes[proxy];
+      return aabb((n.lo + n.hi) * 0.5f, (n.hi - n.lo) * 0.5f);
+    }
+
+    /// Number of items in the tree.
+    unsigned size() const {
+      return num_items;
+    }
+
+    /// Upper limit for proxies, for iterating with is_proxy().
+    unsigned get_proxy_limit() const {
+      return nodes.size();
+    }
+
+    /// Number of levels below the root; about log2(size()) when balanced.
+    int get_height() const {
+      return root == null_node ? 0 : nodes[root].height;
+    }
+
+    /// Call fn(proxy) for every item whose fat box overlaps box.
+    template <class fn_t> void query(const aabb &box, fn_t fn) const {
+      vec3 lo = box.get_min(), hi = box.get_max();
+      query_impl([&](const vec3 &n_lo, const vec3 &n_hi) {
+        return all(n_lo <= hi) && all(lo <= n_hi);
+      }, fn);
+    }
+
+    /// Call fn(proxy) for every item whose fat box may be inside a frustum.
+    template <class fn_t> void query(const frustum &view, fn_t fn) const {
+      query_impl([&](const vec3 &n_lo, const vec3 &n_hi) {
+        return view.intersects(aabb((n_lo + n_hi) * 0.5f, (n_hi - n_lo) * 0.5f));
+      }, fn);
+    }
+
+    /// Call fn(proxy) for every item whose fat box touches a sphere.
+    template <class fn_t> void query(const sphere &s, fn_t fn) const {
+      vec3 c = s.get_center();
+      float r2 = s.get_radius() * s.get_radius();
+      query_impl([&](const vec3 &n_lo, const vec3 &n_hi) {
+        vec3 d = c - max(n_lo, min(c, n_hi));
+        return dot(d, d) <= r2;
+      }, fn);
+    }
+
+    /// Nearest first traversal along the segment start + (end - start) * t, 0 <= t <= 1.
+    ///
+    /// fn(proxy, max_t) is called for items whose fat box the segment passes through
+    /// and returns the t of its own hit, or a number greater than max_t for a miss.
+    /// Boxes beyond the nearest hit so far are skipped.
+    /// Returns the proxy of the nearest hit and sets hit_t, or returns -1 for no hit.
+    template <class fn_t> int ray_cast(const vec3 &start, const vec3 &end, float &hit_t, fn_t fn) const {
+      float max_t = 1.0f;
+      float miss = 2.0f;
+      int hit_proxy = null_node;
+      hit_t = miss;
+      if (root == null_node) return hit_proxy;
+
+      // avoid 0 * inf when the segment lies in the plane of a face.
+      vec3 dir = end - start;
+      vec3 inv_dir;
+      for (int i = 0; i != 3; ++i) {
+        float d = dir[i];
+        inv_dir[i] = fabsf(d) > 1e-30f ? 1.0f / d : (d < 0 ? -1e30f : 1e30f);
+      }
+
+      // entry t of a box, or a number greater than max_t for a miss.
+      auto entry = [&](int index) -> float {
+        const node_t &n = nodes[index];
+        vec3 t0 = (n.lo - start) * inv_dir;
+        vec3 t1 = (n.hi - start) * inv_dir;
+        vec3 t_near = min(t0, t1), t_far = max(t0, t1);
+        float t_in = std::max(std::max(t_near.x(), t_near.y()), std::max(t_near.z(), 0.0f));
+        float t_out = std::min(std::min(t_far.x(), t_far.y()), std::min(t_far.z(), max_t));
+        return t_in <= t_out ? t_in : miss;
+      };
+
+      struct entry_t { int index; float t; };
+      small_dynarray<entry_t, 64> stack;
+      entry_t first = { root, entry(root) };
+      if (first.t <= max_t) stack.push_back(first);
+
+      while (!stack.empty()) {
+        entry_t e = stack.back();
+        stack.pop_back();
+        if (e.t > max_t) continue;
+
+        const node_t &n = nodes[e.index];
+        if (n.child[0] == null_node) {
+          float t = fn(e.index, max_t);
+          if (t <= max_t && t < hit_t) {
+            max_t = t;
+            hit_t = t;
+            hit_proxy = e.index;
+          }
+          continue;
+        }
+
+        // push the far child first so that the near child is visited first.
+        entry_t a = { n.child[0], entry(n.child[0]) };
+        entry_t b = { n.child[1], entry(n.child[1]) };
+        if (a.t > b.t) std::swap(a, b);
+        if (b.t <= max_t) stack.push_back(b);
+        if (a.t <= max_t) stack.push_back(a);
+      }
+      return hit_proxy;
+    }
+  };
+} }
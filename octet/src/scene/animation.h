@@ -7,7 +7,8 @@
 
 namespace octet { namespace scene {
   /// Animation resource: Contains times and values.
-  /// Still a work in progress. Requires splines, compression, blending etc.
+  /// Still a work in progress. Requires splines, blending etc.
+  /// For playing back lots of channels, compile it to an animation_clip.
   class animation : public resource {
     // todo: this could be a GL/CL buffer
     dynarray<unsigned char> data;
@@ -18,7 +19,7 @@ namespace octet { namespace scene {
       atom_t sub_target;   /// sub target (eg. rotateX)
       atom_t component;    /// component (eg. ANGLE)
       int offset;          /// where in data
-      unsigned num_times;  /// how many time values
+      unsigned num_times;  /// how many time values (32 bit milliseconds)
       unsigned component_size; /// number of bytes per component
     };
 
@@ -77,9 +78,36 @@ namespace octet { namespace scene {
       return end_time;
     }
 
+    /// how many keys does a channel have?
+    unsigned get_num_keys(int ch) const {
+      return channels[ch].num_times;
+    }
+
+    /// how many floats are there in each key of a channel? eg. 16 for a matrix.
+    unsigned get_num_values(int ch) const {
+      return channels[ch].component_size / sizeof(float);
+    }
+
+    /// time of one key of a channel in seconds.
+    float get_key_time(int ch, unsigned key) const {
+      const uint32_t *p = (const uint32_t *)&data[channels[ch].offset];
+      return p[key] * 0.001f;
+    }
+
+    /// values of one key of a channel.
+    const float *get_key_values(int ch, unsigned key) const {
+      const channel &c = channels[ch];
+      return (const float *)&data[c.offset + c.num_times * sizeof(uint32_t) + key * c.component_size];
+    }
+
+    /// how many bytes of keys are there?
+    unsigned get_num_bytes() const {
+      return data.size();
+    }
+
     /// add a channel to the animation.
     // just store the floats in the channel for now.
-    // todo: optimise animation data
+    // to make the data compact, compile the animation to an animation_clip.
     void add_channel(resource *target, atom_t sid, atom_t sub_target, atom_t component, dynarray<float> &times, dynarray<float> &values) {
       int num_times = (int)times.size();
       int num_values = (int)values.size();
@@ -93,13 +121,13 @@ namespace octet { namespace scene {
       ch.component_size = component_size;
 
       int offset = ch.offset = (int)data.size();
-      int bytes = num_times * sizeof(unsigned short) + component_size * num_times;
+      int bytes = num_times * sizeof(uint32_t) + component_size * num_times;
       data.resize(ch.offset + bytes);
       end_time = times[num_times-1] > end_time ? times[num_times-1] : end_time;
       for (int i = 0; i != num_times; ++i) {
-        unsigned short it = (unsigned short)( times[i] * 1000 );
-        *((unsigned short*)&data[offset]) = it;
-        offset += sizeof(unsigned short);
+        uint32_t it = (uint32_t)( times[i] * 1000 + 0.5f );
+        memcpy(&data[offset], &it, sizeof(it));
+        offset += sizeof(uint32_t);
       }
       
       memcpy(&data[offset], &values[0], component_size * num_times);
@@ -109,9 +137,18 @@ namespace octet { namespace scene {
 
     /// Evaluate one channel. Time is in ms. This is very inefficient, it is much better to evalaute all channels together.
     void eval_chan(int chan, float time, resource *target) const {
-      int time_ms = int(time * 1000);
+      float tmp[16];
+      if (sample_chan(chan, time, tmp)) {
+        const channel &ch = channels[chan];
+        target->set_value(ch.sid, ch.sub_target, ch.component, tmp);
+      }
+    }
+
+    /// Evaluate one channel into values, which must have space for 16 floats. Returns the number of floats written.
+    unsigned sample_chan(int chan, float time, float *values) const {
+      uint32_t time_ms = time > 0 ? uint32_t(time * 1000) : 0;
       const channel &ch = channels[chan];
-      unsigned short *p = (unsigned short *)&data[ch.offset];
+      const uint32_t *p = (const uint32_t *)&data[ch.offset];
       unsigned a = 0;
       unsigned b = ch.num_times - 1;
       unsigned component_size = ch.component_size;
@@ -121,7 +158,7 @@ namespace octet { namespace scene {
         time_ms = p[0];
       } else if (time_ms >= p[b]) {
         time_ms = p[b];
-        a = b - 1;
+        a = b ? b - 1 : 0;
       } else {
         while (b - a > 1) {
           unsigned mid = a + ((b - a) >> 1);
@@ -135,20 +172,18 @@ namespace octet { namespace scene {
 
       //log("t=%d a=%d b=%d p[a]=%d p[b]=%d\n", time_ms, a, b, p[a], p[b]);
 
-      unsigned data_offset = ch.offset + ch.num_times * sizeof(unsigned short);
+      unsigned data_offset = ch.offset + ch.num_times * sizeof(uint32_t);
 
-      float t = float(time_ms - p[a]) / (p[b] - p[a]);
-      float tmp1[16];
-      float tmp2[16];
-      if (component_size <= sizeof(tmp1)) {
-        memcpy(tmp1, &data[data_offset + a * component_size], component_size);
-        memcpy(tmp2, &data[data_offset + b * component_size], component_size);
-        for (int i = 0; i != component_size/4; ++i) {
-          tmp1[i] = tmp1[i] * (1-t) + tmp2[i] * t;
-        }
-        //log("  t=%f %f %f %f\n", t, tmp1[0], tmp1[1], tmp1[2]);
-        target->set_value(ch.sid, ch.sub_target, ch.component, tmp1);
+      float t = p[b] != p[a] ? float(time_ms - p[a]) / (p[b] - p[a]) : 0.0f;
+      if (component_size > 16 * sizeof(float)) return 0;
+
+      const float *va = (const float *)&data[data_offset + a * component_size];
+      const float *vb = (const float *)&data[data_offset + b * component_size];
+      for (unsigned i = 0; i != component_size/4; ++i) {
+        values[i] = va[i] * (1-t) + vb[i] * t;
       }
+      //log("  t=%f %f %f %f\n", t, values[0], values[1], values[2]);
+      return component_size/4;
     }
   };
 }}
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Animation channel destination
+//
+
+namespace octet { namespace scene {
+  /// Where an animation channel writes its values.
+  ///
+  /// bind() finds the destination once, so that write() is a copy into the node or bone
+  /// instead of a virtual set_value call that compares atoms every frame.
+  /// Targets that we have no direct route into still get set_value.
+  ///
+  /// Bind again if the target changes, eg. if a mesh_instance is given a new skeleton.
+  class animation_binding {
+  public:
+    enum kind_t {
+      /// nothing to write to.
+      kind_none,
+
+      /// a collada matrix, transposed into the nodeToParent of a scene_node, which may be a bone.
+      kind_node_transform,
+
+      /// floats copied to memory, eg. a pose buffer.
+      kind_floats,
+
+      /// call set_value on the target.
+      kind_set_value,
+    };
+
+  private:
+    kind_t kind;
+    float *dest;
+    unsigned num_values;
+    scene_node *node;
+    ref<resource> target;
+    atom_t sid;
+    atom_t sub_target;
+    atom_t component;
+
+  public:
+    animation_binding() {
+      kind = kind_none;
+      dest = 0;
+      num_values = 0;
+      node = 0;
+      sid = sub_target = component = atom_;
+    }
+
+    /// Find where a channel's values go in target.
+    void bind(resource *target, atom_t sid, atom_t sub_target, atom_t component) {
+      *this = animation_binding();
+      this->target = target;
+      this->sid = sid;
+      this->sub_target = sub_target;
+      this->component = component;
+      if (!target) return;
+
+      kind = kind_set_value;
+      if (scene_node *target_node = target->get_scene_node()) {
+        // the node with the channel's sid below the target, if there is one,
+        // so that one clip can play on many copies of a skeleton. Nodes only take transforms.
+        scene_node *found = target_node->find_sid(sid);
+        node = found ? found : target_node;
+        kind = sub_target == atom_transform ? kind_node_transform : kind_none;
+      } else if (mesh_instance *mi = target->get_mesh_instance()) {
+        // the bones of a skeleton are scene_nodes, which is where calc_palette() reads them.
+        skeleton *skel = mi->get_skeleton();
+        int bone = skel ? skel->get_bone_index(sid) : -1;
+        if (bone == -1) {
+          kind = kind_none;
+        } else if (sub_target == atom_transform) {
+          node = skel->get_bone_node(bone);
+          kind = kind_node_transform;
+        }
+      }
+    }
+
+    /// Write num_values floats to dest, eg. a slot in a pose buffer.
+    void bind(float *dest, unsigned num_values) {
+      *this = animation_binding();
+      this->dest = dest;
+      this->num_values = num_values;
+      kind = kind_floats;
+    }
+
+    /// Write values, in the form that set_value takes.
+    void write(const float *values) const {
+      switch (kind) {
+        case kind_node_transform: node->access_nodeToParent().init_transpose(values); break;
+        case kind_floats: memcpy(dest, values, num_values * sizeof(float)); break;
+        case kind_set_value: target->set_value(sid, sub_target, component, (float*)values); break;
+        default: break;
+      }
+    }
+
+    /// What sort of destination did bind() find?
+    kind_t get_kind() const {
+      return kind;
+    }
+
+    /// The node of a kind_node_transform binding.
+    scene_node *get_node() const {
+      return node;
+    }
+  };
+}}
@@ -0,0 +1,519 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Compiled animation
+//
+
+namespace octet { namespace scene {
+  /// Compact form of an animation for playing many channels quickly.
+  ///
+  /// Compiling an animation keeps every value we give to the targets within a tolerance. It:
+  ///   - drops keys that interpolating their neighbours reproduces closely enough.
+  ///   - splits transform matrices into a rotation quaternion, a translation and a scale.
+  ///   - stores each lane in 16 bits, relative to its range, if that is accurate enough.
+  ///   - stores times as 32 bit floats, so clips can be of any length.
+  ///
+  /// Each value of a channel is a "lane". Sampling writes every lane to a pose, with the quaternions normalized.
+  /// A cursor remembers the current key of every track, so playing forwards costs O(1) per track.
+  /// The two keys of every track are gathered and then all the lanes are interpolated in one SIMD loop.
+  ///
+  ///     ref<animation_clip> clip = new animation_clip(anim);
+  ///     animation_clip::cursor cur;
+  ///     dynarray<float> pose(clip->get_pose_size());
+  ///     clip->sample(cur, time, pose.data());
+  ///     clip->apply(pose.data(), target);
+  class animation_clip : public resource {
+  public:
+    enum {
+      /// lanes are a quaternion, a translation and a scale to make a transform.
+      flag_transform = 1,
+
+      /// lanes are stored in 16 bits.
+      flag_quantized = 2,
+
+      /// lanes in a transform track.
+      transform_lanes = 10,
+    };
+
+    /// Where an instance is in a clip. Use one cursor per instance; it also holds the space used by sample().
+    struct cursor {
+      // current key of every track and the last time sampled.
+      dynarray<uint32_t> keys;
+      float time;
+
+      // the two keys of every lane and how far we are between them.
+      dynarray<uint16_t> qa, qb;
+      dynarray<float> ra, rb, t;
+
+      cursor() {
+        time = 0;
+      }
+    };
+
+  private:
+    /// one channel of the animation
+    struct track {
+      atom_t sid;          /// atom for sid on target (eg. node22)
+      atom_t sub_target;   /// sub target (eg. transform)
+      atom_t component;    /// component (eg. ANGLE)
+      uint32_t flags;      /// flag_transform, flag_quantized
+      uint32_t num_keys;   /// how many keys are left
+      uint32_t first_time; /// where in times
+      uint32_t first_key;  /// where in keys or raw_keys
+      uint32_t num_lanes;  /// values in each key
+      uint32_t first_lane; /// where in the pose, lane_min and lane_scale
+    };
+
+    dynarray<track> tracks;
+    dynarray<float> times;
+
+    // quantized keys, with the lanes of each key together
+    dynarray<uint16_t> keys;
+
+    // keys of tracks with too great a range for 16 bits
+    dynarray<float> raw_keys;
+
+    // value = lane_min + key * lane_scale for the quantized lanes.
+    dynarray<float> lane_min;
+    dynarray<float> lane_scale;
+
+    // resources to apply each track to, as in animation.
+    dynarray<ref<resource> > targets;
+
+    float end_time;
+
+    // lanes in a pose. The quantized lanes come first.
+    uint32_t pose_size;
+    uint32_t quantized_size;
+
+    // split a matrix, stored as collada does with the translation in v[3], v[7], v[11], into lanes.
+    static void decompose(float *lanes, const float *v) {
+      vec3 cx(v[0], v[4], v[8]), cy(v[1], v[5], v[9]), cz(v[2], v[6], v[10]);
+      float s[3] = { cx.length(), cy.length(), cz.length() };
+      if (dot(cx, cy.cross(cz)) < 0) s[0] = -s[0];
+
+      float m[3][3];
+      for (unsigned i = 0; i != 3; ++i) {
+        for (unsigned j = 0; j != 3; ++j) {
+          m[i][j] = s[j] != 0 ? v[i * 4 + j] / s[j] : float(i == j);
+        }
+      }
+
+      float *q = lanes;
+      float trace = m[0][0] + m[1][1] + m[2][2];
+      if (trace > 0) {
+        float r = sqrtf(trace + 1) * 2;
+        q[0] = (m[2][1] - m[1][2]) / r; q[1] = (m[0][2] - m[2][0]) / r; q[2] = (m[1][0] - m[0][1]) / r; q[3] = 0.25f * r;
+      } else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+        float r = sqrtf(1 + m[0][0] - m[1][1] - m[2][2]) * 2;
+        q[0] = 0.25f * r; q[1] = (m[0][1] + m[1][0]) / r; q[2] = (m[0][2] + m[2][0]) / r; q[3] = (m[2][1] - m[1][2]) / r;
+      } else if (m[1][1] > m[2][2]) {
+        float r = sqrtf(1 + m[1][1] - m[0][0] - m[2][2]) * 2;
+        q[0] = (m[0][1] + m[1][0]) / r; q[1] = 0.25f * r; q[2] = (m[1][2] + m[2][1]) / r; q[3] = (m[0][2] - m[2][0]) / r;
+      } else {
+        float r = sqrtf(1 + m[2][2] - m[0][0] - m[1][1]) * 2;
+        q[0] = (m[0][2] + m[2][0]) / r; q[1] = (m[1][2] + m[2][1]) / r; q[2] = 0.25f * r; q[3] = (m[1][0] - m[0][1]) / r;
+      }
+
+      lanes[4] = v[3]; lanes[5] = v[7]; lanes[6] = v[11];
+      lanes[7] = s[0]; lanes[8] = s[1]; lanes[9] = s[2];
+    }
+
+    // can keys a and b of a track be interpolated to give every key between them?
+    // Transforms are compared as matrices, as that is what we give to the target.
+    static bool can_join(const float *key_times, const float *values, unsigned num_lanes, bool is_transform, unsigned a, unsigned b, float tolerance) {
+      float duration = key_times[b] - key_times[a];
+      const float *va = values + a * num_lanes, *vb = values + b * num_lanes;
+      float tmp[16], mat[16], mat_k[16];
+      for (unsigned k = a + 1; k != b; ++k) {
+        float t = duration > 0 ? (key_times[k] - key_times[a]) / duration : 0;
+        for (unsigned l = 0; l != num_lanes; ++l) {
+          tmp[l] = va[l] + (vb[l] - va[l]) * t;
+        }
+        const float *lhs = tmp, *rhs = values + k * num_lanes;
+        unsigned num_values = num_lanes;
+        if (is_transform) {
+          normalize_quat(tmp);
+          recompose(mat, tmp);
+          recompose(mat_k, rhs);
+          lhs = mat;
+          rhs = mat_k;
+          num_values = 12;
+        }
+        for (unsigned l = 0; l != num_values; ++l) {
+          if (fabsf(lhs[l] - rhs[l]) > tolerance) return false;
+        }
+      }
+      return true;
+    }
+
+    // first key after lo at or before time.
+    static unsigned find_key(const float *key_times, unsigned lo, unsigned num_keys, float time) {
+      unsigned hi = num_keys;
+      while (hi - lo > 1) {
+        unsigned mid = lo + ((hi - lo) >> 1);
+        if (key_times[mid] <= time) {
+          lo = mid;
+        } else {
+          hi = mid;
+        }
+      }
+      return lo;
+    }
+
+    // add a track with its keys as floats (num_keys * num_lanes)
+    void add_track(const animation *anim, int ch, unsigned flags, const float *key_times, const float *values, unsigned num_keys, unsigned num_lanes, float tolerance) {
+      bool is_transform = (flags & flag_transform) != 0;
+
+      // half the error is from dropping keys, the other half from quantizing.
+      dynarray<unsigned> kept;
+      kept.push_back(0);
+      for (unsigned a = 0, b = 2; b < num_keys; ++b) {
+        if (!can_join(key_times, values, num_lanes, is_transform, a, b, tolerance * 0.5f)) {
+          kept.push_back(a = b - 1);
+        }
+      }
+      if (num_keys > 1) kept.push_back(num_keys - 1);
+
+      // in a matrix, an error in the quaternion is multiplied by up to four times the scale.
+      float quat_gain = 1;
+      if (is_transform) {
+        for (unsigned i = 0; i != kept.size(); ++i) {
+          const float *s = values + kept[i] * num_lanes + 7;
+          quat_gain = std::max(quat_gain, 4 * std::max(fabsf(s[0]), std::max(fabsf(s[1]), fabsf(s[2]))));
+        }
+      }
+
+      float lo[16], hi[16];
+      for (unsigned l = 0; l != num_lanes; ++l) {
+        lo[l] = hi[l] = values[l];
+        for (unsigned i = 0; i != kept.size(); ++i) {
+          float value = values[kept[i] * num_lanes + l];
+          lo[l] = std::min(lo[l], value);
+          hi[l] = std::max(hi[l], value);
+        }
+        float gain = is_transform && l < 4 ? quat_gain : 1;
+        if ((hi[l] - lo[l]) * (0.5f / 65535) * gain > tolerance * 0.5f) flags &= ~flag_quantized;
+      }
+
+      track tr;
+      tr.sid = anim->get_sid(ch);
+      tr.sub_target = anim->get_sub_target(ch);
+      tr.component = anim->get_component(ch);
+      tr.flags = flags;
+      tr.num_keys = kept.size();
+      tr.first_time = times.size();
+      tr.num_lanes = num_lanes;
+
+      for (unsigned i = 0; i != kept.size(); ++i) {
+        times.push_back(key_times[kept[i]]);
+      }
+
+      if (flags & flag_quantized) {
+        tr.first_key = keys.size();
+        tr.first_lane = quantized_size;
+        quantized_size += num_lanes;
+        for (unsigned l = 0; l != num_lanes; ++l) {
+          lane_min.push_back(lo[l]);
+          lane_scale.push_back((hi[l] - lo[l]) * (1.0f / 65535));
+        }
+        for (unsigned i = 0; i != kept.size(); ++i) {
+          for (unsigned l = 0; l != num_lanes; ++l) {
+            float range = hi[l] - lo[l];
+            float q = range > 0 ? (values[kept[i] * num_lanes + l] - lo[l]) * (65535 / range) : 0;
+            keys.push_back((uint16_t)std::min(q + 0.5f, 65535.0f));
+          }
+        }
+      } else {
+        // placed after the quantized lanes once we know how many there are.
+        tr.first_key = raw_keys.size();
+        tr.first_lane = pose_size - quantized_size;
+        for (unsigned i = 0; i != kept.size(); ++i) {
+          for (unsigned l = 0; l != num_lanes; ++l) {
+            raw_keys.push_back(values[kept[i] * num_lanes + l]);
+          }
+        }
+      }
+      pose_size += num_lanes;
+
+      tracks.push_back(tr);
+      targets.push_back(anim->get_target(ch));
+    }
+
+  public:
+    RESOURCE_META(animation_clip)
+
+    /// Make the matrix of a transform track from its lanes, as collada stores it. The quaternion must be normalized.
+    static void recompose(float *v, const float *lanes) {
+      float x = lanes[0], y = lanes[1], z = lanes[2], w = lanes[3];
+      const float *s = lanes + 7;
+      v[0] = (1 - 2 * (y * y + z * z)) * s[0]; v[1] = 2 * (x * y - z * w) * s[1]; v[2] = 2 * (x * z + y * w) * s[2]; v[3] = lanes[4];
+      v[4] = 2 * (x * y + z * w) * s[0]; v[5] = (1 - 2 * (x * x + z * z)) * s[1]; v[6] = 2 * (y * z - x * w) * s[2]; v[7] = lanes[5];
+      v[8] = 2 * (x * z - y * w) * s[0]; v[9] = 2 * (y * z + x * w) * s[1]; v[10] = (1 - 2 * (x * x + y * y)) * s[2]; v[11] = lanes[6];
+      v[12] = 0; v[13] = 0; v[14] = 0; v[15] = 1;
+    }
+
+    /// Scale a quaternion to length 1.
+    static void normalize_quat(float *q) {
+      float length_sq = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+      float scale = length_sq > 0 ? 1.0f / sqrtf(length_sq) : 0;
+      q[0] *= scale; q[1] *= scale; q[2] *= scale; q[3] *= scale;
+    }
+
+    /// Compile anim, if not null. At the times of its keys, the values we give to the targets are within tolerance of it.
+    animation_clip(const animation *anim=0, float tolerance=0.001f) {
+      end_time = 0;
+      pose_size = quantized_size = 0;
+      if (anim) compile(anim, tolerance);
+    }
+
+    /// Serialisation
+    void visit(visitor &v) {
+      v.visit(tracks, atom_tracks);
+      v.visit(times, atom_times);
+      v.visit(keys, atom_keys);
+      v.visit(raw_keys, atom_raw_keys);
+      v.visit(lane_min, atom_lane_min);
+      v.visit(lane_scale, atom_lane_scale);
+      v.visit(targets, atom_targets);
+      v.visit(end_time, atom_end_time);
+      v.visit(pose_size, atom_pose_size);
+      v.visit(quantized_size, atom_quantized_size);
+    }
+
+    /// Replace the clip with a compiled version of anim.
+    void compile(const animation *anim, float tolerance=0.001f) {
+      tracks.reset();
+      times.reset();
+      keys.reset();
+      raw_keys.reset();
+      lane_min.reset();
+      lane_scale.reset();
+      targets.reset();
+      pose_size = quantized_size = 0;
+      end_time = anim->get_end_time();
+
+      dynarray<float> key_times;
+      dynarray<float> values;
+      for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
+        unsigned num_keys = anim->get_num_keys(ch);
+        unsigned num_values = anim->get_num_values(ch);
+        if (num_keys == 0 || num_values == 0 || num_values > 16) continue;
+
+        key_times.resize(num_keys);
+        for (unsigned i = 0; i != num_keys; ++i) {
+          key_times[i] = anim->get_key_time(ch, i);
+        }
+
+        // matrices become a quaternion, translation and scale if we can rebuild them accurately.
+        if (anim->get_sub_target(ch) == atom_transform && num_values == 16) {
+          values.resize(num_keys * transform_lanes);
+          bool is_exact = true;
+          for (unsigned i = 0; i != num_keys && is_exact; ++i) {
+            const float *src = anim->get_key_values(ch, i);
+            float *lanes = &values[i * transform_lanes];
+            decompose(lanes, src);
+
+            // keep neighbouring quaternions in the same hemisphere so that they interpolate the short way.
+            if (i != 0) {
+              const float *prev = lanes - transform_lanes;
+              if (prev[0] * lanes[0] + prev[1] * lanes[1] + prev[2] * lanes[2] + prev[3] * lanes[3] < 0) {
+                lanes[0] = -lanes[0]; lanes[1] = -lanes[1]; lanes[2] = -lanes[2]; lanes[3] = -lanes[3];
+              }
+            }
+
+            float rebuilt[16];
+            recompose(rebuilt, lanes);
+            for (unsigned j = 0; j != 16; ++j) {
+              if (fabsf(rebuilt[j] - src[j]) > tolerance * 0.25f) is_exact = false;
+            }
+          }
+          if (is_exact) {
+            add_track(anim, ch, flag_transform|flag_quantized, key_times.data(), values.data(), num_keys, transform_lanes, tolerance);
+            continue;
+          }
+        }
+
+        values.resize(num_keys * num_values);
+        for (unsigned i = 0; i != num_keys; ++i) {
+          memcpy(&values[i * num_values], anim->get_key_values(ch, i), num_values * sizeof(float));
+        }
+        add_track(anim, ch, flag_quantized, key_times.data(), values.data(), num_keys, num_values, tolerance);
+      }
+
+      for (unsigned i = 0; i != tracks.size(); ++i) {
+        if (!(tracks[i].flags & flag_quantized)) tracks[i].first_lane += quantized_size;
+      }
+    }
+
+    /// Evaluate every track at a time in seconds, writing get_pose_size() floats to pose.
+    /// Sampling is fastest when time moves forwards a little between calls with the same cursor.
+    void sample(cursor &cur, float time, float *pose) const {
+      unsigned num_tracks = tracks.size();
+      unsigned num_raw = pose_size - quantized_size;
+      bool is_forwards = time >= cur.time;
+      if (cur.keys.size() != num_tracks || cur.t.size() != pose_size) {
+        cur.keys.resize(num_tracks);
+        if (num_tracks) memset(cur.keys.data(), 0, num_tracks * sizeof(uint32_t));
+        cur.qa.resize(quantized_size);
+        cur.qb.resize(quantized_size);
+        cur.ra.resize(num_raw);
+        cur.rb.resize(num_raw);
+        cur.t.resize(pose_size);
+        is_forwards = false;
+      }
+      cur.time = time;
+
+      // find the keys of each track and gather them.
+      for (unsigned i = 0; i != num_tracks; ++i) {
+        const track &tr = tracks[i];
+        const float *key_times = &times[tr.first_time];
+        unsigned num_keys = tr.num_keys;
+        unsigned k = cur.keys[i];
+        if (!is_forwards) {
+          k = find_key(key_times, 0, num_keys, time);
+        } else {
+          // step a few keys, then search.
+          for (unsigned steps = 0; k + 1 < num_keys && key_times[k + 1] <= time; ++k) {
+            if (++steps == 4) {
+              k = find_key(key_times, k, num_keys, time);
+              break;
+            }
+          }
+        }
+        cur.keys[i] = k;
+
+        unsigned k1 = k + 1 < num_keys ? k + 1 : k;
+        float duration = key_times[k1] - key_times[k];
+        float t = duration > 0 ? (time - key_times[k]) / duration : 0;
+        t = t < 0 ? 0 : t > 1 ? 1 : t;
+
+        unsigned num_lanes = tr.num_lanes;
+        for (unsigned l = 0; l != num_lanes; ++l) {
+          cur.t[tr.first_lane + l] = t;
+        }
+        if (tr.flags & flag_quantized) {
+          memcpy(&cur.qa[tr.first_lane], &keys[tr.first_key + k * num_lanes], num_lanes * sizeof(uint16_t));
+          memcpy(&cur.qb[tr.first_lane], &keys[tr.first_key + k1 * num_lanes], num_lanes * sizeof(uint16_t));
+        } else {
+          unsigned raw_lane = tr.first_lane - quantized_size;
+          memcpy(&cur.ra[raw_lane], &raw_keys[tr.first_key + k * num_lanes], num_lanes * sizeof(float));
+          memcpy(&cur.rb[raw_lane], &raw_keys[tr.first_key + k1 * num_lanes], num_lanes * sizeof(float));
+        }
+      }
+
+      // interpolate all the quantized lanes together.
+      const uint16_t *qa = cur.qa.data(), *qb = cur.qb.data();
+      const float *t = cur.t.data(), *lo = lane_min.data(), *scale = lane_scale.data();
+      unsigned l = 0;
+      #if OCTET_SSE2
+        __m128i zero = _mm_setzero_si128();
+        for (; l + 8 <= quantized_size; l += 8) {
+          __m128i a = _mm_loadu_si128((const __m128i*)(qa + l));
+          __m128i b = _mm_loadu_si128((const __m128i*)(qb + l));
+          __m128 a0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(a, zero));
+          __m128 a1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(a, zero));
+          __m128 b0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(b, zero));
+          __m128 b1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(b, zero));
+          __m128 f0 = _mm_add_ps(a0, _mm_mul_ps(_mm_sub_ps(b0, a0), _mm_loadu_ps(t + l)));
+          __m128 f1 = _mm_add_ps(a1, _mm_mul_ps(_mm_sub_ps(b1, a1), _mm_loadu_ps(t + l + 4)));
+          _mm_storeu_ps(pose + l, _mm_add_ps(_mm_loadu_ps(lo + l), _mm_mul_ps(f0, _mm_loadu_ps(scale + l))));
+          _mm_storeu_ps(pose + l + 4, _mm_add_ps(_mm_loadu_ps(lo + l + 4), _mm_mul_ps(f1, _mm_loadu_ps(scale + l + 4))));
+        }
+      #endif
+      for (; l != quantized_size; ++l) {
+        float a = qa[l], b = qb[l];
+        pose[l] = lo[l] + (a + (b - a) * t[l]) * scale[l];
+      }
+
+      // then the lanes stored as floats.
+      const float *ra = cur.ra.data(), *rb = cur.rb.data();
+      for (unsigned r = 0; r != num_raw; ++r) {
+        pose[quantized_size + r] = ra[r] + (rb[r] - ra[r]) * t[quantized_size + r];
+      }
+
+      for (unsigned i = 0; i != num_tracks; ++i) {
+        if (tracks[i].flags & flag_transform) normalize_quat(pose + tracks[i].first_lane);
+      }
+    }
+
+    /// Get the values of a track from a pose in the form that resource::set_value takes, eg. a matrix for a transform.
+    /// tmp must have space for 16 floats.
+    const float *get_values(unsigned track_index, const float *pose, float *tmp) const {
+      const track &tr = tracks[track_index];
+      if (tr.flags & flag_transform) {
+        recompose(tmp, pose + tr.first_lane);
+        return tmp;
+      }
+      return pose + tr.first_lane;
+    }
+
+    /// Send a pose to the targets of the tracks. If target is not null, use it instead, as in animation_instance.
+    void apply(const float *pose, resource *target=0) const {
+      float tmp[16];
+      for (unsigned i = 0; i != tracks.size(); ++i) {
+        const track &tr = tracks[i];
+        resource *dest = target ? target : (resource*)targets[i];
+        if (dest) dest->set_value(tr.sid, tr.sub_target, tr.component, (float*)get_values(i, pose, tmp));
+      }
+    }
+
+    /// How many tracks?
+    unsigned get_num_tracks() const {
+      return tracks.size();
+    }
+
+    /// get the sid of a track. Eg. "thigh" in thigh.rotation.x
+    atom_t get_sid(unsigned i) const {
+      return tracks[i].sid;
+    }
+
+    /// get the sid of the sub target. eg. "angle" in thigh.rotation.x
+    atom_t get_sub_target(unsigned i) const {
+      return tracks[i].sub_target;
+    }
+
+    /// get the component. eg. "x" in thigh.rotation.x
+    atom_t get_component(unsigned i) const {
+      return tracks[i].component;
+    }
+
+    /// which resource is a track targeting?
+    resource *get_target(unsigned i) const {
+      return targets[i];
+    }
+
+    /// Is a track a quaternion, translation and scale rather than the animation's values?
+    bool is_transform(unsigned i) const {
+      return (tracks[i].flags & flag_transform) != 0;
+    }
+
+    /// Where a track's lanes start in a pose.
+    unsigned get_first_lane(unsigned i) const {
+      return tracks[i].first_lane;
+    }
+
+    /// How many keys are left in a track after compiling.
+    unsigned get_num_keys(unsigned i) const {
+      return tracks[i].num_keys;
+    }
+
+    /// Number of floats written by sample().
+    unsigned get_pose_size() const {
+      return pose_size;
+    }
+
+    /// how long is the clip?
+    float get_end_time() const {
+      return end_time;
+    }
+
+    /// how many bytes of keys, times and ranges are there?
+    unsigned get_num_bytes() const {
+      return keys.size() * sizeof(uint16_t) + (raw_keys.size() + times.size() + lane_min.size() + lane_scale.size()) * sizeof(float);
+    }
+  };
+}}
@@ -9,12 +9,33 @@
 
 namespace octet { namespace scene {
   /// Instance of an animation; which Animation, what the target is, current time, etc.
+  /// Plays either an animation or a compiled animation_clip.
   class animation_instance : public resource {
     ref<animation> anim;
+    ref<animation_clip> clip;
     ref<resource> target;
     float time;
     bool is_looping;
     bool is_paused;
+
+    // blending with other clips on the same nodes (see pose_system).
+    float weight;
+    float target_weight;
+    float fade_speed;
+    int layer;
+
+    // where we are in the clip and the last pose sampled from it.
+    animation_clip::cursor cursor;
+    dynarray<float> pose;
+
+    // where each channel writes to, found on the first update.
+    dynarray<animation_binding> bindings;
+
+    void init_blend() {
+      weight = target_weight = 1;
+      fade_speed = 0;
+      layer = 0;
+    }
   public:
     RESOURCE_META(animation_instance)
 
@@ -25,15 +46,31 @@ namespace octet { namespace scene {
       this->time = 0;
       this->is_looping = is_looping;
       this->is_paused = false;
+      init_blend();
+    }
+
+    /// Create an instance of a compiled clip.
+    animation_instance(animation_clip *clip, resource *target=0, bool is_looping=true) {
+      this->target = target;
+      this->clip = clip;
+      this->time = 0;
+      this->is_looping = is_looping;
+      this->is_paused = false;
+      init_blend();
     }
 
     /// serialize the animation
     void visit(visitor &v) {
       v.visit(anim, atom_anim);
+      v.visit(clip, atom_clip);
       v.visit(target, atom_target);
       v.visit(time, atom_time);
       v.visit(is_looping, atom_is_looping);
       v.visit(is_paused, atom_is_paused);
+      v.visit(weight, atom_weight);
+      v.visit(target_weight, atom_target_weight);
+      v.visit(fade_speed, atom_fade_speed);
+      v.visit(layer, atom_layer);
     }
 
     /// get the animation
@@ -41,36 +78,124 @@ namespace octet { namespace scene {
       return anim;
     }
 
+    /// get the compiled clip, if we are playing one.
+    const animation_clip *get_clip() const {
+      return clip;
+    }
+
+    /// get the pose last sampled from the clip.
+    const float *get_pose() const {
+      return pose.data();
+    }
+
     /// get the current time.
     float get_time() const {
       return time;
     }
 
-    /// update the animation and the resources it connects to.
-    void update(float delta_time) {
-      if (target) {
-        for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
-          anim->eval_chan(ch, time, target);
+    /// Find where each channel writes to. This happens on the first update;
+    /// call it again if the targets change, eg. a mesh_instance gets a new skeleton.
+    void bind() {
+      if (clip) {
+        bindings.resize(clip->get_num_tracks());
+        for (unsigned i = 0; i != bindings.size(); ++i) {
+          resource *dest = target ? (resource*)target : clip->get_target(i);
+          bindings[i].bind(dest, clip->get_sid(i), clip->get_sub_target(i), clip->get_component(i));
         }
       } else {
-        for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
-          resource *anim_target = anim->get_target(ch);
-          anim->eval_chan(ch, time, anim_target);
+        bindings.resize(anim->get_num_channels());
+        for (unsigned ch = 0; ch != bindings.size(); ++ch) {
+          resource *dest = target ? (resource*)target : anim->get_target(ch);
+          bindings[ch].bind(dest, anim->get_sid(ch), anim->get_sub_target(ch), anim->get_component(ch));
         }
       }
+    }
 
+    /// true if bind() has been called since the channels changed.
+    bool is_bound() const {
+      return bindings.size() == (clip ? clip->get_num_tracks() : anim->get_num_channels());
+    }
+
+    /// get where a channel writes to.
+    const animation_binding &get_binding(unsigned ch) const {
+      return bindings[ch];
+    }
+
+    /// Weight when blending with other clips on the same layer; see pose_system.
+    float get_weight() const {
+      return weight;
+    }
+
+    /// Set the weight straight away, stopping any fade.
+    void set_weight(float value) {
+      weight = target_weight = value;
+      fade_speed = 0;
+    }
+
+    /// Change the weight to value over a number of seconds, eg. fade_to(0, 0.3f) on one instance
+    /// and fade_to(1, 0.3f) on another to crossfade between them.
+    void fade_to(float value, float seconds) {
+      target_weight = value;
+      fade_speed = seconds > 0 ? fabsf(value - weight) / seconds : 0;
+      if (seconds <= 0) weight = value;
+    }
+
+    /// Layers are blended in order, each over the ones below it; see pose_system.
+    int get_layer() const {
+      return layer;
+    }
+
+    /// Set the layer. 0 is the base layer.
+    void set_layer(int value) {
+      layer = value;
+    }
+
+    /// Sample a clip into get_clip()->get_pose_size() floats, without writing to the targets.
+    /// Instances can be sampled on different threads.
+    void sample(float *dest) {
+      clip->sample(cursor, time, dest);
+    }
+
+    /// Move the time and weight on, without sampling.
+    void advance(float delta_time) {
+      if (weight != target_weight) {
+        float step = fade_speed * delta_time;
+        weight = fabsf(target_weight - weight) <= step ? target_weight : weight + (target_weight > weight ? step : -step);
+      }
+
+      float end_time = clip ? clip->get_end_time() : anim->get_end_time();
       //log("update %f\n", delta_time);
       if (!is_paused) {
         time += delta_time;
         //log("..update %f\n", time);
-        if (time >= anim->get_end_time()) {
+        if (time >= end_time) {
           if (is_looping) {
-            time -= anim->get_end_time();
+            time -= end_time;
           } else {
             is_paused = true;
           }
         }
       }
     }
+
+    /// update the animation and the resources it connects to.
+    void update(float delta_time) {
+      if (!is_bound()) bind();
+
+      unsigned num_channels = bindings.size();
+      float tmp[16];
+      if (clip) {
+        pose.resize(clip->get_pose_size());
+        clip->sample(cursor, time, pose.data());
+        for (unsigned i = 0; i != num_channels; ++i) {
+          bindings[i].write(clip->get_values(i, pose.data(), tmp));
+        }
+      } else {
+        for (unsigned ch = 0; ch != num_channels; ++ch) {
+          if (anim->sample_chan(ch, time, tmp)) bindings[ch].write(tmp);
+        }
+      }
+      advance(delta_time);
+    }
   };
 }}
@@ -32,6 +32,9 @@ namespace octet { namespace scene {
     mat4t cameraToWorld;
     mat4t cameraToProjection;
 
+    // world space view volume, for culling
+    frustum view_frustum;
+
     // generated params
     float xscale;
     float yscale;
@@ -126,6 +129,8 @@ namespace octet { namespace scene {
         }
         cameraToProjection.frustum(-near_plane * xscale, near_plane * xscale, -near_plane * yscale, near_plane * yscale, near_plane, far_plane);
       }
+
+      view_frustum.init(worldToCamera * cameraToProjection);
     }
 
     /// call this many times to build matrices for uniforms.
@@ -144,6 +149,11 @@ namespace octet { namespace scene {
       return cameraToProjection;
     }
 
+    /// The world space frustum as of the last set_cameraToWorld(); used for culling.
+    const frustum &get_frustum() const {
+      return view_frustum;
+    }
+
     /// return a ray from screen (x, y) to the far plane; used for picking.
     ray get_ray(float x, float y) {
       vec4 ray_start, ray_end;
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Uniforms shared by every draw in a frame
+//
+
+namespace octet { namespace scene {
+  /// The camera and lights for a frame, shared by all materials.
+  ///
+  /// Where uniform buffers are available, the lights go into one buffer object at binding point
+  /// frame_uniforms::binding. Shaders read it by declaring the block (see shaders/default_solid.fs):
+  ///
+  ///     layout(std140) uniform frame_uniforms { vec4 lighting[17]; int num_lights; };
+  ///
+  /// Shaders that use plain uniforms instead get the same values from material,
+  /// which only sets them when the version of the frame uniforms changes.
+  ///
+  /// With clustered lighting (see light_clusters), the lights are only those that reach everywhere
+  /// and clustered materials also get the cluster parameters, with the cluster textures on
+  /// the three units from first_cluster_unit.
+  class frame_uniforms {
+  public:
+    enum {
+      /// uniform buffer binding point for the block
+      binding = 0,
+
+      /// material::ambient_size + material::max_lights * material::light_size
+      max_lighting = 17,
+
+      /// vec4s of light_clusters::get_shader_params()
+      num_cluster_params = 4,
+
+      /// texture units of the cluster grid, indices and lights, out of the way of material textures.
+      first_cluster_unit = 12,
+    };
+
+    /// std140 layout of the uniform block. Compared with memcmp, so the padding is zeroed too.
+    struct block {
+      vec4 lighting[max_lighting];
+      int32_t num_lights;
+      int32_t pad[3];
+
+      block() : num_lights(0) {
+        pad[0] = pad[1] = pad[2] = 0;
+      }
+    };
+
+  private:
+    block data;
+    vec4 cluster_params[num_cluster_params];
+    mat4t worldToProjection;
+    mat4t worldToCamera;
+    int num_lighting;
+    unsigned version;
+    ref<gl_resource> buffer;
+
+    static unsigned next_version() {
+      static unsigned counter;
+      return ++counter;
+    }
+
+  public:
+    frame_uniforms() {
+      worldToProjection.loadIdentity();
+      worldToCamera.loadIdentity();
+      num_lighting = 0;
+      version = next_version();
+    }
+
+    /// true if the GL context has uniform buffer objects (OpenGL 3.1, OpenGL ES3 or GL_ARB_uniform_buffer_object).
+    /// This must agree with the shaders, which use the block if GL_ARB_uniform_buffer_object is defined.
+    static bool buffers_supported() {
+      #ifdef OCTET_GLES2
+        return false;
+      #else
+        static int supported = -1;
+        if (supported < 0) {
+          supported = app_utils::has_gl_version(3, 1, 3, 0);
+          if (!supported) {
+            const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+            supported = extensions && strstr(extensions, "GL_ARB_uniform_buffer_object");
+          }
+        }
+        return supported != 0;
+      #endif
+    }
+
+    /// Set the values for this frame. The version, and the buffer, only change if the values do.
+    /// cluster_params is NULL unless the lights are clustered.
+    void set(const mat4t &worldToProjection, const mat4t &worldToCamera, const vec4 *lighting, int num_lighting, int num_lights, const vec4 *cluster_params = NULL) {
+      assert(num_lighting <= max_lighting);
+      block new_data;
+      for (int i = 0; i != num_lighting; ++i) {
+        new_data.lighting[i] = lighting[i];
+      }
+      new_data.num_lights = num_lights;
+
+      vec4 new_params[num_cluster_params];
+      if (cluster_params) {
+        for (int i = 0; i != num_cluster_params; ++i) {
+          new_params[i] = cluster_params[i];
+        }
+      }
+
+      bool same_camera = memcmp(&this->worldToProjection, &worldToProjection, sizeof(mat4t)) == 0 && memcmp(&this->worldToCamera, &worldToCamera, sizeof(mat4t)) == 0;
+      bool same_lights = memcmp(&data, &new_data, sizeof(block)) == 0 && this->num_lighting == num_lighting;
+      bool same_clusters = memcmp(this->cluster_params, new_params, sizeof(new_params)) == 0;
+      if (same_camera && same_lights && same_clusters && (buffer || !buffers_supported())) {
+        return;
+      }
+
+      this->worldToProjection = worldToProjection;
+      this->worldToCamera = worldToCamera;
+      this->num_lighting = num_lighting;
+      data = new_data;
+      for (int i = 0; i != num_cluster_params; ++i) {
+        this->cluster_params[i] = new_params[i];
+      }
+      version = next_version();
+
+      if (!same_lights || !buffer) {
+        #ifndef OCTET_GLES2
+          if (buffers_supported()) {
+            if (!buffer) buffer = new gl_resource();
+            buffer->stream(GL_UNIFORM_BUFFER, &data, sizeof(data));
+          }
+        #endif
+      }
+    }
+
+    /// Attach the buffer to the binding point, before drawing.
+    void bind() const {
+      #ifndef OCTET_GLES2
+        if (buffer) {
+          glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer->get_buffer());
+        }
+      #endif
+    }
+
+    /// Changes whenever the values change. No two frame_uniforms share a version.
+    unsigned get_version() const {
+      return version;
+    }
+
+    const mat4t &get_worldToProjection() const {
+      return worldToProjection;
+    }
+
+    const mat4t &get_worldToCamera() const {
+      return worldToCamera;
+    }
+
+    /// lighting uniforms: ambient followed by four vec4s per light
+    const vec4 *get_lighting() const {
+      return data.lighting;
+    }
+
+    int get_num_lighting() const {
+      return num_lighting;
+    }
+
+    int get_num_lights() const {
+      return data.num_lights;
+    }
+
+    /// light_clusters::get_shader_params() of the frame, or zeros if the lights are not clustered.
+    const vec4 *get_cluster_params() const {
+      return cluster_params;
+    }
+  };
+}}
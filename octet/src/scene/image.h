@@ -37,12 +37,16 @@ namespace octet { namespace scene {
 
     GLuint gl_target;
 
+    // did we make gl_texture, or were we given it?
+    bool owns_texture;
+
     void init(const char *name) {
       bool is_cubemap = strstr(name, "%s") != 0;
       this->url = name;
       width = height = 0;
       depth = 1;
       gl_texture = 0;
+      owns_texture = false;
       gl_target = is_cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
       mip_levels = 1;
       cube_faces = is_cubemap ? 6 : 1;
@@ -214,7 +218,7 @@ namespace octet { namespace scene {
     }
 
     void add_texture() {
-      glBindTexture(gl_target, gl_texture);
+      gl_state::bind_texture(0, gl_target, gl_texture);
 
       if (mip_levels == 1 || gl_target != GL_TEXTURE_2D) {
         if (gl_target == GL_TEXTURE_2D) {
@@ -266,6 +270,7 @@ namespace octet { namespace scene {
     image(GLuint _target, GLuint _texture, unsigned _width, unsigned _height, unsigned _depth=1) {
       gl_target = _target;
       gl_texture = _texture;
+      owns_texture = false;
       width = _width;
       height = _height;
       depth = _depth; // for 3D textures
@@ -273,6 +278,9 @@ namespace octet { namespace scene {
 
     /// release resources.
     ~image() {
+      if (owns_texture) {
+        gl_state::delete_texture(gl_texture);
+      }
     }
 
     /// width in pixels
@@ -313,6 +321,7 @@ namespace octet { namespace scene {
 
     /// load the image from a url
     void load() {
+      OCTET_ALLOC_TAG("image");
       string x;
       if (cube_faces == 6) {
         bytes.resize(0);
@@ -373,13 +382,14 @@ namespace octet { namespace scene {
 
         // make a new texture handle
         glGenTextures(1, &gl_texture);
-        glActiveTexture(GL_TEXTURE0);
+        owns_texture = true;
+        gl_state::active_texture(0);
 
         // todo: handle compressed textures
         if (format == GL_RGB || format == GL_RGBA) {
           add_texture();
         } else if (format == COMPRESSED_RGB_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT1_EXT || format == COMPRESSED_RGBA_S3TC_DXT3_EXT || format == COMPRESSED_RGBA_S3TC_DXT5_EXT) {
-          glBindTexture(gl_target, gl_texture);
+          gl_state::bind_texture(0, gl_target, gl_texture);
           unsigned w = width;
           unsigned h = height;
           uint8_t *src = &bytes[0];
@@ -413,7 +423,8 @@ namespace octet { namespace scene {
     void reload(GLuint format, GLuint type, void *pixels) {
       if (gl_target == 0) return;
 
-      glBindTexture(gl_target, gl_texture);
+      gl_state::active_texture(0);
+      gl_state::bind_texture(0, gl_target, gl_texture);
       glTexSubImage2D(gl_target, 0, 0, 0, width, height, format, type, pixels);
     }
   };
@@ -90,6 +90,11 @@ namespace octet { namespace scene {
       return color;
     }
 
+    /// get the full angle of a spot light's cone in degrees.
+    float get_falloff_angle() {
+      return falloff_angle;
+    }
+
     /// Compute parameters for a fragment shader.
     /// in the fragment shader, we give the position and direction for diffuse and specular calculation
     void get_fragment_uniforms(scene_node *node, vec4 *uniforms, const mat4t &worldToCamera) {
@@ -0,0 +1,605 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Clustered light assignment
+//
+
+namespace octet { namespace scene {
+  /// Assigns point and spot lights to the cells ("clusters") of a view space grid,
+  /// so that shaders only light a fragment with the lights that can reach it.
+  ///
+  /// The view frustum is cut into dim_x by dim_y screen tiles and dim_z depth slices,
+  /// with slices spaced exponentially between the near and far planes.
+  /// Each light's range comes from its attenuation: the distance at which it falls below get_cutoff().
+  /// Directional lights, and lights with no attenuation, reach everywhere and go in the
+  /// global light uniforms instead (up to material::max_lights of them).
+  ///
+  /// The results go to three float textures: the grid (offset and count per cluster),
+  /// the light indices and the light data (four texels per light, as light::get_fragment_uniforms,
+  /// with the spot cut-off cosine in the w of the second texel). Materials made with
+  /// material(color, shader, true) and shaders made with bump_shader::init(..., true) read them.
+  /// visual_scene::set_clustered_lighting() does all of this for its materials.
+  ///
+  /// Example
+  ///
+  ///     clusters.begin(cam->get_cameraToProjection(), cam->get_near_plane(), cam->get_far_plane(), viewport_width, viewport_height);
+  ///     for (each light instance) clusters.add_light(li->get_light(), li->get_node(), worldToCamera);
+  ///     clusters.build();
+  ///     clusters.upload();
+  ///
+  ///     clusters.bind(6);
+  ///     vec4 params[light_clusters::num_shader_params];
+  ///     clusters.get_shader_params(params);
+  ///     shader.render_clustered(modelToProjection, modelToCamera, clusters.get_global_uniforms(), clusters.get_num_global_uniforms(), clusters.get_num_global_lights(), params, 6);
+  class light_clusters {
+  public:
+    enum {
+      default_dim_x = 16,
+      default_dim_y = 9,
+      default_dim_z = 24,
+
+      /// lights past this many in one cluster are dropped (see stats::num_overflows)
+      max_lights_per_cluster = 64,
+
+      /// size of the global light uniforms: ambient + four vec4s per light
+      max_global_uniforms = 17,
+      max_global_lights = 4,
+
+      /// vec4s of parameters for the shader
+      num_shader_params = 4,
+
+      // texture widths
+      lights_per_row = 256,
+      indices_per_row = 1024,
+    };
+
+    /// Results of the last build()
+    struct stats {
+      /// point and spot lights in the clusters
+      unsigned num_lights;
+
+      /// lights that reach every cluster
+      unsigned num_global_lights;
+
+      /// lights with no effect on the view
+      unsigned num_culled_lights;
+
+      /// light indices in all the clusters
+      unsigned num_references;
+
+      /// light indices dropped because a cluster was full
+      unsigned num_overflows;
+
+      /// most lights in one cluster
+      unsigned max_cluster_lights;
+    };
+
+  private:
+    struct cull_light {
+      float pos[3];
+      float radius;
+      float axis[3];      // direction the spot light shines
+      float cos_angle;    // cone half angle, or -1 for point lights
+      float sin_angle;
+      unsigned first_slice;
+      unsigned last_slice;
+      unsigned first_x;
+      unsigned last_x;
+      unsigned first_y;
+      unsigned last_y;
+    };
+
+    unsigned dim_x;
+    unsigned dim_y;
+    unsigned dim_z;
+    float cutoff;
+    platform::thread_pool *pool;
+
+    // what the cluster bounds were built for
+    mat4t built_cameraToProjection;
+    float near_plane;
+    float far_plane;
+    float slice_scale;
+    float slice_bias;
+    float viewport_width;
+    float viewport_height;
+
+    // planes between the columns and rows of tiles, facing +x and +y.
+    dynarray<vec4> x_planes;
+    dynarray<vec4> y_planes;
+
+    // bounding spheres of the clusters, one slice after another.
+    // slices are padded so that a group of four starting anywhere in a row stays in the slice.
+    unsigned slice_stride;
+    dynarray<float> sphere_x;
+    dynarray<float> sphere_y;
+    dynarray<float> sphere_z;
+    dynarray<float> sphere_r;
+
+    // this frame's lights
+    dynarray<cull_light> lights;
+    dynarray<vec4> light_data;
+    vec4 global_uniforms[max_global_uniforms];
+    int num_global_lights;
+    vec4 ambient;
+    int num_ambient;
+    unsigned num_culled;
+
+    // per cluster light lists, filled a slice at a time.
+    dynarray<uint16_t> counts;
+    dynarray<uint16_t> slots;
+    dynarray<unsigned> slice_overflows;
+
+    // what we upload
+    dynarray<float> grid;
+    dynarray<float> indices;
+    GLuint textures[3];
+    unsigned light_rows;
+    unsigned index_rows;
+
+    stats last_stats;
+
+    // depth slice of a view space distance, not clamped.
+    int get_slice(float depth) const {
+      return (int)floorf(logf(depth) * slice_scale + slice_bias);
+    }
+
+    // the point at view depth "depth" on the line through the unprojected ndc points near_p and far_p
+    static vec3 at_depth(const vec4 &near_p, const vec4 &far_p, float depth) {
+      float t = (depth + near_p.z()) / (near_p.z() - far_p.z());
+      return near_p.xyz() + (far_p.xyz() - near_p.xyz()) * t;
+    }
+
+    // plane through three points, with "facing" on the positive side.
+    static vec4 get_plane(const vec3 &p0, const vec3 &p1, const vec3 &p2, const vec3 &facing) {
+      vec3 normal = normalize(cross(p1 - p0, p2 - p0));
+      if (dot(normal, facing) < 0) normal = -normal;
+      return vec4(normal, -dot(normal, p0));
+    }
+
+    // first and last tile between planes that a sphere may touch. false if none.
+    static bool get_tile_range(const dynarray<vec4> &planes, const vec3 &pos, float radius, unsigned &first, unsigned &last) {
+      first = ~0u;
+      last = 0;
+      float below = dot(planes[0].xyz(), pos) + planes[0].w();
+      for (unsigned i = 0; i + 1 < planes.size(); ++i) {
+        float above = dot(planes[i + 1].xyz(), pos) + planes[i + 1].w();
+        if (below > -radius && above < radius) {
+          if (first == ~0u) first = i;
+          last = i;
+        }
+        below = above;
+      }
+      return first != ~0u;
+    }
+
+    void build_bounds(const mat4t &cameraToProjection) {
+      built_cameraToProjection = cameraToProjection;
+      mat4t projectionToCamera = cameraToProjection.inverse4x4();
+
+      unsigned num_tiles = dim_x * dim_y;
+      slice_stride = (num_tiles + 6) & ~3;
+      unsigned size = slice_stride * dim_z;
+      sphere_x.resize(size);
+      sphere_y.resize(size);
+      sphere_z.resize(size);
+      sphere_r.resize(size);
+
+      // the corners of the tiles on the near and far planes, released at the end of the function.
+      frame_allocator::scope temps;
+      dynarray<vec4, frame_allocator> near_points((dim_x + 1) * (dim_y + 1));
+      dynarray<vec4, frame_allocator> far_points((dim_x + 1) * (dim_y + 1));
+      for (unsigned y = 0; y <= dim_y; ++y) {
+        for (unsigned x = 0; x <= dim_x; ++x) {
+          float nx = x * 2.0f / dim_x - 1;
+          float ny = y * 2.0f / dim_y - 1;
+          vec4 n = vec4(nx, ny, -1, 1) * projectionToCamera;
+          vec4 f = vec4(nx, ny, 1, 1) * projectionToCamera;
+          near_points[y * (dim_x + 1) + x] = n / n.w();
+          far_points[y * (dim_x + 1) + x] = f / f.w();
+        }
+      }
+
+      // the plane through the eye (or view direction) and an edge of the tiles.
+      // corner points are y * (dim_x + 1) + x
+      unsigned row = dim_x + 1;
+      vec3 right = near_points[dim_x].xyz() - near_points[0].xyz();
+      vec3 up = near_points[dim_y * row].xyz() - near_points[0].xyz();
+      x_planes.resize(dim_x + 1);
+      for (unsigned x = 0; x <= dim_x; ++x) {
+        x_planes[x] = get_plane(near_points[x].xyz(), near_points[dim_y * row + x].xyz(), far_points[x].xyz(), right);
+      }
+      y_planes.resize(dim_y + 1);
+      for (unsigned y = 0; y <= dim_y; ++y) {
+        y_planes[y] = get_plane(near_points[y * row].xyz(), near_points[y * row + dim_x].xyz(), far_points[y * row].xyz(), up);
+      }
+
+      for (unsigned z = 0; z != dim_z; ++z) {
+        float d0 = near_plane * powf(far_plane / near_plane, (float)z / dim_z);
+        float d1 = near_plane * powf(far_plane / near_plane, (float)(z + 1) / dim_z);
+        for (unsigned i = 0; i != slice_stride; ++i) {
+          unsigned idx = z * slice_stride + i;
+          if (i >= num_tiles) {
+            // padding: never touched by a light
+            sphere_x[idx] = sphere_y[idx] = sphere_z[idx] = 1e18f;
+            sphere_r[idx] = 0;
+            continue;
+          }
+          unsigned tx = i % dim_x, ty = i / dim_x;
+          vec3 lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+          for (unsigned c = 0; c != 4; ++c) {
+            unsigned corner = (ty + (c >> 1)) * (dim_x + 1) + tx + (c & 1);
+            vec3 p0 = at_depth(near_points[corner], far_points[corner], d0);
+            vec3 p1 = at_depth(near_points[corner], far_points[corner], d1);
+            lo = min(lo, min(p0, p1));
+            hi = max(hi, max(p0, p1));
+          }
+          vec3 centre = (lo + hi) * 0.5f;
+          sphere_x[idx] = centre.x();
+          sphere_y[idx] = centre.y();
+          sphere_z[idx] = centre.z();
+          sphere_r[idx] = length(hi - centre);
+        }
+      }
+    }
+
+    // distance at which 1/(c + l d + q d^2) * brightness falls below the cutoff; negative if it never does.
+    float get_range(const vec4 &attenuation, float brightness) const {
+      float c = attenuation.x(), l = attenuation.y(), q = attenuation.z();
+      float k = brightness / cutoff;
+      if (k <= c) return 0;
+      if (q > 0) {
+        return (-l + sqrtf(l * l - 4 * q * (c - k))) / (2 * q);
+      } else if (l > 0) {
+        return (k - c) / l;
+      }
+      return -1;
+    }
+
+    // four clusters starting at idx against one light. returns a bit per cluster.
+    unsigned test4(unsigned idx, const cull_light &lt) const {
+      #if OCTET_SSE2
+        __m128 cx = _mm_sub_ps(_mm_loadu_ps(&sphere_x[idx]), _mm_set1_ps(lt.pos[0]));
+        __m128 cy = _mm_sub_ps(_mm_loadu_ps(&sphere_y[idx]), _mm_set1_ps(lt.pos[1]));
+        __m128 cz = _mm_sub_ps(_mm_loadu_ps(&sphere_z[idx]), _mm_set1_ps(lt.pos[2]));
+        __m128 cr = _mm_loadu_ps(&sphere_r[idx]);
+        __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz));
+        __m128 reach = _mm_add_ps(cr, _mm_set1_ps(lt.radius));
+        __m128 hit = _mm_cmplt_ps(dist2, _mm_mul_ps(reach, reach));
+        if (lt.cos_angle > -1) {
+          // the cluster sphere against the cone: along the axis, and away from it.
+          __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(lt.axis[0])), _mm_mul_ps(cy, _mm_set1_ps(lt.axis[1]))), _mm_mul_ps(cz, _mm_set1_ps(lt.axis[2])));
+          __m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(dist2, _mm_mul_ps(along, along)), _mm_setzero_ps()));
+          __m128 closest = _mm_sub_ps(_mm_mul_ps(across, _mm_set1_ps(lt.cos_angle)), _mm_mul_ps(along, _mm_set1_ps(lt.sin_angle)));
+          hit = _mm_and_ps(hit, _mm_cmple_ps(closest, cr));
+          hit = _mm_and_ps(hit, _mm_cmpge_ps(along, _mm_sub_ps(_mm_setzero_ps(), cr)));
+        }
+        return (unsigned)_mm_movemask_ps(hit);
+      #else
+        unsigned mask = 0;
+        for (unsigned i = 0; i != 4; ++i) {
+          float cx = sphere_x[idx + i] - lt.pos[0];
+          float cy = sphere_y[idx + i] - lt.pos[1];
+          float cz = sphere_z[idx + i] - lt.pos[2];
+          float cr = sphere_r[idx + i];
+          float dist2 = cx * cx + cy * cy + cz * cz;
+          float reach = cr + lt.radius;
+          bool hit = dist2 < reach * reach;
+          if (hit && lt.cos_angle > -1) {
+            float along = cx * lt.axis[0] + cy * lt.axis[1] + cz * lt.axis[2];
+            float across = sqrtf(std::max(dist2 - along * along, 0.0f));
+            float closest = across * lt.cos_angle - along * lt.sin_angle;
+            hit = closest <= cr && along >= -cr;
+          }
+          mask |= (unsigned)hit << i;
+        }
+        return mask;
+      #endif
+    }
+
+    // fill the light lists of one depth slice.
+    void build_slice(unsigned z) {
+      unsigned num_tiles = dim_x * dim_y;
+      uint16_t *slice_counts = counts.data() + z * num_tiles;
+      uint16_t *slice_slots = slots.data() + z * num_tiles * max_lights_per_cluster;
+      memset(slice_counts, 0, num_tiles * sizeof(uint16_t));
+      unsigned overflows = 0;
+
+      for (unsigned l = 0; l != lights.size(); ++l) {
+        const cull_light &lt = lights[l];
+        if (z < lt.first_slice || z > lt.last_slice) continue;
+
+        // only the tiles under the light's rectangle on screen, four at a time.
+        for (unsigned y = lt.first_y; y <= lt.last_y; ++y) {
+          for (unsigned x = lt.first_x; x <= lt.last_x; x += 4) {
+            unsigned i = y * dim_x + x;
+            unsigned remaining = lt.last_x - x + 1;
+            unsigned mask = test4(z * slice_stride + i, lt) & (remaining >= 4 ? 15 : (1 << remaining) - 1);
+            while (mask) {
+              unsigned tile = i + first_bit(mask);
+              mask &= mask - 1;
+              if (slice_counts[tile] < max_lights_per_cluster) {
+                slice_slots[tile * max_lights_per_cluster + slice_counts[tile]++] = (uint16_t)l;
+              } else {
+                overflows++;
+              }
+            }
+          }
+        }
+      }
+      slice_overflows[z] = overflows;
+    }
+
+    static unsigned first_bit(unsigned mask) {
+      unsigned i = 0;
+      while (!(mask & (1 << i))) ++i;
+      return i;
+    }
+
+    static void upload_texture(GLuint texture, GLint internal_format, GLenum format, unsigned width, unsigned height, const float *data) {
+      gl_state::active_texture(0);
+      gl_state::bind_texture(0, GL_TEXTURE_2D, texture);
+      glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_FLOAT, (void*)data);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+  public:
+    light_clusters() {
+      dim_x = default_dim_x;
+      dim_y = default_dim_y;
+      dim_z = default_dim_z;
+      cutoff = 1.0f / 256;
+      pool = 0;
+      near_plane = far_plane = 0;
+      slice_scale = slice_bias = 0;
+      viewport_width = viewport_height = 1;
+      slice_stride = 0;
+      memset(built_cameraToProjection.get(), 0, sizeof(mat4t));
+      textures[0] = textures[1] = textures[2] = 0;
+      light_rows = index_rows = 0;
+      num_global_lights = 0;
+      num_ambient = 0;
+      num_culled = 0;
+      memset(&last_stats, 0, sizeof(last_stats));
+    }
+
+    ~light_clusters() {
+      if (textures[0]) {
+        for (unsigned i = 0; i != 3; ++i) {
+          gl_state::delete_texture(textures[i]);
+        }
+      }
+    }
+
+    /// Set the number of tiles across, down and in depth.
+    void set_dimensions(unsigned x, unsigned y, unsigned z) {
+      dim_x = x;
+      dim_y = y;
+      dim_z = z;
+      slice_stride = 0;
+    }
+
+    /// Set the brightness below which a light has no effect. The default is 1/256.
+    void set_cutoff(float value) {
+      cutoff = value;
+    }
+
+    /// get the brightness below which a light has no effect.
+    float get_cutoff() const {
+      return cutoff;
+    }
+
+    /// Use a specific pool. The default is thread_pool::get_default().
+    void set_thread_pool(platform::thread_pool *value) {
+      pool = value;
+    }
+
+    /// Start a new frame for a camera. The cluster bounds are only rebuilt if the projection changes.
+    void begin(const mat4t &cameraToProjection, float near_plane, float far_plane, int viewport_width, int viewport_height) {
+      bool same = slice_stride != 0 && this->near_plane == near_plane && this->far_plane == far_plane &&
+        memcmp(&built_cameraToProjection, &cameraToProjection, sizeof(mat4t)) == 0;
+      this->near_plane = near_plane;
+      this->far_plane = far_plane;
+      this->viewport_width = (float)viewport_width;
+      this->viewport_height = (float)viewport_height;
+      slice_scale = dim_z / logf(far_plane / near_plane);
+      slice_bias = -logf(near_plane) * slice_scale;
+      if (!same) {
+        build_bounds(cameraToProjection);
+      }
+
+      lights.resize(0);
+      light_data.resize(0);
+      for (unsigned i = 0; i != max_global_uniforms; ++i) {
+        global_uniforms[i] = vec4(0, 0, 0, 0);
+      }
+      num_global_lights = 0;
+      ambient = vec4(0, 0, 0, 1);
+      num_ambient = 0;
+      num_culled = 0;
+    }
+
+    /// Add a light, using the view space data from light::get_fragment_uniforms.
+    void add_light(light *lt, scene_node *node, const mat4t &worldToCamera) {
+      atom_t kind = lt->get_kind();
+      if (kind == atom_ambient) {
+        ambient += lt->get_color();
+        num_ambient++;
+        return;
+      }
+
+      vec4 uniforms[4];
+      lt->get_fragment_uniforms(node, uniforms, worldToCamera);
+      vec4 color = lt->get_color();
+      float brightness = std::max(color.x(), std::max(color.y(), color.z()));
+      float range = kind == atom_directional ? -1 : get_range(uniforms[3], brightness);
+
+      if (range < 0) {
+        // reaches everywhere
+        if (num_global_lights != max_global_lights) {
+          for (unsigned i = 0; i != 4; ++i) {
+            global_uniforms[1 + num_global_lights * 4 + i] = uniforms[i];
+          }
+          num_global_lights++;
+        }
+        return;
+      }
+
+      float depth = -uniforms[0].z();
+      unsigned first_x, last_x, first_y, last_y;
+      if (
+        range == 0 || depth + range < near_plane || depth - range > far_plane ||
+        !get_tile_range(x_planes, uniforms[0].xyz(), range, first_x, last_x) ||
+        !get_tile_range(y_planes, uniforms[0].xyz(), range, first_y, last_y)
+      ) {
+        num_culled++;
+        return;
+      }
+
+      cull_light &cl = lights.emplace_back();
+      for (unsigned i = 0; i != 3; ++i) {
+        cl.pos[i] = uniforms[0][i];
+        cl.axis[i] = -uniforms[1][i];
+      }
+      cl.radius = range;
+      cl.cos_angle = -1;
+      cl.sin_angle = 0;
+      float half_angle = lt->get_falloff_angle() * (3.14159265f / 360);
+      if (kind == atom_spot && half_angle < 3.14159265f / 2) {
+        cl.cos_angle = cosf(half_angle);
+        cl.sin_angle = sinf(half_angle);
+      }
+      int first = get_slice(std::max(depth - range, near_plane));
+      int last = get_slice(std::min(depth + range, far_plane));
+      cl.first_slice = (unsigned)std::max(first, 0);
+      cl.last_slice = (unsigned)std::min(last, (int)dim_z - 1);
+      cl.first_x = first_x;
+      cl.last_x = last_x;
+      cl.first_y = first_y;
+      cl.last_y = last_y;
+
+      uniforms[1][3] = cl.cos_angle;
+      for (unsigned i = 0; i != 4; ++i) {
+        light_data.push_back(uniforms[i]);
+      }
+    }
+
+    /// Assign the lights to clusters.
+    void build() {
+      global_uniforms[0] = num_ambient ? ambient : vec4(0.5f, 0.5f, 0.5f, 1);
+
+      unsigned num_tiles = dim_x * dim_y;
+      unsigned num_clusters = num_tiles * dim_z;
+      counts.resize(num_clusters);
+      slots.resize(num_clusters * max_lights_per_cluster);
+      slice_overflows.resize(dim_z);
+
+      // each thread owns whole slices, so no two write the same list.
+      platform::thread_pool &p = pool ? *pool : platform::thread_pool::get_default();
+      unsigned grain = lights.size() < 64 ? dim_z : 1;
+      p.parallel_for(dim_z, grain, [&](unsigned begin, unsigned end) {
+        for (unsigned z = begin; z != end; ++z) {
+          build_slice(z);
+        }
+      });
+
+      // pack the lists end to end.
+      grid.resize(num_clusters * 2);
+      indices.resize(0);
+      memset(&last_stats, 0, sizeof(last_stats));
+      last_stats.num_lights = lights.size();
+      last_stats.num_global_lights = num_global_lights;
+      last_stats.num_culled_lights = num_culled;
+      for (unsigned c = 0; c != num_clusters; ++c) {
+        unsigned count = counts[c];
+        grid[c * 2 + 0] = (float)indices.size();
+        grid[c * 2 + 1] = (float)count;
+        const uint16_t *src = slots.data() + c * max_lights_per_cluster;
+        for (unsigned i = 0; i != count; ++i) {
+          indices.push_back((float)src[i]);
+        }
+        last_stats.max_cluster_lights = std::max(last_stats.max_cluster_lights, count);
+      }
+      last_stats.num_references = indices.size();
+      for (unsigned z = 0; z != dim_z; ++z) {
+        last_stats.num_overflows += slice_overflows[z];
+      }
+    }
+
+    /// Copy the grid, indices and light data to textures.
+    void upload() {
+      #ifndef OCTET_GLES2
+        if (!textures[0]) {
+          glGenTextures(3, textures);
+        }
+
+        light_rows = (light_data.size() / 4 + lights_per_row - 1) / lights_per_row;
+        index_rows = (indices.size() + indices_per_row - 1) / indices_per_row;
+        if (light_rows == 0) light_rows = 1;
+        if (index_rows == 0) index_rows = 1;
+        light_data.resize(light_rows * lights_per_row * 4);
+        indices.resize(index_rows * indices_per_row);
+
+        upload_texture(textures[0], GL_RG32F, GL_RG, dim_x * dim_y, dim_z, grid.data());
+        upload_texture(textures[1], GL_R32F, GL_RED, indices_per_row, index_rows, indices.data());
+        upload_texture(textures[2], GL_RGBA32F, GL_RGBA, lights_per_row * 4, light_rows, (float*)light_data.data());
+      #endif
+    }
+
+    /// Bind the grid, indices and light textures to three texture units starting at first_unit.
+    void bind(unsigned first_unit) const {
+      for (unsigned i = 0; i != 3; ++i) {
+        gl_state::bind_texture(first_unit + i, GL_TEXTURE_2D, textures[i]);
+      }
+    }
+
+    /// Get the uniform "cluster_params" for the shader.
+    void get_shader_params(vec4 *params) const {
+      params[0] = vec4((float)dim_x, (float)dim_y, (float)dim_z, 0);
+      params[1] = vec4(slice_scale, slice_bias, 1.0f / viewport_width, 1.0f / viewport_height);
+      params[2] = vec4(1.0f / (dim_x * dim_y), 1.0f / dim_z, lights_per_row * 4.0f, (float)indices_per_row);
+      params[3] = vec4(1.0f / (lights_per_row * 4), 1.0f / light_rows, 1.0f / indices_per_row, 1.0f / index_rows);
+    }
+
+    /// Ambient and the lights that reach everywhere, laid out like visual_scene's light uniforms.
+    const vec4 *get_global_uniforms() const {
+      return global_uniforms;
+    }
+
+    int get_num_global_uniforms() const {
+      return 1 + num_global_lights * 4;
+    }
+
+    int get_num_global_lights() const {
+      return num_global_lights;
+    }
+
+    /// Get the lights of one cluster after build(). Returns the number of lights.
+    unsigned get_cluster_lights(unsigned x, unsigned y, unsigned z, const float *&light_indices) const {
+      unsigned c = (z * dim_y + y) * dim_x + x;
+      light_indices = indices.data() + (unsigned)grid[c * 2];
+      return (unsigned)grid[c * 2 + 1];
+    }
+
+    /// Get the depth slice of a view space distance.
+    unsigned get_slice_of_depth(float depth) const {
+      int slice = get_slice(depth);
+      return (unsigned)std::min(std::max(slice, 0), (int)dim_z - 1);
+    }
+
+    /// Get the view space bounding sphere of a cluster.
+    vec4 get_cluster_sphere(unsigned x, unsigned y, unsigned z) const {
+      unsigned idx = z * slice_stride + y * dim_x + x;
+      return vec4(sphere_x[idx], sphere_y[idx], sphere_z[idx], sphere_r[idx]);
+    }
+
+    /// Get the results of the last build()
+    const stats &get_stats() const {
+      return last_stats;
+    }
+  };
+}}
@@ -0,0 +1,130 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Levels of detail of a mesh
+//
+
+namespace octet { namespace scene {
+  /// Levels of detail of a mesh, from the full mesh (level 0) to the simplest.
+  ///
+  /// Each level has an error: how far, in model space, its surface may be from the full mesh.
+  /// visual_scene draws the simplest level whose error covers no more than get_pixel_error() pixels on the screen.
+  /// To stop an instance flickering between two levels at the switching distance, a coarser level must be
+  /// get_hysteresis() under the limit before we switch to it. Finer levels are used as soon as they are needed.
+  ///
+  /// One lod_group can be shared by all the instances of a mesh. eg.
+  ///
+  ///     ref<lod_group> lods = new lod_group(new mesh_sphere(vec3(0), 1, 4));
+  ///     lods->generate(3);
+  ///     mi->set_lod_group(lods);
+  class lod_group : public resource {
+    // meshes and their errors, in order of increasing error.
+    dynarray<ref<mesh> > meshes;
+    dynarray<float> errors;
+
+    // largest error, in pixels, that we allow on screen.
+    float pixel_error;
+
+    // fraction of pixel_error to stay under when switching to a coarser level.
+    float hysteresis;
+
+  public:
+    RESOURCE_META(lod_group)
+
+    /// Make a group with msh as the first level, if msh is not null.
+    lod_group(mesh *msh=0, float pixel_error=1.0f) {
+      this->pixel_error = pixel_error;
+      hysteresis = 0.25f;
+      if (msh) add_level(msh, 0);
+    }
+
+    /// Serialise
+    void visit(visitor &v) {
+      v.visit(meshes, atom_meshes);
+      v.visit(errors, atom_errors);
+      v.visit(pixel_error, atom_pixel_error);
+      v.visit(hysteresis, atom_hysteresis);
+    }
+
+    /// Add a level. Levels must be added with errors that never get smaller.
+    void add_level(mesh *msh, float error) {
+      assert(errors.size() == 0 || error >= errors.back());
+      meshes.push_back(msh);
+      errors.push_back(error);
+    }
+
+    /// Add up to num_levels levels with the simplifier, each with about ratio times the triangles of the one before.
+    /// Each level is made from the one before, so its error is the sum of the errors so far.
+    /// Stops early if a level can not be simplified any further.
+    void generate(unsigned num_levels, float ratio=0.5f) {
+      for (unsigned i = 0; i != num_levels && meshes.size(); ++i) {
+        mesh *prev = meshes.back();
+        ref<simplifier> level = new simplifier(prev, ratio);
+        if (level->get_num_indices() == 0 || level->get_num_indices() >= prev->get_num_indices()) break;
+        add_level(level, errors.back() + level->get_error());
+      }
+    }
+
+    /// Choose a level for an instance whose model space units cover pixels_per_unit pixels on the screen.
+    /// current is the level it was drawn with last time.
+    unsigned select_level(unsigned current, float pixels_per_unit) const {
+      unsigned num_levels = meshes.size();
+      if (num_levels == 0) return 0;
+
+      // the simplest level that is good enough.
+      unsigned level = 0;
+      while (level + 1 != num_levels && errors[level + 1] * pixels_per_unit <= pixel_error) {
+        ++level;
+      }
+
+      // only go coarser as far as the levels that are well under the limit.
+      if (level > current) {
+        float limit = pixel_error * (1 - hysteresis);
+        unsigned coarser = current;
+        while (coarser != level && errors[coarser + 1] * pixels_per_unit <= limit) {
+          ++coarser;
+        }
+        level = coarser;
+      }
+      return level;
+    }
+
+    /// Number of levels.
+    unsigned get_num_levels() const {
+      return meshes.size();
+    }
+
+    /// The mesh of a level. Level 0 is the full mesh.
+    mesh *get_mesh(unsigned level) const {
+      return meshes[level];
+    }
+
+    /// The error of a level, in model space.
+    float get_error(unsigned level) const {
+      return errors[level];
+    }
+
+    /// Largest error, in pixels, allowed on screen.
+    float get_pixel_error() const {
+      return pixel_error;
+    }
+
+    /// Set the largest error, in pixels, allowed on screen. Larger values draw simpler levels closer to the camera.
+    void set_pixel_error(float value) {
+      pixel_error = value;
+    }
+
+    /// Fraction of the pixel error to stay under when switching to a coarser level.
+    float get_hysteresis() const {
+      return hysteresis;
+    }
+
+    /// Set the fraction of the pixel error to stay under when switching to a coarser level. 0 switches as soon as possible.
+    void set_hysteresis(float value) {
+      hysteresis = value;
+    }
+  };
+}}
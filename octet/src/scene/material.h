@@ -24,15 +24,124 @@ namespace octet { namespace scene {
     //dynarray<uint8_t> static_buffer;
     dynarray<uint8_t> buffer;
 
+    // true once the parameters have been bound to the instanced variant of the shader.
+    bool instanced_bound;
+
+    // the parameters that change frequently, found once.
+    param_uniform *modelToProjection_param;
+    param_uniform *modelToCamera_param;
+    param_uniform *lighting_param;
+    param_uniform *num_lights_param;
+    param_uniform *cluster_params_param;
+
+    // binding table: the colours and textures to set when the material is used. made on first use.
+    struct binding {
+      param_uniform *uniform;
+      param_sampler *sampler;
+    };
+    dynarray<binding> bindings;
+    bool bindings_built;
+
+    // changes whenever a colour or texture changes, so that programs know to take them again.
+    // no two materials share a version.
+    unsigned version;
+
+    static unsigned next_version() {
+      static unsigned counter;
+      return ++counter;
+    }
+
+    void init() {
+      instanced_bound = false;
+      modelToProjection_param = modelToCamera_param = lighting_param = num_lights_param = cluster_params_param = NULL;
+      bindings_built = false;
+      version = next_version();
+    }
+
     // create the parameters that change frequently such as the matrices and lighting
     void create_dynamic_params() {
       buffer.reserve(0x200);
       param_buffer_info dynamic_pbi(buffer);
 
-      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_modelToProjection, GL_FLOAT_MAT4, 1, param::stage_vertex));
-      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_modelToCamera, GL_FLOAT_MAT4, 1, param::stage_vertex));
-      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_lighting, GL_FLOAT_VEC4, ambient_size + max_lights * light_size, param::stage_fragment));
-      params.push_back(new param_uniform(dynamic_pbi, NULL, atom_num_lights, GL_INT, 1, param::stage_fragment));
+      params.push_back(modelToProjection_param = new param_uniform(dynamic_pbi, NULL, atom_modelToProjection, GL_FLOAT_MAT4, 1, param::stage_vertex));
+      params.push_back(modelToCamera_param = new param_uniform(dynamic_pbi, NULL, atom_modelToCamera, GL_FLOAT_MAT4, 1, param::stage_vertex));
+      params.push_back(lighting_param = new param_uniform(dynamic_pbi, NULL, atom_lighting, GL_FLOAT_VEC4, ambient_size + max_lights * light_size, param::stage_fragment));
+      params.push_back(num_lights_param = new param_uniform(dynamic_pbi, NULL, atom_num_lights, GL_INT, 1, param::stage_fragment));
+    }
+
+    // create the parameters of a shader lit by light_clusters. The texture units never change,
+    // so they are set with the colours; the cluster parameters come with the lights of the frame.
+    void create_cluster_params() {
+      param_buffer_info pbi(buffer);
+      params.push_back(cluster_params_param = new param_uniform(pbi, NULL, atom_cluster_params, GL_FLOAT_VEC4, frame_uniforms::num_cluster_params, param::stage_fragment));
+
+      static const atom_t names[] = { atom_cluster_grid, atom_cluster_indices, atom_cluster_lights };
+      for (unsigned i = 0; i != 3; ++i) {
+        GLint unit = frame_uniforms::first_cluster_unit + i;
+        params.push_back(new param_uniform(pbi, &unit, names[i], GL_INT, 1, param::stage_fragment));
+      }
+    }
+
+    // find the uniforms that are not set per draw or per frame.
+    void build_bindings() {
+      bindings.resize(0);
+      for (unsigned i = 0; i != params.size(); ++i) {
+        param_uniform *pu = params[i]->get_param_uniform();
+        if (pu && pu != modelToProjection_param && pu != modelToCamera_param && pu != lighting_param && pu != num_lights_param && pu != cluster_params_param) {
+          binding &b = bindings.emplace_back();
+          b.uniform = pu;
+          b.sampler = params[i]->get_param_sampler();
+        }
+      }
+      bindings_built = true;
+    }
+
+    // set the lighting uniforms, and the camera of the instanced variant, unless the program already has them.
+    void render_frame_params(const frame_uniforms &frame, param_shader::upload_record &record, bool instanced) {
+      if (record.frame_version == frame.get_version()) return;
+      record.frame_version = frame.get_version();
+
+      if (instanced) {
+        custom_shader->set_instanced_matrices(frame.get_worldToProjection(), frame.get_worldToCamera());
+      }
+
+      // shaders with the frame_uniforms block have no lighting uniforms, so these do nothing.
+      if (lighting_param) {
+        lighting_param->set_value(buffer.data(), frame.get_lighting(), sizeof(vec4) * frame.get_num_lighting());
+        lighting_param->render(buffer.data(), instanced);
+      }
+      if (num_lights_param) {
+        int32_t num_lights = frame.get_num_lights();
+        num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+        num_lights_param->render(buffer.data(), instanced);
+      }
+      if (cluster_params_param) {
+        cluster_params_param->set_value(buffer.data(), frame.get_cluster_params(), sizeof(vec4) * frame_uniforms::num_cluster_params);
+        cluster_params_param->render(buffer.data(), instanced);
+      }
+    }
+
+    // set the colour and texture uniforms unless the program already has ours, and bind the textures.
+    // returns the number of textures.
+    unsigned render_static_params(param_shader::upload_record &record, bool instanced) {
+      if (!bindings_built) build_bindings();
+
+      bool upload = record.owner != this || record.owner_version != version;
+      record.owner = this;
+      record.owner_version = version;
+
+      unsigned num_textures = 0;
+      for (unsigned i = 0; i != bindings.size(); ++i) {
+        const binding &b = bindings[i];
+        if (upload) {
+          //printf("%s: %d off=%x\n", app_utils::get_atom_name(b.uniform->get_name()), b.uniform->get_uniform_buffer_index(), b.uniform->get_offset());
+          b.uniform->render(buffer.data(), instanced);
+        } else if (b.sampler) {
+          b.sampler->bind_texture();
+        }
+        if (b.sampler) num_textures++;
+      }
+      return num_textures;
     }
 
     // create the attribute parameters
@@ -42,6 +151,20 @@ namespace octet { namespace scene {
       params.push_back(new param_attribute(atom_normal, GL_FLOAT_VEC3));
     }
 
+    // connect a parameter added after construction to the shader and its instanced variant.
+    void bind_new_param(param *p) {
+      param_bind_info pbind;
+      pbind.program = custom_shader->get_program();
+      p->bind(pbind);
+      if (instanced_bound) {
+        pbind.program = custom_shader->get_instanced_program();
+        pbind.instanced = true;
+        p->bind(pbind);
+      }
+      bindings_built = false;
+      version = next_version();
+    }
+
   public:
     RESOURCE_META(material)
 
@@ -53,22 +176,28 @@ namespace octet { namespace scene {
 
     /// Default constructor makes a blank material.
     material() {
+      init();
     }
 
     /// Alternative constructor.
-    material(const vec4 &color, param_shader *shader = NULL) {
+    /// A clustered material is also lit by the point and spot lights of visual_scene::set_clustered_lighting().
+    material(const vec4 &color, param_shader *shader = NULL, bool clustered = false) {
+      init();
       // materials are constructed from parameters which build the final shader.
       // this allows us to use OpenGLES2 (uniforms) and 3 (buffers) as well as new shader features.
       params.reserve(16);
 
       create_dynamic_params();
       create_attribute_params();
+      if (clustered) {
+        create_cluster_params();
+      }
 
       param_buffer_info static_pbi(buffer);
       params.push_back(new param_color(static_pbi, color, atom_diffuse, param::stage_fragment));
 
       if (shader == NULL) {
-        shader = new param_shader("shaders/default.vs", "shaders/default_solid.fs");
+        shader = new param_shader("shaders/default.vs", clustered ? "shaders/default_clustered.fs" : "shaders/default_solid.fs");
       }
       shader->init(params);
       custom_shader = shader;
@@ -76,6 +205,7 @@ namespace octet { namespace scene {
 
     /// create a material from an existing image
     material(image *img, sampler *smpl = NULL, param_shader *shader = NULL) {
+      init();
       if (!smpl) smpl = new sampler();
 
       params.reserve(16);
@@ -94,6 +224,7 @@ namespace octet { namespace scene {
     }
 
     material(param *diffuse, param *ambient, param *emission, param *specular, param *bump, param *shininess) {
+      init();
     }
 
     /// Serialize.
@@ -107,32 +238,76 @@ namespace octet { namespace scene {
       log("lu[1] = %s\n", light_uniforms[1].toString(tmp, sizeof(tmp)));
       log("lu[2] = %s\n", light_uniforms[2].toString(tmp, sizeof(tmp)));
       log("lu[3] = %s\n", light_uniforms[3].toString(tmp, sizeof(tmp)));*/
-      {
-        // matrices and lighting go in the dynamic uniform buffer
-        param_uniform *modelToProjection_param = get_param_uniform(atom_modelToProjection);
-        if (modelToProjection_param) modelToProjection_param->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
+      custom_shader->render();
+      param_shader::upload_record &record = custom_shader->get_upload_record(false);
 
-        param_uniform *modelToCamera_param = get_param_uniform(atom_modelToCamera);
-        if (modelToCamera_param) modelToCamera_param->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
+      // these lights are not from a frame_uniforms, so the next material must set its own.
+      record.frame_version = 0;
+      if (lighting_param) {
+        lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+        lighting_param->render(buffer.data());
+      }
+      if (num_lights_param) {
+        num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+        num_lights_param->render(buffer.data());
+      }
 
-        param_uniform *lighting_param = get_param_uniform(atom_lighting);
-        if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+      render_static_params(record, false);
+      render_matrices(modelToProjection, modelToCamera);
+    }
 
-        param_uniform *num_lights_param = get_param_uniform(atom_num_lights);
-        if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+    /// Set the lighting, colour and texture uniforms, but not the matrices.
+    /// Values that the program already has from this material or this frame are not set again.
+    /// The program is only bound if use_program is true; pass false if it is already current.
+    /// Returns the number of textures bound.
+    unsigned render_shared(const frame_uniforms &frame, bool use_program) {
+      if (use_program) {
+        custom_shader->render();
       }
+      param_shader::upload_record &record = custom_shader->get_upload_record(false);
+      render_frame_params(frame, record, false);
+      return render_static_params(record, false);
+    }
 
-      custom_shader->render();
+    /// Can this material draw many objects in one call with render_shared_instanced()?
+    bool can_draw_instanced() {
+      return custom_shader && custom_shader->get_instanced_program() != 0;
+    }
 
-      {
-        // colours and textures go in the static uniform buffer
+    /// Like render_shared(), but for the instanced variant of the shader.
+    /// The model matrices come from an instance buffer (see render_queue) and the camera from the frame.
+    unsigned render_shared_instanced(const frame_uniforms &frame, bool use_program) {
+      GLuint program = custom_shader->get_instanced_program();
+      if (!instanced_bound) {
+        param_bind_info pbind;
+        pbind.program = program;
+        pbind.instanced = true;
         for (unsigned i = 0; i != params.size(); ++i) {
-          param_uniform *pu = params[i]->get_param_uniform();
-          if (pu) {
-            //printf("%s: %d off=%x\n", app_utils::get_atom_name(pu->get_name()), pu->get_uniform_buffer_index(), pu->get_offset());
-            pu->render(buffer.data());
-          }
+          params[i]->bind(pbind);
         }
+        instanced_bound = true;
+      }
+
+      if (use_program) {
+        gl_state::use_program(program);
+      }
+      param_shader::upload_record &record = custom_shader->get_upload_record(true);
+      render_frame_params(frame, record, true);
+      return render_static_params(record, true);
+    }
+
+    /// Set only the matrix uniforms.
+    /// Objects that share this material can be drawn with render_shared() once and then this for each object.
+    void render_matrices(const mat4t &modelToProjection, const mat4t &modelToCamera) {
+      // matrices go in the dynamic uniform buffer
+      if (modelToProjection_param) {
+        modelToProjection_param->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
+        modelToProjection_param->render(buffer.data());
+      }
+
+      if (modelToCamera_param) {
+        modelToCamera_param->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
+        modelToCamera_param->render(buffer.data());
       }
     }
 
@@ -162,11 +337,18 @@ namespace octet { namespace scene {
     void set_diffuse(const vec4 &color) {
       if (param *p = get_param_uniform(atom_diffuse)) {
         p->get_param_uniform()->set_value(buffer.data(), &color, sizeof(color));
+        version = next_version();
       }
     }
 
     void set_uniform(param_uniform *param, const void *data, size_t size) {
       memcpy(buffer.data() + param->get_offset(), data, size);
+      version = next_version();
+    }
+
+    /// get the shader that draws this material
+    param_shader *get_shader() const {
+      return custom_shader;
     }
 
     dynarray<ref<param> > &get_params() {
@@ -177,10 +359,7 @@ namespace octet { namespace scene {
       param_buffer_info pbi(buffer);
       param_uniform *result = new param_uniform(pbi, data, name, _type, _repeat, _stage);
       params.push_back(result);
-
-      param_bind_info pbind;
-      pbind.program = custom_shader->get_program();
-      result->bind(pbind);
+      bind_new_param(result);
       return result;
     }
 
@@ -189,10 +368,7 @@ namespace octet { namespace scene {
       pbi.texture_slot = texture_slot;
       param_sampler *result = new param_sampler(pbi, name, _image, _sampler, _stage);
       params.push_back(result);
-
-      param_bind_info pbind;
-      pbind.program = custom_shader->get_program();
-      result->bind(pbind);
+      bind_new_param(result);
       return result;
     }
   };
@@ -57,6 +57,104 @@ namespace octet { namespace scene {
     // bounding box
     aabb mesh_aabb;
 
+    // what ray_cast_bvh and occluder_corners were built from. If any of this changes, they are rebuilt.
+    struct ray_cast_source {
+      unsigned vertex_version;
+      unsigned index_version;
+      unsigned num_indices;
+      unsigned num_vertices;
+      unsigned first_index;
+      unsigned stride;
+      unsigned mode;
+      unsigned index_type;
+      unsigned pos_format;
+
+      bool operator==(const ray_cast_source &rhs) const {
+        return memcmp(this, &rhs, sizeof(*this)) == 0;
+      }
+    };
+
+    // triangles for ray_cast, built on first use.
+    triangle_bvh ray_cast_bvh;
+    ray_cast_source ray_cast_built;
+    bool has_ray_cast_bvh;
+
+    // triangles for occlusion_buffer, built on first use.
+    dynarray<vec3p> occluder_corners;
+    ray_cast_source occluder_built;
+    bool has_occluder_corners;
+
+    // what the triangles would be copied from now.
+    ray_cast_source get_triangle_source() const {
+      unsigned pos_slot = get_slot(attribute_pos);
+      ray_cast_source source;
+      memset(&source, 0, sizeof(source));
+      source.vertex_version = vertices ? vertices->get_version() : 0;
+      source.index_version = indices ? indices->get_version() : 0;
+      source.num_indices = num_indices;
+      source.num_vertices = num_vertices;
+      source.first_index = first_index;
+      source.stride = stride;
+      source.mode = mode;
+      source.index_type = index_type;
+      source.pos_format = pos_slot < max_slots ? format[pos_slot] : 0;
+      return source;
+    }
+
+    // vertex array object recording the attribute layout and buffers, built on first draw.
+    // vertex_array_dirty is set when the layout changes; the versions catch new buffer contents.
+    mutable GLuint vertex_array;
+    mutable bool vertex_array_dirty;
+    mutable unsigned vertex_array_vertex_version;
+    mutable unsigned vertex_array_index_version;
+
+    static bool &vertex_arrays_enabled() {
+      static bool value = true;
+      return value;
+    }
+
+    // point the attributes at the vertex buffer
+    void set_attribute_pointers() const {
+      vertices->bind();
+
+      unsigned n = normalized;
+      for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
+        unsigned size = get_size(slot);
+        unsigned kind = get_kind(slot);
+        unsigned attr = get_attr(slot);
+        size_t offset = get_offset(slot);
+        glVertexAttribPointer(attr, size, kind, n & 1, get_stride(), (void*)(offset));
+        glEnableVertexAttribArray(attr);
+        n >>= 1;
+      }
+    }
+
+    // bind the vertex array object, (re)building it if the mesh has changed since the last draw.
+    void bind_vertex_array() const {
+      #ifndef OCTET_GLES2
+        if (vertex_array_dirty && vertex_array) {
+          // start again with a clean object so that removed attributes are not left enabled.
+          gl_state::delete_vertex_array(vertex_array);
+          vertex_array = 0;
+        }
+
+        bool rebuild = vertex_array == 0;
+        if (rebuild) {
+          glGenVertexArrays(1, &vertex_array);
+        }
+        gl_state::bind_vertex_array(vertex_array);
+
+        unsigned index_version = indices ? indices->get_version() : 0;
+        if (rebuild || vertex_array_vertex_version != vertices->get_version() || vertex_array_index_version != index_version) {
+          set_attribute_pointers();
+          if (indices) indices->bind();
+          vertex_array_vertex_version = vertices->get_version();
+          vertex_array_index_version = index_version;
+          vertex_array_dirty = false;
+        }
+      #endif
+    }
+
     struct general_vertex {
       const uint8_t *bytes;
       unsigned size;
@@ -86,7 +184,7 @@ namespace octet { namespace scene {
     };
 
     // add a new edge to a hash map. (index, index) -> (triangle+1, triangle+1)
-    static void add_edge(dynarray<edge> &edges, unsigned tri_idx, unsigned i0, unsigned i1) {
+    template <class allocator_t> static void add_edge(dynarray<edge, allocator_t> &edges, unsigned tri_idx, unsigned i0, unsigned i1) {
       edge e = { (int32_t)std::min(i0, i1), (int32_t)std::max(i0, i1), (int32_t)tri_idx, (int32_t)~0 };
       edges.push_back(e);
     }
@@ -150,15 +248,17 @@ namespace octet { namespace scene {
 
     /// make a new, empty, mesh.
     mesh(skin *_skin=0) {
+      vertex_array = 0;
       init(_skin, 0, 0);
     }
 
     mesh(unsigned num_vertices, unsigned num_indices) {
+      vertex_array = 0;
       init(0, num_vertices, num_indices);
     }
 
     /// clone a mesh. Note that this does not also clone the vertices and indices.
-    mesh(const mesh &rhs) {
+    mesh(const mesh &rhs) : resource(rhs) {
       vertices = rhs.vertices;
       indices = rhs.indices;
 
@@ -177,6 +277,38 @@ namespace octet { namespace scene {
       mode = rhs.mode;
 
       mesh_skin = rhs.mesh_skin;
+
+      vertex_array = 0;
+      vertex_array_dirty = true;
+      has_ray_cast_bvh = false;
+      has_occluder_corners = false;
+    }
+
+    /// copy the format and buffers of another mesh, as the modifiers (eg. indexer) do.
+    /// We keep our own vertex array object; it is rebuilt on the next draw.
+    mesh &operator=(const mesh &rhs) {
+      resource::operator=(rhs);
+      vertices = rhs.vertices;
+      indices = rhs.indices;
+
+      memcpy(format, rhs.format, sizeof(format));
+
+      num_indices = rhs.num_indices;
+      num_vertices = rhs.num_vertices;
+      first_index = rhs.first_index;
+      stride = rhs.stride;
+      mode = rhs.mode;
+      index_type = rhs.index_type;
+      normalized = rhs.normalized;
+      num_slots = rhs.num_slots;
+
+      mesh_skin = rhs.mesh_skin;
+      mesh_aabb = rhs.mesh_aabb;
+
+      vertex_array_dirty = true;
+      has_ray_cast_bvh = false;
+      has_occluder_corners = false;
+      return *this;
     }
 
     /// Init function used for aggregated meshes.
@@ -200,6 +332,10 @@ namespace octet { namespace scene {
 
       mesh_skin = _skin;
 
+      vertex_array_dirty = true;
+      has_ray_cast_bvh = false;
+      has_occluder_corners = false;
+
       if (max_vertices || max_indices) {
         set_default_attributes();
         allocate(max_vertices * sizeof(vertex), max_indices * sizeof(uint32_t));
@@ -221,10 +357,16 @@ namespace octet { namespace scene {
       v.visit(num_slots, atom_num_slots);
       v.visit(mesh_skin, atom_mesh_skin);
       v.visit(mesh_aabb, atom_aabb);
+      vertex_array_dirty = true;
     }
 
     // Destructor
     ~mesh() {
+      #ifndef OCTET_GLES2
+        if (vertex_array) {
+          gl_state::delete_vertex_array(vertex_array);
+        }
+      #endif
     }
 
     /// Set the defuault mesh parameters, used for boxes, spheres etc.
@@ -238,6 +380,7 @@ namespace octet { namespace scene {
     /// reset the mesh to empty.
     void clear_attributes() {
       num_slots = 0;
+      vertex_array_dirty = true;
     }
 
     /// Add an extra attribute to the mesh. eg. add_attribute(attribute_pos, 3, GL_FLOAT, 0)
@@ -245,6 +388,7 @@ namespace octet { namespace scene {
       assert(num_slots < max_slots);
       format[num_slots] = (offset << 9) + (attr << 5) + ((size-1) << 3) + (kind - GL_BYTE);
       if (norm) normalized |= 1 << num_slots;
+      vertex_array_dirty = true;
       return num_slots++;
     }
 
@@ -383,13 +527,13 @@ namespace octet { namespace scene {
         // note that it is your responsibility to deallocate resources!
         btIndexedMesh mesh;
         mesh.m_numTriangles = get_num_indices() / 3;
-        mesh.m_triangleIndexBase = (const unsigned char *)malloc(get_indices()->get_size());
-        mesh.m_triangleIndexStride = sizeof(uint32_t) * 3;
+        mesh.m_triangleIndexBase = (const unsigned char *)malloc(get_indices()->get_size());
+        mesh.m_triangleIndexStride = sizeof(uint32_t) * 3;
         mesh.m_numVertices = get_num_vertices();
-        mesh.m_vertexBase = (const unsigned char *)malloc(get_vertices()->get_size());
-        mesh.m_vertexStride = get_stride();
-
-        {
+        mesh.m_vertexBase = (const unsigned char *)malloc(get_vertices()->get_size());
+        mesh.m_vertexStride = get_stride();
+
+        {
           gl_resource::rolock idx_lock(get_indices());
           gl_resource::rolock vtx_lock(get_vertices());
           memcpy((void*)mesh.m_triangleIndexBase, idx_lock.u8() + get_index_size() * first_index, get_indices()->get_size());
@@ -446,6 +590,7 @@ namespace octet { namespace scene {
       num_vertices = (uint32_t)num_vertices_;
       mode = mode_;
       index_type = index_type_;
+      vertex_array_dirty = true;
     }
 
     /// dump the mesh to a file in ASCII. Used to debug mesh transforms.
@@ -472,36 +617,79 @@ namespace octet { namespace scene {
       fprintf(file, "</model>\n");
     }
 
+    /// true if the GL context has vertex array objects (OpenGL 3.0 or OpenGL ES3).
+    static bool vertex_arrays_supported() {
+      #ifdef OCTET_GLES2
+        return false;
+      #else
+        return app_utils::has_gl_version(3, 0, 3, 0);
+      #endif
+    }
+
+    /// Set this to false to set up the attributes on every draw instead of using vertex array objects.
+    static void set_vertex_arrays(bool value) {
+      vertex_arrays_enabled() = value;
+    }
+
+    /// true if enable_attributes() binds a vertex array object.
+    static bool uses_vertex_arrays() {
+      return vertex_arrays_enabled() && vertex_arrays_supported();
+    }
+
     /// When rendering a mesh, call this first to enable the attributes.
     /// assume the shader, uniforms and render params are already set up.
     void enable_attributes() const {
-      vertices->bind();
-
-      unsigned n = normalized;
-      for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
-        unsigned size = get_size(slot);
-        unsigned kind = get_kind(slot);
-        unsigned attr = get_attr(slot);
-        size_t offset = get_offset(slot);
-        glVertexAttribPointer(attr, size, kind, n & 1, get_stride(), (void*)(offset));
-        glEnableVertexAttribArray(attr);
-        n >>= 1;
+      if (uses_vertex_arrays()) {
+        bind_vertex_array();
+      } else {
+        set_attribute_pointers();
       }
     }
 
     /// When rendering a mesh, call this next to draw the primitives.
     void draw() {
       //printf("de %04x %d %d\n", get_mode(), get_num_vertices(), get_index_type());
-      if (get_index_type()) {
+      bind_indices();
+      draw_primitives();
+    }
+
+    /// Bind the index buffer, if there is one. draw() does this for you.
+    /// The vertex array object already holds the index buffer, if we are using one.
+    void bind_indices() const {
+      if (get_index_type() && !uses_vertex_arrays()) {
         indices->bind();
-        glDrawElements(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index));
+      }
+    }
+
+    /// Draw the primitives, assuming that bind_indices() has been called.
+    /// Used to draw a mesh many times without binding its buffers again.
+    /// num_instances > 1 needs instanced drawing (OpenGL 3.3 or OpenGL ES3).
+    void draw_primitives(unsigned num_instances = 1) const {
+      if (num_instances == 1) {
+        if (get_index_type()) {
+          glDrawElements(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index));
+        } else {
+          glDrawArrays(get_mode(), 0, get_num_vertices());
+        }
       } else {
-        glDrawArrays(get_mode(), 0, get_num_vertices());
+        #ifndef OCTET_GLES2
+          if (get_index_type()) {
+            glDrawElementsInstanced(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index), num_instances);
+          } else {
+            glDrawArraysInstanced(get_mode(), 0, get_num_vertices(), num_instances);
+          }
+        #endif
       }
     }
 
     /// When rendering a mesh, call this last to disable attributes.
-    void disable_attributes() {
+    void disable_attributes() const {
+      if (uses_vertex_arrays()) {
+        #ifndef OCTET_GLES2
+          gl_state::bind_vertex_array(0);
+        #endif
+        return;
+      }
       for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
         unsigned attr = get_attr(slot);
         glDisableVertexAttribArray(attr);
@@ -536,89 +724,106 @@ namespace octet { namespace scene {
       mesh_aabb = aabb((vmax + vmin) * 0.5f, (vmax - vmin) * 0.5f);
     }
 
-    /// *very* slow ray cast.
-    /// returns "barycentric" coordinates.
-    /// eg. hit pos = bary[0] * pos0 + bary[1] * pos1 + bary[2] * pos2 (or ray.start + ray.distance * bary[3])
-    /// eg. hit uv = bary[0] * uv0 + bary[1] * uv1 + bary[2] * uv2
-    bool ray_cast(const ray &the_ray, int indices[], vec4 &bary_numer, float &bary_denom) {
+    /// Build the triangle tree used by ray_cast if the vertices, indices or format
+    /// have changed since it was last built.
+    /// ray_cast calls this; call it after making a big mesh to avoid a pause on the first ray cast.
+    void update_ray_cast_bvh() {
+      ray_cast_source source = get_triangle_source();
+      if (has_ray_cast_bvh && ray_cast_built == source) return;
+      ray_cast_built = source;
+      has_ray_cast_bvh = true;
+
+      dynarray<vec3p> corners;
+      dynarray<uint32_t> triangle_indices;
+      get_triangle_corners(corners, triangle_indices);
+      ray_cast_bvh.build(corners.data(), triangle_indices.data(), corners.size() / 3);
+    }
+
+    /// Model space triangles for occlusion_buffer, three corners each.
+    /// These are copied from the buffers on first use and kept until the mesh changes.
+    const dynarray<vec3p> &get_occluder_corners() {
+      ray_cast_source source = get_triangle_source();
+      if (has_occluder_corners && occluder_built == source) return occluder_corners;
+      occluder_built = source;
+      has_occluder_corners = true;
+
+      dynarray<uint32_t> triangle_indices;
+      get_triangle_corners(occluder_corners, triangle_indices);
+      return occluder_corners;
+    }
+
+    /// Copy the triangles of the mesh: three corners and three vertex indices for each triangle.
+    /// Works for GL_TRIANGLES with 16 bit, 32 bit or no indices and GL_FLOAT positions; other meshes give no triangles.
+    void get_triangle_corners(dynarray<vec3p> &corners, dynarray<uint32_t> &triangle_indices) {
       unsigned pos_slot = get_slot(attribute_pos);
-      if (get_index_type() != GL_UNSIGNED_INT) return false;
-      if (get_size(pos_slot) < 3) return false;
-      if (get_kind(pos_slot) != GL_FLOAT) return false;
+      corners.resize(0);
+      triangle_indices.resize(0);
+      if (
+        pos_slot < max_slots && mode == GL_TRIANGLES && stride &&
+        get_kind(pos_slot) == GL_FLOAT && get_size(pos_slot) >= 3
+      ) {
+        unsigned pos_offset = get_offset(pos_slot);
+        size_t vertex_bytes = vertices->get_size();
+        unsigned count = index_type ? num_indices : num_vertices;
+        count -= count % 3;
 
-      vec3 org = the_ray.get_start();
-      vec3 dir = the_ray.get_distance();
-      //log("ray_cast: org=%s dir=%s\n", org.toString(), dir.toString());
+        gl_resource::rolock vtx_lock(get_vertices());
+        const uint8_t *vtx = vtx_lock.u8();
+        corners.reserve(count);
+        triangle_indices.reserve(count);
 
-      unsigned pos_offset = get_offset(pos_slot);
-      gl_resource::rolock idx_lock(get_indices());
-      gl_resource::rolock vtx_lock(get_vertices());
-      const uint32_t *idx = idx_lock.u32() + first_index;
-      const uint8_t *vtx = vtx_lock.u8();
-
-      float best_denom = 0;
-      vec4 best_numer(0, 0, 0, 0);
-      for (unsigned i = 0; i != get_num_indices(); i += 3) {
-        vec3 a = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+0]) - org;
-        vec3 b = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+1]) - org;
-        vec3 c = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+2]) - org;
-        vec3 d = dir;
-
-        // solve [ba, bb, bc, bd] * [[ax, ay, az, 1], [bx, by, bz, 1], [cx, cy, cz, 1], [-dx, -dy, -dz, 0]] = [0, 0, 0, 1]
-        //
-        // ie. ba + bb + bc = 1  and  ba * a + bb * b + bc * c = bd * d
-        //
-        // [ba, bb, bc] are barycentric coordinates, bd is the distance along the vector
-
-        // The last line of the inverse matrix is the solution (vector triple products)
-
-        // numerator
-        vec4 numer(
-          dot(cross(b, c), d),
-          dot(cross(c, a), d),
-          dot(cross(a, b), d),
-          dot(cross(a, b), c)
-        );
-
-        // denominator
-        float denom = numer[0] + numer[1] + numer[2];
-
-        //log("a=%s b=%s c=%s d=%s denom=%f\n", a.toString(), b.toString(), c.toString(), d.toString(), denom);
-        //log("numer=%s\n", numer.toString());
-        //log("res=%s\n", (numer / denom).toString());
-
-        // using a multiply lets us check the sign without using a divide.
-        vec4 bary2 = numer * denom;
-
-        if (all(bary2 >= vec4(0, 0, 0, 0))) {
-          rational best_distance(best_numer[3], best_denom);
-          rational new_distance(numer[3], denom);
-          /*printf(
-            "t%d %9.3f %d %d %d  %s %s %s\n",
-            i, numer[3]/denom, idx[i+0], idx[i+1], idx[i+2],
-            (numer/denom).toString(), best_distance.toString(), new_distance.toString()
-          );*/
-
-          unsigned further = new_distance > best_distance;
-          if (!further) {
-            indices[0] = idx[i+0];
-            indices[1] = idx[i+1];
-            indices[2] = idx[i+2];
-            best_numer = numer;
-            best_denom = denom;
+        if (index_type) {
+          gl_resource::rolock idx_lock(get_indices());
+          size_t num_stored = indices->get_size() / get_index_size();
+          if (first_index + count > num_stored) {
+            count = num_stored > first_index ? (unsigned)(num_stored - first_index) : 0;
+            count -= count % 3;
+          }
+          for (unsigned i = 0; i != count; i += 3) {
+            uint32_t tri[3] = { get_index(idx_lock.u8(), i), get_index(idx_lock.u8(), i + 1), get_index(idx_lock.u8(), i + 2) };
+            // skip triangles that point outside the vertex buffer.
+            if ((size_t)std::max(tri[0], std::max(tri[1], tri[2])) * stride + pos_offset + 12 > vertex_bytes) continue;
+            for (unsigned j = 0; j != 3; ++j) {
+              corners.push_back(*(const vec3p*)(vtx + stride * tri[j] + pos_offset));
+              triangle_indices.push_back(tri[j]);
+            }
+          }
+        } else {
+          // stop at the first triangle that runs off the end of the vertex buffer.
+          for (unsigned i = 0; i != count && (size_t)(i + 2) * stride + pos_offset + 12 <= vertex_bytes; i += 3) {
+            for (unsigned j = i; j != i + 3; ++j) {
+              corners.push_back(*(const vec3p*)(vtx + stride * j + pos_offset));
+              triangle_indices.push_back(j);
+            }
           }
         }
       }
+    }
 
-      if (fabsf(best_denom) < 1e-6f) {
+    /// Find the nearest triangle hit by a ray, in model space. Both sides of the triangles count.
+    /// returns "barycentric" coordinates.
+    /// eg. hit pos = bary[0] * pos0 + bary[1] * pos1 + bary[2] * pos2 (or ray.start + ray.distance * bary[3])
+    /// eg. hit uv = bary[0] * uv0 + bary[1] * uv1 + bary[2] * uv2
+    ///
+    /// The first call builds a triangle_bvh, which is kept until the mesh changes.
+    /// Works for GL_TRIANGLES with 16 bit, 32 bit or no indices and GL_FLOAT positions.
+    bool ray_cast(const ray &the_ray, int indices[], vec4 &bary_numer, float &bary_denom) {
+      update_ray_cast_bvh();
+
+      triangle_bvh::hit result;
+      if (!ray_cast_bvh.ray_cast(result, the_ray.get_start(), the_ray.get_distance(), 1e37f)) {
         bary_numer = vec4(0, 0, 0, 0);
         bary_denom = 0;
         return false;
-      } else {
-        bary_numer = best_numer;
-        bary_denom = best_denom;
-        return true;
       }
+
+      const uint32_t *tri = ray_cast_bvh.get_vertex_indices(result.triangle);
+      indices[0] = (int)tri[0];
+      indices[1] = (int)tri[1];
+      indices[2] = (int)tri[2];
+      bary_numer = vec4(1 - result.u - result.v, result.u, result.v, result.t);
+      bary_denom = 1;
+      return true;
     }
 
     /// access the vertex buffer (VBO) or memory buffer
@@ -634,6 +839,7 @@ namespace octet { namespace scene {
     /// set a new VBO object
     void set_vertices(gl_resource *value) {
       vertices = value;
+      vertex_array_dirty = true;
     }
 
     /// assign a vector to the vertex buffer and set params
@@ -644,12 +850,14 @@ namespace octet { namespace scene {
       }
       vertices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
       stride = sizeof(elem_t);
+      vertex_array_dirty = true;
       set_num_vertices(rhs.size());
     }
 
     /// set a new IBO object
     void set_indices(gl_resource *value) {
       indices = value;
+      vertex_array_dirty = true;
     }
 
     /// assign a vector to the index buffer and set params
@@ -659,6 +867,7 @@ namespace octet { namespace scene {
         indices->allocate(GL_ELEMENT_ARRAY_BUFFER, rhs.size() * sizeof(elem_t));
       }
       indices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
+      vertex_array_dirty = true;
       set_index_type(sizeof(elem_t) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
       set_num_indices(rhs.size());
       set_first_index(0);
@@ -666,13 +875,15 @@ namespace octet { namespace scene {
 
     /// Get all the edges in a hash map to avoid duplicates.
     /// record the triangle indices that they came from.
-    void get_edges(dynarray<edge> &edges) {
+    /// Use a dynarray<edge, frame_allocator> for per-frame queries.
+    template <class allocator_t> void get_edges(dynarray<edge, allocator_t> &edges) {
       if (get_index_type() != GL_UNSIGNED_INT) return;
 
       gl_resource::rolock idx_lock(get_indices());
       const uint32_t *ip = idx_lock.u32();
 
       edges.resize(0);
+      if (edges.capacity() < get_num_indices()) edges.reserve(get_num_indices());
       for (unsigned i = 0; i < get_num_indices(); i += 3) {
         add_edge(edges, i, ip[i+0], ip[i+1]);
         add_edge(edges, i, ip[i+1], ip[i+2]);
@@ -711,7 +922,7 @@ namespace octet { namespace scene {
     ///
     ///   There is only one triangle that uses the edge.
     ///   One triangle can be seen from the viewpoint, the other can't.
-    void get_silhouette_edges(const vec3 &viewpoint, bool is_directional, dynarray<edge> &edges) {
+    template <class allocator_t> void get_silhouette_edges(const vec3 &viewpoint, bool is_directional, dynarray<edge, allocator_t> &edges) {
       unsigned pos_slot = get_slot(attribute_pos);
       if (get_index_type() != GL_UNSIGNED_INT) return;
       if (get_size(pos_slot) < 3) return;
@@ -797,6 +1008,7 @@ namespace octet { namespace scene {
       dynarray<uint8_t> dest_vertices;
       dynarray<uint32_t> dest_indices;
       dest_indices.reserve(get_num_indices());
+      dest_vertices.reserve(get_num_vertices() * get_stride());
 
       //The code below is inside a new scope { ... } with the purpose of be sure that outside the scope idx_lock will be deleted
       //  why do we want to delete idx_lock? When the object is created it locks indices to read only, and we want to unlock it after using it
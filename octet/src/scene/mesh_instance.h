@@ -11,7 +11,7 @@ namespace octet { namespace scene {
   /// Instance of a mesh in a game world; node, mesh, material and skin.
   class mesh_instance : public resource {
   public:
-    enum { flag_selected = 1 << 0, flag_enabled = 1 << 1, flag_lod = 1 << 2 };
+    enum { flag_selected = 1 << 0, flag_enabled = 1 << 1, flag_lod = 1 << 2, flag_occluder = 1 << 3 };
 
   private:
     // which scene_node (model to world matrix) to use in the scene
@@ -26,6 +26,16 @@ namespace octet { namespace scene {
     // for characters, which skeleton to use
     ref<skeleton> skel;
 
+    // simpler mesh to draw into the occlusion buffer, if flag_occluder is set.
+    ref<mesh> occluder_msh;
+
+    // copy of the mesh skinned on the CPU, made by render_queue for skeletons with too many bones for the shader.
+    ref<skinner> cpu_skin;
+
+    // levels of detail to draw instead of the mesh, if any, and the level drawn last.
+    ref<lod_group> lod;
+    unsigned lod_level;
+
     // assorted mesh instance booleans (see flag_*)
     unsigned flags;
 
@@ -45,6 +55,7 @@ namespace octet { namespace scene {
       this->mat = mat;
       this->skel = skel;
       flags = flag_enabled;
+      lod_level = 0;
       min_draw_distance = -8.507059e37f;
       max_draw_distance = 8.507059e37f;
     }
@@ -86,9 +97,7 @@ namespace octet { namespace scene {
         if (index != -1) {
           switch (sub_target) {
             case atom_transform: {
-              mat4t m;
-              m.init_transpose(value);
-              skel->set_bone(index, m);
+              skel->get_bone_node(index)->access_nodeToParent().init_transpose(value);
             } break;
             case atom_rotateX: euler[0] = *value; break;
             case atom_rotateY: euler[1] = *value; break;
@@ -124,6 +133,21 @@ namespace octet { namespace scene {
     /// Get the flags for this instance.
     unsigned get_flags() const { return flags; }
 
+    /// Get the mesh drawn into the occlusion buffer: the occluder mesh if there is one, otherwise the mesh.
+    mesh *get_occluder_mesh() const { return occluder_msh ? (mesh*)occluder_msh : (mesh*)msh; }
+
+    /// Get the copy of the mesh skinned on the CPU, if render_queue has made one.
+    skinner *get_cpu_skinner() const { return cpu_skin; }
+
+    /// Get the levels of detail, if any.
+    lod_group *get_lod_group() const { return lod; }
+
+    /// Get the level of detail chosen for the last frame.
+    unsigned get_lod_level() const { return lod_level; }
+
+    /// Get the mesh to draw: the current level of detail if there is a lod_group, otherwise the mesh.
+    mesh *get_draw_mesh() const { return lod && lod_level < lod->get_num_levels() ? lod->get_mesh(lod_level) : (mesh*)msh; }
+
     /// Get the LOD min distance
     float get_min_draw_distance() const { return min_draw_distance; }
 
@@ -145,6 +169,23 @@ namespace octet { namespace scene {
     /// Set the flags for this instance.
     void set_flags(unsigned value) { flags = value; }
 
+    /// Set a simpler mesh to draw into the occlusion buffer. It must fit inside the mesh. eg. a box for a wall.
+    void set_occluder_mesh(mesh *value) { occluder_msh = value; }
+
+    /// Set the copy of the mesh skinned on the CPU. render_queue does this when it needs one.
+    void set_cpu_skinner(skinner *value) { cpu_skin = value; }
+
+    /// Draw levels of a lod_group instead of the mesh. Level 0 should be the mesh, which is still used for bounds and picking.
+    /// If there is no mesh yet, level 0 becomes the mesh.
+    void set_lod_group(lod_group *value) {
+      lod = value;
+      lod_level = 0;
+      if (!msh && lod && lod->get_num_levels()) msh = lod->get_mesh(0);
+    }
+
+    /// Set the level of detail to draw. visual_scene does this every frame.
+    void set_lod_level(unsigned value) { lod_level = value; }
+
     /// Set the flags for this instance.
     void set_min_draw_distance(float value) { min_draw_distance = value; }
 
@@ -0,0 +1,405 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Software depth buffer for occlusion culling
+//
+
+namespace octet { namespace scene {
+  /// A small depth buffer drawn on the CPU, for finding mesh instances hidden behind others.
+  ///
+  /// Occluders, usually big walls and floors (see mesh_instance::flag_occluder), are drawn
+  /// into the buffer. Then a pyramid is built with the farthest depth of each 2x2 block at each level.
+  /// A box is hidden if its nearest point is behind the farthest depth in the pyramid over the pixels it covers.
+  ///
+  /// Triangles are drawn by bands of rows, shared between the threads of a thread_pool.
+  /// With SSE2, four pixels are drawn at once.
+  ///
+  /// Example
+  ///
+  ///     occlusion.begin(worldToProjection);
+  ///     occlusion.add_occluder(wall->get_occluder_mesh(), wall->get_node()->calcModelToWorld());
+  ///     occlusion.rasterize();
+  ///     unsigned num_hidden = occlusion.test_boxes(visible, cx, cy, cz, hx, hy, hz, count);
+  class occlusion_buffer {
+  public:
+    enum {
+      default_width = 256,
+      default_height = 128,
+
+      /// rows in each job
+      band_height = 8,
+    };
+
+    /// Results of the last rasterize() and test_boxes()
+    struct stats {
+      /// meshes drawn into the buffer
+      unsigned num_occluders;
+
+      /// triangles that touched the buffer
+      unsigned num_triangles;
+
+      /// boxes tested
+      unsigned num_tested;
+
+      /// boxes found to be hidden
+      unsigned num_occluded;
+    };
+
+  private:
+    // a triangle set up for drawing.
+    // inside where a[i] * x + b[i] * y + c[i] >= 0 for all three edges, at pixel (x, y).
+    struct triangle {
+      float a[3];
+      float b[3];
+      float c[3];
+
+      // depth = za * x + zb * y + zc
+      float za;
+      float zb;
+      float zc;
+
+      // pixels covered, inclusive. x0 > x1 if the triangle is not drawn.
+      int x0;
+      int x1;
+      int y0;
+      int y1;
+    };
+
+    struct occluder {
+      const vec3p *corners;
+      unsigned num_triangles;
+      unsigned first_triangle;
+      mat4t modelToProjection;
+    };
+
+    unsigned width;
+    unsigned height;
+    platform::thread_pool *pool;
+    mat4t worldToProjection;
+
+    dynarray<occluder> occluders;
+    dynarray<triangle> triangles;
+
+    // all the levels of the pyramid, largest first. Level 0 is the depth buffer.
+    dynarray<float> pyramid;
+    dynarray<unsigned> level_offsets;
+    dynarray<unsigned> level_widths;
+    dynarray<unsigned> level_heights;
+
+    stats last_stats;
+
+    platform::thread_pool &get_pool() const {
+      return pool ? *pool : platform::thread_pool::get_default();
+    }
+
+    void setup_triangle(triangle &tri, const vec4 *clip) const {
+      tri.x0 = 1;
+      tri.x1 = 0;
+
+      // triangles that cross the near plane are left out. Drawing less is always safe.
+      for (unsigned i = 0; i != 3; ++i) {
+        if (clip[i].w() <= 0 || clip[i].z() < -clip[i].w()) return;
+      }
+      if (clip[0].z() > clip[0].w() && clip[1].z() > clip[1].w() && clip[2].z() > clip[2].w()) return;
+
+      float sx[3], sy[3], sz[3];
+      for (unsigned i = 0; i != 3; ++i) {
+        float rw = 1.0f / clip[i].w();
+        sx[i] = (clip[i].x() * rw * 0.5f + 0.5f) * width;
+        sy[i] = (clip[i].y() * rw * 0.5f + 0.5f) * height;
+        sz[i] = clip[i].z() * rw * 0.5f + 0.5f;
+      }
+
+      float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+      if (fabsf(area) < 1e-8f) return;
+      if (area < 0) {
+        // both sides of a triangle are drawn.
+        std::swap(sx[1], sx[2]);
+        std::swap(sy[1], sy[2]);
+        std::swap(sz[1], sz[2]);
+        area = -area;
+      }
+
+      float min_x = std::min(sx[0], std::min(sx[1], sx[2]));
+      float max_x = std::max(sx[0], std::max(sx[1], sx[2]));
+      float min_y = std::min(sy[0], std::min(sy[1], sy[2]));
+      float max_y = std::max(sy[0], std::max(sy[1], sy[2]));
+      tri.x0 = std::max((int)floorf(min_x), 0);
+      tri.x1 = std::min((int)ceilf(max_x), (int)width - 1);
+      tri.y0 = std::max((int)floorf(min_y), 0);
+      tri.y1 = std::min((int)ceilf(max_y), (int)height - 1);
+      if (tri.x0 > tri.x1 || tri.y0 > tri.y1) {
+        tri.x0 = 1;
+        tri.x1 = 0;
+        return;
+      }
+
+      // edge i is opposite corner i. Sample at pixel centres.
+      float inv_area = 1.0f / area;
+      tri.za = tri.zb = tri.zc = 0;
+      for (unsigned i = 0; i != 3; ++i) {
+        unsigned j = (i + 1) % 3, k = (i + 2) % 3;
+        float a = sy[j] - sy[k];
+        float b = sx[k] - sx[j];
+        float c = sx[j] * sy[k] - sy[j] * sx[k];
+        tri.a[i] = a;
+        tri.b[i] = b;
+        tri.c[i] = c + (a + b) * 0.5f;
+        tri.za += a * sz[i] * inv_area;
+        tri.zb += b * sz[i] * inv_area;
+        tri.zc += tri.c[i] * sz[i] * inv_area;
+      }
+    }
+
+    // draw the triangles into rows [y_begin, y_end)
+    void rasterize_band(unsigned y_begin, unsigned y_end) {
+      float *depth = pyramid.data();
+      for (unsigned i = y_begin * width; i != y_end * width; ++i) {
+        depth[i] = 1;
+      }
+
+      for (unsigned t = 0; t != triangles.size(); ++t) {
+        const triangle &tri = triangles[t];
+        if (tri.x0 > tri.x1) continue;
+        int y0 = std::max(tri.y0, (int)y_begin);
+        int y1 = std::min(tri.y1, (int)y_end - 1);
+        int x_start = tri.x0 & ~3;
+        for (int y = y0; y <= y1; ++y) {
+          float *row = depth + y * width;
+          #if OCTET_SSE2
+            __m128 xs = _mm_add_ps(_mm_set1_ps((float)x_start), _mm_setr_ps(0, 1, 2, 3));
+            __m128 fy = _mm_set1_ps((float)y);
+            __m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[0]), xs), _mm_mul_ps(_mm_set1_ps(tri.b[0]), fy)), _mm_set1_ps(tri.c[0]));
+            __m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[1]), xs), _mm_mul_ps(_mm_set1_ps(tri.b[1]), fy)), _mm_set1_ps(tri.c[1]));
+            __m128 e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.a[2]), xs), _mm_mul_ps(_mm_set1_ps(tri.b[2]), fy)), _mm_set1_ps(tri.c[2]));
+            __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.za), xs), _mm_mul_ps(_mm_set1_ps(tri.zb), fy)), _mm_set1_ps(tri.zc));
+            __m128 step0 = _mm_set1_ps(tri.a[0] * 4), step1 = _mm_set1_ps(tri.a[1] * 4), step2 = _mm_set1_ps(tri.a[2] * 4);
+            __m128 step_z = _mm_set1_ps(tri.za * 4);
+            __m128 zero = _mm_setzero_ps();
+            for (int x = x_start; x <= tri.x1; x += 4) {
+              __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+              if (_mm_movemask_ps(inside)) {
+                __m128 old_z = _mm_loadu_ps(row + x);
+                __m128 new_z = _mm_min_ps(old_z, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_z), _mm_andnot_ps(inside, old_z)));
+              }
+              e0 = _mm_add_ps(e0, step0);
+              e1 = _mm_add_ps(e1, step1);
+              e2 = _mm_add_ps(e2, step2);
+              z = _mm_add_ps(z, step_z);
+            }
+          #else
+            for (int x = tri.x0; x <= tri.x1; ++x) {
+              float fx = (float)x, fy = (float)y;
+              float e0 = tri.a[0] * fx + tri.b[0] * fy + tri.c[0];
+              float e1 = tri.a[1] * fx + tri.b[1] * fy + tri.c[1];
+              float e2 = tri.a[2] * fx + tri.b[2] * fy + tri.c[2];
+              if (e0 >= 0 && e1 >= 0 && e2 >= 0) {
+                float z = tri.za * fx + tri.zb * fy + tri.zc;
+                row[x] = std::min(row[x], z);
+              }
+            }
+          #endif
+        }
+      }
+    }
+
+    // each texel of the next level is the farthest of up to four texels of the last.
+    void build_pyramid() {
+      for (unsigned level = 1; level != level_offsets.size(); ++level) {
+        const float *src = pyramid.data() + level_offsets[level - 1];
+        float *dest = pyramid.data() + level_offsets[level];
+        unsigned src_w = level_widths[level - 1], src_h = level_heights[level - 1];
+        unsigned w = level_widths[level], h = level_heights[level];
+        for (unsigned y = 0; y != h; ++y) {
+          unsigned sy0 = y * 2, sy1 = std::min(y * 2 + 1, src_h - 1);
+          for (unsigned x = 0; x != w; ++x) {
+            unsigned sx0 = x * 2, sx1 = std::min(x * 2 + 1, src_w - 1);
+            float a = std::max(src[sy0 * src_w + sx0], src[sy0 * src_w + sx1]);
+            float b = std::max(src[sy1 * src_w + sx0], src[sy1 * src_w + sx1]);
+            dest[y * w + x] = std::max(a, b);
+          }
+        }
+      }
+    }
+
+    // true if the box is behind the occluders.
+    bool is_hidden(const vec3 &centre, const vec3 &half) const {
+      vec4 c = centre.xyz1() * worldToProjection;
+      vec4 dx = worldToProjection.x() * half.x();
+      vec4 dy = worldToProjection.y() * half.y();
+      vec4 dz = worldToProjection.z() * half.z();
+
+      float min_x = 1e30f, max_x = -1e30f, min_y = 1e30f, max_y = -1e30f, min_z = 1e30f;
+      for (unsigned i = 0; i != 8; ++i) {
+        vec4 p = c + (i & 1 ? dx : -dx) + (i & 2 ? dy : -dy) + (i & 4 ? dz : -dz);
+        // boxes that reach the near plane are always visible.
+        if (p.w() <= 0 || p.z() < -p.w()) return false;
+        float rw = 1.0f / p.w();
+        float x = p.x() * rw, y = p.y() * rw, z = p.z() * rw;
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+        min_z = std::min(min_z, z);
+      }
+      min_z = min_z * 0.5f + 0.5f;
+
+      int x0 = std::max((int)floorf((min_x * 0.5f + 0.5f) * width), 0);
+      int x1 = std::min((int)floorf((max_x * 0.5f + 0.5f) * width), (int)width - 1);
+      int y0 = std::max((int)floorf((min_y * 0.5f + 0.5f) * height), 0);
+      int y1 = std::min((int)floorf((max_y * 0.5f + 0.5f) * height), (int)height - 1);
+      if (x0 > x1 || y0 > y1) return false;
+
+      // find a level where the box covers at most 2x2 texels.
+      unsigned level = 0;
+      while (level + 1 < level_offsets.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+        ++level;
+      }
+      const float *texels = pyramid.data() + level_offsets[level];
+      unsigned w = level_widths[level];
+      for (int y = y0 >> level; y <= y1 >> level; ++y) {
+        for (int x = x0 >> level; x <= x1 >> level; ++x) {
+          if (texels[y * w + x] >= min_z) return false;
+        }
+      }
+      return true;
+    }
+
+  public:
+    occlusion_buffer() {
+      pool = 0;
+      worldToProjection.loadIdentity();
+      memset(&last_stats, 0, sizeof(last_stats));
+      set_size(default_width, default_height);
+    }
+
+    /// Set the size of the depth buffer in pixels. The width is rounded up to a multiple of four.
+    void set_size(unsigned new_width, unsigned new_height) {
+      width = (std::max(new_width, 1u) + 3) & ~3;
+      height = std::max(new_height, 1u);
+
+      level_offsets.resize(0);
+      level_widths.resize(0);
+      level_heights.resize(0);
+      unsigned offset = 0, w = width, h = height;
+      for (;;) {
+        level_offsets.push_back(offset);
+        level_widths.push_back(w);
+        level_heights.push_back(h);
+        offset += w * h;
+        if (w == 1 && h == 1) break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+      }
+      // room to read four pixels past the end of a row.
+      pyramid.resize(offset + 4);
+      for (unsigned i = 0; i != pyramid.size(); ++i) {
+        pyramid[i] = 1;
+      }
+    }
+
+    /// Use a specific pool. The default is thread_pool::get_default().
+    void set_thread_pool(platform::thread_pool *value) {
+      pool = value;
+    }
+
+    /// Start a new frame.
+    void begin(const mat4t &worldToProjection) {
+      this->worldToProjection = worldToProjection;
+      occluders.resize(0);
+      triangles.resize(0);
+      memset(&last_stats, 0, sizeof(last_stats));
+    }
+
+    /// Add a mesh to draw into the buffer. The mesh must stay alive until rasterize().
+    void add_occluder(mesh *msh, const mat4t &modelToWorld) {
+      const dynarray<vec3p> &corners = msh->get_occluder_corners();
+      if (corners.size() == 0) return;
+      occluder &occ = occluders.emplace_back();
+      occ.corners = corners.data();
+      occ.num_triangles = corners.size() / 3;
+      occ.first_triangle = triangles.size();
+      occ.modelToProjection = modelToWorld * worldToProjection;
+      triangles.resize(triangles.size() + occ.num_triangles);
+    }
+
+    /// Draw the occluders and build the pyramid.
+    void rasterize() {
+      platform::thread_pool &p = get_pool();
+
+      p.parallel_for(occluders.size(), 1, [&](unsigned begin, unsigned end) {
+        for (unsigned o = begin; o != end; ++o) {
+          const occluder &occ = occluders[o];
+          for (unsigned t = 0; t != occ.num_triangles; ++t) {
+            vec4 clip[3];
+            for (unsigned i = 0; i != 3; ++i) {
+              clip[i] = vec3(occ.corners[t * 3 + i]).xyz1() * occ.modelToProjection;
+            }
+            setup_triangle(triangles[occ.first_triangle + t], clip);
+          }
+        }
+      });
+
+      unsigned num_bands = (height + band_height - 1) / band_height;
+      p.parallel_for(num_bands, 1, [&](unsigned begin, unsigned end) {
+        for (unsigned band = begin; band != end; ++band) {
+          rasterize_band(band * band_height, std::min((band + 1) * band_height, height));
+        }
+      });
+
+      build_pyramid();
+
+      last_stats.num_occluders = occluders.size();
+      for (unsigned t = 0; t != triangles.size(); ++t) {
+        last_stats.num_triangles += triangles[t].x0 <= triangles[t].x1;
+      }
+    }
+
+    /// Test world space boxes, given as arrays of centres and half extents, like frustum::intersects.
+    /// Clears visible[i] if box i is hidden. Boxes that are already not visible are skipped.
+    /// Returns the number of boxes found to be hidden.
+    unsigned test_boxes(uint8_t *visible, const float *cx, const float *cy, const float *cz, const float *hx, const float *hy, const float *hz, unsigned count) {
+      get_pool().parallel_for(count, 256, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          if (visible[i] && is_hidden(vec3(cx[i], cy[i], cz[i]), vec3(hx[i], hy[i], hz[i]))) {
+            visible[i] = 2;
+          }
+        }
+      });
+
+      unsigned num_tested = 0, num_occluded = 0;
+      for (unsigned i = 0; i != count; ++i) {
+        num_tested += visible[i] != 0;
+        if (visible[i] == 2) {
+          visible[i] = 0;
+          num_occluded++;
+        }
+      }
+      last_stats.num_tested += num_tested;
+      last_stats.num_occluded += num_occluded;
+      return num_occluded;
+    }
+
+    /// Depth of the nearest occluder at a pixel, 0 (near) to 1 (far or none).
+    float get_depth(unsigned x, unsigned y) const {
+      return pyramid[y * width + x];
+    }
+
+    unsigned get_width() const {
+      return width;
+    }
+
+    unsigned get_height() const {
+      return height;
+    }
+
+    /// Get the results of the last frame
+    const stats &get_stats() const {
+      return last_stats;
+    }
+  };
+}}
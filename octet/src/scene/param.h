@@ -34,7 +34,9 @@ namespace octet { namespace scene {
     virtual void bind(param_bind_info &pbi) {
     }
 
-    virtual void render(const uint8_t *buffer) {
+    /// set the GL state for this parameter.
+    /// instanced is true when drawing with the instanced variant of the shader.
+    virtual void render(const uint8_t *buffer, bool /*instanced*/=false) {
     }
 
     const char *get_atom_name() const {
@@ -86,6 +88,14 @@ namespace octet { namespace scene {
 
   struct param_bind_info {
     GLint program;
+
+    // true if program is the instanced variant of the shader.
+    bool instanced;
+
+    param_bind_info() {
+      program = 0;
+      instanced = false;
+    }
   };
 
   struct param_buffer_info {
@@ -106,6 +116,7 @@ namespace octet { namespace scene {
   /// The parameter uniform records the location, name and type of the uniform as well as the repeat count for arrays.
   class param_uniform : public param {
     GLint uniform;           // uniform index
+    GLint instanced_uniform; // uniform index in the instanced variant of the shader
     uint16_t offset;         // offset in uniform buffer
     uint16_t repeat;         // how many in array?
     uint8_t uniform_buffer;  // Which uniform buffer? 0 = dynamic, 1 = static.
@@ -121,6 +132,8 @@ namespace octet { namespace scene {
       param(name, _type, _stage)
     {
       repeat = _repeat;
+      uniform = -1;
+      instanced_uniform = -1;
 
       // in uniform buffers, everything is in units of 16 bytes
       // matrices are repeats of vec4s
@@ -169,7 +182,12 @@ namespace octet { namespace scene {
 
     /// connect the parameter to the shader
     void bind(param_bind_info &pbi) {
-      uniform = glGetUniformLocation(pbi.program, get_atom_name());
+      GLint location = glGetUniformLocation(pbi.program, get_atom_name());
+      if (pbi.instanced) {
+        instanced_uniform = location;
+      } else {
+        uniform = location;
+      }
       //log("bind %d %s\n", uniform, get_atom_name());
     }
 
@@ -199,8 +217,8 @@ namespace octet { namespace scene {
 
     /// for OpenGL ES2, call glUniform* to copy the uniform to the GPU command buffer.
     /// for OpenGL ES3, we can use the uniform buffer directly and so don't need this.
-    void render(const uint8_t *buffer) {
-      GLint uni = get_uniform();
+    void render(const uint8_t *buffer, bool instanced=false) {
+      GLint uni = instanced ? instanced_uniform : get_uniform();
 
       if (uni == -1) return;
 
@@ -288,27 +306,69 @@ namespace octet { namespace scene {
     }
 
     /// Set the OpenGL state for this sampler.
-    void render(const uint8_t *buffer) {
-      param_uniform::render(buffer);
-      glActiveTexture(GL_TEXTURE0 + texture_slot);
-      glBindTexture(sampler_->get_gl_target(), sampler_->get_gl_texture(image_));
+    void render(const uint8_t *buffer, bool instanced=false) {
+      param_uniform::render(buffer, instanced);
+      bind_texture();
 
       //log("%s: u%d=ts%d targ=%04x tex=%d\n", get_atom_name(), get_uniform(), texture_slot, sampler_->get_gl_target(), sampler_->get_gl_texture(image_));
     }
+
+    /// Bind the texture to our slot without setting the uniform.
+    void bind_texture() {
+      GLuint texture = sampler_->get_gl_texture(image_);
+      gl_state::bind_texture(texture_slot, sampler_->get_gl_target(), texture);
+    }
   };
 
   /// Shader that uses parameters.
   class param_shader : public shader {
+  public:
+    /// Which values were last set in the uniforms of one of our programs, so that materials can skip setting them again.
+    struct upload_record {
+      /// the material that set the colours and textures, and its version at the time.
+      const void *owner;
+      unsigned owner_version;
+
+      /// the frame_uniforms version of the lighting (and instance camera) uniforms.
+      unsigned frame_version;
+    };
+
+  private:
     std::string vertex_shader;
     std::string fragment_shader;
 
+    // variant that takes model matrices from an instance buffer, built on first use.
+    ref<shader> instanced_shader;
+    bool instanced_checked;
+    GLint worldToProjection_index;
+    GLint worldToCamera_index;
+
+    // [0] for the program, [1] for the instanced variant
+    upload_record records[2];
+
+    // connect the "frame_uniforms" block to its buffer, if the program has one.
+    static void bind_frame_block(GLuint program) {
+      #ifndef OCTET_GLES2
+        if (frame_uniforms::buffers_supported()) {
+          GLuint index = glGetUniformBlockIndex(program, "frame_uniforms");
+          if (index != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, index, frame_uniforms::binding);
+          }
+        }
+      #endif
+    }
+
   public:
     RESOURCE_META(param_shader)
 
     param_shader() {
+      instanced_checked = false;
+      memset(records, 0, sizeof(records));
     }
 
     param_shader(const char *vs_url, const char *fs_url) {
+      instanced_checked = false;
+      memset(records, 0, sizeof(records));
       dynarray<uint8_t> vs;
       dynarray<uint8_t> fs;
       app_utils::get_url(vs, vs_url);
@@ -320,6 +380,11 @@ namespace octet { namespace scene {
 
     void init(dynarray<ref<param> > &params) {
       shader::init(vertex_shader.data(), fragment_shader.data());
+      bind_frame_block(get_program());
+
+      // a new program has none of the values we set in the old one.
+      records[0].owner = NULL;
+      records[0].frame_version = 0;
 
       param_bind_info pbi;
       pbi.program = get_program();
@@ -328,6 +393,53 @@ namespace octet { namespace scene {
         params[i]->bind(pbi);
       }
     }
+
+    /// Get the program for drawing many instances with one call, or 0 if there is none.
+    ///
+    /// The variant is the same source compiled with INSTANCED defined; the vertex shader
+    /// reads the attribute "modelToWorld" and the uniforms "worldToProjection" and "worldToCamera".
+    /// Shaders that do not mention INSTANCED have no variant.
+    GLuint get_instanced_program() {
+      if (!instanced_checked) {
+        instanced_checked = true;
+        if (vertex_shader.find("INSTANCED") == std::string::npos) return 0;
+
+        // #version has to stay on the first line.
+        std::string vs = vertex_shader;
+        size_t pos = 0;
+        if (vs.compare(0, 8, "#version") == 0) {
+          pos = vs.find('\n');
+          pos = pos == std::string::npos ? vs.size() : pos + 1;
+        }
+        vs.insert(pos, "#define INSTANCED 1\n");
+
+        shader *variant = new shader();
+        variant->init(vs.c_str(), fragment_shader.c_str());
+        GLint status = 0;
+        glGetProgramiv(variant->get_program(), GL_LINK_STATUS, &status);
+        if (!status) {
+          glDeleteProgram(variant->get_program());
+          delete variant;
+          return 0;
+        }
+        instanced_shader = variant;
+        bind_frame_block(variant->get_program());
+        worldToProjection_index = glGetUniformLocation(variant->get_program(), "worldToProjection");
+        worldToCamera_index = glGetUniformLocation(variant->get_program(), "worldToCamera");
+      }
+      return instanced_shader ? instanced_shader->get_program() : 0;
+    }
+
+    /// What was last set in the uniforms of the program or its instanced variant.
+    upload_record &get_upload_record(bool instanced) {
+      return records[instanced ? 1 : 0];
+    }
+
+    /// Set the camera matrices of the instanced variant, which must be the current program.
+    void set_instanced_matrices(const mat4t &worldToProjection, const mat4t &worldToCamera) {
+      glUniformMatrix4fv(worldToProjection_index, 1, GL_FALSE, worldToProjection.get());
+      glUniformMatrix4fv(worldToCamera_index, 1, GL_FALSE, worldToCamera.get());
+    }
   };
 }}
 
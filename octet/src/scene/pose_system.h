@@ -0,0 +1,290 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Batched animation of many instances
+//
+
+namespace octet { namespace scene {
+  /// Samples and blends the clips of many animation_instances together, eg. for a crowd.
+  ///
+  /// Every update:
+  ///   - the clips of all the instances are sampled into one pose buffer, a chunk of instances per thread.
+  ///   - every node with transform tracks blends them, a chunk of nodes per thread.
+  ///   - the blended matrices are written to the nodes, so the transform_system picks them up.
+  ///
+  /// On each node the instances of the lowest layer are averaged by their weights and each layer
+  /// above is blended over the result by its total weight, up to 1. Rotations blend as quaternions.
+  /// Each node is blended by one thread in the order of the instances, so the results are the same
+  /// with any number of threads.
+  ///
+  /// Tracks that do not write a transform to a scene_node, and instances of an animation rather
+  /// than a clip, are written to their targets one by one afterwards.
+  ///
+  ///     pose_system poses;
+  ///     // every frame
+  ///     poses.update(animation_instances, delta_time);
+  class pose_system {
+    enum { sample_grain = 16, blend_grain = 256 };
+
+    // a transform track of an instance that moves a node.
+    struct blend_input {
+      unsigned node_index;
+      int layer;
+      unsigned instance;
+      unsigned lane;      // first lane in poses
+
+      bool operator<(const blend_input &rhs) const {
+        if (node_index != rhs.node_index) return node_index < rhs.node_index;
+        if (layer != rhs.layer) return layer < rhs.layer;
+        return instance < rhs.instance;
+      }
+    };
+
+    // a node and its inputs, which are sorted by layer and then by instance.
+    struct blend_output {
+      scene_node *node;
+      unsigned first_input;
+      unsigned num_inputs;
+
+      // the node's matrix, if it is being moved this update.
+      mat4t *dest;
+    };
+
+    // a track written through its binding.
+    struct other_track {
+      unsigned instance;
+      unsigned track;
+    };
+
+    // clip instances as of the last build and their layers.
+    dynarray<ref<animation_instance> > instances;
+    dynarray<int> layers;
+
+    // sampled clips, one after the other, and where each instance starts.
+    dynarray<unsigned> pose_starts;
+    dynarray<float> poses;
+
+    // weights of the instances this update, taken before they advance.
+    dynarray<float> weights;
+
+    dynarray<blend_input> inputs;
+    dynarray<blend_output> outputs;
+    dynarray<other_track> others;
+
+    // clip instances found this update.
+    dynarray<animation_instance*> current;
+
+    platform::thread_pool *pool;
+
+    // have the instances, their layers or their bindings changed since build()?
+    bool is_stale() const {
+      if (current.size() != instances.size()) return true;
+      for (unsigned i = 0; i != current.size(); ++i) {
+        animation_instance *inst = current[i];
+        if (inst != instances[i] || inst->get_layer() != layers[i] || !inst->is_bound()) return true;
+      }
+      return false;
+    }
+
+    // find the inputs of every node.
+    void build() {
+      instances.resize(0);
+      layers.resize(0);
+      pose_starts.resize(0);
+      inputs.resize(0);
+      outputs.resize(0);
+      others.resize(0);
+
+      hash_map<scene_node*, unsigned> node_outputs;
+      unsigned pose_size = 0;
+      for (unsigned i = 0; i != current.size(); ++i) {
+        animation_instance *inst = current[i];
+        if (!inst->is_bound()) inst->bind();
+        instances.push_back(inst);
+        layers.push_back(inst->get_layer());
+        pose_starts.push_back(pose_size);
+
+        const animation_clip *clip = inst->get_clip();
+        for (unsigned track = 0; track != clip->get_num_tracks(); ++track) {
+          const animation_binding &binding = inst->get_binding(track);
+          if (binding.get_kind() == animation_binding::kind_node_transform && clip->is_transform(track)) {
+            scene_node *node = binding.get_node();
+            int index = node_outputs.get_index(node);
+            unsigned out;
+            if (index < 0) {
+              out = node_outputs[node] = outputs.size();
+              blend_output o = { node, 0, 0, 0 };
+              outputs.push_back(o);
+            } else {
+              out = node_outputs.get_value(index);
+            }
+            blend_input in = { out, inst->get_layer(), i, pose_size + clip->get_first_lane(track) };
+            inputs.push_back(in);
+          } else if (binding.get_kind() != animation_binding::kind_none) {
+            other_track ot = { i, track };
+            others.push_back(ot);
+          }
+        }
+        pose_size += clip->get_pose_size();
+      }
+
+      std::sort(inputs.data(), inputs.data() + inputs.size());
+      for (unsigned k = 0; k != inputs.size(); ++k) {
+        blend_output &o = outputs[inputs[k].node_index];
+        if (o.num_inputs++ == 0) o.first_input = k;
+      }
+
+      poses.resize(pose_size);
+      weights.resize(instances.size());
+    }
+
+    // blend the inputs of one output into its node.
+    void blend(unsigned index) {
+      const blend_output &o = outputs[index];
+      if (!o.dest) return;
+
+      // most nodes are moved by one clip.
+      float values[16];
+      if (o.num_inputs == 1) {
+        animation_clip::recompose(values, &poses[inputs[o.first_input].lane]);
+        o.dest->init_transpose(values);
+        return;
+      }
+
+      float result[animation_clip::transform_lanes];
+      float sum[animation_clip::transform_lanes];
+      bool has_result = false;
+      unsigned k = o.first_input, end = o.first_input + o.num_inputs;
+      while (k != end) {
+        int layer = inputs[k].layer;
+        float total = 0;
+        const float *first = 0;
+        for (unsigned l = 0; l != animation_clip::transform_lanes; ++l) sum[l] = 0;
+        for (; k != end && inputs[k].layer == layer; ++k) {
+          float w = weights[inputs[k].instance];
+          if (w <= 0) continue;
+
+          // keep the quaternions in one hemisphere so that they do not cancel out.
+          const float *lanes = &poses[inputs[k].lane];
+          float qw = w;
+          if (!first) {
+            first = lanes;
+          } else if (first[0] * lanes[0] + first[1] * lanes[1] + first[2] * lanes[2] + first[3] * lanes[3] < 0) {
+            qw = -w;
+          }
+          for (unsigned l = 0; l != 4; ++l) sum[l] += lanes[l] * qw;
+          for (unsigned l = 4; l != animation_clip::transform_lanes; ++l) sum[l] += lanes[l] * w;
+          total += w;
+        }
+        if (total <= 0) continue;
+
+        animation_clip::normalize_quat(sum);
+        for (unsigned l = 4; l != animation_clip::transform_lanes; ++l) sum[l] /= total;
+
+        if (!has_result) {
+          memcpy(result, sum, sizeof(result));
+          has_result = true;
+        } else {
+          // this layer over the ones below.
+          float f = total < 1 ? total : 1;
+          if (result[0] * sum[0] + result[1] * sum[1] + result[2] * sum[2] + result[3] * sum[3] < 0) {
+            sum[0] = -sum[0]; sum[1] = -sum[1]; sum[2] = -sum[2]; sum[3] = -sum[3];
+          }
+          for (unsigned l = 0; l != animation_clip::transform_lanes; ++l) {
+            result[l] += (sum[l] - result[l]) * f;
+          }
+          animation_clip::normalize_quat(result);
+        }
+      }
+
+      animation_clip::recompose(values, result);
+      o.dest->init_transpose(values);
+    }
+
+    template <class fn_t> void run(unsigned count, unsigned grain, fn_t fn) {
+      if (count <= grain) {
+        fn(0, count);
+      } else {
+        platform::thread_pool &p = pool ? *pool : platform::thread_pool::get_default();
+        p.parallel_for(count, grain, fn);
+      }
+    }
+
+  public:
+    /// Make an empty system.
+    pose_system() {
+      pool = 0;
+    }
+
+    /// Use a specific pool. The default is thread_pool::get_default().
+    void set_thread_pool(platform::thread_pool *value) {
+      pool = value;
+    }
+
+    /// Play all the instances for one frame and move them on by delta_time.
+    void update(slot_map<ref<animation_instance> > &all, float delta_time) {
+      current.resize(0);
+      for (unsigned idx = 0; idx != all.size(); ++idx) {
+        animation_instance *inst = all[idx];
+        if (inst->get_clip()) {
+          current.push_back(inst);
+        } else {
+          inst->update(delta_time);
+        }
+      }
+
+      if (is_stale()) build();
+
+      for (unsigned i = 0; i != instances.size(); ++i) {
+        weights[i] = instances[i]->get_weight();
+      }
+
+      run(instances.size(), sample_grain, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          animation_instance *inst = instances[i];
+          inst->sample(poses.data() + pose_starts[i]);
+          inst->advance(delta_time);
+        }
+      });
+
+      // mark the nodes with a weighted input as moved. This walks their children, so it is done on one thread
+      // and the threads then write the matrices. Nothing else moves the nodes until we are done.
+      for (unsigned i = 0; i != outputs.size(); ++i) {
+        blend_output &o = outputs[i];
+        o.dest = 0;
+        for (unsigned k = o.first_input; k != o.first_input + o.num_inputs; ++k) {
+          if (weights[inputs[k].instance] > 0) {
+            o.dest = &o.node->access_nodeToParent();
+            break;
+          }
+        }
+      }
+
+      run(outputs.size(), blend_grain, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          blend(i);
+        }
+      });
+
+      float tmp[16];
+      for (unsigned i = 0; i != others.size(); ++i) {
+        const other_track &ot = others[i];
+        animation_instance *inst = instances[ot.instance];
+        inst->get_binding(ot.track).write(inst->get_clip()->get_values(ot.track, poses.data() + pose_starts[ot.instance], tmp));
+      }
+    }
+
+    /// Number of clip instances in the last update.
+    unsigned get_num_instances() const {
+      return instances.size();
+    }
+
+    /// Number of nodes blended in the last update.
+    unsigned get_num_nodes() const {
+      return outputs.size();
+    }
+  };
+}}
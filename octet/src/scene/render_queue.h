@@ -0,0 +1,597 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// sort keyed list of draws for one frame
+//
+
+namespace octet { namespace scene {
+  /// Mesh instances to draw this frame, sorted to keep GL state changes down.
+  ///
+  /// Each draw gets a 64 bit key made of the pass, shader, material, mesh and depth,
+  /// most significant first. The keys are radix sorted and submit() draws in key order,
+  /// binding the program only when the shader changes, the colours and textures when
+  /// the material changes and the buffers when the mesh changes.
+  ///
+  /// Runs of draws with the same mesh and material become one instanced draw if the
+  /// context and the shader support it: the model matrices of the run go in an instance
+  /// buffer and the shader's INSTANCED variant reads them as the attribute "modelToWorld".
+  ///
+  /// sort() also works out the bone matrices of every skinned draw in one batch, shared
+  /// between the threads of a thread_pool. Skeletons with more bones than the skinning shader
+  /// has room for are skinned on the CPU by a skinner and drawn unskinned.
+  ///
+  /// Example
+  ///
+  ///     queue.reset();
+  ///     queue.add(mi, render_queue::pass_opaque, modelToWorld, modelToProjection, modelToCamera);
+  ///     queue.sort();
+  ///     frame.set(worldToProjection, worldToCamera, light_uniforms, num_light_uniforms, num_lights);
+  ///     frame.bind();
+  ///     queue.submit(frame, cameraToProjection);
+  ///
+  /// The ids in the keys are handed out each frame, so keys are only comparable within a frame.
+  class render_queue {
+  public:
+    /// passes are drawn in this order.
+    enum pass_type {
+      pass_opaque,
+      pass_skinned,
+      num_passes = 16,
+    };
+
+    /// counts from the last submit()
+    struct stats {
+      /// mesh instances in the queue
+      unsigned num_items;
+
+      /// glDrawElements and glDrawArrays calls, including instanced ones
+      unsigned num_draw_calls;
+
+      /// glDrawElementsInstanced and glDrawArraysInstanced calls
+      unsigned num_instanced_draw_calls;
+
+      /// glUseProgram calls
+      unsigned num_program_binds;
+
+      /// materials set up (colours, lighting and textures)
+      unsigned num_material_binds;
+
+      /// glBindTexture calls
+      unsigned num_texture_binds;
+
+      /// glBindBuffer calls for vertices, indices and instances
+      unsigned num_buffer_binds;
+
+      /// glBindVertexArray calls for meshes
+      unsigned num_vertex_array_binds;
+    };
+
+  private:
+    enum {
+      // shorter runs than this are drawn one at a time.
+      min_instances = 4,
+
+      // size of the bone array in the skinning shader (bump_shader).
+      max_shader_bones = 192,
+
+      // skinned draws per job on the thread pool.
+      skinning_grain = 16,
+    };
+
+    // key layout, from the top bit down.
+    enum {
+      pass_bits = 4,
+      shader_bits = 12,
+      material_bits = 16,
+      mesh_bits = 16,
+      depth_bits = 16,
+
+      depth_shift = 0,
+      mesh_shift = depth_shift + depth_bits,
+      material_shift = mesh_shift + mesh_bits,
+      shader_shift = material_shift + material_bits,
+      pass_shift = shader_shift + shader_bits,
+    };
+
+    struct item {
+      mat4t modelToWorld;
+      mat4t modelToProjection;
+      mat4t modelToCamera;
+      mesh_instance *mi;
+
+      // the mesh to draw: the level of detail, or the copy skinned on the CPU.
+      mesh *msh;
+
+      // bones in palettes, for the skinning shader. num_bones is 0 for unskinned draws.
+      unsigned first_bone;
+      unsigned num_bones;
+
+      // the bone of each joint of the skin, in joint_indices.
+      unsigned first_joint;
+
+      // set if we skin this draw on the CPU.
+      skinner *cpu_skin;
+
+      float depth;
+      unsigned pass;
+    };
+
+    dynarray<item> items;
+
+    // bone matrices of the skinned draws and the items that have them.
+    dynarray<mat4t> palettes;
+    dynarray<unsigned> skinned_items;
+
+    // room for one skeleton's matrices per chunk of skinned items, kept so that skinning does not allocate.
+    dynarray<mat4t> skin_scratch;
+
+    // the joints of a skin matched to the bones of a skeleton. Matching is slow and
+    // one skeleton may carry many skins, so the pairs are kept from frame to frame.
+    struct skin_binding {
+      skeleton *skel;
+      skin *skn;
+      unsigned num_nodes;    // in the skeleton when matched, in case bones are added.
+      unsigned num_joints;
+      unsigned first_joint;  // in joint_indices
+      int next;              // another skin on the same skeleton, or -1
+    };
+    hash_map<skeleton*, unsigned> skeleton_bindings;
+    dynarray<skin_binding> skin_bindings;
+    dynarray<int> joint_indices;
+
+    // keeps the skeletons and skins of the bindings alive, so that their addresses are not reused.
+    dynarray<ref<resource> > binding_refs;
+    bool cpu_skinning;
+    skinner::blend_mode skin_blend;
+    platform::thread_pool *pool;
+
+    // draws [begin, end) in submit order. first_instance is -1 unless they are instanced.
+    struct batch {
+      unsigned begin;
+      unsigned end;
+      int first_instance;
+    };
+
+    dynarray<batch> batches;
+
+    // model matrices of the instanced batches, streamed to the GPU every frame.
+    dynarray<mat4t> instance_matrices;
+    ref<gl_resource> instance_buffer;
+
+    // keys and item indices, sorted in place with a second pair of arrays to ping pong.
+    dynarray<uint64_t> keys;
+    dynarray<unsigned> order;
+    dynarray<uint64_t> tmp_keys;
+    dynarray<unsigned> tmp_order;
+
+    // small ids for the pointers in the keys.
+    hash_map<param_shader*, unsigned> shader_ids;
+    hash_map<material*, unsigned> material_ids;
+    hash_map<mesh*, unsigned> mesh_ids;
+
+    bool sorting;
+    bool instancing;
+    stats last_stats;
+
+    template <class type> static uint64_t get_id(hash_map<type*, unsigned> &ids, type *ptr, unsigned bits) {
+      int index = ids.get_index(ptr);
+      if (index >= 0) return ids.get_value(index);
+      // ids that do not fit wrap around; this costs binds, but the draws are still right.
+      unsigned id = ids.get_num_entries() & ((1u << bits) - 1);
+      ids[ptr] = id;
+      return id;
+    }
+
+    // stable least significant digit first sort of keys and order, one byte at a time.
+    void radix_sort() {
+      unsigned num_items = keys.size();
+      tmp_keys.resize(num_items);
+      tmp_order.resize(num_items);
+
+      // one pass over the keys to count every byte.
+      unsigned counts[8][256];
+      memset(counts, 0, sizeof(counts));
+      for (unsigned i = 0; i != num_items; ++i) {
+        uint64_t key = keys[i];
+        for (unsigned digit = 0; digit != 8; ++digit) {
+          counts[digit][(key >> (digit * 8)) & 0xff]++;
+        }
+      }
+
+      uint64_t *src_keys = keys.data(), *dest_keys = tmp_keys.data();
+      unsigned *src_order = order.data(), *dest_order = tmp_order.data();
+      for (unsigned digit = 0; digit != 8; ++digit) {
+        unsigned shift = digit * 8;
+
+        // all keys have the same byte here, nothing to do.
+        if (counts[digit][(src_keys[0] >> shift) & 0xff] == num_items) continue;
+
+        unsigned offsets[256];
+        unsigned total = 0;
+        for (unsigned i = 0; i != 256; ++i) {
+          offsets[i] = total;
+          total += counts[digit][i];
+        }
+
+        for (unsigned i = 0; i != num_items; ++i) {
+          unsigned dest = offsets[(src_keys[i] >> shift) & 0xff]++;
+          dest_keys[dest] = src_keys[i];
+          dest_order[dest] = src_order[i];
+        }
+
+        std::swap(src_keys, dest_keys);
+        std::swap(src_order, dest_order);
+      }
+
+      if (src_keys != keys.data()) {
+        memcpy(keys.data(), src_keys, num_items * sizeof(uint64_t));
+        memcpy(order.data(), src_order, num_items * sizeof(unsigned));
+      }
+    }
+
+    // find or make the binding of a skin to a skeleton.
+    const skin_binding &bind_skin(skeleton *skel, skin *skn) {
+      unsigned num_joints = skn->get_num_joints();
+      int index = skeleton_bindings.get_index(skel);
+      int head = index >= 0 ? (int)skeleton_bindings.get_value(index) : -1;
+      for (int b = head; b != -1; b = skin_bindings[b].next) {
+        skin_binding &sb = skin_bindings[b];
+        if (sb.skn != skn) continue;
+        if (sb.num_joints != num_joints) {
+          sb.first_joint = joint_indices.size();
+          sb.num_joints = num_joints;
+          joint_indices.resize(joint_indices.size() + num_joints);
+          sb.num_nodes = ~0u;
+        }
+        if (sb.num_nodes != skel->get_num_nodes()) {
+          skel->match_skin(skn, joint_indices.data() + sb.first_joint);
+          sb.num_nodes = skel->get_num_nodes();
+        }
+        return sb;
+      }
+
+      skin_binding sb = { skel, skn, skel->get_num_nodes(), num_joints, joint_indices.size(), head };
+      joint_indices.resize(joint_indices.size() + num_joints);
+      skel->match_skin(skn, joint_indices.data() + sb.first_joint);
+      skeleton_bindings[skel] = skin_bindings.size();
+      skin_bindings.push_back(sb);
+      binding_refs.push_back(skel);
+      binding_refs.push_back(skn);
+      return skin_bindings.back();
+    }
+
+    // calculate the bone matrices of the skinned draws, and skin on the CPU the ones that need it.
+    void calc_skinning() {
+      // forget the bindings if most of them are no longer drawn.
+      if (skin_bindings.size() > skinned_items.size() * 2 + 64) {
+        skeleton_bindings.clear();
+        skin_bindings.resize(0);
+        joint_indices.resize(0);
+        binding_refs.resize(0);
+      }
+
+      palettes.resize(0);
+      skinned_items.resize(0);
+      unsigned max_nodes = 0;
+      for (unsigned i = 0; i != items.size(); ++i) {
+        item &it = items[i];
+        skeleton *skel = it.mi->get_skeleton();
+        skin *skn = it.msh->get_skin();
+        if (!skel || !skn || skn->get_num_joints() == 0) continue;
+
+        // the bindings are shared, so they are made here rather than on the threads.
+        const skin_binding &sb = bind_skin(skel, skn);
+        it.first_bone = palettes.size();
+        it.num_bones = sb.num_joints;
+        it.first_joint = sb.first_joint;
+        if (cpu_skinning || it.num_bones > max_shader_bones) {
+          skinner *cpu = it.mi->get_cpu_skinner();
+          if (!cpu || cpu->get_src() != it.msh || cpu->is_stale()) {
+            cpu = new skinner(it.msh);
+            it.mi->set_cpu_skinner(cpu);
+          }
+          it.cpu_skin = cpu;
+        }
+        palettes.resize(palettes.size() + it.num_bones);
+        max_nodes = std::max(max_nodes, skel->get_num_nodes());
+        skinned_items.push_back(i);
+      }
+      if (skinned_items.size() == 0) return;
+
+      // CPU skinned vertices stay in model space, to be drawn with the usual model matrices.
+      mat4t identity;
+      identity.loadIdentity();
+      // the pool hands out chunks that start at multiples of the grain.
+      unsigned num_chunks = (skinned_items.size() + skinning_grain - 1) / skinning_grain;
+      skin_scratch.resize(num_chunks * max_nodes);
+
+      platform::thread_pool &p = pool ? *pool : platform::thread_pool::get_default();
+      p.parallel_for(skinned_items.size(), skinning_grain, [&](unsigned begin, unsigned end) {
+        mat4t *scratch = skin_scratch.data() + begin / skinning_grain * max_nodes;
+        for (unsigned i = begin; i != end; ++i) {
+          item &it = items[skinned_items[i]];
+          mat4t *palette = &palettes[it.first_bone];
+          const int *indices = joint_indices.data() + it.first_joint;
+          it.mi->get_skeleton()->calc_palette(it.msh->get_skin(), indices, it.cpu_skin ? identity : it.modelToCamera, palette, scratch);
+          if (it.cpu_skin) {
+            it.cpu_skin->skin(palette, it.num_bones, skin_blend);
+          }
+        }
+      });
+
+      for (unsigned i = 0; i != skinned_items.size(); ++i) {
+        item &it = items[skinned_items[i]];
+        if (it.cpu_skin) {
+          it.cpu_skin->upload();
+          it.msh = it.cpu_skin;
+          it.num_bones = 0;
+        }
+      }
+    }
+
+    // split the sorted draws into runs with the same mesh and material.
+    // long enough runs are instanced and their model matrices go in instance_matrices.
+    void make_batches() {
+      batches.resize(0);
+      instance_matrices.resize(0);
+      bool can_instance = instancing && instancing_supported();
+      unsigned num_items = order.size();
+
+      for (unsigned begin = 0; begin != num_items; ) {
+        const item &first = items[order[begin]];
+        mesh *msh = first.msh;
+        material *mat = first.mi->get_material();
+        bool skinned = first.num_bones != 0;
+        unsigned end = begin + 1;
+        while (end != num_items) {
+          const item &it = items[order[end]];
+          if (it.msh != msh || it.mi->get_material() != mat || (it.num_bones != 0) != skinned) break;
+          ++end;
+        }
+
+        batch &bat = batches.emplace_back();
+        bat.begin = begin;
+        bat.end = end;
+        bat.first_instance = -1;
+
+        if (can_instance && !skinned && end - begin >= min_instances && mat->can_draw_instanced()) {
+          bat.first_instance = (int)instance_matrices.size();
+          for (unsigned i = begin; i != end; ++i) {
+            instance_matrices.push_back(items[order[i]].modelToWorld);
+          }
+        }
+        begin = end;
+      }
+    }
+
+  public:
+    /// Make an empty queue.
+    render_queue() {
+      sorting = true;
+      instancing = true;
+      cpu_skinning = false;
+      skin_blend = skinner::blend_linear;
+      pool = 0;
+      memset(&last_stats, 0, sizeof(last_stats));
+    }
+
+    /// Empty the queue for a new frame.
+    void reset() {
+      items.resize(0);
+      keys.resize(0);
+      order.resize(0);
+    }
+
+    /// Set this to false to draw in the order of add() (still skipping repeated binds).
+    void set_sorting(bool value) {
+      sorting = value;
+    }
+
+    /// Set this to false to draw every mesh instance with its own draw call.
+    void set_instancing(bool value) {
+      instancing = value;
+    }
+
+    /// Set this to true to skin every skinned draw on the CPU, not just the ones with too many bones for the shader.
+    void set_cpu_skinning(bool value) {
+      cpu_skinning = value;
+    }
+
+    /// How to blend the bones of draws skinned on the CPU. The skinning shader always blends matrices.
+    void set_skin_blend(skinner::blend_mode value) {
+      skin_blend = value;
+    }
+
+    /// Use a specific pool for the skinning. The default is thread_pool::get_default().
+    void set_thread_pool(platform::thread_pool *value) {
+      pool = value;
+    }
+
+    /// true if the GL context can draw instances (OpenGL 3.3 or OpenGL ES3).
+    static bool instancing_supported() {
+      #ifdef OCTET_GLES2
+        return false;
+      #else
+        return app_utils::has_gl_version(3, 3, 3, 0);
+      #endif
+    }
+
+    /// Add a mesh instance to draw.
+    /// Opaque instances are drawn front to back, by distance in front of the camera.
+    void add(mesh_instance *mi, pass_type pass, const mat4t &modelToWorld, const mat4t &modelToProjection, const mat4t &modelToCamera) {
+      item &it = items.emplace_back();
+      it.modelToWorld = modelToWorld;
+      it.modelToProjection = modelToProjection;
+      it.modelToCamera = modelToCamera;
+      it.mi = mi;
+      it.msh = mi->get_draw_mesh();
+      it.first_bone = 0;
+      it.num_bones = 0;
+      it.cpu_skin = 0;
+      it.depth = -modelToCamera.w().z();
+      it.pass = pass;
+    }
+
+    /// Calculate the bones of the skinned draws, make the keys and sort them.
+    void sort() {
+      calc_skinning();
+
+      unsigned num_items = items.size();
+      keys.resize(num_items);
+      order.resize(num_items);
+      shader_ids.clear();
+      material_ids.clear();
+      mesh_ids.clear();
+      if (num_items == 0) return;
+
+      float min_depth = items[0].depth, max_depth = items[0].depth;
+      for (unsigned i = 1; i != num_items; ++i) {
+        min_depth = std::min(min_depth, items[i].depth);
+        max_depth = std::max(max_depth, items[i].depth);
+      }
+      float depth_scale = max_depth > min_depth ? ((1 << depth_bits) - 1) / (max_depth - min_depth) : 0.0f;
+
+      for (unsigned i = 0; i != num_items; ++i) {
+        const item &it = items[i];
+        material *mat = it.mi->get_material();
+        uint64_t key = (uint64_t)it.pass << pass_shift;
+        key |= get_id(shader_ids, mat->get_shader(), shader_bits) << shader_shift;
+        key |= get_id(material_ids, mat, material_bits) << material_shift;
+        key |= get_id(mesh_ids, it.msh, mesh_bits) << mesh_shift;
+        key |= (uint64_t)(unsigned)((it.depth - min_depth) * depth_scale) << depth_shift;
+        keys[i] = key;
+        order[i] = i;
+      }
+
+      if (sorting) {
+        radix_sort();
+      }
+    }
+
+    /// Draw the queue in key order, with the camera and lights of the frame.
+    void submit(const frame_uniforms &frame, const mat4t &cameraToProjection) {
+      memset(&last_stats, 0, sizeof(last_stats));
+      last_stats.num_items = order.size();
+
+      make_batches();
+      bool any_instanced = instance_matrices.size() != 0;
+      if (any_instanced) {
+        if (!instance_buffer) instance_buffer = new gl_resource();
+        instance_buffer->stream(GL_ARRAY_BUFFER, instance_matrices.data(), instance_matrices.size() * sizeof(mat4t));
+        last_stats.num_buffer_binds++;
+      }
+      bool vertex_arrays = mesh::uses_vertex_arrays();
+
+      GLuint cur_program = 0;
+      material *cur_mat = 0;
+      bool cur_instanced = false;
+      mesh *cur_msh = 0;
+
+      for (unsigned b = 0; b != batches.size(); ++b) {
+        const batch &bat = batches[b];
+        const item &first = items[order[bat.begin]];
+        mesh *msh = first.msh;
+        material *mat = first.mi->get_material();
+        bool instanced = bat.first_instance >= 0;
+
+        if (msh != cur_msh) {
+          // vertex array objects replace each other, so there is nothing to disable.
+          if (cur_msh && !vertex_arrays) cur_msh->disable_attributes();
+          msh->enable_attributes();
+          msh->bind_indices();
+          if (vertex_arrays) {
+            last_stats.num_vertex_array_binds++;
+          } else {
+            last_stats.num_buffer_binds += msh->get_index_type() ? 2 : 1;
+          }
+          cur_msh = msh;
+        }
+
+        if (instanced) {
+          if (mat != cur_mat || !cur_instanced) {
+            GLuint program = mat->get_shader()->get_instanced_program();
+            bool use_program = program != cur_program;
+            last_stats.num_texture_binds += mat->render_shared_instanced(frame, use_program);
+            last_stats.num_program_binds += use_program;
+            last_stats.num_material_binds++;
+            cur_program = program;
+            cur_mat = mat;
+            cur_instanced = true;
+          }
+
+          // the rows of the model matrices, starting at this batch.
+          // this state lives in the mesh's vertex array object, if it has one, so we undo it after the draw.
+          gl_state::bind_buffer(GL_ARRAY_BUFFER, instance_buffer->get_buffer());
+          last_stats.num_buffer_binds++;
+          for (unsigned row = 0; row != 4; ++row) {
+            size_t offset = bat.first_instance * sizeof(mat4t) + row * sizeof(vec4);
+            glVertexAttribPointer(attribute_instance_matrix + row, 4, GL_FLOAT, GL_FALSE, sizeof(mat4t), (void*)offset);
+            glVertexAttribDivisor(attribute_instance_matrix + row, 1);
+            glEnableVertexAttribArray(attribute_instance_matrix + row);
+          }
+
+          msh->draw_primitives(bat.end - bat.begin);
+          last_stats.num_draw_calls++;
+          last_stats.num_instanced_draw_calls++;
+
+          for (unsigned row = 0; row != 4; ++row) {
+            glVertexAttribDivisor(attribute_instance_matrix + row, 0);
+            glDisableVertexAttribArray(attribute_instance_matrix + row);
+          }
+          continue;
+        }
+
+        for (unsigned i = bat.begin; i != bat.end; ++i) {
+          const item &it = items[order[i]];
+          if (!it.num_bones) {
+            if (mat != cur_mat || cur_instanced) {
+              GLuint program = mat->get_shader()->get_program();
+              bool use_program = program != cur_program;
+              last_stats.num_texture_binds += mat->render_shared(frame, use_program);
+              last_stats.num_program_binds += use_program;
+              last_stats.num_material_binds++;
+              cur_program = program;
+              cur_mat = mat;
+              cur_instanced = false;
+            }
+            mat->render_matrices(it.modelToProjection, it.modelToCamera);
+          } else {
+            /// multi-matrix rendering, with the bones from sort()
+            mat->render_skinned(cameraToProjection, &palettes[it.first_bone], it.num_bones, (vec4*)frame.get_lighting(), frame.get_num_lighting(), frame.get_num_lights());
+            // we do not know what the skinned material has bound.
+            cur_program = 0;
+            cur_mat = 0;
+          }
+
+          msh->draw_primitives();
+          last_stats.num_draw_calls++;
+        }
+      }
+
+      if (cur_msh) cur_msh->disable_attributes();
+    }
+
+    /// number of draws in the queue
+    unsigned size() const {
+      return order.size();
+    }
+
+    /// mesh instance of the nth draw in submit order (after sort())
+    mesh_instance *get_mesh_instance(unsigned index) const {
+      return items[order[index]].mi;
+    }
+
+    /// key of the nth draw in submit order (after sort())
+    uint64_t get_key(unsigned index) const {
+      return keys[index];
+    }
+
+    /// counts from the last submit()
+    const stats &get_stats() const {
+      return last_stats;
+    }
+  };
+} }
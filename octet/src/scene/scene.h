@@ -11,19 +11,32 @@
 #define OCTET_SCENE_INCLUDED
 
 #include "../scene/scene_node.h"
+#include "../scene/transform_system.h"
 #include "../scene/skin.h"
 #include "../scene/skeleton.h"
 #include "../scene/animation.h"
+#include "../scene/animation_clip.h"
+#include "../scene/triangle_bvh.h"
 #include "../scene/mesh.h"
+#include "../scene/simplifier.h"
+#include "../scene/lod_group.h"
+#include "../scene/skinner.h"
 #include "../scene/image.h"
 #include "../scene/sampler.h"
+#include "../scene/frame_uniforms.h"
 #include "../scene/param.h"
 #include "../scene/material.h"
 #include "../scene/light.h"
+#include "../scene/light_clusters.h"
 #include "../scene/camera_instance.h"
 #include "../scene/light_instance.h"
 #include "../scene/mesh_instance.h"
+#include "../scene/animation_binding.h"
 #include "../scene/animation_instance.h"
+#include "../scene/pose_system.h"
+#include "../scene/aabb_tree.h"
+#include "../scene/occlusion_buffer.h"
+#include "../scene/render_queue.h"
 #include "../scene/visual_scene.h"
 #include "../scene/displacement_map.h"
 #include "../scene/indexer.h"
@@ -15,8 +15,8 @@ namespace octet { namespace scene {
     // todo: support DAGs with multiple node parents
     ref<scene_node> parent;
 
-    // child nodes
-    dynarray<ref<scene_node> > children;
+    // child nodes. most nodes have only a few, so they are kept in the node.
+    small_dynarray<ref<scene_node>, 4> children;
 
     // this node's transform relative to parent
     mat4t nodeToParent;
@@ -27,6 +27,83 @@ namespace octet { namespace scene {
     // is this node and all its children renderable?
     bool enabled;
 
+    // cached nodeToParent * parent's nodeToWorld, valid if world_dirty is false.
+    mat4t nodeToWorld;
+
+    // cached enabled && parent's world_enabled, valid if world_dirty is false.
+    bool world_enabled;
+
+    // set when this node or one of its parents changes.
+    // the children of a dirty node are always dirty, so a clean node has clean parents.
+    bool world_dirty;
+
+    // incremented whenever nodeToWorld is recalculated.
+    unsigned world_version;
+
+    // versions of the tree, only kept up to date on its root. See get_hierarchy_version().
+    unsigned tree_hierarchy_version;
+    unsigned tree_transform_version;
+
+    void init_world() {
+      nodeToWorld.loadIdentity();
+      world_enabled = true;
+      world_dirty = true;
+      world_version = 0;
+      tree_hierarchy_version = next_version();
+      tree_transform_version = next_version();
+    }
+
+    // invalidate the cache of this node and everything below it, and change the transform version of the tree.
+    void mark_dirty() {
+      if (world_dirty) return;
+      get_root()->tree_transform_version = next_version();
+      mark_subtree_dirty();
+    }
+
+    // stops at dirty nodes as their children are already dirty.
+    void mark_subtree_dirty() {
+      if (world_dirty) return;
+      world_dirty = true;
+      for (unsigned i = 0; i != children.size(); ++i) {
+        children[i]->mark_subtree_dirty();
+      }
+    }
+
+    // recompute the cache from the parent's, which must be clean.
+    void refresh_world() {
+      if (parent) {
+        nodeToWorld = nodeToParent * parent->nodeToWorld;
+        world_enabled = enabled && parent->world_enabled;
+      } else {
+        nodeToWorld = nodeToParent;
+        world_enabled = enabled;
+      }
+      world_dirty = false;
+      world_version++;
+    }
+
+    // bring this node's cache up to date, and any dirty parents.
+    void clean_world() {
+      if (!world_dirty) return;
+      if (parent) parent->clean_world();
+      refresh_world();
+    }
+
+    // parents before children, so refresh_world always has a clean parent.
+    void update_world_children() {
+      for (unsigned i = 0; i != children.size(); ++i) {
+        scene_node *child = children[i];
+        if (child->world_dirty) child->refresh_world();
+        child->update_world_children();
+      }
+    }
+
+    // tree versions come from one counter, so a node that moves to another tree sees a different version.
+    static unsigned next_version() {
+      static unsigned counter;
+      return ++counter;
+    }
+
   public:
     RESOURCE_META(scene_node)
 
@@ -35,6 +112,7 @@ namespace octet { namespace scene {
       nodeToParent.loadIdentity();
       sid = atom_;
       enabled = true;
+      init_world();
       if (parent) {
         parent->add_child(this);
       }
@@ -45,6 +123,7 @@ namespace octet { namespace scene {
       this->nodeToParent = nodeToParent;
       this->sid = sid;
       enabled = true;
+      init_world();
     }
 
     /// the virtual add_ref on animation_target gets passed to here and we pass iton (delegate it) to the resource
@@ -61,6 +140,7 @@ namespace octet { namespace scene {
     void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
       if (sub_target == atom_transform) {
         nodeToParent.init_transpose(value);
+        mark_dirty();
       }
     }
 
@@ -73,13 +153,17 @@ namespace octet { namespace scene {
       //log("visit scene_node nodeToParent\n");
       v.visit(nodeToParent, atom_nodeToParent);
       v.visit(sid, atom_sid);
+      mark_dirty();
+      get_root()->tree_hierarchy_version = next_version();
     }
 
 
     /// add a child node to this node.
     void add_child(scene_node *new_node) {
       new_node->parent = this;
+      new_node->mark_dirty();
       children.push_back(new_node);
+      get_root()->tree_hierarchy_version = next_version();
     }
 
     /// Get the parent node of this node.
@@ -97,21 +181,60 @@ namespace octet { namespace scene {
       return children[index];
     }
 
-    // compute the scene_node to world matrix for an individual scene_node;
-    mat4t calcModelToWorld() {
-      mat4t result = nodeToParent;
-      for (scene_node *p = parent; p != NULL; p = p->parent) {
-        result = result * p->nodeToParent;
-      }
-      return result;
+    /// get the scene_node to world matrix for an individual scene_node.
+    /// This is cached, so it only walks the parents if something has moved.
+    const mat4t &calcModelToWorld() {
+      clean_world();
+      return nodeToWorld;
     }
 
-    // calculate whether this node is enabled (recursively)
+    /// is this node and all its parents enabled? (cached like calcModelToWorld)
     bool calcEnabled() {
-      for (scene_node *p = this; p != NULL; p = p->parent) {
-        if (!p->enabled) return false;
-      }
-      return true;
+      clean_world();
+      return world_enabled;
+    }
+
+    /// Set the cached world matrix from one calculated elsewhere (see transform_system).
+    /// The parent must already be up to date.
+    void set_nodeToWorld(const mat4t &value) {
+      nodeToWorld = value;
+      world_enabled = enabled && (!parent || parent->world_enabled);
+      world_dirty = false;
+      world_version++;
+    }
+
+    /// true if the cached world matrix needs recalculating.
+    bool get_world_dirty() const {
+      return world_dirty;
+    }
+
+    /// The top of the heirachy that this node is in.
+    scene_node *get_root() {
+      scene_node *node = this;
+      while (node->parent) node = node->parent;
+      return node;
+    }
+
+    /// A number that changes when nodes are added to the heirachy that this node is in.
+    unsigned get_hierarchy_version() {
+      return get_root()->tree_hierarchy_version;
+    }
+
+    /// A number that changes when any node in the heirachy that this node is in moves.
+    unsigned get_transform_version() {
+      return get_root()->tree_transform_version;
+    }
+
+    /// A number that changes each time this node's world matrix is recalculated.
+    unsigned get_world_version() const {
+      return world_version;
+    }
+
+    /// Update the cached world matrices of this node and all its children.
+    /// visual_scene::update calls this once a frame so that later queries do no work.
+    void update_world() {
+      clean_world();
+      update_world_children();
     }
 
     /// transform a point from model space to world space
@@ -134,7 +257,9 @@ namespace octet { namespace scene {
     }
 
     /// access the node to parent transform matrix for writing.
+    /// Write to the matrix straight away; do not keep the reference.
     mat4t &access_nodeToParent() {
+      mark_dirty();
       return nodeToParent;
     }
 
@@ -165,27 +290,34 @@ namespace octet { namespace scene {
 
     /// set enabled state
     void set_enabled(bool value) {
-      enabled = value;
+      if (value != enabled) {
+        enabled = value;
+        mark_dirty();
+      }
     }
 
     /// reset the matrix
     void loadIdentity() {
       nodeToParent.loadIdentity();
+      mark_dirty();
     }
 
     /// Translate the matrix
     void translate(vec3_in xyz) {
       nodeToParent.translate(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Rotate the matrix
     void rotate(float angle, vec3_in axis) {
       nodeToParent.rotate(angle, axis[0], axis[1], axis[2]);
+      mark_dirty();
     }
 
     /// Scale the matrix
     void scale(vec3_in xyz) {
       nodeToParent.scale(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Get the identifying sid
@@ -193,6 +325,15 @@ namespace octet { namespace scene {
       return sid;
     }
 
+    /// Find the first node with a sid, searching this node and then its children depth first. Null if there is none.
+    scene_node *find_sid(atom_t value) {
+      if (sid == value) return this;
+      for (unsigned i = 0; i != children.size(); ++i) {
+        if (scene_node *node = children[i]->find_sid(value)) return node;
+      }
+      return 0;
+    }
+
     /// recursively fetch all child nodes
     void get_all_child_nodes(dynarray<scene_node*> &nodes, dynarray<int> &parents) {
       dynarray<scene_node*> stack;
@@ -0,0 +1,634 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Mesh simplify modifier. Edge collapses chosen by quadric error.
+//
+
+namespace octet { namespace scene {
+  /// Mesh modifier that removes triangles by collapsing edges, cheapest first.
+  ///
+  /// The cost of a collapse is how far it moves the surface, measured with quadric error metrics
+  /// (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997),
+  /// plus how much it changes the other float attributes such as normals and uvs.
+  ///
+  /// Each collapse moves a vertex onto one of its neighbours, so the result uses a subset of the source vertices.
+  /// Vertices that share a position but not their attributes (uv seams, hard edges) may only move along the seam,
+  /// taking every side of the seam with them, so seams do not open up. Open borders only move along the border.
+  ///
+  /// eg. new simplifier(msh, 0.25f) has about a quarter of the triangles of msh.
+  class simplifier : public mesh {
+    enum {
+      // float attributes compared by the attribute cost, eg. normal (3) + uv (2)
+      max_attributes = 16,
+
+      // sides of a seam at one position. Positions with more do not move.
+      max_wedges = 8,
+
+      // positions with more neighbours do not move.
+      max_neighbours = 32,
+    };
+
+    // sum of w * (dot(n, p) + d)^2 over planes (n, d) as a symmetric 4x4 matrix.
+    struct quadric {
+      double a00, a01, a02, a11, a12, a22;
+      double b0, b1, b2;
+      double c;
+      double weight;
+
+      void add_plane(const vec3 &n, float d, float w) {
+        a00 += w * n[0] * n[0]; a01 += w * n[0] * n[1]; a02 += w * n[0] * n[2];
+        a11 += w * n[1] * n[1]; a12 += w * n[1] * n[2]; a22 += w * n[2] * n[2];
+        b0 += w * n[0] * d; b1 += w * n[1] * d; b2 += w * n[2] * d;
+        c += w * d * d;
+        weight += w;
+      }
+
+      void add(const quadric &rhs) {
+        a00 += rhs.a00; a01 += rhs.a01; a02 += rhs.a02;
+        a11 += rhs.a11; a12 += rhs.a12; a22 += rhs.a22;
+        b0 += rhs.b0; b1 += rhs.b1; b2 += rhs.b2;
+        c += rhs.c;
+        weight += rhs.weight;
+      }
+
+      // weighted sum of squared distances from the planes.
+      double eval(const vec3 &p) const {
+        double x = p[0], y = p[1], z = p[2];
+        return
+          a00 * x * x + a11 * y * y + a22 * z * z +
+          2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+          2 * (b0 * x + b1 * y + b2 * z) + c
+        ;
+      }
+    };
+
+    // a collapse of position a onto position b.
+    struct collapse {
+      unsigned a;
+      unsigned b;
+      float cost;
+
+      bool operator<(const collapse &rhs) const { return cost < rhs.cost; }
+    };
+
+    // source mesh. Provides underlying geometry.
+    ref<mesh> src;
+
+    // parameters
+    float target_ratio;
+    float max_error;
+    float attribute_weight;
+
+    // result: the furthest a source vertex is from the result, in model space.
+    float error;
+
+    // working params: three vertices per triangle, and each vertex's welded position.
+    dynarray<uint32_t> tris;
+    dynarray<unsigned> pos_id;
+    dynarray<vec3p> points;
+
+    // for each position, the triangles that use it: pos_tris[tri_offsets[p]] .. pos_tris[tri_offsets[p+1]-1]
+    dynarray<unsigned> tri_offsets;
+    dynarray<unsigned> pos_tris;
+
+    // find which triangles use each position.
+    void get_position_triangles() {
+      unsigned num_points = points.size();
+      unsigned num_tris = tris.size() / 3;
+      tri_offsets.resize(num_points + 1);
+      memset(tri_offsets.data(), 0, tri_offsets.size() * sizeof(unsigned));
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        tri_offsets[pos_id[tris[i]] + 1]++;
+      }
+      for (unsigned p = 0; p != num_points; ++p) {
+        tri_offsets[p + 1] += tri_offsets[p];
+      }
+      pos_tris.resize(num_tris * 3);
+      for (unsigned i = 0; i != num_tris * 3; ++i) {
+        pos_tris[tri_offsets[pos_id[tris[i]]]++] = i / 3;
+      }
+      for (unsigned p = num_points; p != 0; --p) {
+        tri_offsets[p] = tri_offsets[p - 1];
+      }
+      tri_offsets[0] = 0;
+    }
+
+    // the vertex of triangle t at position p, or ~0
+    unsigned get_wedge(unsigned t, unsigned p) const {
+      for (unsigned k = 0; k != 3; ++k) {
+        if (pos_id[tris[t * 3 + k]] == p) return tris[t * 3 + k];
+      }
+      return ~0u;
+    }
+
+    // the triangles around a position: the vertex there, then the positions and vertices of the other two corners in order.
+    struct ring {
+      unsigned num;
+      unsigned wedge[max_neighbours];
+      unsigned pos[max_neighbours][2];
+      unsigned other[max_neighbours][2];
+    };
+
+    // returns false if there are too many triangles to move p.
+    bool get_ring(ring &r, unsigned p) const {
+      unsigned first = tri_offsets[p];
+      r.num = tri_offsets[p + 1] - first;
+      if (r.num > max_neighbours) return false;
+      for (unsigned i = 0; i != r.num; ++i) {
+        const uint32_t *t = &tris[pos_tris[first + i] * 3];
+        unsigned k0 = pos_id[t[0]] == p ? 0 : pos_id[t[1]] == p ? 1 : 2;
+        unsigned k1 = k0 == 2 ? 0 : k0 + 1;
+        unsigned k2 = k1 == 2 ? 0 : k1 + 1;
+        r.wedge[i] = t[k0];
+        r.other[i][0] = t[k1];
+        r.other[i][1] = t[k2];
+        r.pos[i][0] = pos_id[t[k1]];
+        r.pos[i][1] = pos_id[t[k2]];
+      }
+      return true;
+    }
+
+    // the other positions in a ring, and how many triangles share each edge.
+    static bool get_neighbours(const ring &r, unsigned *nbr, unsigned *count, unsigned &num) {
+      num = 0;
+      for (unsigned i = 0; i != r.num; ++i) {
+        for (unsigned k = 0; k != 2; ++k) {
+          unsigned q = r.pos[i][k];
+          unsigned j = 0;
+          while (j != num && nbr[j] != q) ++j;
+          if (j == num) {
+            if (num == max_neighbours) return false;
+            nbr[num] = q;
+            count[num++] = 0;
+          }
+          count[j]++;
+        }
+      }
+      return true;
+    }
+
+    // pair each vertex in the ring of a with the vertex at b that it would become, using the triangles on edge ab.
+    // returns false if a vertex at a has no such triangle or would have to become two vertices, as that would open a seam.
+    static bool get_wedge_map(unsigned *from, unsigned *to, unsigned &num, const ring &r, unsigned b) {
+      num = 0;
+      for (unsigned i = 0; i != r.num; ++i) {
+        unsigned wa = r.wedge[i];
+        unsigned wb = r.pos[i][0] == b ? r.other[i][0] : r.pos[i][1] == b ? r.other[i][1] : ~0u;
+        unsigned j = 0;
+        while (j != num && from[j] != wa) ++j;
+        if (j == num) {
+          if (num == max_wedges) return false;
+          from[num] = wa;
+          to[num++] = wb;
+        } else if (to[j] == ~0u) {
+          to[j] = wb;
+        } else if (wb != ~0u && to[j] != wb) {
+          return false;
+        }
+      }
+      for (unsigned j = 0; j != num; ++j) {
+        if (to[j] == ~0u) return false;
+      }
+      return true;
+    }
+
+    // true if moving position a to position b turns over or squashes any triangle of a not on edge ab.
+    bool has_flips(const ring &r, unsigned a, unsigned b) const {
+      vec3 pa = points[a], pb = points[b];
+      for (unsigned i = 0; i != r.num; ++i) {
+        if (r.pos[i][0] == b || r.pos[i][1] == b) continue;
+        vec3 p1 = points[r.pos[i][0]], p2 = points[r.pos[i][1]];
+        vec3 n0 = cross(p1 - pa, p2 - pa);
+        vec3 n1 = cross(p1 - pb, p2 - pb);
+        float d = dot(n0, n1);
+        if (d <= 0 || d * d < 0.0625f * n0.squared() * n1.squared()) return true;
+      }
+      return false;
+    }
+
+    // true if a and b have other neighbours in common than the ones on the triangles of edge ab.
+    // collapsing the edge would join the surface to itself.
+    bool joins_surface(const ring &ra, unsigned b, unsigned num_edge_tris) const {
+      ring rb;
+      unsigned nbr_a[max_neighbours], count_a[max_neighbours], num_a;
+      unsigned nbr_b[max_neighbours], count_b[max_neighbours], num_b;
+      if (!get_ring(rb, b) || !get_neighbours(ra, nbr_a, count_a, num_a) || !get_neighbours(rb, nbr_b, count_b, num_b)) return true;
+      unsigned common = 0;
+      for (unsigned i = 0; i != num_a; ++i) {
+        for (unsigned j = 0; j != num_b; ++j) {
+          common += nbr_a[i] == nbr_b[j];
+        }
+      }
+      return common > num_edge_tris;
+    }
+
+    // squared distance from p to the nearest point of triangle abc. (Ericson, Real-Time Collision Detection, 5.1.5)
+    static float distance_sq_to_triangle(const vec3 &p, const vec3 &a, const vec3 &b, const vec3 &c) {
+      vec3 ab = b - a, ac = c - a, ap = p - a;
+      float d1 = dot(ab, ap), d2 = dot(ac, ap);
+      if (d1 <= 0 && d2 <= 0) return ap.squared();
+
+      vec3 bp = p - b;
+      float d3 = dot(ab, bp), d4 = dot(ac, bp);
+      if (d3 >= 0 && d4 <= d3) return bp.squared();
+
+      float vc = d1 * d4 - d3 * d2;
+      if (vc <= 0 && d1 >= 0 && d3 <= 0) return (ap - ab * (d1 / (d1 - d3))).squared();
+
+      vec3 cp = p - c;
+      float d5 = dot(ab, cp), d6 = dot(ac, cp);
+      if (d6 >= 0 && d5 <= d6) return cp.squared();
+
+      float vb = d5 * d2 - d1 * d6;
+      if (vb <= 0 && d2 >= 0 && d6 <= 0) return (ap - ac * (d2 / (d2 - d6))).squared();
+
+      float va = d3 * d6 - d5 * d4;
+      if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return (bp - (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))).squared();
+
+      float denom = 1 / (va + vb + vc);
+      return (ap - ab * (vb * denom) - ac * (vc * denom)).squared();
+    }
+
+  public:
+    RESOURCE_META(simplifier)
+
+    /// Simplify src to about target_ratio times the triangles, making no collapse whose estimated error is over max_error.
+    simplifier(mesh *src=0, float target_ratio=0.5f, float max_error=1e37f) {
+      this->src = src;
+      this->target_ratio = target_ratio;
+      this->max_error = max_error;
+      attribute_weight = 0.1f;
+      error = 0;
+      update();
+    }
+
+    /// standard update function, called if input changes.
+    /// Works for GL_TRIANGLES meshes with GL_FLOAT positions; other meshes are copied unchanged.
+    void update() {
+      if (!src) return;
+
+      *(mesh*)this = *(mesh*)src;
+      error = 0;
+
+      dynarray<vec3p> corners;
+      src->get_triangle_corners(corners, tris);
+      if (tris.size() == 0) return;
+
+      unsigned num_vertices = 0;
+      for (unsigned i = 0; i != tris.size(); ++i) {
+        num_vertices = std::max(num_vertices, tris[i] + 1);
+      }
+
+      // weld the vertices by position. vertices at the same position are the sides of a seam.
+      dynarray<vec3p> vertex_pos(num_vertices);
+      dynarray<uint8_t> used(num_vertices);
+      memset(used.data(), 0, num_vertices);
+      for (unsigned i = 0; i != tris.size(); ++i) {
+        vertex_pos[tris[i]] = corners[i];
+        used[tris[i]] = 1;
+      }
+      dynarray<unsigned> order;
+      order.reserve(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        if (used[v]) order.push_back(v);
+      }
+      std::sort(order.data(), order.data() + order.size(), [&](unsigned lhs, unsigned rhs) {
+        return memcmp(&vertex_pos[lhs], &vertex_pos[rhs], sizeof(vec3p)) < 0;
+      });
+      pos_id.resize(num_vertices);
+      points.resize(0);
+      for (unsigned i = 0; i != order.size(); ++i) {
+        unsigned v = order[i];
+        if (i == 0 || memcmp(&vertex_pos[v], &vertex_pos[order[i - 1]], sizeof(vec3p)) != 0) {
+          points.push_back(vertex_pos[v]);
+        }
+        pos_id[v] = points.size() - 1;
+      }
+      unsigned num_points = points.size();
+
+      // drop triangles with two corners at the same place.
+      unsigned num_tris = 0;
+      for (unsigned i = 0; i != tris.size(); i += 3) {
+        unsigned p0 = pos_id[tris[i]], p1 = pos_id[tris[i + 1]], p2 = pos_id[tris[i + 2]];
+        if (p0 == p1 || p1 == p2 || p2 == p0) continue;
+        for (unsigned k = 0; k != 3; ++k) tris[num_tris * 3 + k] = tris[i + k];
+        num_tris++;
+      }
+      tris.resize(num_tris * 3);
+
+      // float attributes other than the position, for the attribute cost.
+      unsigned attr_offset[max_attributes];
+      unsigned num_attributes = 0;
+      for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
+        if (get_attr(slot) == attribute_pos || get_kind(slot) != GL_FLOAT) continue;
+        for (unsigned i = 0; i != get_size(slot) && num_attributes != max_attributes; ++i) {
+          attr_offset[num_attributes++] = get_offset(slot) + i * sizeof(float);
+        }
+      }
+      unsigned stride = get_stride();
+      size_t vertex_bytes = src->get_vertices()->get_size();
+      dynarray<float> attributes(num_vertices * num_attributes);
+      {
+        gl_resource::rolock vtx_lock(src->get_vertices());
+        const uint8_t *vtx = vtx_lock.u8();
+        for (unsigned v = 0; v != num_vertices; ++v) {
+          for (unsigned i = 0; i != num_attributes; ++i) {
+            size_t offset = (size_t)v * stride + attr_offset[i];
+            attributes[v * num_attributes + i] = offset + sizeof(float) <= vertex_bytes ? *(const float*)(vtx + offset) : 0.0f;
+          }
+        }
+      }
+
+      // attribute differences are measured as a fraction of the size of the mesh.
+      vec3 vmin = points.size() ? (vec3)points[0] : vec3(0);
+      vec3 vmax = vmin;
+      for (unsigned p = 0; p != num_points; ++p) {
+        vmin = min(vmin, (vec3)points[p]);
+        vmax = max(vmax, (vec3)points[p]);
+      }
+      float attribute_scale = attribute_weight * length(vmax - vmin) * 0.5f;
+      float attribute_scale_sq = attribute_scale * attribute_scale;
+
+      // the planes of the triangles around each position, weighted by area.
+      // borders and seams add planes at right angles to the surface to hold them in place.
+      get_position_triangles();
+      dynarray<quadric> quadrics(num_points);
+      memset(quadrics.data(), 0, num_points * sizeof(quadric));
+      for (unsigned t = 0; t != num_tris; ++t) {
+        unsigned v[3] = { tris[t * 3], tris[t * 3 + 1], tris[t * 3 + 2] };
+        unsigned p[3] = { pos_id[v[0]], pos_id[v[1]], pos_id[v[2]] };
+        vec3 p0 = points[p[0]], p1 = points[p[1]], p2 = points[p[2]];
+        vec3 n = cross(p1 - p0, p2 - p0);
+        float len = length(n);
+        if (len == 0) continue;
+        n = n / len;
+        for (unsigned k = 0; k != 3; ++k) {
+          quadrics[p[k]].add_plane(n, -dot(n, p0), len * 0.5f);
+        }
+
+        for (unsigned k = 0; k != 3; ++k) {
+          unsigned a = p[k], b = p[k == 2 ? 0 : k + 1];
+          unsigned wa = v[k], wb = v[k == 2 ? 0 : k + 1];
+          bool constrained = true;
+          for (unsigned i = tri_offsets[a]; i != tri_offsets[a + 1]; ++i) {
+            unsigned t2 = pos_tris[i];
+            if (t2 != t && get_wedge(t2, b) != ~0u) {
+              constrained = get_wedge(t2, a) != wa || get_wedge(t2, b) != wb;
+              break;
+            }
+          }
+          if (constrained) {
+            vec3 pa = points[a], pb = points[b];
+            vec3 edge = pb - pa;
+            vec3 m = cross(edge, n);
+            float mlen = length(m);
+            if (mlen == 0) continue;
+            m = m / mlen;
+            float w = edge.squared() * 10.0f;
+            quadrics[a].add_plane(m, -dot(m, pa), w);
+            quadrics[b].add_plane(m, -dot(m, pa), w);
+          }
+        }
+      }
+
+      // collapse edges in passes. collapses in the same pass do not touch the same triangles.
+      unsigned target = (unsigned)(num_tris * target_ratio);
+      float max_error_sq = max_error < 1e18f ? max_error * max_error : 1e37f;
+      dynarray<unsigned> remap(num_vertices);
+      for (unsigned v = 0; v != num_vertices; ++v) remap[v] = v;
+      dynarray<unsigned> pos_remap(num_points);
+      for (unsigned p = 0; p != num_points; ++p) pos_remap[p] = p;
+      dynarray<uint8_t> locked(num_points);
+      dynarray<uint8_t> dirty(num_points);
+      memset(dirty.data(), 1, num_points);
+      dynarray<collapse> best_collapse(num_points);
+      dynarray<collapse> collapses;
+
+      while (num_tris > target) {
+        get_position_triangles();
+
+        // the cheapest collapse of each position, where anything nearby changed in the last pass.
+        for (unsigned a = 0; a != num_points; ++a) {
+          if (!dirty[a]) continue;
+          dirty[a] = 0;
+          collapse &best = best_collapse[a];
+          best.a = a;
+          best.b = ~0u;
+          best.cost = 0;
+          ring r;
+          unsigned nbr[max_neighbours], count[max_neighbours], num_nbr;
+          if (tri_offsets[a] == tri_offsets[a + 1] || !get_ring(r, a) || !get_neighbours(r, nbr, count, num_nbr)) continue;
+
+          // borders move along the border. edges shared by more than two triangles stay put.
+          bool border = false, complex = false;
+          for (unsigned j = 0; j != num_nbr; ++j) {
+            border |= count[j] == 1;
+            complex |= count[j] > 2;
+          }
+          if (complex) continue;
+
+          for (unsigned j = 0; j != num_nbr; ++j) {
+            unsigned b = nbr[j];
+            if (border && count[j] != 1) continue;
+
+            unsigned from[max_wedges], to[max_wedges], num_wedges;
+            if (!get_wedge_map(from, to, num_wedges, r, b)) continue;
+
+            quadric q = quadrics[a];
+            q.add(quadrics[b]);
+            float error_sq = (float)std::max(0.0, q.eval(points[b]) / std::max(q.weight, 1e-30));
+            if (error_sq > max_error_sq) continue;
+
+            float attr_sq = 0;
+            for (unsigned w = 0; w != num_wedges; ++w) {
+              const float *fa = &attributes[from[w] * num_attributes];
+              const float *fb = &attributes[to[w] * num_attributes];
+              for (unsigned i = 0; i != num_attributes; ++i) {
+                attr_sq += (fa[i] - fb[i]) * (fa[i] - fb[i]);
+              }
+            }
+
+            float cost = error_sq + attr_sq * attribute_scale_sq;
+            if (best.b == ~0u || cost < best.cost) {
+              best.b = b;
+              best.cost = cost;
+            }
+          }
+        }
+
+        // only the cheapest quarter in each pass, so that an expensive collapse does not go before
+        // a cheap one that was locked by its neighbour.
+        collapses.resize(0);
+        for (unsigned a = 0; a != num_points; ++a) {
+          if (best_collapse[a].b != ~0u) collapses.push_back(best_collapse[a]);
+        }
+        if (collapses.size() == 0) break;
+        unsigned num_cheap = collapses.size() / 4 + 1;
+        std::nth_element(collapses.data(), collapses.data() + num_cheap - 1, collapses.data() + collapses.size());
+        std::sort(collapses.data(), collapses.data() + num_cheap);
+
+        memset(locked.data(), 0, num_points);
+        unsigned num_collapsed = 0;
+        for (unsigned c = 0; c != num_cheap && num_tris > target; ++c) {
+          unsigned a = collapses[c].a, b = collapses[c].b;
+          if (locked[a] || locked[b]) continue;
+
+          ring r;
+          get_ring(r, a);
+          unsigned num_edge_tris = 0;
+          for (unsigned i = 0; i != r.num; ++i) {
+            num_edge_tris += r.pos[i][0] == b || r.pos[i][1] == b;
+          }
+          // keep at least one triangle.
+          if (num_edge_tris >= num_tris) continue;
+          if (has_flips(r, a, b) || joins_surface(r, b, num_edge_tris)) continue;
+
+          unsigned from[max_wedges], to[max_wedges], num_wedges;
+          get_wedge_map(from, to, num_wedges, r, b);
+          for (unsigned w = 0; w != num_wedges; ++w) {
+            remap[from[w]] = to[w];
+          }
+          quadrics[b].add(quadrics[a]);
+          pos_remap[a] = b;
+
+          // nothing else in this pass may change the triangles around a.
+          for (unsigned i = tri_offsets[a]; i != tri_offsets[a + 1]; ++i) {
+            unsigned t = pos_tris[i];
+            for (unsigned k = 0; k != 3; ++k) locked[pos_id[tris[t * 3 + k]]] = 1;
+          }
+
+          num_tris -= num_edge_tris;
+          num_collapsed++;
+        }
+
+        if (num_collapsed == 0) break;
+
+        // the triangles around the locked positions have changed, and so have the costs of their corners.
+        for (unsigned p = 0; p != num_points; ++p) {
+          if (!locked[p]) continue;
+          for (unsigned i = tri_offsets[p]; i != tri_offsets[p + 1]; ++i) {
+            unsigned t = pos_tris[i];
+            for (unsigned k = 0; k != 3; ++k) dirty[pos_id[tris[t * 3 + k]]] = 1;
+          }
+        }
+
+        // move the triangles to their new vertices and drop the ones that have collapsed.
+        unsigned dest = 0;
+        for (unsigned i = 0; i != tris.size(); i += 3) {
+          unsigned v0 = remap[tris[i]], v1 = remap[tris[i + 1]], v2 = remap[tris[i + 2]];
+          if (pos_id[v0] == pos_id[v1] || pos_id[v1] == pos_id[v2] || pos_id[v2] == pos_id[v0]) continue;
+          tris[dest++] = v0;
+          tris[dest++] = v1;
+          tris[dest++] = v2;
+        }
+        tris.resize(dest);
+        num_tris = dest / 3;
+      }
+
+      // measure how far the positions that moved are from the triangles near where they went:
+      // the triangles around that position and around its neighbours.
+      get_position_triangles();
+      float error_sq = 0;
+      for (unsigned p = 0; p != num_points; ++p) {
+        unsigned q = p;
+        while (pos_remap[q] != q) q = pos_remap[q];
+        if (q == p || tri_offsets[q] == tri_offsets[q + 1]) continue;
+        ring r;
+        unsigned nbr[max_neighbours], count[max_neighbours], num_nbr = 0;
+        if (get_ring(r, q)) get_neighbours(r, nbr, count, num_nbr);
+        float nearest = 1e37f;
+        for (unsigned j = 0; j <= num_nbr; ++j) {
+          unsigned r = j == num_nbr ? q : nbr[j];
+          for (unsigned i = tri_offsets[r]; i != tri_offsets[r + 1]; ++i) {
+            const uint32_t *t = &tris[pos_tris[i] * 3];
+            nearest = std::min(nearest, distance_sq_to_triangle(points[p], points[pos_id[t[0]]], points[pos_id[t[1]]], points[pos_id[t[2]]]));
+          }
+        }
+        error_sq = std::max(error_sq, nearest);
+      }
+      error = sqrtf(error_sq);
+
+      // keep the vertices still in use, in their original order.
+      dynarray<unsigned> new_index(num_vertices);
+      memset(used.data(), 0, num_vertices);
+      for (unsigned i = 0; i != tris.size(); ++i) {
+        used[tris[i]] = 1;
+      }
+      unsigned num_dest_vertices = 0;
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        new_index[v] = num_dest_vertices;
+        num_dest_vertices += used[v];
+      }
+
+      dynarray<uint8_t> dest_vertices(num_dest_vertices * stride);
+      {
+        gl_resource::rolock vtx_lock(src->get_vertices());
+        const uint8_t *vtx = vtx_lock.u8();
+        for (unsigned v = 0; v != num_vertices; ++v) {
+          if (used[v]) memcpy(&dest_vertices[new_index[v] * stride], vtx + (size_t)v * stride, stride);
+        }
+      }
+      for (unsigned i = 0; i != tris.size(); ++i) {
+        tris[i] = new_index[tris[i]];
+      }
+
+      unsigned isize = tris.size() * sizeof(uint32_t);
+      unsigned vsize = dest_vertices.size();
+      gl_resource *indices = new gl_resource(GL_ELEMENT_ARRAY_BUFFER, isize);
+      gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, vsize);
+      if (isize) indices->assign(tris.data(), 0, isize);
+      if (vsize) vertices->assign(dest_vertices.data(), 0, vsize);
+
+      set_indices(indices);
+      set_vertices(vertices);
+      set_index_type(GL_UNSIGNED_INT);
+      set_first_index(0);
+      set_num_indices(tris.size());
+      set_num_vertices(num_dest_vertices);
+      calc_aabb();
+
+      // the working arrays are not needed between updates.
+      tris.reset();
+      pos_id.reset();
+      points.reset();
+      tri_offsets.reset();
+      pos_tris.reset();
+    }
+
+    void visit(visitor &v) {
+      mesh::visit(v);
+      v.visit(src, atom_src);
+      v.visit(target_ratio, atom_target_ratio);
+      v.visit(max_error, atom_max_error);
+    }
+
+    /// How far, in model space, the source vertices are from the simplified surface.
+    float get_error() const {
+      return error;
+    }
+
+    /// The fraction of the triangles to keep.
+    float get_target_ratio() const {
+      return target_ratio;
+    }
+
+    /// Set the fraction of the triangles to keep. Call update() afterwards.
+    void set_target_ratio(float value) {
+      target_ratio = value;
+    }
+
+    /// Collapses whose error, estimated from the quadrics, is over this are not made, even if we keep more triangles.
+    void set_max_error(float value) {
+      max_error = value;
+    }
+
+    /// How much a change in normal or uv counts against a collapse, as a fraction of the size of the mesh.
+    /// eg. with 0.1, turning a normal by 90 degrees costs about as much as moving the surface by 14% of the radius.
+    void set_attribute_weight(float value) {
+      attribute_weight = value;
+    }
+  };
+}}
@@ -11,7 +11,6 @@
 namespace octet { namespace scene {
   class skeleton : public resource {
     // skeleton components
-    dynarray<mat4t> nodeToParents;
     dynarray<atom_t> joints;
     dynarray<ref<scene_node> > nodes;
     dynarray<int> parents;
@@ -27,7 +26,6 @@ namespace octet { namespace scene {
     }
 
     void visit(visitor &v) {
-      v.visit(nodeToParents, atom_nodeToParents);
       v.visit(joints, atom_joints);
       v.visit(nodes, atom_nodes);
       v.visit(parents, atom_parents);
@@ -38,7 +36,6 @@ namespace octet { namespace scene {
 
     void add_bone(scene_node *node, int parent) {
       nodes.push_back(node);
-      nodeToParents.push_back(node->get_nodeToParent());
       joints.push_back(node->get_sid());
       parents.push_back(parent);
       //char tmp[256];
@@ -47,7 +44,7 @@ namespace octet { namespace scene {
 
     int get_num_bones() const { return result.size(); }
 
-    int find_joint(atom_t sid) {
+    int find_joint(atom_t sid) const {
       for (unsigned i = 0; i != joints.size(); ++i) {
         if (joints[i] == sid) {
           return i;
@@ -56,64 +53,61 @@ namespace octet { namespace scene {
       return -1;
     }
 
-    mat4t *calc_transforms(const mat4t &worldToCamera, skin *skn) {
-      //static bool first_frame = true;
-      if (boneToNode.size() < nodeToParents.size()) {
-        boneToNode.resize(nodeToParents.size());
-      }
-
-      // todo: optionally drive animation directly to the skeleton.
-      for (int i = 0; i != nodes.size(); ++i) {
-        nodeToParents[i] = nodes[i]->access_nodeToParent();
+    /// Find the bone of each joint of a skin, or -1, into indices, which needs room for the joints of the skin.
+    /// The skeleton is not changed, so many skins can share it. Keep the indices for calc_palette().
+    void match_skin(const skin *skn, int *indices) const {
+      for (unsigned i = 0; i != skn->get_num_joints(); ++i) {
+        indices[i] = find_joint(skn->get_joint(i));
       }
+    }
 
-      // compute matrix heirachy
-      for (int i = 0; i != nodeToParents.size(); ++i) {
+    /// Calculate the bone matrices of a skin, from skin space to the space of modelToBase, into dest.
+    /// indices come from match_skin(). dest needs room for the joints of the skin and scratch for get_num_nodes() matrices.
+    /// This only reads the skeleton and its scene_nodes, so many instances can be done at once on different threads.
+    void calc_palette(const skin *skn, const int *indices, const mat4t &modelToBase, mat4t *dest, mat4t *scratch) const {
+      // compute matrix heirachy: skeleton -> parent -> parent -> world -> camera
+      for (unsigned i = 0; i != nodes.size(); ++i) {
         int parent = parents[i];
-        // skeleton -> parent -> parent -> world -> camera
-        if (parent == -1) {
-          boneToNode[i] = nodeToParents[i] * worldToCamera;
-        } else {
-          boneToNode[i] = nodeToParents[i] * boneToNode[parent];
-        }
-        //log("%d %s p=%d\n", i, result[i].toString(), parent);
+        multiply(scratch[i], nodes[i]->get_nodeToParent(), parent == -1 ? modelToBase : scratch[parent]);
       }
 
-      unsigned num_joints = skn->get_num_joints();
-      if (result.size() < num_joints) {
-        result.resize(num_joints);
-        indices.resize(num_joints);
-        for (int i = 0; i != num_joints; ++i) {
-          // skin -> bind space -> skeleton -> parent -> parent -> world -> camera
-          indices[i] = find_joint(skn->get_joint(i));
-        }
-      }
-
-      // premultiply by skin matrices
-      for (int i = 0; i != num_joints; ++i) {
-        // skin -> bind space -> skeleton -> parent -> parent -> world -> camera
+      // premultiply by skin matrices: skin -> bind space -> skeleton -> parent -> parent -> world -> camera
+      for (unsigned i = 0; i != skn->get_num_joints(); ++i) {
         int index = indices[i];
         if (index != -1) {
-          result[i] = skn->get_modelToBind() * skn->get_bindToModel(i) * boneToNode[index];
+          mat4t bindToBase;
+          multiply(bindToBase, skn->get_bindToModel(i), scratch[index]);
+          multiply(dest[i], skn->get_modelToBind(), bindToBase);
         } else {
-          result[i] = worldToCamera;
+          dest[i] = modelToBase;
         }
-        //if (first_frame) log("%d %d [%s]\n", i, index, result[i].toString());
       }
+    }
 
-      return &result[0];
+    /// Calculate the bone matrices for the skinning shader, from skin space to camera space.
+    /// The result is kept here until the next call.
+    mat4t *calc_transforms(const mat4t &worldToCamera, skin *skn) {
+      indices.resize(skn->get_num_joints());
+      match_skin(skn, indices.data());
+      boneToNode.resize(nodes.size());
+      result.resize(skn->get_num_joints());
+      calc_palette(skn, indices.data(), worldToCamera, result.data(), boneToNode.data());
+      return result.data();
+    }
+
+    /// Number of scene_nodes in the skeleton, for the scratch space of calc_palette().
+    unsigned get_num_nodes() const {
+      return nodes.size();
     }
 
     // convert an sid into an index. (should be cached!)
-    int get_bone_index(atom_t sid) {
-      for (int i = 0; i != joints.size(); ++i) {
-        if (joints[i] == sid) return i;
-      }
-      return -1;
+    int get_bone_index(atom_t sid) const {
+      return find_joint(sid);
     }
 
-    void set_bone(int index, const mat4t &value) {
-      nodeToParents[index] = value;
+    /// The scene_node of a bone. Animate the bone by moving its node.
+    scene_node *get_bone_node(int index) const {
+      return nodes[index];
     }
   };
 }}
@@ -0,0 +1,333 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Mesh skinning modifier. Skins the vertices on the CPU.
+//
+
+namespace octet { namespace scene {
+  /// Mesh modifier that skins a mesh on the CPU.
+  ///
+  /// The positions, normals, tangents and bitangents of the source mesh are moved by a palette of
+  /// bone matrices (see skeleton::calc_palette) and streamed to a vertex buffer of our own,
+  /// so the result draws with an unskinned shader and any number of bones.
+  /// render_queue uses this for skeletons with more bones than the skinning shader has room for.
+  ///
+  /// Bone indices and weights are read as the skinning shader reads them: up to four indices and
+  /// one weight fewer, the weight of the first index being one minus the others.
+  ///
+  /// skin() only works on memory, so many skinners can run at once on different threads.
+  /// upload() must be called on the thread with the GL context. eg.
+  ///
+  ///     ref<skinner> cpu = new skinner(msh);
+  ///     dynarray<int> indices(msh->get_skin()->get_num_joints());
+  ///     skel->match_skin(msh->get_skin(), indices.data());
+  ///     skel->calc_palette(msh->get_skin(), indices.data(), identity, palette, scratch);
+  ///     cpu->skin(palette, msh->get_skin()->get_num_joints(), skinner::blend_dual_quaternion);
+  ///     cpu->upload();
+  class skinner : public mesh {
+  public:
+    enum blend_mode {
+      /// add up the bone matrices, as the skinning shader does.
+      blend_linear,
+
+      /// add up the bones as dual quaternions. Twisted joints keep their volume, but scale in the bones is ignored.
+      blend_dual_quaternion,
+    };
+
+  private:
+    enum { max_influences = 4 };
+
+    // a rotation (real part) and translation (dual part), as quaternions (x, y, z, w).
+    struct dual_quat {
+      float real[4];
+      float dual[4];
+    };
+
+    // source mesh. Provides the vertices to skin.
+    ref<mesh> src;
+
+    // version of the source vertex buffer when we copied it.
+    unsigned src_version;
+
+    // a copy of the source vertices, so that we do not read from the GPU every frame.
+    dynarray<uint8_t> src_vertices;
+
+    // the skinned vertices. Attributes that we do not change are copied from the source once.
+    dynarray<uint8_t> dest_vertices;
+
+    // one per bone, for blend_dual_quaternion.
+    dynarray<dual_quat> dual_quats;
+
+    // byte offsets of the attributes in a vertex, ~0u if the mesh does not have them.
+    unsigned pos_offset;
+    unsigned normal_offset;
+    unsigned tangent_offset;
+    unsigned bitangent_offset;
+    unsigned weight_offset;
+    unsigned index_offset;
+    unsigned num_weights;
+    unsigned num_indices;
+
+    // offset of a GL_FLOAT attribute with at least min_size lanes, or ~0u.
+    unsigned get_float_offset(unsigned attr, unsigned min_size) const {
+      unsigned slot = get_slot(attr);
+      if (slot >= get_num_slots() || get_kind(slot) != GL_FLOAT || get_size(slot) < min_size) return ~0u;
+      return get_offset(slot);
+    }
+
+    // the bones that move a vertex and their weights, leaving out bones with no weight.
+    unsigned get_influences(const uint8_t *vertex, unsigned num_bones, unsigned *bones, float *weights) const {
+      const float *index = (const float*)(vertex + index_offset);
+      const float *weight = (const float*)(vertex + weight_offset);
+      float w[max_influences];
+      if (num_weights >= num_indices) {
+        for (unsigned k = 0; k != num_indices; ++k) w[k] = weight[k];
+      } else {
+        float sum = 0;
+        for (unsigned k = 1; k != num_indices; ++k) {
+          w[k] = k - 1 < num_weights ? weight[k - 1] : 0.0f;
+          sum += w[k];
+        }
+        w[0] = 1 - sum;
+      }
+
+      unsigned n = 0;
+      for (unsigned k = 0; k != num_indices; ++k) {
+        if (w[k] == 0) continue;
+        unsigned bone = (unsigned)std::max(index[k], 0.0f);
+        bones[n] = bone < num_bones ? bone : num_bones - 1;
+        weights[n++] = w[k];
+      }
+
+      // a vertex with no weights stays with its first bone.
+      if (n == 0) {
+        unsigned bone = (unsigned)std::max(index[0], 0.0f);
+        bones[n] = bone < num_bones ? bone : num_bones - 1;
+        weights[n++] = 1;
+      }
+      return n;
+    }
+
+    // dest = weights[0] * palette[bones[0]] + weights[1] * palette[bones[1]] ...
+    static void blend_matrices(mat4t &dest, const mat4t *palette, const unsigned *bones, const float *weights, unsigned n) {
+      #if OCTET_SSE2
+        float *d = (float*)&dest;
+        for (unsigned row = 0; row != 4; ++row) {
+          __m128 sum = _mm_mul_ps(_mm_loadu_ps((const float*)&palette[bones[0]] + row * 4), _mm_set1_ps(weights[0]));
+          for (unsigned k = 1; k != n; ++k) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps((const float*)&palette[bones[k]] + row * 4), _mm_set1_ps(weights[k])));
+          }
+          _mm_storeu_ps(d + row * 4, sum);
+        }
+      #else
+        dest = palette[bones[0]] * weights[0];
+        for (unsigned k = 1; k != n; ++k) {
+          dest += palette[bones[k]] * weights[k];
+        }
+      #endif
+    }
+
+    // dest = (src, w) * m. Directions (w = 0) are normalized.
+    static void transform(float *dest, const float *src, const mat4t &m, float w) {
+      #if OCTET_SSE2
+        const float *r = (const float*)&m;
+        __m128 sum = _mm_mul_ps(_mm_loadu_ps(r + 0), _mm_set1_ps(src[0]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(r + 4), _mm_set1_ps(src[1])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(r + 8), _mm_set1_ps(src[2])));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(r + 12), _mm_set1_ps(w)));
+        float result[4];
+        _mm_storeu_ps(result, sum);
+      #else
+        vec4 result = vec4(src[0], src[1], src[2], w) * m;
+      #endif
+      float scale = 1;
+      if (w == 0) {
+        float length_sq = result[0] * result[0] + result[1] * result[1] + result[2] * result[2];
+        if (length_sq > 0) scale = 1.0f / sqrtf(length_sq);
+      }
+      dest[0] = result[0] * scale;
+      dest[1] = result[1] * scale;
+      dest[2] = result[2] * scale;
+    }
+
+    // the rotation and translation of a bone matrix as a dual quaternion. The rows are normalized to drop any scale.
+    static void make_dual_quat(dual_quat &dest, const mat4t &m) {
+      // with row vectors, the rows of m are the columns of the usual rotation matrix.
+      vec3 ax = m.x().xyz().normalize(), ay = m.y().xyz().normalize(), az = m.z().xyz().normalize();
+      float m00 = ax[0], m01 = ay[0], m02 = az[0];
+      float m10 = ax[1], m11 = ay[1], m12 = az[1];
+      float m20 = ax[2], m21 = ay[2], m22 = az[2];
+
+      float *q = dest.real;
+      float trace = m00 + m11 + m22;
+      if (trace > 0) {
+        float s = sqrtf(trace + 1) * 2;
+        q[0] = (m21 - m12) / s; q[1] = (m02 - m20) / s; q[2] = (m10 - m01) / s; q[3] = 0.25f * s;
+      } else if (m00 > m11 && m00 > m22) {
+        float s = sqrtf(1 + m00 - m11 - m22) * 2;
+        q[0] = 0.25f * s; q[1] = (m01 + m10) / s; q[2] = (m02 + m20) / s; q[3] = (m21 - m12) / s;
+      } else if (m11 > m22) {
+        float s = sqrtf(1 + m11 - m00 - m22) * 2;
+        q[0] = (m01 + m10) / s; q[1] = 0.25f * s; q[2] = (m12 + m21) / s; q[3] = (m02 - m20) / s;
+      } else {
+        float s = sqrtf(1 + m22 - m00 - m11) * 2;
+        q[0] = (m02 + m20) / s; q[1] = (m12 + m21) / s; q[2] = 0.25f * s; q[3] = (m10 - m01) / s;
+      }
+
+      // dual = 0.5 * (t, 0) * real
+      vec3 t = m.w().xyz();
+      vec3 r(q[0], q[1], q[2]);
+      vec3 d = (t * q[3] + cross(t, r)) * 0.5f;
+      dest.dual[0] = d[0];
+      dest.dual[1] = d[1];
+      dest.dual[2] = d[2];
+      dest.dual[3] = -0.5f * dot(t, r);
+    }
+
+    // skin one vertex with blended dual quaternions.
+    void skin_dual_quaternion(uint8_t *dest, const uint8_t *src, const unsigned *bones, const float *weights, unsigned n) const {
+      // add up the bones on the same side of the hypersphere as the first.
+      const dual_quat &first = dual_quats[bones[0]];
+      float real[4] = { 0, 0, 0, 0 }, dual[4] = { 0, 0, 0, 0 };
+      for (unsigned k = 0; k != n; ++k) {
+        const dual_quat &dq = dual_quats[bones[k]];
+        float side = first.real[0] * dq.real[0] + first.real[1] * dq.real[1] + first.real[2] * dq.real[2] + first.real[3] * dq.real[3];
+        float w = side < 0 ? -weights[k] : weights[k];
+        for (unsigned i = 0; i != 4; ++i) {
+          real[i] += dq.real[i] * w;
+          dual[i] += dq.dual[i] * w;
+        }
+      }
+      float length_sq = real[0] * real[0] + real[1] * real[1] + real[2] * real[2] + real[3] * real[3];
+      float scale = length_sq > 0 ? 1.0f / sqrtf(length_sq) : 0.0f;
+      vec3 r = vec3(real[0], real[1], real[2]) * scale, d = vec3(dual[0], dual[1], dual[2]) * scale;
+      float rw = real[3] * scale, dw = dual[3] * scale;
+
+      // p' = rotate(p) + 2 * (rw * d - dw * r + r x d)
+      vec3 translation = (d * rw - r * dw + cross(r, d)) * 2.0f;
+      vec3p &pos = *(vec3p*)(dest + pos_offset);
+      vec3 p = *(const vec3p*)(src + pos_offset);
+      pos = p + cross(r, cross(r, p) + p * rw) * 2.0f + translation;
+
+      unsigned dir_offsets[] = { normal_offset, tangent_offset, bitangent_offset };
+      for (unsigned i = 0; i != 3; ++i) {
+        if (dir_offsets[i] == ~0u) continue;
+        vec3 v = *(const vec3p*)(src + dir_offsets[i]);
+        *(vec3p*)(dest + dir_offsets[i]) = v + cross(r, cross(r, v) + v * rw) * 2.0f;
+      }
+    }
+
+  public:
+    RESOURCE_META(skinner)
+
+    /// Skin a copy of src, which needs a skin and blendweight and blendindices attributes.
+    skinner(mesh *src=0) {
+      this->src = src;
+      src_version = 0;
+      pos_offset = normal_offset = tangent_offset = bitangent_offset = weight_offset = index_offset = ~0u;
+      num_weights = num_indices = 0;
+      update();
+    }
+
+    /// standard update function, called if input changes.
+    /// Copies the source vertices; the copy is drawn unskinned until the first skin().
+    void update() {
+      if (!src) return;
+
+      *(mesh*)this = *(mesh*)src;
+      // we draw unskinned.
+      set_skin(0);
+
+      pos_offset = get_float_offset(attribute_pos, 3);
+      normal_offset = get_float_offset(attribute_normal, 3);
+      tangent_offset = get_float_offset(attribute_tangent, 3);
+      bitangent_offset = get_float_offset(attribute_bitangent, 3);
+      weight_offset = get_float_offset(attribute_blendweight, 1);
+      index_offset = get_float_offset(attribute_blendindices, 1);
+      num_weights = weight_offset == ~0u ? 0 : std::min(get_size(get_slot(attribute_blendweight)), (unsigned)max_influences);
+      num_indices = index_offset == ~0u ? 0 : std::min(get_size(get_slot(attribute_blendindices)), (unsigned)max_influences);
+
+      gl_resource *src_buffer = src->get_vertices();
+      size_t vsize = src_buffer ? src_buffer->get_size() : 0;
+      src_version = src_buffer ? src_buffer->get_version() : 0;
+      src_vertices.resize((unsigned)vsize);
+      if (vsize) {
+        gl_resource::rolock vtx_lock(src_buffer);
+        memcpy(src_vertices.data(), vtx_lock.u8(), vsize);
+      }
+      dest_vertices = src_vertices;
+
+      gl_resource *vertices = new gl_resource();
+      vertices->stream(GL_ARRAY_BUFFER, dest_vertices.data(), vsize);
+      set_vertices(vertices);
+    }
+
+    void visit(visitor &v) {
+      mesh::visit(v);
+      v.visit(src, atom_src);
+    }
+
+    /// The mesh we skin.
+    mesh *get_src() const {
+      return src;
+    }
+
+    /// true if the source vertices have changed since we copied them. Call update() to copy them again.
+    bool is_stale() const {
+      return src && src->get_vertices() && src->get_vertices()->get_version() != src_version;
+    }
+
+    /// true if the mesh has the attributes we need: float positions, blend weights and blend indices.
+    bool can_skin() const {
+      return pos_offset != ~0u && weight_offset != ~0u && index_offset != ~0u && get_stride() != 0;
+    }
+
+    /// Move the vertices by a palette of num_bones matrices from skin space to model space (see skeleton::calc_palette).
+    /// Safe to call on any thread, as long as no other thread uses this skinner.
+    void skin(const mat4t *palette, unsigned num_bones, blend_mode mode=blend_linear) {
+      if (!can_skin() || num_bones == 0) return;
+
+      if (mode == blend_dual_quaternion) {
+        dual_quats.resize(num_bones);
+        for (unsigned i = 0; i != num_bones; ++i) {
+          make_dual_quat(dual_quats[i], palette[i]);
+        }
+      }
+
+      unsigned stride = get_stride();
+      unsigned num_vertices = src_vertices.size() / stride;
+      for (unsigned v = 0; v != num_vertices; ++v) {
+        const uint8_t *sv = &src_vertices[v * stride];
+        uint8_t *dv = &dest_vertices[v * stride];
+        unsigned bones[max_influences];
+        float weights[max_influences];
+        unsigned n = get_influences(sv, num_bones, bones, weights);
+
+        if (mode == blend_dual_quaternion) {
+          skin_dual_quaternion(dv, sv, bones, weights, n);
+          continue;
+        }
+
+        // one bone is common enough to skip the blend.
+        mat4t blended;
+        const mat4t *m = &palette[bones[0]];
+        if (n != 1 || weights[0] != 1) {
+          blend_matrices(blended, palette, bones, weights, n);
+          m = &blended;
+        }
+        transform((float*)(dv + pos_offset), (const float*)(sv + pos_offset), *m, 1);
+        if (normal_offset != ~0u) transform((float*)(dv + normal_offset), (const float*)(sv + normal_offset), *m, 0);
+        if (tangent_offset != ~0u) transform((float*)(dv + tangent_offset), (const float*)(sv + tangent_offset), *m, 0);
+        if (bitangent_offset != ~0u) transform((float*)(dv + bitangent_offset), (const float*)(sv + bitangent_offset), *m, 0);
+      }
+    }
+
+    /// Send the vertices from the last skin() to the vertex buffer. Call on the GL thread.
+    void upload() {
+      get_vertices()->stream(GL_ARRAY_BUFFER, dest_vertices.data(), dest_vertices.size());
+    }
+  };
+}}
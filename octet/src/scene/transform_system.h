@@ -0,0 +1,194 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// flattened scene_node heirachy for updating world matrices in bulk
+//
+
+namespace octet { namespace scene {
+  /// Flat copy of a scene_node heirachy for updating many world matrices quickly.
+  ///
+  /// Nodes are stored breadth first, so each depth level is one range of the arrays
+  /// and every parent comes before its children. Local and world matrices are kept in
+  /// arrays of their own, and each level is one batch of matrix multiplies shared
+  /// between the threads of a thread_pool.
+  ///
+  /// Example
+  ///
+  ///     transform_system transforms;
+  ///     transforms.build(crowd_root);
+  ///
+  ///     // every frame: animation writes the local matrices straight to the array.
+  ///     for (unsigned i = 0; i != transforms.size(); ++i) {
+  ///       transforms.access_local(i) = ...;
+  ///     }
+  ///     transforms.update(false);
+  ///
+  /// Indices change when build() is called. Call build() again when is_stale() is true.
+  class transform_system {
+    enum { grain = 1024 };
+
+    // breadth first order
+    dynarray<scene_node*> nodes;
+    dynarray<int> parents;
+    dynarray<mat4t> locals;
+    dynarray<mat4t> worlds;
+
+    // level d is nodes [level_starts[d], level_starts[d+1])
+    dynarray<unsigned> level_starts;
+
+    hash_map<scene_node*, unsigned> node_indices;
+
+    // not a ref: the root usually owns the transform_system.
+    scene_node *root;
+    unsigned version;
+    platform::thread_pool *pool;
+
+    // update nodes [begin, end), whose parents are all up to date.
+    void update_range(unsigned begin, unsigned end, const mat4t &base, bool from_nodes, bool to_nodes) {
+      for (unsigned i = begin; i != end; ++i) {
+        scene_node *node = nodes[i];
+        if (from_nodes) {
+          if (!node->get_world_dirty()) {
+            // clean nodes have clean parents, so the cached matrix is right.
+            worlds[i] = node->calcModelToWorld();
+            continue;
+          }
+          locals[i] = node->get_nodeToParent();
+        }
+        int parent = parents[i];
+        multiply(worlds[i], locals[i], parent >= 0 ? worlds[parent] : base);
+        if (to_nodes) {
+          node->set_nodeToWorld(worlds[i]);
+        }
+      }
+    }
+
+  public:
+    /// Make an empty system.
+    transform_system() {
+      root = 0;
+      version = 0;
+      pool = 0;
+    }
+
+    /// Flatten the heirachy under root, including root itself.
+    void build(scene_node *new_root) {
+      nodes.resize(0);
+      parents.resize(0);
+      level_starts.resize(0);
+      node_indices.clear();
+      root = new_root;
+      version = root ? root->get_hierarchy_version() : 0;
+      if (!root) return;
+
+      nodes.push_back(root);
+      parents.push_back(-1);
+      level_starts.push_back(0);
+
+      // breadth first: the nodes of each level follow the nodes of the level above.
+      for (unsigned level_begin = 0; level_begin != nodes.size(); ) {
+        unsigned level_end = nodes.size();
+        for (unsigned i = level_begin; i != level_end; ++i) {
+          scene_node *node = nodes[i];
+          for (int j = 0; j != node->get_num_children(); ++j) {
+            nodes.push_back(node->get_child(j));
+            parents.push_back((int)i);
+          }
+        }
+        level_starts.push_back(level_end);
+        level_begin = level_end;
+      }
+
+      locals.resize(nodes.size());
+      worlds.resize(nodes.size());
+      node_indices.reserve(nodes.size());
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        locals[i] = nodes[i]->get_nodeToParent();
+        node_indices[nodes[i]] = i;
+      }
+    }
+
+    /// true if nodes have been added to the tree since build(), or nothing has been built.
+    bool is_stale() const {
+      return !root || version != root->get_hierarchy_version();
+    }
+
+    /// Use a specific pool. The default is thread_pool::get_default(), started the first time
+    /// a level is bigger than one grain.
+    void set_thread_pool(platform::thread_pool *value) {
+      pool = value;
+    }
+
+    /// Recalculate the world matrices, one level at a time.
+    ///
+    /// If from_nodes is true, the local matrices are read from the nodes and nodes
+    /// that have not moved are skipped. Otherwise the local matrices in this system are used.
+    /// If to_nodes is true, the world matrices are stored in the nodes for calcModelToWorld().
+    void update(bool from_nodes = true, bool to_nodes = true) {
+      if (!root) return;
+
+      mat4t base;
+      base.loadIdentity();
+      if (root->get_parent()) {
+        base = root->get_parent()->calcModelToWorld();
+      }
+
+      for (unsigned level = 0; level + 1 < level_starts.size(); ++level) {
+        unsigned begin = level_starts[level];
+        unsigned end = level_starts[level + 1];
+        if (end - begin <= grain) {
+          update_range(begin, end, base, from_nodes, to_nodes);
+        } else {
+          platform::thread_pool &p = pool ? *pool : platform::thread_pool::get_default();
+          p.parallel_for(end - begin, grain, [&](unsigned b, unsigned e) {
+            update_range(begin + b, begin + e, base, from_nodes, to_nodes);
+          });
+        }
+      }
+    }
+
+    /// number of nodes
+    unsigned size() const {
+      return nodes.size();
+    }
+
+    /// number of depth levels
+    unsigned get_num_levels() const {
+      return level_starts.size() ? level_starts.size() - 1 : 0;
+    }
+
+    /// index of a node, or -1 if it was not in the heirachy when built.
+    int get_index(scene_node *node) const {
+      int index = node_indices.get_index(node);
+      return index < 0 ? -1 : (int)node_indices.get_value(index);
+    }
+
+    /// get the node at an index.
+    scene_node *get_node(unsigned index) const {
+      return nodes[index];
+    }
+
+    /// get the parent index of a node, -1 for the root.
+    int get_parent(unsigned index) const {
+      return parents[index];
+    }
+
+    /// local matrix for writing. Used with update(false).
+    mat4t &access_local(unsigned index) {
+      return locals[index];
+    }
+
+    /// local matrix as of the last build() or update(true).
+    const mat4t &get_local(unsigned index) const {
+      return locals[index];
+    }
+
+    /// world matrix as of the last update().
+    const mat4t &get_world(unsigned index) const {
+      return worlds[index];
+    }
+  };
+} }
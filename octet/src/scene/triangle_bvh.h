@@ -0,0 +1,423 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// bounding volume heirachy of triangles for ray casting meshes
+//
+
+namespace octet { namespace scene {
+  /// Static tree of triangles for fast ray casts against big meshes.
+  ///
+  /// The tree is split with the surface area heuristic (binned) and each leaf holds
+  /// groups of four triangles laid out so that one ray is tested against four
+  /// triangles at a time (Moller-Trumbore, SSE2 where available).
+  ///
+  /// Example
+  ///
+  ///     triangle_bvh bvh;
+  ///     bvh.build(corners, vertex_indices, num_triangles);
+  ///     triangle_bvh::hit result;
+  ///     if (bvh.ray_cast(result, origin, direction, 1.0f)) {
+  ///       vec3 pos = origin + direction * result.t;
+  ///     }
+  ///
+  /// mesh::ray_cast builds one of these for each mesh the first time it is called.
+  class triangle_bvh {
+  public:
+    /// nearest hit of a ray: origin + direction * t = v0 * (1 - u - v) + v1 * u + v2 * v
+    struct hit {
+      unsigned triangle;
+      float t;
+      float u;
+      float v;
+    };
+
+  private:
+    enum { packet_size = 4, num_bins = 16, max_leaf_triangles = 16, no_triangle = 0xffffffff };
+
+    struct node_t {
+      float lo[3];
+      // inner nodes: index of the second child (the first child is the next node). leaves: first packet.
+      uint32_t offset;
+      float hi[3];
+      // number of packets, 0 for inner nodes.
+      uint32_t count;
+    };
+
+    // four triangles as a corner and two edges, one lane each.
+    struct packet_t {
+      float v0[3][packet_size];
+      float e1[3][packet_size];
+      float e2[3][packet_size];
+      uint32_t triangle[packet_size];
+    };
+
+    struct bin_t {
+      vec3 lo;
+      vec3 hi;
+      unsigned count;
+    };
+
+    // a triangle's box during the build. These are partitioned in place, so each node's
+    // triangles are together in memory.
+    struct build_ref {
+      float lo[3];
+      float hi[3];
+      uint32_t triangle;
+
+      // twice the centre of the box
+      float centre2(unsigned axis) const { return lo[axis] + hi[axis]; }
+    };
+
+    dynarray<node_t> nodes;
+    dynarray<packet_t> packets;
+
+    // three vertex indices for each triangle.
+    dynarray<uint32_t> vertex_indices;
+
+    // build state
+    const vec3p *build_corners;
+    dynarray<build_ref> build_refs;
+
+    // half the surface area of a box, which is proportional to the chance of a ray hitting it.
+    static float half_area(const vec3 &lo, const vec3 &hi) {
+      vec3 d = max(hi - lo, vec3(0, 0, 0));
+      return d.x() * d.y() + d.y() * d.z() + d.z() * d.x();
+    }
+
+    static unsigned num_packets(unsigned num_triangles) {
+      return (num_triangles + packet_size - 1) / packet_size;
+    }
+
+    void make_leaf(unsigned node, unsigned begin, unsigned end) {
+      nodes[node].offset = packets.size();
+      nodes[node].count = num_packets(end - begin);
+      for (unsigned i = begin; i < end; i += packet_size) {
+        packet_t &p = packets.emplace_back();
+        for (unsigned lane = 0; lane != packet_size; ++lane) {
+          vec3 v0(0, 0, 0), e1(0, 0, 0), e2(0, 0, 0);
+          uint32_t triangle = no_triangle;
+          if (i + lane < end) {
+            // padding lanes are degenerate triangles that are never hit.
+            triangle = build_refs[i + lane].triangle;
+            v0 = vec3(build_corners[triangle * 3 + 0]);
+            e1 = vec3(build_corners[triangle * 3 + 1]) - v0;
+            e2 = vec3(build_corners[triangle * 3 + 2]) - v0;
+          }
+          for (unsigned axis = 0; axis != 3; ++axis) {
+            p.v0[axis][lane] = v0[axis];
+            p.e1[axis][lane] = e1[axis];
+            p.e2[axis][lane] = e2[axis];
+          }
+          p.triangle[lane] = triangle;
+        }
+      }
+    }
+
+    // build the subtree for build_refs[begin, end) at nodes[node].
+    void build_node(unsigned node, unsigned begin, unsigned end) {
+      float lo[3], hi[3], centre_lo[3], centre_hi[3];
+      for (unsigned axis = 0; axis != 3; ++axis) {
+        lo[axis] = centre_lo[axis] = 1e37f;
+        hi[axis] = centre_hi[axis] = -1e37f;
+      }
+      for (unsigned i = begin; i != end; ++i) {
+        const build_ref &r = build_refs[i];
+        for (unsigned axis = 0; axis != 3; ++axis) {
+          float c = r.centre2(axis);
+          lo[axis] = r.lo[axis] < lo[axis] ? r.lo[axis] : lo[axis];
+          hi[axis] = r.hi[axis] > hi[axis] ? r.hi[axis] : hi[axis];
+          centre_lo[axis] = c < centre_lo[axis] ? c : centre_lo[axis];
+          centre_hi[axis] = c > centre_hi[axis] ? c : centre_hi[axis];
+        }
+      }
+      for (unsigned axis = 0; axis != 3; ++axis) {
+        nodes[node].lo[axis] = lo[axis];
+        nodes[node].hi[axis] = hi[axis];
+      }
+
+      unsigned count = end - begin;
+      vec3 extent = vec3(centre_hi[0], centre_hi[1], centre_hi[2]) - vec3(centre_lo[0], centre_lo[1], centre_lo[2]);
+      unsigned axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+      if (count <= packet_size || extent[axis] <= 0) {
+        make_leaf(node, begin, end);
+        return;
+      }
+
+      // sort the centres into bins along the longest axis and find the cheapest split between bins.
+      bin_t bins[num_bins];
+      for (unsigned b = 0; b != num_bins; ++b) {
+        bins[b].lo = vec3(1e37f);
+        bins[b].hi = vec3(-1e37f);
+        bins[b].count = 0;
+      }
+      float scale = num_bins / extent[axis] * 0.9999f;
+      float offset = centre_lo[axis];
+      for (unsigned i = begin; i != end; ++i) {
+        const build_ref &r = build_refs[i];
+        bin_t &bin = bins[(unsigned)((r.centre2(axis) - offset) * scale)];
+        bin.lo = min(bin.lo, vec3(r.lo[0], r.lo[1], r.lo[2]));
+        bin.hi = max(bin.hi, vec3(r.hi[0], r.hi[1], r.hi[2]));
+        bin.count++;
+      }
+
+      // right_cost[b] is the cost of bins [b, num_bins) as one child. Empty bins have inside out boxes.
+      float right_cost[num_bins];
+      vec3 right_lo(1e37f), right_hi(-1e37f);
+      unsigned right_count = 0;
+      for (unsigned b = num_bins - 1; b != 0; --b) {
+        right_lo = min(right_lo, bins[b].lo);
+        right_hi = max(right_hi, bins[b].hi);
+        right_count += bins[b].count;
+        right_cost[b] = half_area(right_lo, right_hi) * num_packets(right_count);
+      }
+
+      unsigned best_split = 0;
+      float best_cost = 1e37f;
+      vec3 left_lo(1e37f), left_hi(-1e37f);
+      unsigned left_count = 0;
+      for (unsigned b = 1; b != num_bins; ++b) {
+        left_lo = min(left_lo, bins[b - 1].lo);
+        left_hi = max(left_hi, bins[b - 1].hi);
+        left_count += bins[b - 1].count;
+        float cost = half_area(left_lo, left_hi) * num_packets(left_count) + right_cost[b];
+        if (left_count != 0 && left_count != count && cost < best_cost) {
+          best_cost = cost;
+          best_split = b;
+        }
+      }
+
+      // a traversal step costs about as much as one packet test.
+      vec3 box_lo(lo[0], lo[1], lo[2]), box_hi(hi[0], hi[1], hi[2]);
+      float leaf_cost = half_area(box_lo, box_hi) * num_packets(count);
+      float split_cost = half_area(box_lo, box_hi) + best_cost;
+      if (count <= max_leaf_triangles && (best_split == 0 || leaf_cost <= split_cost)) {
+        make_leaf(node, begin, end);
+        return;
+      }
+
+      unsigned mid = begin;
+      if (best_split != 0) {
+        // partition the triangles by bin.
+        unsigned i = begin, j = end;
+        while (i != j) {
+          unsigned b = (unsigned)((build_refs[i].centre2(axis) - offset) * scale);
+          if (b < best_split) {
+            ++i;
+          } else {
+            std::swap(build_refs[i], build_refs[--j]);
+          }
+        }
+        mid = i;
+      } else {
+        // all the centres fell in one bin: split in the middle of the list.
+        mid = begin + count / 2;
+      }
+
+      unsigned left = nodes.size();
+      nodes.resize(left + 1);
+      build_node(left, begin, mid);
+      unsigned right = nodes.size();
+      nodes.resize(right + 1);
+      nodes[node].offset = right;
+      nodes[node].count = 0;
+      build_node(right, mid, end);
+    }
+
+    // one ray against four triangles. updates result and returns true for a nearer hit.
+    static bool intersect(hit &result, const packet_t &p, const vec3 &org, const vec3 &dir) {
+      bool found = false;
+      #if OCTET_SSE2
+        __m128 ox = _mm_set1_ps(org.x()), oy = _mm_set1_ps(org.y()), oz = _mm_set1_ps(org.z());
+        __m128 dx = _mm_set1_ps(dir.x()), dy = _mm_set1_ps(dir.y()), dz = _mm_set1_ps(dir.z());
+        __m128 e1x = _mm_loadu_ps(p.e1[0]), e1y = _mm_loadu_ps(p.e1[1]), e1z = _mm_loadu_ps(p.e1[2]);
+        __m128 e2x = _mm_loadu_ps(p.e2[0]), e2y = _mm_loadu_ps(p.e2[1]), e2z = _mm_loadu_ps(p.e2[2]);
+
+        // pvec = dir x e2, det = e1 . pvec
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+        // tvec = org - v0, u = tvec . pvec / det
+        __m128 tx = _mm_sub_ps(ox, _mm_loadu_ps(p.v0[0]));
+        __m128 ty = _mm_sub_ps(oy, _mm_loadu_ps(p.v0[1]));
+        __m128 tz = _mm_sub_ps(oz, _mm_loadu_ps(p.v0[2]));
+        __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+        // qvec = tvec x e1, v = dir . qvec / det, t = e2 . qvec / det
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+        // both sides of the triangle count. comparisons with NaN (det == 0) fail.
+        __m128 zero = _mm_setzero_ps();
+        __m128 valid = _mm_cmpneq_ps(det, zero);
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+        valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+        valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(result.t)));
+        unsigned mask = (unsigned)_mm_movemask_ps(valid);
+        if (mask) {
+          float ts[packet_size], us[packet_size], vs[packet_size];
+          _mm_storeu_ps(ts, t);
+          _mm_storeu_ps(us, u);
+          _mm_storeu_ps(vs, v);
+          for (unsigned lane = 0; lane != packet_size; ++lane) {
+            if ((mask >> lane) & 1 && ts[lane] < result.t) {
+              result.t = ts[lane];
+              result.u = us[lane];
+              result.v = vs[lane];
+              result.triangle = p.triangle[lane];
+              found = true;
+            }
+          }
+        }
+      #else
+        for (unsigned lane = 0; lane != packet_size; ++lane) {
+          vec3 e1(p.e1[0][lane], p.e1[1][lane], p.e1[2][lane]);
+          vec3 e2(p.e2[0][lane], p.e2[1][lane], p.e2[2][lane]);
+          vec3 pvec = cross(dir, e2);
+          float det = dot(e1, pvec);
+          if (det == 0) continue;
+          float inv_det = 1.0f / det;
+          vec3 tvec = org - vec3(p.v0[0][lane], p.v0[1][lane], p.v0[2][lane]);
+          float u = dot(tvec, pvec) * inv_det;
+          vec3 qvec = cross(tvec, e1);
+          float v = dot(dir, qvec) * inv_det;
+          float t = dot(e2, qvec) * inv_det;
+          if (u >= 0 && v >= 0 && u + v <= 1 && t >= 0 && t < result.t) {
+            result.t = t;
+            result.u = u;
+            result.v = v;
+            result.triangle = p.triangle[lane];
+            found = true;
+          }
+        }
+      #endif
+      return found;
+    }
+
+    // entry distance of a ray into a node's box, or a number greater than max_t for a miss.
+    static float entry(const node_t &n, const vec3 &org, const vec3 &inv_dir, float max_t) {
+      float t_in = 0, t_out = max_t;
+      for (unsigned axis = 0; axis != 3; ++axis) {
+        float t0 = (n.lo[axis] - org[axis]) * inv_dir[axis];
+        float t1 = (n.hi[axis] - org[axis]) * inv_dir[axis];
+        if (t0 > t1) std::swap(t0, t1);
+        t_in = t0 > t_in ? t0 : t_in;
+        t_out = t1 < t_out ? t1 : t_out;
+      }
+      return t_in <= t_out ? t_in : max_t * 2 + 1;
+    }
+
+  public:
+    triangle_bvh() {
+      build_corners = 0;
+    }
+
+    /// Build the tree from three corners and three vertex indices for each triangle.
+    void build(const vec3p *corners, const uint32_t *indices, unsigned num_triangles) {
+      nodes.reset();
+      packets.reset();
+      vertex_indices.resize(num_triangles * 3);
+      if (num_triangles) {
+        memcpy(vertex_indices.data(), indices, num_triangles * 3 * sizeof(uint32_t));
+      }
+      if (num_triangles == 0) return;
+
+      build_corners = corners;
+      build_refs.resize(num_triangles);
+      for (unsigned i = 0; i != num_triangles; ++i) {
+        vec3 a(corners[i * 3 + 0]), b(corners[i * 3 + 1]), c(corners[i * 3 + 2]);
+        vec3 tri_lo = min(a, min(b, c)), tri_hi = max(a, max(b, c));
+        build_ref &r = build_refs[i];
+        for (unsigned axis = 0; axis != 3; ++axis) {
+          r.lo[axis] = tri_lo[axis];
+          r.hi[axis] = tri_hi[axis];
+        }
+        r.triangle = i;
+      }
+
+      nodes.reserve(num_triangles / 2 + 1);
+      packets.reserve(num_packets(num_triangles) * 2);
+      nodes.resize(1);
+      build_node(0, 0, num_triangles);
+
+      build_corners = 0;
+      build_refs.reset();
+    }
+
+    /// Free the tree.
+    void reset() {
+      nodes.reset();
+      packets.reset();
+      vertex_indices.reset();
+    }
+
+    /// Find the nearest triangle hit by origin + direction * t for 0 <= t < max_t.
+    /// Both sides of each triangle are hit.
+    bool ray_cast(hit &result, const vec3 &origin, const vec3 &direction, float max_t) const {
+      result.triangle = no_triangle;
+      result.t = max_t;
+      result.u = result.v = 0;
+      if (nodes.size() == 0) return false;
+
+      // avoid 0 * inf when the ray lies in the plane of a face.
+      vec3 inv_dir;
+      for (unsigned axis = 0; axis != 3; ++axis) {
+        float d = direction[axis];
+        inv_dir[axis] = fabsf(d) > 1e-30f ? 1.0f / d : (d < 0 ? -1e30f : 1e30f);
+      }
+
+      struct entry_t { unsigned node; float t; };
+      small_dynarray<entry_t, 64> stack;
+      entry_t first = { 0, entry(nodes[0], origin, inv_dir, result.t) };
+      if (first.t <= result.t) stack.push_back(first);
+
+      bool found = false;
+      while (!stack.empty()) {
+        entry_t e = stack.back();
+        stack.pop_back();
+        if (e.t > result.t) continue;
+
+        const node_t &n = nodes[e.node];
+        if (n.count) {
+          for (unsigned i = 0; i != n.count; ++i) {
+            found |= intersect(result, packets[n.offset + i], origin, direction);
+          }
+          continue;
+        }
+
+        // visit the nearer child first.
+        entry_t a = { e.node + 1, entry(nodes[e.node + 1], origin, inv_dir, result.t) };
+        entry_t b = { n.offset, entry(nodes[n.offset], origin, inv_dir, result.t) };
+        if (a.t > b.t) std::swap(a, b);
+        if (b.t <= result.t) stack.push_back(b);
+        if (a.t <= result.t) stack.push_back(a);
+      }
+      return found;
+    }
+
+    /// the three vertex indices of a triangle.
+    const uint32_t *get_vertex_indices(unsigned triangle) const {
+      return &vertex_indices[triangle * 3];
+    }
+
+    /// number of triangles in the tree.
+    unsigned get_num_triangles() const {
+      return vertex_indices.size() / 3;
+    }
+
+    /// number of nodes in the tree. 0 if it has not been built.
+    unsigned get_num_nodes() const {
+      return nodes.size();
+    }
+  };
+} }
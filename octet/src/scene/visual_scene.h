@@ -10,22 +10,105 @@
 namespace octet { namespace scene {
   /// Visual scene; contains instances of meshes, cameras and lights required to draw a scene.
   class visual_scene : public scene_node {
+  public:
+    /// counts from the frustum culling pass of the last render.
+    struct cull_stats {
+      /// enabled mesh instances
+      unsigned num_tested;
+
+      /// instances that may be on screen and were drawn
+      unsigned num_visible;
+
+      /// instances outside the frustum
+      unsigned num_culled;
+
+      /// instances in the frustum but hidden behind occluders (included in num_culled)
+      unsigned num_occluded;
+    };
+
+  private:
     ///////////////////////////////////////////
     //
     // rendering information
     //
 
     /// each of these is a set of (scene_node, mesh, material)
-    dynarray<ref<mesh_instance> > mesh_instances;
+    slot_map<ref<mesh_instance> > mesh_instances;
 
     /// animations playing at the moment
-    dynarray<ref<animation_instance> > animation_instances;
+    slot_map<ref<animation_instance> > animation_instances;
 
     /// cameras available
-    dynarray<ref<camera_instance> > camera_instances;
+    slot_map<ref<camera_instance> > camera_instances;
 
     /// lights available
-    dynarray<ref<light_instance> > light_instances;
+    slot_map<ref<light_instance> > light_instances;
+
+    /// handles of all the instances above, so that we can delete them by pointer.
+    hash_map<void*, slot_map_handle> instance_handles;
+
+    /// a mesh instance for each node, used by get_first_mesh_instance()
+    hash_map<scene_node*, slot_map_handle> node_mesh_instances;
+
+    /// flattened copy of the nodes below the scene for updating world matrices.
+    transform_system transforms;
+
+    /// samples and blends the animation instances.
+    pose_system poses;
+
+    /// a leaf of the bvh; the node, mesh and world_version it was last fitted to.
+    struct bvh_item {
+      mesh_instance *mi;
+      scene_node *node;
+      mesh *msh;
+      unsigned world_version;
+    };
+
+    /// world space boxes of the mesh instances for cast_ray and the query_* functions.
+    aabb_tree<bvh_item> bvh;
+    hash_map<mesh_instance*, int> bvh_proxies;
+
+    /// the root of a heirachy with nodes in the bvh, and its versions when the bvh was last refitted.
+    struct bvh_root {
+      ref<scene_node> node;
+      unsigned hierarchy_version;
+      unsigned transform_version;
+    };
+
+    /// the trees that the bvh's nodes are in, so that moving a node in another scene does not refit this one.
+    dynarray<bvh_root> bvh_roots;
+    hash_map<scene_node*, unsigned> bvh_root_indices;
+
+    /// set this to false to draw everything
+    bool frustum_culling;
+
+    /// world space boxes of the enabled mesh instances: six runs of floats (centre xyz, half extent xyz).
+    dynarray<float> cull_boxes;
+    dynarray<unsigned> cull_indices;
+    dynarray<uint8_t> cull_results;
+
+    /// 1 if a mesh instance is enabled and may be visible this frame.
+    dynarray<uint8_t> cull_visible;
+    cull_stats last_cull_stats;
+
+    /// depth of the occluders, for hiding instances behind them. Off by default.
+    occlusion_buffer occlusion;
+    bool occlusion_culling;
+
+    /// the draws of this frame, sorted to save state changes.
+    render_queue queue;
+
+    /// the camera and lights shared by all the materials.
+    frame_uniforms frame;
+
+    /// point and spot lights sorted into view space clusters, for clustered materials.
+    light_clusters clusters;
+    vec4 cluster_params[light_clusters::num_shader_params];
+    bool clustered_lighting;
+
+    /// size of the viewport from begin_render()
+    int viewport_width;
+    int viewport_height;
 
     /// set this to draw bounding boxes
     bool render_aabbs;
@@ -57,6 +140,106 @@ namespace octet { namespace scene {
     #else
       typedef void collison_shape_t;
     #endif
+
+    // does nothing if inst is NULL or already in the scene.
+    template <class type> type *add_instance(slot_map<ref<type> > &instances, type *inst) {
+      if (inst && !instance_handles.contains(inst)) {
+        instance_handles[inst] = instances.insert(inst);
+      }
+      return inst;
+    }
+
+    template <class type> bool delete_instance(slot_map<ref<type> > &instances, type *inst) {
+      int index = instance_handles.get_index(inst);
+      if (index < 0) return false;
+      slot_map_handle handle = instance_handles.get_value(index);
+      instance_handles.erase(inst);
+      return instances.erase(handle);
+    }
+
+    // the visitor reads and writes instance lists as dynarrays.
+    template <class type> void visit_instances(visitor &v, slot_map<ref<type> > &instances, atom_t sid) {
+      dynarray<ref<type> > tmp;
+      if (!v.is_reader()) {
+        tmp.reserve(instances.size());
+        for (unsigned i = 0; i != instances.size(); ++i) {
+          tmp.push_back(instances[i]);
+        }
+      }
+      v.visit(tmp, sid);
+      if (v.is_reader()) {
+        instances.reset();
+        for (unsigned i = 0; i != tmp.size(); ++i) {
+          add_instance(instances, (type*)tmp[i]);
+        }
+      }
+    }
+
+    /// the world space box of a mesh instance for the bvh.
+    static bool get_bvh_item(bvh_item &item, aabb &bb, mesh_instance *mi) {
+      item.mi = mi;
+      item.node = mi->get_node();
+      item.msh = mi->get_mesh();
+      if (!item.node || !item.msh) return false;
+      bb = item.msh->get_aabb().get_transform(item.node->calcModelToWorld());
+      item.world_version = item.node->get_world_version();
+      return true;
+    }
+
+    void bvh_insert(mesh_instance *mi) {
+      bvh_item item;
+      aabb bb;
+      if (mi && get_bvh_item(item, bb, mi)) {
+        bvh_proxies[mi] = bvh.insert(bb, item);
+        add_bvh_root(item.node);
+      }
+    }
+
+    // remember the current versions of the tree that a bvh node is in.
+    void add_bvh_root(scene_node *node) {
+      scene_node *root = node->get_root();
+      if (bvh_root_indices.get_index(root) >= 0) return;
+      bvh_root_indices[root] = bvh_roots.size();
+      bvh_root br = { root, root->get_hierarchy_version(), root->get_transform_version() };
+      bvh_roots.push_back(br);
+    }
+
+    void clear_bvh_roots() {
+      bvh_roots.resize(0);
+      bvh_root_indices.clear();
+    }
+
+    // has any tree with nodes in the bvh changed, or been added to another tree?
+    bool bvh_roots_changed() {
+      for (unsigned i = 0; i != bvh_roots.size(); ++i) {
+        bvh_root &br = bvh_roots[i];
+        if (
+          br.node->get_parent() ||
+          br.hierarchy_version != br.node->get_hierarchy_version() ||
+          br.transform_version != br.node->get_transform_version()
+        ) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void bvh_remove(mesh_instance *mi) {
+      int index = bvh_proxies.get_index(mi);
+      if (index >= 0) {
+        bvh.remove(bvh_proxies.get_value(index));
+        bvh_proxies.erase(mi);
+      }
+    }
+
+    void rebuild_bvh() {
+      bvh.clear();
+      bvh_proxies.clear();
+      clear_bvh_roots();
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        bvh_insert(mesh_instances[i]);
+      }
+    }
 
     void draw_aabb(const aabb &bb) {
       vec3 pos[8];
@@ -77,11 +260,11 @@ namespace octet { namespace scene {
       };
 
       /// render immediate data (this is inefficient!)
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
       glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 0, (void*)pos );
       glEnableVertexAttribArray(attribute_pos);
     
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      gl_state::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
       glDrawElements(GL_LINES, 24, GL_UNSIGNED_SHORT, indices);
       glDisableVertexAttribArray(attribute_pos);
     }
@@ -110,6 +293,25 @@ namespace octet { namespace scene {
       num_light_uniforms = ambient_size + num_lights * light_size;
     }
 
+    // sort the lights into clusters. Only the lights that reach everywhere go in the light uniforms.
+    void calc_light_clusters(camera_instance &cam, const mat4t &worldToCamera) {
+      clusters.begin(cam.get_cameraToProjection(), cam.get_near_plane(), cam.get_far_plane(), viewport_width, viewport_height);
+      for (unsigned i = 0; i != light_instances.size(); ++i) {
+        light_instance *li = light_instances[i];
+        clusters.add_light(li->get_light(), li->get_node(), worldToCamera);
+      }
+      clusters.build();
+      clusters.upload();
+      clusters.get_shader_params(cluster_params);
+
+      num_light_uniforms = clusters.get_num_global_uniforms();
+      num_lights = clusters.get_num_global_lights();
+      const vec4 *global_uniforms = clusters.get_global_uniforms();
+      for (int i = 0; i != num_light_uniforms; ++i) {
+        light_uniforms[i] = global_uniforms[i];
+      }
+    }
+
     void render_mesh_aabbs() {
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
@@ -120,7 +322,7 @@ namespace octet { namespace scene {
     }
 
     void render_debug_line_buffer() {
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      gl_state::bind_buffer(GL_ARRAY_BUFFER, 0);
       glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 12, (void*)debug_line_buffer.data() );
       glEnableVertexAttribArray(attribute_pos);
     
@@ -181,34 +383,118 @@ namespace octet { namespace scene {
       }
     }
 
+    /// find the mesh instances that may be visible before we touch any GL state.
+    /// sets cull_visible for each mesh instance.
+    void cull_mesh_instances(const frustum &view, const mat4t &worldToProjection) {
+      unsigned num_instances = mesh_instances.size();
+      cull_visible.resize(num_instances);
+      cull_indices.resize(0);
+      if (num_instances) {
+        memset(cull_visible.data(), 0, num_instances);
+      }
+
+      for (unsigned mesh_index = 0; mesh_index != num_instances; ++mesh_index) {
+        mesh_instance *mi = mesh_instances[mesh_index];
+        if ((mi->get_flags() & mesh_instance::flag_enabled) && mi->get_node()->calcEnabled()) {
+          cull_indices.push_back(mesh_index);
+        }
+      }
+
+      unsigned num_tested = cull_indices.size();
+      unsigned stride = (num_tested + 3) & ~3;
+      cull_boxes.resize(stride * 6);
+      cull_results.resize(num_tested);
+      float *cx = cull_boxes.data();
+      float *cy = cx + stride, *cz = cy + stride;
+      float *hx = cz + stride, *hy = hx + stride, *hz = hy + stride;
+
+      for (unsigned i = 0; i != num_tested; ++i) {
+        mesh_instance *mi = mesh_instances[cull_indices[i]];
+        mesh *msh = mi->get_mesh();
+        aabb bb = msh->get_aabb();
+        vec3 half = bb.get_half_extent();
+        if (!frustum_culling || (mi->get_skeleton() && msh->get_skin()) || all(half == vec3(0, 0, 0))) {
+          // skinned meshes move outside their box and some meshes have no box; always draw them.
+          cx[i] = cy[i] = cz[i] = 0;
+          hx[i] = hy[i] = hz[i] = 1e30f;
+        } else {
+          bb = bb.get_transform(mi->get_node()->calcModelToWorld());
+          vec3 c = bb.get_center();
+          half = bb.get_half_extent();
+          cx[i] = c.x(); cy[i] = c.y(); cz[i] = c.z();
+          hx[i] = half.x(); hy[i] = half.y(); hz[i] = half.z();
+        }
+      }
+
+      unsigned num_visible = view.intersects(cull_results.data(), cx, cy, cz, hx, hy, hz, num_tested);
+
+      // draw the occluders in the frustum, then hide what is behind them.
+      unsigned num_occluded = 0;
+      if (occlusion_culling && frustum_culling) {
+        occlusion.begin(worldToProjection);
+        for (unsigned i = 0; i != num_tested; ++i) {
+          mesh_instance *mi = mesh_instances[cull_indices[i]];
+          if (cull_results[i] && (mi->get_flags() & mesh_instance::flag_occluder) && !mi->get_skeleton()) {
+            occlusion.add_occluder(mi->get_occluder_mesh(), mi->get_node()->calcModelToWorld());
+          }
+        }
+        occlusion.rasterize();
+        num_occluded = occlusion.test_boxes(cull_results.data(), cx, cy, cz, hx, hy, hz, num_tested);
+        num_visible -= num_occluded;
+      }
+
+      for (unsigned i = 0; i != num_tested; ++i) {
+        cull_visible[cull_indices[i]] = cull_results[i];
+      }
+
+      last_cull_stats.num_tested = num_tested;
+      last_cull_stats.num_visible = num_visible;
+      last_cull_stats.num_culled = num_tested - num_visible;
+      last_cull_stats.num_occluded = num_occluded;
+    }
+
     void render_impl(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
       mat4t cameraToWorld = cam.get_node()->calcModelToWorld();
 
       mat4t worldToCamera;
       cameraToWorld.invertQuick(worldToCamera);
 
-      calc_lighting(worldToCamera);
-
       cam.set_cameraToWorld(cameraToWorld, aspect_ratio);
       mat4t cameraToProjection = cam.get_cameraToProjection();
 
+      if (clustered_lighting) {
+        calc_light_clusters(cam, worldToCamera);
+      } else {
+        calc_lighting(worldToCamera);
+      }
+
+      // the matrices of the camera, for occlusion, instanced draws and world space debug drawing.
+      mat4t worldToProjection;
+      mat4t worldToView;
+      mat4t worldToWorld;
+      worldToWorld.loadIdentity();
+      cam.get_matrices(worldToProjection, worldToView, worldToWorld);
+
+      cull_mesh_instances(cam.get_frustum(), worldToProjection);
+
       draw_debug_data(cam);
 
+      // screen pixels per camera space unit, at a distance of one for perspective cameras.
+      bool is_ortho = cam.get_is_ortho();
+      float lod_pixel_scale = is_ortho ? viewport_height * cam.get_yscale() : viewport_height * 0.5f / cam.get_yscale();
+
+      queue.reset();
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
+        // disabled or outside the frustum
+        if (!cull_visible[mesh_index]) continue;
+
         mesh_instance *mi = mesh_instances[mesh_index];
 
         scene_node *node = mi->get_node();
         unsigned flags = mi->get_flags();
 
-        if (
-          !(flags & mesh_instance::flag_enabled) ||
-          !node->calcEnabled()
-        ) continue;
-
         mesh *msh = mi->get_mesh();
-        skin *skn = msh->get_skin();
-        skeleton *skel = mi->get_skeleton();
-        material *mat = mi->get_material();
+        bool skinned = mi->get_skeleton() && msh->get_skin();
 
         mat4t modelToWorld = node->calcModelToWorld();
         mat4t modelToCamera;
@@ -228,33 +514,38 @@ namespace octet { namespace scene {
           }
         }
 
-        if (!skel || !skn) {
-          /// normal rendering for single matrix objects
-          /// build a projection matrix: model -> world -> camera_instance -> projection
-          /// the projection space is the cube -1 <= x/w, y/w, z/w <= 1
-          mat->render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
-        } else {
-          /// multi-matrix rendering
-          mat4t *transforms = skel->calc_transforms(modelToCamera, skn);
-          int num_bones = skel->get_num_bones();
-          if(num_bones > 192) {
-            GLint mvuv = 0;
-            //glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &mvuv);
-            printf("warning: too many bones (%d/%d)\n", num_bones, mvuv/4);
-          } else {
-            mat->render_skinned(cameraToProjection, transforms, num_bones, light_uniforms, num_light_uniforms, num_lights);
-          }
+        // choosing a level of detail by the size of its error on screen, at the nearest point of the bounds.
+        if (lod_group *lod = mi->get_lod_group()) {
+          aabb bb = msh->get_aabb();
+          float scale = sqrtf(std::max(modelToCamera.x().xyz().squared(), std::max(modelToCamera.y().xyz().squared(), modelToCamera.z().xyz().squared())));
+          float distance = -(vec4(bb.get_center(), 1) * modelToCamera).z() - length(bb.get_half_extent()) * scale;
+          float pixels_per_unit = scale * (is_ortho ? lod_pixel_scale : lod_pixel_scale / std::max(distance, cam.get_near_plane()));
+          mi->set_lod_level(lod->select_level(mi->get_lod_level(), pixels_per_unit));
         }
 
-        /*if (true) {
-          static bool dumped;
-          if (!dumped) { msh->dump_transformed(modelToProjection); dumped = true; }
-        }*/
-        msh->enable_attributes();
-        msh->draw();
-        msh->disable_attributes();
+        /// build a projection matrix: model -> world -> camera_instance -> projection
+        /// the projection space is the cube -1 <= x/w, y/w, z/w <= 1
+        queue.add(mi, skinned ? render_queue::pass_skinned : render_queue::pass_opaque, modelToWorld, modelToProjection, modelToCamera);
+      }
+
+      /// sort by shader, material and mesh so that we only bind what changes.
+      queue.sort();
+      frame.set(worldToProjection, worldToView, light_uniforms, num_light_uniforms, num_lights, clustered_lighting ? cluster_params : NULL);
+      frame.bind();
+      if (clustered_lighting) {
+        clusters.bind(frame_uniforms::first_cluster_unit);
+      }
+      queue.submit(frame, cameraToProjection);
 
+      // boxes around selected instances, in world space.
+      bool any_selected = false;
+      for (unsigned i = 0; i != queue.size(); ++i) {
+        mesh_instance *mi = queue.get_mesh_instance(i);
         if (mi->get_flags() & mesh_instance::flag_selected) {
+          if (!any_selected) {
+            debug_material->render(worldToProjection, worldToView, light_uniforms, num_light_uniforms, num_lights);
+            any_selected = true;
+          }
           aabb bb = mi->get_mesh()->get_aabb();
           bb = bb.get_transform(mi->get_node()->calcModelToWorld());
           draw_aabb(bb);
@@ -270,9 +561,14 @@ namespace octet { namespace scene {
       frame_number = 0;
       num_light_uniforms = 0;
       num_lights = 0;
+      frustum_culling = true;
+      memset(&last_cull_stats, 0, sizeof(last_cull_stats));
       render_aabbs = false;
       dump_vertices = false;
       render_debug_lines = false;
+      clustered_lighting = false;
+      occlusion_culling = false;
+      viewport_width = viewport_height = 1;
       debug_material = new material(vec4(1, 0, 0, 1));
       debug_line_buffer.resize(256);
       assert(is_power_of_two(debug_line_buffer.size()));
@@ -349,10 +645,13 @@ namespace octet { namespace scene {
     /// Serialization
     void visit(visitor &v) {
       scene_node::visit(v);
-      v.visit(mesh_instances, atom_mesh_instances);
-      v.visit(animation_instances, atom_animation_instances);
-      v.visit(camera_instances, atom_camera_instances);
-      v.visit(light_instances, atom_light_instances);
+      visit_instances(v, mesh_instances, atom_mesh_instances);
+      visit_instances(v, animation_instances, atom_animation_instances);
+      visit_instances(v, camera_instances, atom_camera_instances);
+      visit_instances(v, light_instances, atom_light_instances);
+      if (v.is_reader()) {
+        rebuild_bvh();
+      }
     }
 
     /// reset the scene.
@@ -361,31 +660,39 @@ namespace octet { namespace scene {
       animation_instances.reset();
       camera_instances.reset();
       light_instances.reset();
+      instance_handles.clear();
+      node_mesh_instances.clear();
+      bvh.clear();
+      bvh_proxies.clear();
+      clear_bvh_roots();
     }
 
     /// set up OpenGL state
     void begin_render(int vx, int vy, vec4_in clear_color=vec4(0.5f, 0.5f, 0.5f, 1.0f)) {
       /// set a viewport - includes whole window area
       glViewport(0, 0, vx, vy);
+      viewport_width = vx;
+      viewport_height = vy;
 
       /// clear the background to black
       glClearColor(clear_color.x(), clear_color.y(), clear_color.z(), clear_color.w());
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+      gl_state::begin_frame();
+
       /// allow Z buffer depth testing (closer objects are always drawn in front of far ones)
-      glEnable(GL_DEPTH_TEST);
+      gl_state::set_enabled(GL_DEPTH_TEST, true);
 
-      GLint param;
-      glGetIntegerv(GL_SAMPLE_BUFFERS, &param);
-      if (param == 0) {
+      /// the sample buffer count is only asked for once, as the query can stall the driver.
+      if (gl_state::get_sample_buffers() == 0) {
         /// if multisampling is disabled, we can't use GL_SAMPLE_COVERAGE (which I think is mean)
         /// Instead, allow alpha blend (transparency when alpha channel is 0)
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        gl_state::set_enabled(GL_BLEND, true);
+        gl_state::blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
       } else {
         /// if multisampling is enabled, use GL_SAMPLE_COVERAGE instead
-        glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
-        glEnable(GL_SAMPLE_COVERAGE);
+        gl_state::set_enabled(GL_SAMPLE_ALPHA_TO_COVERAGE, true);
+        gl_state::set_enabled(GL_SAMPLE_COVERAGE, true);
       }
     }
 
@@ -407,7 +714,7 @@ namespace octet { namespace scene {
         float f = distance * 2, n = f * 0.001f;
         cam->set_node(node);
         cam->set_perspective(0, 45, 1, n, f);
-        camera_instances.push_back(cam);
+        add_camera_instance(cam);
       }
 
       /// default light instance
@@ -422,7 +729,7 @@ namespace octet { namespace scene {
         _light->set_kind(atom_directional);
         li->set_node(node);
         li->set_light(_light);
-        light_instances.push_back(li);
+        add_light_instance(li);
       }
 
       if (!object_shader) {
@@ -453,40 +760,78 @@ namespace octet { namespace scene {
       return new_node;
     }
 
+    /// Add a mesh instance to the scene.
+    /// Adding NULL, or an instance that is already in the scene, does nothing.
     mesh_instance *add_mesh_instance(mesh_instance *inst=0) {
-      mesh_instances.push_back(inst);
+      if (!inst || instance_handles.contains(inst)) {
+        return inst;
+      }
+
+      add_instance(mesh_instances, inst);
+      scene_node *node = inst->get_node();
+      if (node && !node_mesh_instances.contains(node)) {
+        node_mesh_instances[node] = get_mesh_instance_handle(inst);
+      }
+      bvh_insert(inst);
       return inst;
     }
 
     animation_instance *add_animation_instance(animation_instance *inst) {
-      animation_instances.push_back(inst);
-      return inst;
+      return add_instance(animation_instances, inst);
     }
 
     camera_instance *add_camera_instance(camera_instance *inst) {
-      camera_instances.push_back(inst);
-      return inst;
+      return add_instance(camera_instances, inst);
     }
 
     light_instance *add_light_instance(light_instance *inst) {
-      light_instances.push_back(inst);
-      return inst;
+      return add_instance(light_instances, inst);
+    }
+
+    /// Remove a mesh instance from the scene. The last mesh instance takes its index.
+    /// Returns false if the instance is not in the scene.
+    bool delete_mesh_instance(mesh_instance *inst) {
+      if (!inst) return false;
+      scene_node *node = inst->get_node();
+      int index = node_mesh_instances.get_index(node);
+      if (index >= 0 && node_mesh_instances.get_value(index) == get_mesh_instance_handle(inst)) {
+        node_mesh_instances.erase(node);
+      }
+      bvh_remove(inst);
+      return delete_instance(mesh_instances, inst);
+    }
+
+    /// Remove the mesh instance that a handle refers to.
+    /// Returns false if it has already been deleted.
+    bool delete_mesh_instance(slot_map_handle handle) {
+      return delete_mesh_instance(get_mesh_instance(handle));
     }
 
-    void delete_mesh_instance(mesh_instance *inst) {
-      //mesh_instances.erase_by_value(inst);
+    /// Remove an animation instance from the scene.
+    bool delete_animation_instance(animation_instance *inst) {
+      return delete_instance(animation_instances, inst);
     }
 
-    void delete_animation_instance(animation_instance *inst) {
-      //animation_instances.erase_by_value(inst);
+    /// Remove a camera instance from the scene.
+    bool delete_camera_instance(camera_instance *inst) {
+      return delete_instance(camera_instances, inst);
     }
 
-    void delete_camera_instance(camera_instance *inst) {
-      //camera_instances.erase_by_value(inst);
+    /// Remove a light instance from the scene.
+    bool delete_light_instance(light_instance *inst) {
+      return delete_instance(light_instances, inst);
     }
 
-    void delete_light_instance(light_instance *inst) {
-      //light_instances.erase_by_value(inst);
+    /// Get a handle for a mesh instance that can be kept after the instance is deleted.
+    slot_map_handle get_mesh_instance_handle(mesh_instance *inst) {
+      int index = instance_handles.get_index(inst);
+      return index < 0 ? slot_map_handle() : instance_handles.get_value(index);
+    }
+
+    /// Get a mesh instance from a handle, or NULL if it has been deleted.
+    mesh_instance *get_mesh_instance(slot_map_handle handle) {
+      ref<mesh_instance> *mi = mesh_instances.get(handle);
+      return mi ? (mesh_instance*)*mi : (mesh_instance*)NULL;
     }
 
     /// how many mesh instances do we have?
@@ -508,6 +853,66 @@ namespace octet { namespace scene {
       return (scene_node*)this;
     }
 
+    /// turn frustum culling on or off (on by default)
+    void set_frustum_culling(bool value) {
+      frustum_culling = value;
+    }
+
+    /// hide mesh instances behind occluders (mesh instances with mesh_instance::flag_occluder). Off by default.
+    /// Needs frustum culling.
+    void set_occlusion_culling(bool value) {
+      occlusion_culling = value;
+    }
+
+    /// the occluder depth buffer, to change its size or look at the last frame.
+    occlusion_buffer &get_occlusion_buffer() {
+      return occlusion;
+    }
+
+    /// how many mesh instances were culled and drawn in the last render?
+    const cull_stats &get_cull_stats() const {
+      return last_cull_stats;
+    }
+
+    /// sort draws by shader, material and mesh (on by default)
+    /// turning this off draws in the order the mesh instances were added.
+    void set_render_sorting(bool value) {
+      queue.set_sorting(value);
+    }
+
+    /// draw runs of mesh instances with the same mesh and material with one call (on by default)
+    /// this needs OpenGL 3.3 or OpenGL ES3 and a shader with an INSTANCED variant, like shaders/default.vs.
+    void set_instancing(bool value) {
+      queue.set_instancing(value);
+    }
+
+    /// skin every skinned mesh on the CPU, not just the ones with too many bones for the skinning shader. Off by default.
+    void set_cpu_skinning(bool value) {
+      queue.set_cpu_skinning(value);
+    }
+
+    /// how meshes skinned on the CPU blend their bones: skinner::blend_linear (default) or skinner::blend_dual_quaternion.
+    void set_skin_blend(skinner::blend_mode value) {
+      queue.set_skin_blend(value);
+    }
+
+    /// draw calls and binds in the last render
+    const render_queue::stats &get_render_stats() const {
+      return queue.get_stats();
+    }
+
+    /// sort every light into view space clusters each frame, lifting the four light limit
+    /// for clustered materials (see material(color, shader, true)). Other materials only get
+    /// the lights that reach everywhere, such as directional lights. Off by default.
+    void set_clustered_lighting(bool value) {
+      clustered_lighting = value;
+    }
+
+    /// the light clusters of the last render, to bind for a clustered shader.
+    const light_clusters &get_light_clusters() const {
+      return clusters;
+    }
+
     /// debugging aid to draw boxes around objects
     void set_render_aabbs(bool value) {
       render_aabbs = value;
@@ -555,15 +960,19 @@ namespace octet { namespace scene {
         }
       #endif
 
-      for (int idx = 0; idx != animation_instances.size(); ++idx) {
-        animation_instance *inst = animation_instances[idx];
-        inst->update(delta_time);
-      }
+      poses.update(animation_instances, delta_time);
 
-      for (int idx = 0; idx != mesh_instances.size(); ++idx) {
+      for (unsigned idx = 0; idx != mesh_instances.size(); ++idx) {
         mesh_instance *inst = mesh_instances[idx];
         inst->update(delta_time);
       }
+
+      // one pass over the heirachy so that render and queries use cached matrices.
+      if (transforms.is_stale()) {
+        transforms.build(this);
+      }
+      transforms.update();
+      refit_bvh();
     }
 
     /// render using specific shaders.
@@ -583,23 +992,44 @@ namespace octet { namespace scene {
     /// play an animation on another target (not the same one as in the collada file)
     void play(animation *anim, resource *target, bool is_looping) {
       animation_instance *inst = new animation_instance(anim, target, is_looping);
-      animation_instances.push_back(inst);
+      add_animation_instance(inst);
     }
 
     /// play an animation with built-in targets (as in the collada file)
     void play(animation *anim, bool is_looping) {
       animation_instance *inst = new animation_instance(anim, NULL, is_looping);
-      animation_instances.push_back(inst);
+      add_animation_instance(inst);
+    }
+
+    /// play a compiled clip. If target is null, use the targets of the clip.
+    void play(animation_clip *clip, resource *target, bool is_looping) {
+      animation_instance *inst = new animation_instance(clip, target, is_looping);
+      add_animation_instance(inst);
     }
 
     /// find a mesh instance for a node
     mesh_instance *get_first_mesh_instance(scene_node *node) {
-      for (int i = 0; i != mesh_instances.size(); ++i) {
+      // usually this is the instance we found last time.
+      int index = node_mesh_instances.get_index(node);
+      if (index >= 0) {
+        mesh_instance *mi = get_mesh_instance(node_mesh_instances.get_value(index));
+        if (mi && mi->get_node() == node) {
+          return mi;
+        }
+      }
+
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
         mesh_instance *mi = mesh_instances[i];
         if (mi && mi->get_node() == node) {
+          node_mesh_instances[node] = mesh_instances.get_handle(i);
           return mi;
         }
       }
+
+      // the instance was deleted or moved to another node.
+      if (index >= 0) {
+        node_mesh_instances.erase(node);
+      }
       return NULL;
     }
 
@@ -607,7 +1037,7 @@ namespace octet { namespace scene {
     aabb get_world_aabb() {
       aabb world_aabb;
       bool first = true;
-      for (int i = 0; i != mesh_instances.size(); ++i) {
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
         mesh_instance *mi = mesh_instances[i];
         if (mi && mi->get_node()) {
           mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
@@ -629,36 +1059,104 @@ namespace octet { namespace scene {
       rational depth;
     };
 
-    /// brute force & ignorance ray cast.
-    /// return the mesh instance and location of hits.
-    /// todo: build a kd tree for mesh instance bbs & mesh triangles
+    /// Move the bvh leaves of mesh instances whose nodes have moved.
+    /// Called by update() and the queries; only does work if a node in one of their trees has moved since last time.
+    void refit_bvh() {
+      if (!bvh_roots_changed()) {
+        return;
+      }
+
+      for (unsigned proxy = 0; proxy != bvh.get_proxy_limit(); ++proxy) {
+        if (!bvh.is_proxy(proxy)) continue;
+        bvh_item old_item = bvh.get_item(proxy);
+        mesh_instance *mi = old_item.mi;
+        if (
+          mi->get_node() == old_item.node && mi->get_mesh() == old_item.msh &&
+          (old_item.node->calcModelToWorld(), old_item.node->get_world_version() == old_item.world_version)
+        ) {
+          continue;
+        }
+
+        bvh_item item;
+        aabb bb;
+        if (get_bvh_item(item, bb, mi)) {
+          bvh.access_item(proxy) = item;
+          bvh.move(proxy, bb);
+        }
+      }
+
+      // calcModelToWorld() does not mark anything dirty, so these versions are still current.
+      clear_bvh_roots();
+      for (unsigned proxy = 0; proxy != bvh.get_proxy_limit(); ++proxy) {
+        if (bvh.is_proxy(proxy)) add_bvh_root(bvh.get_item(proxy).node);
+      }
+    }
+
+    /// find the nearest mesh instance that a ray hits.
+    /// result.depth is the fraction of the way from the start to the end of the ray.
+    /// result.mi is NULL if nothing is hit.
     void cast_ray(cast_result &result, const ray &the_ray) {
       result.mi = 0;
       result.depth = rational(0, 0);
+      refit_bvh();
+
+      float hit_t = 0;
+      int proxy = bvh.ray_cast(the_ray.get_start(), the_ray.get_end(), hit_t, [&](int proxy, float max_t) {
+        mesh_instance *mi = bvh.get_item(proxy).mi;
+        const mat4t &nodeToWorld = mi->get_node()->calcModelToWorld();
+        mesh *mesh = mi->get_mesh();
+        aabb bb = mesh->get_aabb();
+        bb = bb.get_transform(nodeToWorld);
+        if (!the_ray.intersects(bb)) return max_t + 1;
+
+        mat4t worldToNode = nodeToWorld.inverse3x4();
+        ray model_ray = the_ray.get_transform(worldToNode);
+        int indices[3] = {0};
+        vec4 bary_numer(0, 0, 0, 0);
+        float bary_denom;
+        bool hit = mesh->ray_cast(model_ray, indices, bary_numer, bary_denom);
+        return hit ? bary_numer.w() / bary_denom : max_t + 1;
+      });
+
+      if (proxy >= 0) {
+        result.mi = bvh.get_item(proxy).mi;
+        result.depth = rational(hit_t);
+      }
+    }
 
-      for (int i = 0; i != mesh_instances.size(); ++i) {
-        mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
-          mesh *mesh = mi->get_mesh();
-          aabb bb = mesh->get_aabb();
-          bb = bb.get_transform(nodeToWorld);
-          if (the_ray.intersects(bb)) {
-            mat4t worldToNode = nodeToWorld.inverse3x4();
-            //ray model_ray = ray(vec3(0, 0, -1), vec3(0, 0, 2)); //the_ray.get_transform(worldToNode);
-            ray model_ray = the_ray.get_transform(worldToNode);
-            int indices[3] = {0};
-            vec4 bary_numer(0, 0, 0, 0);
-            float bary_denom;
-            bool hit = mesh->ray_cast(model_ray, indices, bary_numer, bary_denom);
-            if (hit) {
-              rational depth(bary_numer.w() / bary_denom);
-              result.depth = min(depth, result.depth);
-            }
-            //printf("hit=%d %s %f\n", hit, (bary_numer/bary_denom).toString(tmp, sizeof(tmp)), (float)result.depth);
-          }
+    /// find the mesh instances whose boxes may be inside a frustum, such as camera_instance::get_frustum().
+    /// results are added to the end of the array.
+    void query_frustum(dynarray<mesh_instance*> &result, const frustum &view) {
+      refit_bvh();
+      bvh.query(view, [&](int proxy) {
+        const bvh_item &item = bvh.get_item(proxy);
+        aabb bb = item.msh->get_aabb().get_transform(item.node->calcModelToWorld());
+        if (view.intersects(bb)) result.push_back(item.mi);
+      });
+    }
+
+    /// find the mesh instances whose boxes touch a sphere, eg. everything within a radius of an explosion.
+    /// results are added to the end of the array.
+    void query_sphere(dynarray<mesh_instance*> &result, const sphere &volume) {
+      refit_bvh();
+      bvh.query(volume, [&](int proxy) {
+        const bvh_item &item = bvh.get_item(proxy);
+        aabb bb = item.msh->get_aabb().get_transform(item.node->calcModelToWorld());
+        if (volume.intersects(bb)) result.push_back(item.mi);
+      });
+    }
+
+    /// find the mesh instances whose boxes overlap a box.
+    /// results are added to the end of the array.
+    void query_aabb(dynarray<mesh_instance*> &result, const aabb &volume) {
+      refit_bvh();
+      bvh.query(volume, [&](int proxy) {
+        const bvh_item &item = bvh.get_item(proxy);
+        aabb bb = item.msh->get_aabb().get_transform(item.node->calcModelToWorld());
+        if (all(abs(bb.get_center() - volume.get_center()) <= bb.get_half_extent() + volume.get_half_extent())) {
+          result.push_back(item.mi);
         }
-      }
+      });
     }
 
     /// Debug rendering: add a new line in world space (old ones will be lost)
@@ -16,6 +16,10 @@ namespace octet { namespace shaders {
     GLuint light_uniforms_index;    // lighting parameters for fragment shader
     GLuint num_lights_index;        // how many lights?
     GLuint samplers_index;          // index for texture samplers
+    GLuint cluster_params_index;    // light cluster grid parameters (see scene::light_clusters)
+    GLuint cluster_grid_index;      // samplers for the cluster textures
+    GLuint cluster_indices_index;
+    GLuint cluster_lights_index;
 
     void init_uniforms(const char *vertex_shader, const char *fragment_shader) {
       // use the common shader code to compile and link the shaders
@@ -29,10 +33,21 @@ namespace octet { namespace shaders {
       light_uniforms_index = glGetUniformLocation(program(), "light_uniforms");
       num_lights_index = glGetUniformLocation(program(), "num_lights");
       samplers_index = glGetUniformLocation(program(), "samplers");
+      cluster_params_index = glGetUniformLocation(program(), "cluster_params");
+      cluster_grid_index = glGetUniformLocation(program(), "cluster_grid");
+      cluster_indices_index = glGetUniformLocation(program(), "cluster_indices");
+      cluster_lights_index = glGetUniformLocation(program(), "cluster_lights");
     }
 
   public:
-    void init(bool is_skinned=false) {
+    /// Make the shader. If is_clustered is set, the fragment shader lights with the
+    /// per cluster light lists of scene::light_clusters as well as the global lights (see render_clustered()).
+    void init(bool is_skinned=false, bool is_clustered=false) {
+      #ifdef OCTET_GLES2
+        // no float textures or dynamic loops
+        is_clustered = false;
+      #endif
+
       // this is the vertex shader for regular geometry
       // it is called for each corner of each triangle
       // it inputs pos and uv from each corner
@@ -43,6 +58,7 @@ namespace octet { namespace shaders {
         varying vec3 normal_;
         varying vec3 tangent_;
         varying vec3 bitangent_;
+        varying vec3 camera_pos_;
       
         attribute vec4 pos;
         attribute vec3 normal;
@@ -58,6 +74,7 @@ namespace octet { namespace shaders {
           normal_ = (modelToCamera * vec4(normal,0)).xyz;
           tangent_ = (modelToCamera * vec4(tangent,0)).xyz;
           bitangent_ = (modelToCamera * vec4(bitangent,0)).xyz;
+          camera_pos_ = (modelToCamera * pos).xyz;
           gl_Position = modelToProjection * pos;
         }
       );
@@ -72,6 +89,7 @@ namespace octet { namespace shaders {
         varying vec3 normal_;
         varying vec3 tangent_;
         varying vec3 bitangent_;
+        varying vec3 camera_pos_;
       
         attribute vec4 pos;
         attribute vec3 normal;
@@ -96,6 +114,7 @@ namespace octet { namespace shaders {
           normal_ = normalize((blendedModelToCamera * vec4(normal,0)).xyz);
           tangent_ = normalize((blendedModelToCamera * vec4(tangent,0)).xyz);
           bitangent_ = normalize((blendedModelToCamera * vec4(bitangent,0)).xyz);
+          camera_pos_ = (blendedModelToCamera * pos).xyz;
           gl_Position = cameraToProjection * (blendedModelToCamera * pos);
         }
       );
@@ -157,9 +176,110 @@ namespace octet { namespace shaders {
         }
       );
     
+      // this is the fragment shader for clustered lighting.
+      // the fragment finds its cluster from its screen position and depth, then
+      // adds the point and spot lights in the cluster's list to the global lights.
+      // cluster_params[0] = tiles across, down and in depth
+      // cluster_params[1] = depth slice scale and bias, 1/viewport size
+      // cluster_params[2] = 1/grid size, light and index texture widths
+      // cluster_params[3] = 1/light texture size, 1/index texture size
+      const char clustered_fragment_shader[] = SHADER_STR(
+        const int max_lights = 4;
+        varying vec2 uv_;
+        varying vec3 normal_;
+        varying vec3 tangent_;
+        varying vec3 bitangent_;
+        varying vec3 camera_pos_;
+
+        uniform vec4 light_uniforms[1+max_lights*4];
+        uniform int num_lights;
+        uniform sampler2D samplers[6];
+
+        uniform vec4 cluster_params[4];
+        uniform sampler2D cluster_grid;
+        uniform sampler2D cluster_indices;
+        uniform sampler2D cluster_lights;
+
+        // element "index" of a texture used as an array
+        vec4 fetch(sampler2D tex, float index, float width, vec2 inv_size) {
+          float y = floor((index + 0.5) / width);
+          float x = index - y * width;
+          return texture2D(tex, (vec2(x, y) + 0.5) * inv_size);
+        }
+
+        void main() {
+          float shininess = texture2D(samplers[5], uv_).x * 255.0;
+          vec3 nnormal = normalize(normal_);
+          vec3 diffuse_light = vec3(0.3, 0.3, 0.3);
+          vec3 specular_light = vec3(0, 0, 0);
+
+          for (int i = 0; i != num_lights; ++i) {
+            vec3 light_direction = light_uniforms[i * 4 + 2].xyz;
+            vec3 light_color = light_uniforms[i * 4 + 3].xyz;
+            vec3 half_direction = normalize(light_direction + vec3(0, 0, 1));
+
+            float diffuse_factor = max(dot(light_direction, nnormal), 0.0);
+            float specular_factor = pow(max(dot(half_direction, nnormal), 0.0), shininess) * diffuse_factor;
+
+            diffuse_light += diffuse_factor * light_color;
+            specular_light += specular_factor * light_color;
+          }
+
+          vec2 tile = floor(gl_FragCoord.xy * cluster_params[1].zw * cluster_params[0].xy);
+          tile = clamp(tile, vec2(0, 0), cluster_params[0].xy - 1.0);
+          float slice = floor(log(max(-camera_pos_.z, 1e-6)) * cluster_params[1].x + cluster_params[1].y);
+          slice = clamp(slice, 0.0, cluster_params[0].z - 1.0);
+          vec2 grid_uv = (vec2(tile.y * cluster_params[0].x + tile.x, slice) + 0.5) * cluster_params[2].xy;
+          vec4 cluster = texture2D(cluster_grid, grid_uv);
+          int count = int(cluster.y);
+
+          for (int i = 0; i != count; ++i) {
+            float light_index = fetch(cluster_indices, cluster.x + float(i), cluster_params[2].w, cluster_params[3].zw).x;
+            float base = light_index * 4.0;
+            vec4 light_pos = fetch(cluster_lights, base, cluster_params[2].z, cluster_params[3].xy);
+            vec4 light_dir = fetch(cluster_lights, base + 1.0, cluster_params[2].z, cluster_params[3].xy);
+            vec3 light_color = fetch(cluster_lights, base + 2.0, cluster_params[2].z, cluster_params[3].xy).xyz;
+            vec4 light_atten = fetch(cluster_lights, base + 3.0, cluster_params[2].z, cluster_params[3].xy);
+
+            vec3 to_light = light_pos.xyz - camera_pos_;
+            float dist = length(to_light);
+            vec3 light_direction = to_light / dist;
+            float atten = 1.0 / (light_atten.x + (light_atten.y + light_atten.z * dist) * dist);
+
+            // spot lights shine down -z; w is the cosine of the cone's half angle, or -1.
+            float spot_cos = dot(light_direction, light_dir.xyz);
+            if (light_dir.w > -1.0) {
+              atten *= spot_cos >= light_dir.w ? pow(max(spot_cos, 0.0), light_atten.w) : 0.0;
+            }
+
+            vec3 half_direction = normalize(light_direction + vec3(0, 0, 1));
+            float diffuse_factor = max(dot(light_direction, nnormal), 0.0) * atten;
+            float specular_factor = pow(max(dot(half_direction, nnormal), 0.0), shininess) * diffuse_factor;
+
+            diffuse_light += diffuse_factor * light_color;
+            specular_light += specular_factor * light_color;
+          }
+
+          vec4 diffuse = texture2D(samplers[0], uv_);
+          vec4 ambient = texture2D(samplers[1], uv_);
+          vec4 emission = texture2D(samplers[2], uv_);
+          vec4 specular = texture2D(samplers[3], uv_);
+
+          vec3 ambient_light = light_uniforms[0].xyz;
+
+          gl_FragColor.xyz = 
+            ambient_light * ambient.xyz +
+            diffuse_light * diffuse.xyz +
+            emission.xyz +
+            specular_light * specular.xyz
+          ;
+          gl_FragColor.w = diffuse.w;
+        }
+      );
+    
       // use the common shader code to compile and link the shaders
       // the result is a shader program
-      init_uniforms(is_skinned ? skinned_vertex_shader : vertex_shader, fragment_shader);
+      init_uniforms(is_skinned ? skinned_vertex_shader : vertex_shader, is_clustered ? clustered_fragment_shader : fragment_shader);
     }
 
     void render(const mat4t &modelToProjection, const mat4t &modelToCamera, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
@@ -193,5 +313,20 @@ namespace octet { namespace shaders {
       static const GLint samplers[] = { 0, 1, 2, 3, 4, 5 };
       glUniform1iv(samplers_index, 6, samplers);
     }
+
+    /// For a shader made with init(..., true): render() with the cluster parameters from
+    /// light_clusters::get_shader_params(). The cluster textures are bound to three units starting at first_cluster_unit.
+    void render_clustered(const mat4t &modelToProjection, const mat4t &modelToCamera, const vec4 *light_uniforms, int num_light_uniforms, int num_lights, const vec4 *cluster_params, int first_cluster_unit) {
+      render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+      set_cluster_params(cluster_params, first_cluster_unit);
+    }
+
+    /// Set the cluster parameters after render() or render_skinned().
+    void set_cluster_params(const vec4 *cluster_params, int first_cluster_unit) {
+      glUniform4fv(cluster_params_index, 4, (float*)cluster_params);
+      glUniform1i(cluster_grid_index, first_cluster_unit);
+      glUniform1i(cluster_indices_index, first_cluster_unit + 1);
+      glUniform1i(cluster_lights_index, first_cluster_unit + 2);
+    }
   };
 }}
@@ -56,7 +56,7 @@ namespace octet { namespace shaders {
 
     // start using the program
     void use() {
-      glUseProgram(program_);
+      gl_state::use_program(program_);
     }
 
     // use the program we have compiled in init()
@@ -29,6 +29,7 @@ namespace octet { namespace shaders {
       glBindAttribLocation(program, attribute_blendindices, "blendindices");
       glBindAttribLocation(program, attribute_color, "color");
       glBindAttribLocation(program, attribute_uv, "uv");
+      glBindAttribLocation(program, attribute_instance_matrix, "modelToWorld");
       glLinkProgram(program);
 
       program_ = program;
@@ -91,7 +92,7 @@ namespace octet { namespace shaders {
 
     // use the program we have compiled in init()
     void render() {
-      glUseProgram(program_);
+      gl_state::use_program(program_);
     }
 
     /// get the OpenGL program object.